@@ -28,7 +28,7 @@
 #define DEFCCNAME "FILE:/tmp/krb5cc_%{uid}"
 
 /* Define to default client keytab name */
-#define DEFCKTNAME "FILE:/etc/krb5/user/%{euid}/client.keytab"
+#define DEFCKTNAME "FILE:/usr/local/var/krb5/user/%{euid}/client.keytab"
 
 /* Define to default keytab name */
 #define DEFKTNAME "FILE:/etc/krb5.keytab"
@@ -266,7 +266,7 @@
 /* #undef HAVE_LIBNSL */
 
 /* Define to 1 if you have the `resolv' library (-lresolv). */
-#define HAVE_LIBRESOLV 1
+/* #undef HAVE_LIBRESOLV */
 
 /* Define to 1 if you have the `socket' library (-lsocket). */
 /* #undef HAVE_LIBSOCKET */
@@ -305,7 +305,7 @@
 #define HAVE_NETINET_IN_H 1
 
 /* Define to 1 if you have the `ns_initparse' function. */
-#define HAVE_NS_INITPARSE 1
+/* #undef HAVE_NS_INITPARSE */
 
 /* Define to 1 if you have the `ns_name_uncompress' function. */
 #define HAVE_NS_NAME_UNCOMPRESS 1
@@ -509,6 +509,9 @@
    */
 /* #undef HAVE_SYS_DIR_H */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
 /* Define if sys_errlist in libc */
 /* #undef HAVE_SYS_ERRLIST */
 
@@ -585,6 +588,9 @@
 /* Define to 1 if you have the `vsprintf' function. */
 #define HAVE_VSPRINTF 1
 
+/* Define if zlib is available */
+#define HAVE_ZLIB 1
+
 /* Define to 1 if the system has the type `__int128_t'. */
 #define HAVE___INT128_T 1
 
@@ -186,6 +186,7 @@ typedef unsigned char   u_char;
 #define KRB5_CONF_AUTH_TO_LOCAL                "auth_to_local"
 #define KRB5_CONF_AUTH_TO_LOCAL_NAMES          "auth_to_local_names"
 #define KRB5_CONF_CANONICALIZE                 "canonicalize"
+#define KRB5_CONF_CCACHE_INDEX                 "ccache_index"
 #define KRB5_CONF_CCACHE_TYPE                  "ccache_type"
 #define KRB5_CONF_CLOCKSKEW                    "clockskew"
 #define KRB5_CONF_DATABASE_NAME                "database_name"
@@ -223,6 +224,7 @@ typedef unsigned char   u_char;
 #define KRB5_CONF_HOST_BASED_SERVICES          "host_based_services"
 #define KRB5_CONF_HTTP_ANCHORS                 "http_anchors"
 #define KRB5_CONF_IGNORE_ACCEPTOR_HOSTNAME     "ignore_acceptor_hostname"
+#define KRB5_CONF_IPROP_CHECKPOINT             "iprop_checkpoint"
 #define KRB5_CONF_IPROP_ENABLE                 "iprop_enable"
 #define KRB5_CONF_IPROP_LISTEN                 "iprop_listen"
 #define KRB5_CONF_IPROP_LOGFILE                "iprop_logfile"
@@ -230,17 +232,26 @@ typedef unsigned char   u_char;
 #define KRB5_CONF_IPROP_PORT                   "iprop_port"
 #define KRB5_CONF_IPROP_RESYNC_TIMEOUT         "iprop_resync_timeout"
 #define KRB5_CONF_IPROP_REPLICA_POLL           "iprop_replica_poll"
+#define KRB5_CONF_IPROP_REPLICA_WAIT           "iprop_replica_wait"
 #define KRB5_CONF_IPROP_SLAVE_POLL             "iprop_slave_poll"
 #define KRB5_CONF_IPROP_ULOGSIZE               "iprop_ulogsize"
+#define KRB5_CONF_IPROP_ULOG_SYNC              "iprop_ulog_sync"
+#define KRB5_CONF_IPROP_ULOG_SYNC_INTERVAL     "iprop_ulog_sync_interval"
 #define KRB5_CONF_K5LOGIN_AUTHORITATIVE        "k5login_authoritative"
 #define KRB5_CONF_K5LOGIN_DIRECTORY            "k5login_directory"
+#define KRB5_CONF_KADM5_HOOK_ASYNC             "kadm5_hook_async"
+#define KRB5_CONF_KADM5_HOOK_QUEUE_SIZE        "kadm5_hook_queue_size"
+#define KRB5_CONF_KADM5_HOOK_RETRIES           "kadm5_hook_retries"
 #define KRB5_CONF_KADMIND_LISTEN               "kadmind_listen"
 #define KRB5_CONF_KADMIND_PORT                 "kadmind_port"
+#define KRB5_CONF_KADMIND_WORKERS              "kadmind_workers"
 #define KRB5_CONF_KCM_MACH_SERVICE             "kcm_mach_service"
 #define KRB5_CONF_KCM_SOCKET                   "kcm_socket"
 #define KRB5_CONF_KDC                          "kdc"
 #define KRB5_CONF_KDCDEFAULTS                  "kdcdefaults"
+#define KRB5_CONF_KDC_CONNECTION_REUSE         "kdc_connection_reuse"
 #define KRB5_CONF_KDC_DEFAULT_OPTIONS          "kdc_default_options"
+#define KRB5_CONF_KDC_IDLE_TIMEOUT             "kdc_idle_timeout"
 #define KRB5_CONF_KDC_LISTEN                   "kdc_listen"
 #define KRB5_CONF_KDC_MAX_DGRAM_REPLY_SIZE     "kdc_max_dgram_reply_size"
 #define KRB5_CONF_KDC_PORTS                    "kdc_ports"
@@ -1205,6 +1216,7 @@ struct _krb5_context {
     krb5_flags      library_options;
     krb5_boolean    profile_secure;
     int             fcc_default_format;
+    krb5_boolean    fcc_index;
     krb5_prompt_type *prompt_types;
     /* Message size above which we'll try TCP first in send-to-kdc
        type code.  Aside from the 2**16 size limit, we put no
@@ -2044,6 +2056,9 @@ typedef struct _krb5_kt_ops {
                                          krb5_keytab_entry *);
     krb5_error_code (KRB5_CALLCONV *remove)(krb5_context, krb5_keytab,
                                             krb5_keytab_entry *);
+    /* optional; add several entries in one update */
+    krb5_error_code (KRB5_CALLCONV *add_entries)(krb5_context, krb5_keytab,
+                                                 krb5_keytab_entry *, size_t);
 } krb5_kt_ops;
 
 /* Not sure it's ready for exposure just yet.  */
@@ -2105,6 +2120,13 @@ krb5_error_code k5_kt_get_principal(krb5_context context, krb5_keytab keytab,
 krb5_error_code k5_kt_have_match(krb5_context context, krb5_keytab keytab,
                                  krb5_principal mprinc);
 
+/*
+ * Add count entries to keytab.  If the keytab type supports it, the entries
+ * are written in a single update; otherwise they are added one at a time.
+ */
+krb5_error_code k5_kt_add_entries(krb5_context context, krb5_keytab keytab,
+                                  krb5_keytab_entry *entries, size_t count);
+
 krb5_error_code krb5_principal2salt_norealm(krb5_context, krb5_const_principal,
                                             krb5_data *);
 
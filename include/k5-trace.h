@@ -355,6 +355,13 @@ void krb5int_trace(krb5_context context, const char *fmt, ...);
     TRACE(c, "Bad value of {str} from [{str}] in conf file: {kerr}", \
           subsection, section, retval)
 
+#define TRACE_RC_MEM_STATS(c, st)                                       \
+    TRACE(c, "Closing memory replay cache: {long} stores, {long} "      \
+          "replays, {long} expired, {long} evicted, {long} rejected, "  \
+          "{long} entries", (long)(st)->stores, (long)(st)->replays,    \
+          (long)(st)->expired, (long)(st)->evicted, (long)(st)->rejected, \
+          (long)(st)->entries)
+
 #define TRACE_RD_REP(c, ctime, cusec, subkey, seqnum)               \
     TRACE(c, "Read AP-REP, time {long}.{int}, subkey {keyblock}, "      \
           "seqnum {int}", (long) ctime, (int) cusec, subkey, (int) seqnum)
@@ -385,8 +392,21 @@ void krb5int_trace(krb5_context context, const char *fmt, ...);
 #define TRACE_SENDTO_KDC(c, len, rlm, primary, tcp)                     \
     TRACE(c, "Sending request ({int} bytes) to {data}{str}{str}", len,  \
           rlm, (primary) ? " (primary)" : "", (tcp) ? " (tcp only)" : "")
+#define TRACE_SENDTO_KDC_CONN_CLOSED(c, raddr)                          \
+    TRACE(c, "Discarding closed idle connection to {raddr}", raddr)
+#define TRACE_SENDTO_KDC_CONN_REUSE(c, raddr)                   \
+    TRACE(c, "Reusing idle connection to {raddr}", raddr)
+#define TRACE_SENDTO_KDC_CONN_SAVE(c, raddr)                            \
+    TRACE(c, "Keeping connection to {raddr} for reuse", raddr)
 #define TRACE_SENDTO_KDC_K5TLS_LOAD_ERROR(c, ret)       \
     TRACE(c, "Error loading k5tls module: {kerr}", ret)
+#define TRACE_SENDTO_KDC_RANK_ADDR(c, rank, raddr, rtt, failures, demoted) \
+    TRACE(c, "KDC order {int}: {raddr} (rtt {str}, {int} failures{str})", \
+          rank, raddr, rtt, failures, (demoted) ? ", demoted" : "")
+#define TRACE_SENDTO_KDC_RANK_HOST(c, rank, host, port, rtt, failures,  \
+                                   demoted)                             \
+    TRACE(c, "KDC order {int}: {str}:{int} (rtt {str}, {int} failures{str})", \
+          rank, host, port, rtt, failures, (demoted) ? ", demoted" : "")
 #define TRACE_SENDTO_KDC_PRIMARY(c, primary)                            \
     TRACE(c, "Response was{str} from primary KDC", (primary) ? "" : " not")
 #define TRACE_SENDTO_KDC_RESOLVING(c, hostname)         \
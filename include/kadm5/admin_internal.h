@@ -68,6 +68,11 @@ kadm5_ret_t _kadm5_chpass_principal_util(void *server_handle,
                                          char **ret_pw,
                                          char *msg_ret,
                                          unsigned int msg_len);
+kadm5_ret_t _kadm5_chpass_principal_message(void *lhandle,
+                                            krb5_principal princ,
+                                            kadm5_ret_t code,
+                                            char *msg_ret,
+                                            unsigned int msg_len);
 
 /* this is needed by the alt_prof code I stole.  The functions
    maybe shouldn't be named krb5_*, but they are. */
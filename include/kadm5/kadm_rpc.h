@@ -65,6 +65,23 @@ struct gprincs_ret {
 };
 typedef struct gprincs_ret gprincs_ret;
 
+struct gprincs_page_arg {
+	krb5_ui_4 api_version;
+	char *exp;
+	char *cursor;
+	int max;
+};
+typedef struct gprincs_page_arg gprincs_page_arg;
+
+struct gprincs_page_ret {
+	krb5_ui_4 api_version;
+	kadm5_ret_t code;
+	char **princs;
+	int count;
+	char *next_cursor;
+};
+typedef struct gprincs_page_ret gprincs_page_ret;
+
 struct chpass_arg {
 	krb5_ui_4 api_version;
 	krb5_principal princ;
@@ -246,6 +263,39 @@ struct getpkeys_ret {
 };
 typedef struct getpkeys_ret getpkeys_ret;
 
+struct bprinc_arg {
+	krb5_ui_4 api_version;
+	kadm5_principal_op_rec *ops;
+	int count;
+};
+typedef struct bprinc_arg bprinc_arg;
+
+struct bprinc_ret {
+	krb5_ui_4 api_version;
+	kadm5_ret_t code;
+	kadm5_ret_t *codes;
+	int count;
+};
+typedef struct bprinc_ret bprinc_ret;
+
+struct brandkey_arg {
+	krb5_ui_4 api_version;
+	krb5_principal *princs;
+	int count;
+	krb5_boolean keepold;
+	int n_ks_tuple;
+	krb5_key_salt_tuple *ks_tuple;
+};
+typedef struct brandkey_arg brandkey_arg;
+
+struct brandkey_ret {
+	krb5_ui_4 api_version;
+	kadm5_ret_t code;
+	kadm5_principal_keys_rec *results;
+	int count;
+};
+typedef struct brandkey_ret brandkey_ret;
+
 #define KADM 2112
 #define KADMVERS 2
 #define CREATE_PRINCIPAL 1
@@ -360,6 +410,26 @@ extern enum clnt_stat get_principal_keys_2(getpkeys_arg *, getpkeys_ret *,
 					   CLIENT *);
 extern  bool_t get_principal_keys_2_svc(getpkeys_arg *, getpkeys_ret *,
 					struct svc_req *);
+#define CREATE_PRINCIPALS 27
+extern  enum clnt_stat create_principals_2(bprinc_arg *, bprinc_ret *,
+					   CLIENT *);
+extern  bool_t create_principals_2_svc(bprinc_arg *, bprinc_ret *,
+				       struct svc_req *);
+#define MODIFY_PRINCIPALS 28
+extern  enum clnt_stat modify_principals_2(bprinc_arg *, bprinc_ret *,
+					   CLIENT *);
+extern  bool_t modify_principals_2_svc(bprinc_arg *, bprinc_ret *,
+				       struct svc_req *);
+#define GET_PRINCS_PAGE 29
+extern  enum clnt_stat get_princs_page_2(gprincs_page_arg *,
+					 gprincs_page_ret *, CLIENT *);
+extern  bool_t get_princs_page_2_svc(gprincs_page_arg *, gprincs_page_ret *,
+				     struct svc_req *);
+#define RANDKEY_PRINCIPALS 30
+extern  enum clnt_stat randkey_principals_2(brandkey_arg *, brandkey_ret *,
+					    CLIENT *);
+extern  bool_t randkey_principals_2_svc(brandkey_arg *, brandkey_ret *,
+					struct svc_req *);
 
 extern bool_t xdr_cprinc_arg ();
 extern bool_t xdr_cprinc3_arg ();
@@ -369,6 +439,8 @@ extern bool_t xdr_mprinc_arg ();
 extern bool_t xdr_rprinc_arg ();
 extern bool_t xdr_gprincs_arg ();
 extern bool_t xdr_gprincs_ret ();
+extern bool_t xdr_gprincs_page_arg ();
+extern bool_t xdr_gprincs_page_ret ();
 extern bool_t xdr_chpass_arg ();
 extern bool_t xdr_chpass3_arg ();
 extern bool_t xdr_setkey_arg ();
@@ -404,5 +476,11 @@ extern bool_t xdr_krb5_string_attr ();
 extern bool_t xdr_kadm5_key_data ();
 extern bool_t xdr_getpkeys_arg ();
 extern bool_t xdr_getpkeys_ret ();
+extern bool_t xdr_kadm5_principal_op_rec ();
+extern bool_t xdr_bprinc_arg ();
+extern bool_t xdr_bprinc_ret ();
+extern bool_t xdr_kadm5_principal_keys_rec ();
+extern bool_t xdr_brandkey_arg ();
+extern bool_t xdr_brandkey_ret ();
 
 #endif /* __KADM_RPC_H__ */
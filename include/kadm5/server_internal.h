@@ -187,6 +187,12 @@ k5_pwqual_check(krb5_context context, pwqual_handle handle,
                 const char *password, const char *policy_name,
                 krb5_principal princ);
 
+/* Compile the text dictionary infile into a compiled dictionary outfile, for
+ * use as dict_file.  If folded is true, lookups will be case-insensitive. */
+krb5_error_code
+k5_pwqual_dict_compile(krb5_context context, const char *infile,
+                       const char *outfile, krb5_boolean folded);
+
 /*** initvt functions for built-in password quality modules ***/
 
 /* The dict module checks passwords against the realm's dictionary. */
@@ -214,12 +220,18 @@ pwqual_princ_initvt(krb5_context context, int maj_ver, int min_ver,
  * @name kadm5_hook plugin support
  */
 
-/** Load all kadm5_hook plugins. */
+/**
+ * Load all kadm5_hook plugins.  If the kadm5_hook_async relation is set for
+ * @a realm, postcommit calls are queued to a background thread per module.
+ */
 krb5_error_code
-k5_kadm5_hook_load(krb5_context context,
+k5_kadm5_hook_load(krb5_context context, const char *realm,
                    kadm5_hook_handle **handles_out);
 
-/** Free handles allocated by k5_kadm5_hook_load(). */
+/**
+ * Free handles allocated by k5_kadm5_hook_load(), first delivering any queued
+ * postcommit calls.
+ */
 void
 k5_kadm5_hook_free_handles(krb5_context context, kadm5_hook_handle *handles);
 
@@ -390,6 +390,18 @@ krb5_error_code krb5_db_iterate ( krb5_context kcontext,
                                   int (*func) (krb5_pointer, krb5_db_entry *),
                                   krb5_pointer func_arg, krb5_flags iterflags );
 
+/*
+ * Iterate in name order over principals whose unparsed names sort at or after
+ * start.  func may end the iteration early by returning nonzero; that value
+ * is returned.  Return KRB5_PLUGIN_OP_NOTSUPP if the module cannot iterate in
+ * name order.
+ */
+krb5_error_code krb5_db_iterate_from(krb5_context kcontext, const char *start,
+                                     int (*func)(krb5_pointer,
+                                                 krb5_db_entry *),
+                                     krb5_pointer func_arg,
+                                     krb5_flags iterflags);
+
 
 krb5_error_code krb5_db_store_master_key  ( krb5_context kcontext,
                                             char *keyfile,
@@ -1450,6 +1462,22 @@ typedef struct _kdb_vftabl {
                                  krb5_data ***auth_indicators);
 
     /* End of minor version 0 for major version 9. */
+
+    /*
+     * Optional: Invoke func for each principal entry whose unparsed name sorts
+     * at or after start (compared bytewise), in that order, until func returns
+     * nonzero.  Return func's nonzero result if it ends the iteration early.
+     * This lets callers scan a range of names, such as those beginning with a
+     * given prefix, without visiting every entry.  Modules whose entries are
+     * not stored in name order should leave this unimplemented.
+     */
+    krb5_error_code (*iterate_from)(krb5_context kcontext, const char *start,
+                                    int (*func)(krb5_pointer,
+                                                krb5_db_entry *),
+                                    krb5_pointer func_arg,
+                                    krb5_flags iterflags);
+
+    /* End of minor version 1 for major version 9. */
 } kdb_vftabl;
 
 #endif /* !defined(_WIN32) */
@@ -55,6 +55,12 @@ extern "C" {
 
 #define MAXLOGLEN       0x10000000      /* 256 MB log file */
 
+/* Values for the iprop_ulog_sync realm relation, controlling when ulog
+ * updates are flushed to disk. */
+#define ULOG_SYNC_ALWAYS        0       /* after every update */
+#define ULOG_SYNC_BATCH         1       /* once per batch (default) */
+#define ULOG_SYNC_INTERVAL      2       /* periodically, via ulog_sync() */
+
 /*
  * Prototype declarations
  */
@@ -66,6 +72,11 @@ krb5_error_code ulog_get_entries(krb5_context context, const kdb_last_t *last,
                                  kdb_incr_result_t *ulog_handle);
 krb5_error_code ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret,
                             char **db_args);
+krb5_error_code ulog_get_delta(krb5_context context, const kdb_last_t *last,
+                               kdb_incr_result_t *ulog_handle);
+krb5_error_code ulog_replay_delta(krb5_context context,
+                                  kdb_incr_result_t *incr_ret,
+                                  char **db_args);
 krb5_error_code ulog_conv_2logentry(krb5_context context, krb5_db_entry *entry,
                                     kdb_incr_update_t *update);
 krb5_error_code ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
@@ -77,6 +88,10 @@ update_status_t ulog_get_sno_status(krb5_context context,
 krb5_error_code ulog_get_last(krb5_context context, kdb_last_t *last_out);
 krb5_error_code ulog_set_last(krb5_context context, const kdb_last_t *last);
 void ulog_fini(krb5_context context);
+krb5_error_code ulog_begin_batch(krb5_context context);
+krb5_error_code ulog_end_batch(krb5_context context);
+void ulog_sync(krb5_context context);
+krb5_deltat ulog_get_sync_interval(krb5_context context);
 
 typedef struct kdb_hlog {
     uint32_t        kdb_hmagic;     /* Log header magic # */
@@ -104,6 +119,13 @@ typedef struct _kdb_log_context {
     kdb_hlog_t      *ulog;
     uint32_t        ulogentries;
     int             ulogfd;
+    int             sync_mode;      /* ULOG_SYNC_* */
+    krb5_deltat     sync_interval;  /* flush interval for ULOG_SYNC_INTERVAL */
+    int             batch_depth;    /* nesting level of ulog_begin_batch() */
+    char            *dirty_start;   /* range of entries not yet synced */
+    char            *dirty_end;
+    krb5_boolean    header_dirty;   /* header not yet synced */
+    char            *ckpt_name;     /* checkpoint file, or NULL if disabled */
 } kdb_log_context;
 
 #ifdef  __cplusplus
@@ -8578,6 +8578,112 @@ void KRB5_CALLCONV
 krb5_set_kdc_recv_hook(krb5_context context, krb5_post_recv_fn recv_hook,
                        void *data);
 
+/** An in-progress exchange of a message with the KDCs of a realm. */
+typedef struct _krb5_kdc_exchange *krb5_kdc_exchange;
+
+/** Contact only the primary KDCs of the realm. */
+#define KRB5_KDC_EXCHANGE_PRIMARY 0x1
+/** Do not use UDP to contact the KDCs. */
+#define KRB5_KDC_EXCHANGE_TCP     0x2
+
+/**
+ * Begin sending a message to the KDCs of a realm without blocking.
+ *
+ * @param [in]  context         Library context
+ * @param [in]  realm           Realm to send the message to
+ * @param [in]  message         Message to send, such as one produced by
+ *                              krb5_init_creds_step() or krb5_tkt_creds_step()
+ * @param [in]  flags           @ref KRB5_KDC_EXCHANGE_PRIMARY and/or
+ *                              @ref KRB5_KDC_EXCHANGE_TCP
+ * @param [out] exchange_out    Exchange handle
+ *
+ * The exchange uses the same KDC selection, retransmission schedule, and
+ * send and receive hooks as synchronous library functions, but returns
+ * control to the caller instead of waiting for a reply.  The caller drives
+ * the exchange by calling krb5_kdc_exchange_step() whenever the descriptor
+ * returned by krb5_kdc_exchange_get_fd() becomes readable or the interval
+ * returned by krb5_kdc_exchange_get_timeout() elapses, and must release the
+ * exchange with krb5_kdc_exchange_free().  Many exchanges can be in progress
+ * at once using a single context, as long as the context is used by only one
+ * thread at a time.
+ *
+ * @version New in 1.22
+ *
+ * @retval 0 Success
+ * @return A Kerberos error code
+ */
+krb5_error_code KRB5_CALLCONV
+krb5_kdc_exchange_start(krb5_context context, const krb5_data *realm,
+                        const krb5_data *message, int flags,
+                        krb5_kdc_exchange *exchange_out);
+
+/**
+ * Get a descriptor which becomes readable when an exchange can progress.
+ *
+ * @param [in] exchange         Exchange handle
+ *
+ * The returned descriptor remains valid and constant for the lifetime of the
+ * exchange, so it can be registered once with an event loop such as poll(),
+ * epoll, or libverto.  It must not be read from or closed by the caller.
+ *
+ * @version New in 1.22
+ *
+ * @return A descriptor to poll for reading, or -1 if the platform does not
+ * support one; in that case, the caller must step the exchange periodically.
+ */
+int KRB5_CALLCONV
+krb5_kdc_exchange_get_fd(krb5_kdc_exchange exchange);
+
+/**
+ * Get the time until an exchange must be stepped if its descriptor does not
+ * become readable.
+ *
+ * @param [in] exchange         Exchange handle
+ *
+ * @version New in 1.22
+ *
+ * @return A timeout in milliseconds, or 0 if the exchange should be stepped
+ * immediately.
+ */
+int KRB5_CALLCONV
+krb5_kdc_exchange_get_timeout(krb5_kdc_exchange exchange);
+
+/**
+ * Make progress on an exchange without blocking.
+ *
+ * @param [in]  context         Library context
+ * @param [in]  exchange        Exchange handle
+ * @param [out] reply_out       KDC reply, once the exchange has finished
+ * @param [out] done_out        Set to TRUE if the exchange has finished
+ *
+ * Process any replies which have arrived and send retransmissions or queries
+ * to further KDCs as the schedule requires.  When the exchange finishes
+ * successfully, @a done_out is set and @a reply_out is set to the reply, which
+ * should be freed with krb5_free_data_contents().  If an error is returned,
+ * the exchange has failed; for example, @c KRB5_KDC_UNREACH is returned if no
+ * KDC replied.  Once an exchange has finished or failed, it should only be
+ * freed.
+ *
+ * @version New in 1.22
+ *
+ * @retval 0 Success
+ * @return A Kerberos error code
+ */
+krb5_error_code KRB5_CALLCONV
+krb5_kdc_exchange_step(krb5_context context, krb5_kdc_exchange exchange,
+                       krb5_data *reply_out, krb5_boolean *done_out);
+
+/**
+ * Free an exchange, abandoning it if it has not finished.
+ *
+ * @param [in] context          Library context
+ * @param [in] exchange         Exchange handle
+ *
+ * @version New in 1.22
+ */
+void KRB5_CALLCONV
+krb5_kdc_exchange_free(krb5_context context, krb5_kdc_exchange exchange);
+
 #if defined(__APPLE__) && (defined(__ppc__) || defined(__ppc64__) || defined(__i386__) || defined(__x86_64__))
 #pragma pack(pop)
 #endif
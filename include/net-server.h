@@ -73,6 +73,15 @@ krb5_error_code loop_setup_signals(verto_ctx *ctx, void *handle,
                                    void (*reset)());
 void loop_free(verto_ctx *ctx);
 
+/*
+ * Stop reading requests from the RPC connection on fd, so that a request
+ * received on it can be answered after the dispatch function returns.  While
+ * held, the connection is not read from, timed out, or closed to make room
+ * for new connections.  loop_release_rpc_connection() resumes reading.
+ */
+krb5_error_code loop_hold_rpc_connection(int fd);
+void loop_release_rpc_connection(int fd);
+
 /* to be supplied by the server application */
 
 /*
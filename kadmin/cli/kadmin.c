@@ -46,6 +46,9 @@
 #include <time.h>
 #include "kadmin.h"
 
+/* Number of principal names to retrieve per list_principals request. */
+#define LIST_PAGE_SIZE 1000
+
 static krb5_boolean script_mode = FALSE;
 int exit_status = 0;
 char *def_realm = NULL;
@@ -1385,6 +1388,339 @@ cleanup:
     free(ks_tuple);
 }
 
+/* One addprinc or modprinc line of a bulk_principals input file.  The
+ * principal entry points into the argv strings, which point into line. */
+struct bulk_item {
+    int lineno;
+    char *line;
+    char **argv;
+    char *canon;
+};
+
+struct bulk_batch {
+    krb5_boolean create;
+    int count;
+    int size;
+    kadm5_principal_op_rec *ops;
+    struct bulk_item *items;
+    kadm5_ret_t *codes;
+    int default_policy;         /* -1 if not yet checked */
+    int nsucceeded;
+    int nfailed;
+};
+
+/* Split line in place into whitespace-separated words, allowing double quotes
+ * to group words.  Return -1 on an unterminated quote. */
+static int
+bulk_split_line(char *line, char ***argv_out, int *argc_out)
+{
+    char **argv, *in, *out;
+    int argc = 0;
+    size_t len = strlen(line);
+
+    *argv_out = NULL;
+    *argc_out = 0;
+    argv = calloc(len / 2 + 2, sizeof(*argv));
+    if (argv == NULL)
+        return -1;
+    in = out = line;
+    for (;;) {
+        while (isspace((unsigned char)*in))
+            in++;
+        if (*in == '\0')
+            break;
+        argv[argc++] = out;
+        while (*in != '\0' && !isspace((unsigned char)*in)) {
+            if (*in == '"') {
+                for (in++; *in != '\0' && *in != '"'; in++)
+                    *out++ = *in;
+                if (*in == '\0') {
+                    free(argv);
+                    return -1;
+                }
+                in++;
+            } else {
+                *out++ = *in++;
+            }
+        }
+        if (*in != '\0')
+            in++;
+        *out++ = '\0';
+    }
+    argv[argc] = NULL;
+    *argv_out = argv;
+    *argc_out = argc;
+    return 0;
+}
+
+static void
+bulk_free_item(kadm5_principal_op_t op, struct bulk_item *item)
+{
+    krb5_free_principal(context, op->rec.principal);
+    kadmin_free_tl_data(&op->rec.n_tl_data, &op->rec.tl_data);
+    free(op->ks_tuple);
+    free(item->canon);
+    free(item->argv);
+    free(item->line);
+    memset(op, 0, sizeof(*op));
+    memset(item, 0, sizeof(*item));
+}
+
+/* Send the queued operations to the server and report per-item failures. */
+static void
+bulk_flush(struct bulk_batch *b)
+{
+    kadm5_ret_t ret;
+    int i;
+
+    if (b->count == 0)
+        return;
+    if (b->create)
+        ret = kadm5_create_principals(handle, b->ops, b->count, b->codes);
+    else
+        ret = kadm5_modify_principals(handle, b->ops, b->count, b->codes);
+    for (i = 0; i < b->count; i++) {
+        if (ret)
+            b->codes[i] = ret;
+        if (b->codes[i] == 0) {
+            b->nsucceeded++;
+        } else {
+            com_err("bulk_principals", b->codes[i],
+                    b->create ? _("line %d: while creating \"%s\".") :
+                    _("line %d: while modifying \"%s\"."),
+                    b->items[i].lineno, b->items[i].canon);
+            b->nfailed++;
+        }
+        bulk_free_item(&b->ops[i], &b->items[i]);
+    }
+    b->count = 0;
+}
+
+/* Parse an addprinc or modprinc command line into op.  Return 0 on success, or
+ * -1 after reporting an error. */
+static int
+bulk_parse_item(struct bulk_batch *b, int argc, char **argv,
+                struct bulk_item *item, kadm5_principal_op_t op)
+{
+    kadm5_principal_ent_rec oldprinc;
+    krb5_boolean randkey, nokey;
+    krb5_error_code retval;
+    long mask;
+
+    memset(op, 0, sizeof(*op));
+    if (kadmin_parse_princ_args(argc, argv, &op->rec, &mask, &op->pass,
+                                &randkey, &nokey, &op->ks_tuple,
+                                &op->n_ks_tuple, "bulk_principals"))
+        goto usage;
+    retval = krb5_unparse_name(context, op->rec.principal, &item->canon);
+    if (retval) {
+        com_err("bulk_principals", retval,
+                _("line %d: while canonicalizing principal"), item->lineno);
+        return -1;
+    }
+
+    if (!b->create) {
+        if (op->ks_tuple != NULL || randkey || nokey || op->pass != NULL)
+            goto usage;
+        if (mask & KADM5_ATTRIBUTES) {
+            /* Attribute changes are relative to the current attributes. */
+            memset(&oldprinc, 0, sizeof(oldprinc));
+            retval = kadm5_get_principal(handle, op->rec.principal,
+                                         &oldprinc, KADM5_ATTRIBUTES);
+            if (retval) {
+                com_err("bulk_principals", retval,
+                        _("line %d: while getting \"%s\"."), item->lineno,
+                        item->canon);
+                return -1;
+            }
+            krb5_free_principal(context, op->rec.principal);
+            kadmin_free_tl_data(&op->rec.n_tl_data, &op->rec.tl_data);
+            memset(&op->rec, 0, sizeof(op->rec));
+            op->rec.attributes = oldprinc.attributes;
+            kadm5_free_principal_ent(handle, &oldprinc);
+            if (kadmin_parse_princ_args(argc, argv, &op->rec, &mask,
+                                        &op->pass, &randkey, &nokey,
+                                        &op->ks_tuple, &op->n_ks_tuple,
+                                        "bulk_principals"))
+                goto usage;
+        }
+        op->mask = mask;
+        return 0;
+    }
+
+    if (!(mask & (KADM5_POLICY | KADM5_POLICY_CLR))) {
+        /* If the policy "default" exists, assign it. */
+        if (b->default_policy == -1)
+            b->default_policy = policy_exists("default");
+        if (b->default_policy) {
+            op->rec.policy = "default";
+            mask |= KADM5_POLICY;
+        }
+    }
+    mask &= ~KADM5_POLICY_CLR;
+
+    if (nokey) {
+        op->pass = NULL;
+        mask |= KADM5_KEY_DATA;
+    } else if (randkey) {
+        op->pass = NULL;
+    } else if (op->pass == NULL) {
+        error(_("bulk_principals: line %d: -pw, -randkey, or -nokey is "
+                "required for \"%s\"\n"), item->lineno, item->canon);
+        return -1;
+    }
+    op->mask = mask | KADM5_PRINCIPAL;
+    return 0;
+
+usage:
+    error(_("bulk_principals: line %d: invalid %s command\n"), item->lineno,
+          b->create ? "add_principal" : "modify_principal");
+    return -1;
+}
+
+/* Queue one input line, flushing the batch first if it is full or holds the
+ * other kind of operation. */
+static void
+bulk_add_line(struct bulk_batch *b, const char *text, int lineno)
+{
+    struct bulk_item *item;
+    kadm5_principal_op_t op;
+    krb5_boolean create;
+    char **argv;
+    int argc;
+
+    item = &b->items[b->count];
+    op = &b->ops[b->count];
+    memset(item, 0, sizeof(*item));
+    item->lineno = lineno;
+    item->line = strdup(text);
+    if (item->line == NULL) {
+        com_err("bulk_principals", ENOMEM, _("while reading input"));
+        return;
+    }
+    if (bulk_split_line(item->line, &argv, &argc) != 0) {
+        error(_("bulk_principals: line %d: unterminated quote\n"), lineno);
+        goto fail;
+    }
+    item->argv = argv;
+    if (argc == 0 || *argv[0] == '#') {
+        bulk_free_item(op, item);
+        return;
+    }
+
+    if (!strcmp(argv[0], "add_principal") || !strcmp(argv[0], "addprinc") ||
+        !strcmp(argv[0], "ank")) {
+        create = TRUE;
+    } else if (!strcmp(argv[0], "modify_principal") ||
+               !strcmp(argv[0], "modprinc")) {
+        create = FALSE;
+    } else {
+        error(_("bulk_principals: line %d: unsupported command \"%s\"\n"),
+              lineno, argv[0]);
+        goto fail;
+    }
+
+    if (create != b->create && b->count > 0) {
+        /* Move the pending line out of the way of the flush. */
+        b->items[b->size] = *item;
+        bulk_flush(b);
+        b->items[0] = b->items[b->size];
+        item = &b->items[0];
+        op = &b->ops[0];
+    }
+    b->create = create;
+    if (bulk_parse_item(b, argc, argv, item, op) != 0)
+        goto fail;
+    if (++b->count == b->size)
+        bulk_flush(b);
+    return;
+
+fail:
+    b->nfailed++;
+    bulk_free_item(op, item);
+}
+
+static void
+kadmin_bulk_usage()
+{
+    error(_("usage: bulk_principals [-b batchsize] [filename|-]\n"));
+}
+
+void
+kadmin_bulk(int argc, char *argv[])
+{
+    struct bulk_batch b;
+    FILE *fp = stdin;
+    char buf[BUFSIZ], *fname = "-", *end;
+    int lineno = 0, size = 100;
+    size_t len;
+
+    memset(&b, 0, sizeof(b));
+    b.default_policy = -1;
+
+    argc--;
+    argv++;
+    if (argc >= 2 && !strcmp(*argv, "-b")) {
+        size = strtol(argv[1], &end, 10);
+        if (*end != '\0' || size <= 0) {
+            kadmin_bulk_usage();
+            return;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc > 1 || (argc == 1 && **argv == '-' && strcmp(*argv, "-"))) {
+        kadmin_bulk_usage();
+        return;
+    }
+    if (argc == 1)
+        fname = *argv;
+
+    if (strcmp(fname, "-") != 0) {
+        fp = fopen(fname, "r");
+        if (fp == NULL) {
+            com_err("bulk_principals", errno, _("while opening %s"), fname);
+            return;
+        }
+    }
+
+    b.size = size;
+    b.ops = calloc(size, sizeof(*b.ops));
+    b.items = calloc(size + 1, sizeof(*b.items));
+    b.codes = calloc(size, sizeof(*b.codes));
+    if (b.ops == NULL || b.items == NULL || b.codes == NULL) {
+        com_err("bulk_principals", ENOMEM, _("while allocating batch"));
+        goto cleanup;
+    }
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        lineno++;
+        len = strlen(buf);
+        if (len > 0 && buf[len - 1] != '\n' && !feof(fp)) {
+            error(_("bulk_principals: line %d: line too long\n"), lineno);
+            b.nfailed++;
+            /* Discard the rest of the line. */
+            while (fgets(buf, sizeof(buf), fp) != NULL) {
+                if (buf[strlen(buf) - 1] == '\n')
+                    break;
+            }
+            continue;
+        }
+        bulk_add_line(&b, buf, lineno);
+    }
+    bulk_flush(&b);
+
+    info(_("%d principals processed, %d failed.\n"),
+         b.nsucceeded + b.nfailed, b.nfailed);
+
+cleanup:
+    if (fp != stdin)
+        fclose(fp);
+    free(b.ops);
+    free(b.items);
+    free(b.codes);
+}
+
 void
 kadmin_getprinc(int argc, char *argv[])
 {
@@ -1525,7 +1861,7 @@ void
 kadmin_getprincs(int argc, char *argv[])
 {
     krb5_error_code retval;
-    char *expr, **names;
+    char *expr, **names, *cursor = NULL, *next;
     int i, count;
 
     expr = NULL;
@@ -1533,14 +1869,21 @@ kadmin_getprincs(int argc, char *argv[])
         error(_("usage: get_principals [expression]\n"));
         return;
     }
-    retval = kadm5_get_principals(handle, expr, &names, &count);
-    if (retval) {
-        com_err("get_principals", retval, _("while retrieving list."));
-        return;
-    }
-    for (i = 0; i < count; i++)
-        printf("%s\n", names[i]);
-    kadm5_free_name_list(handle, names, count);
+    /* Print the list a page at a time as it is retrieved. */
+    do {
+        retval = kadm5_get_principals_page(handle, expr, cursor,
+                                           LIST_PAGE_SIZE, &names, &count,
+                                           &next);
+        free(cursor);
+        if (retval) {
+            com_err("get_principals", retval, _("while retrieving list."));
+            return;
+        }
+        for (i = 0; i < count; i++)
+            printf("%s\n", names[i]);
+        kadm5_free_name_list(handle, names, count);
+        cursor = next;
+    } while (cursor != NULL);
 }
 
 static int
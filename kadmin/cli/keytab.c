@@ -37,23 +37,29 @@
 #include <adm_proto.h>
 #include "kadmin.h"
 
-static void add_principal(void *lhandle, char *keytab_str, krb5_keytab keytab,
-                          krb5_boolean keepold,
-                          int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
-                          char *princ_str);
+static void add_principals(char *keytab_str, krb5_keytab keytab,
+                           krb5_boolean keepold, int n_ks_tuple,
+                           krb5_key_salt_tuple *ks_tuple, char **names,
+                           int count, int done, int total);
 static void remove_principal(char *keytab_str, krb5_keytab keytab,
                              char *princ_str, char *kvno_str);
 static char *etype_string(krb5_enctype enctype);
 
+/* Number of principals whose keys are changed and written per batch. */
+#define KTADD_BATCH_SIZE 500
+
 static int quiet;
 
 static int norandkey;
 
+static int progress;
+
 static void
 add_usage()
 {
-    fprintf(stderr, _("Usage: ktadd [-k[eytab] keytab] [-q] [-e keysaltlist] "
-                      "[-norandkey] [principal | -glob princ-exp] [...]\n"));
+    fprintf(stderr, _("Usage: ktadd [-k[eytab] keytab] [-q] [-progress] "
+                      "[-e keysaltlist] [-norandkey] "
+                      "[principal | -glob princ-exp] [...]\n"));
 }
 
 static void
@@ -110,12 +116,31 @@ process_keytab(krb5_context my_context, char **keytab_str,
     return 0;
 }
 
+/* Append a copy of name to the list *names of length *count. */
+static int
+add_name(char ***names, int *count, const char *name)
+{
+    char **newlist, *copy;
+
+    copy = strdup(name);
+    if (copy == NULL)
+        return ENOMEM;
+    newlist = realloc(*names, (*count + 1) * sizeof(*newlist));
+    if (newlist == NULL) {
+        free(copy);
+        return ENOMEM;
+    }
+    newlist[(*count)++] = copy;
+    *names = newlist;
+    return 0;
+}
+
 void
 kadmin_keytab_add(int argc, char **argv)
 {
     krb5_keytab keytab = 0;
-    char *keytab_str = NULL, **princs;
-    int code, num, i;
+    char *keytab_str = NULL, **princs, **names = NULL;
+    int code, num, i, nnames = 0, n;
     krb5_error_code retval;
     int n_ks_tuple = 0;
     krb5_boolean keepold = FALSE;
@@ -124,6 +149,7 @@ kadmin_keytab_add(int argc, char **argv)
     argc--; argv++;
     quiet = 0;
     norandkey = 0;
+    progress = 0;
     while (argc) {
         if (strncmp(*argv, "-k", 2) == 0) {
             argc--; argv++;
@@ -134,6 +160,8 @@ kadmin_keytab_add(int argc, char **argv)
             keytab_str = *argv;
         } else if (strcmp(*argv, "-q") == 0) {
             quiet++;
+        } else if (strcmp(*argv, "-progress") == 0) {
+            progress++;
         } else if (strcmp(*argv, "-norandkey") == 0) {
             norandkey++;
         } else if (strcmp(*argv, "-e") == 0) {
@@ -169,6 +197,8 @@ kadmin_keytab_add(int argc, char **argv)
     if (process_keytab(context, &keytab_str, &keytab))
         return;
 
+    /* Expand the arguments into a list of principal names, so that the keys
+     * can be changed and written a batch at a time. */
     while (*argv) {
         if (strcmp(*argv, "-glob") == 0) {
             if (*++argv == NULL) {
@@ -184,17 +214,30 @@ kadmin_keytab_add(int argc, char **argv)
                 continue;
             }
 
-            for (i = 0; i < num; i++)
-                add_principal(handle, keytab_str, keytab, keepold,
-                              n_ks_tuple, ks_tuple, princs[i]);
+            for (i = 0; i < num && code == 0; i++)
+                code = add_name(&names, &nnames, princs[i]);
             kadm5_free_name_list(handle, princs, num);
+            argv++;
         } else {
-            add_principal(handle, keytab_str, keytab, keepold,
-                          n_ks_tuple, ks_tuple, *argv);
+            code = add_name(&names, &nnames, *argv);
             argv++;
         }
+        if (code) {
+            com_err(whoami, code, _("while expanding principal list"));
+            goto cleanup;
+        }
     }
 
+    for (i = 0; i < nnames; i += n) {
+        n = (nnames - i < KTADD_BATCH_SIZE) ? nnames - i : KTADD_BATCH_SIZE;
+        add_principals(keytab_str, keytab, keepold, n_ks_tuple, ks_tuple,
+                       names + i, n, i, nnames);
+    }
+
+cleanup:
+    for (i = 0; i < nnames; i++)
+        free(names[i]);
+    free(names);
     code = krb5_kt_close(context, keytab);
     if (code != 0)
         com_err(whoami, code, _("while closing keytab"));
@@ -242,119 +285,156 @@ kadmin_keytab_remove(int argc, char **argv)
     free(keytab_str);
 }
 
-/* Generate new random keys for princ, and convert them into a kadm5_key_data
- * array (with no salt information). */
-static krb5_error_code
-fetch_new_keys(void *lhandle, krb5_principal princ, krb5_boolean keepold,
-               int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
-               kadm5_key_data **key_data_out, int *nkeys_out)
+/* Report the failure of princ_str's key change or extraction. */
+static void
+report_add_error(krb5_error_code code, const char *princ_str)
 {
-    krb5_error_code code;
-    kadm5_key_data *key_data;
-    kadm5_principal_ent_rec princ_rec;
-    krb5_keyblock *keys = NULL;
-    int i, nkeys = 0;
-
-    *key_data_out = NULL;
-    *nkeys_out = 0;
-    memset(&princ_rec, 0, sizeof(princ_rec));
-
-    /* Generate new random keys. */
-    code = randkey_princ(lhandle, princ, keepold, n_ks_tuple, ks_tuple,
-                         &keys, &nkeys);
-    if (code)
-        goto cleanup;
-
-    /* Get the principal entry to find the kvno of the new keys.  (This is not
-     * atomic, but randkey doesn't report the new kvno.) */
-    code = kadm5_get_principal(lhandle, princ, &princ_rec,
-                               KADM5_PRINCIPAL_NORMAL_MASK);
-    if (code)
-        goto cleanup;
-
-    key_data = k5calloc(nkeys, sizeof(*key_data), &code);
-    if (key_data == NULL)
-        goto cleanup;
-
-    /* Transfer the keyblocks and free the container array. */
-    for (i = 0; i < nkeys; i++) {
-        key_data[i].key = keys[i];
-        key_data[i].kvno = princ_rec.kvno;
+    if (code == KADM5_UNK_PRINC) {
+        fprintf(stderr, _("%s: Principal %s does not exist.\n"),
+                whoami, princ_str);
+    } else {
+        com_err(whoami, code, _("while changing %s's key"), princ_str);
     }
-    *key_data_out = key_data;
-    *nkeys_out = nkeys;
-    free(keys);
-    keys = NULL;
-    nkeys = 0;
-
-cleanup:
-    for (i = 0; i < nkeys; i++)
-        krb5_free_keyblock_contents(context, &keys[i]);
-    free(keys);
-    kadm5_free_principal_ent(lhandle, &princ_rec);
-    return code;
 }
 
+/*
+ * Change the keys of (or with -norandkey, fetch the keys of) the count
+ * principals in names, then add all of the resulting keys to keytab in one
+ * update.  done and total are used for progress reporting.
+ */
 static void
-add_principal(void *lhandle, char *keytab_str, krb5_keytab keytab,
-              krb5_boolean keepold, int n_ks_tuple,
-              krb5_key_salt_tuple *ks_tuple, char *princ_str)
+add_principals(char *keytab_str, krb5_keytab keytab, krb5_boolean keepold,
+               int n_ks_tuple, krb5_key_salt_tuple *ks_tuple, char **names,
+               int count, int done, int total)
 {
-    krb5_principal princ = NULL;
-    krb5_keytab_entry new_entry;
-    kadm5_key_data *key_data;
-    int code, nkeys, i;
-
-    princ = NULL;
-    key_data = NULL;
-    nkeys = 0;
-
-    code = krb5_parse_name(context, princ_str, &princ);
-    if (code != 0) {
-        com_err(whoami, code, _("while parsing -add principal name %s"),
-                princ_str);
+    krb5_principal *princs = NULL, *batch = NULL;
+    kadm5_principal_keys_rec *res = NULL, *bres = NULL;
+    krb5_keytab_entry *entries = NULL;
+    const char *emsg;
+    int code, i, j, n, *idx = NULL, nentries = 0;
+
+    princs = k5calloc(count, sizeof(*princs), &code);
+    res = k5calloc(count, sizeof(*res), &code);
+    if (princs == NULL || res == NULL) {
+        com_err(whoami, ENOMEM, _("while changing keys"));
         goto cleanup;
     }
 
+    for (i = 0; i < count; i++) {
+        res[i].code = krb5_parse_name(context, names[i], &princs[i]);
+        if (res[i].code != 0) {
+            com_err(whoami, res[i].code,
+                    _("while parsing -add principal name %s"), names[i]);
+        }
+    }
+
     if (norandkey) {
-        code = kadm5_get_principal_keys(handle, princ, 0, &key_data, &nkeys);
+        for (i = 0; i < count; i++) {
+            if (princs[i] == NULL)
+                continue;
+            res[i].code = kadm5_get_principal_keys(handle, princs[i], 0,
+                                                   &res[i].key_data,
+                                                   &res[i].n_key_data);
+        }
     } else {
-        code = fetch_new_keys(handle, princ, keepold, n_ks_tuple, ks_tuple,
-                              &key_data, &nkeys);
+        /* Change the keys of all of the parsed principals in one request. */
+        batch = k5calloc(count, sizeof(*batch), &code);
+        bres = k5calloc(count, sizeof(*bres), &code);
+        idx = k5calloc(count, sizeof(*idx), &code);
+        if (batch == NULL || bres == NULL || idx == NULL) {
+            com_err(whoami, ENOMEM, _("while changing keys"));
+            goto cleanup;
+        }
+        for (i = n = 0; i < count; i++) {
+            if (princs[i] != NULL) {
+                batch[n] = princs[i];
+                idx[n++] = i;
+            }
+        }
+        code = kadm5_randkey_principals(handle, batch, n, keepold, n_ks_tuple,
+                                        ks_tuple, bres);
+        /* The library falls back to per-principal RPCs if the server doesn't
+         * support the batch RPC.  Any other failure of the request is fatal,
+         * since the server may already have changed some of the keys. */
+        for (i = 0; i < n; i++) {
+            if (code)
+                bres[i].code = code;
+            res[idx[i]] = bres[i];
+        }
     }
 
-    if (code != 0) {
-        if (code == KADM5_UNK_PRINC) {
-            fprintf(stderr, _("%s: Principal %s does not exist.\n"),
-                    whoami, princ_str);
-        } else
-            com_err(whoami, code, _("while changing %s's key"), princ_str);
-        goto cleanup;
+    for (i = 0; i < count; i++) {
+        if (princs[i] != NULL && res[i].code != 0)
+            report_add_error(res[i].code, names[i]);
+        else if (res[i].code == 0)
+            nentries += res[i].n_key_data;
     }
 
-    for (i = 0; i < nkeys; i++) {
-        memset(&new_entry, 0, sizeof(new_entry));
-        new_entry.principal = princ;
-        new_entry.key = key_data[i].key;
-        new_entry.vno = key_data[i].kvno;
-
-        code = krb5_kt_add_entry(context, keytab, &new_entry);
-        if (code != 0) {
-            com_err(whoami, code, _("while adding key to keytab"));
-            goto cleanup;
+    /* Write the keys of all of the successful principals at once. */
+    entries = k5calloc(nentries + 1, sizeof(*entries), &code);
+    if (entries == NULL) {
+        com_err(whoami, code, _("while adding key to keytab"));
+        goto cleanup;
+    }
+    for (i = 0, nentries = 0; i < count; i++) {
+        if (res[i].code != 0)
+            continue;
+        for (j = 0; j < res[i].n_key_data; j++) {
+            entries[nentries].principal = princs[i];
+            entries[nentries].key = res[i].key_data[j].key;
+            entries[nentries].vno = res[i].key_data[j].kvno;
+            nentries++;
+        }
+    }
+    code = k5_kt_add_entries(context, keytab, entries, nentries);
+    if (code != 0) {
+        com_err(whoami, code, _("while adding key to keytab"));
+        for (i = 0; i < count; i++) {
+            if (res[i].code == 0)
+                res[i].code = code;
         }
+    }
 
-        if (!quiet) {
+    for (i = 0; i < count; i++) {
+        if (progress) {
+            /* One tab-separated line per principal: position, total,
+             * principal, and either the new kvno and number of keys or an
+             * error message. */
+            if (res[i].code == 0) {
+                printf("%d\t%d\t%s\tok\t%d\t%d\n", done + i + 1, total,
+                       names[i], (res[i].n_key_data > 0) ?
+                       (int)res[i].key_data[0].kvno : 0, res[i].n_key_data);
+            } else {
+                emsg = krb5_get_error_message(context, res[i].code);
+                printf("%d\t%d\t%s\terror\t%s\n", done + i + 1, total,
+                       names[i], emsg);
+                krb5_free_error_message(context, emsg);
+            }
+            continue;
+        }
+        if (quiet || res[i].code != 0)
+            continue;
+        for (j = 0; j < res[i].n_key_data; j++) {
             printf(_("Entry for principal %s with kvno %d, "
                      "encryption type %s added to keytab %s.\n"),
-                   princ_str, key_data[i].kvno,
-                   etype_string(key_data[i].key.enctype), keytab_str);
+                   names[i], res[i].key_data[j].kvno,
+                   etype_string(res[i].key_data[j].key.enctype), keytab_str);
         }
     }
+    if (progress)
+        fflush(stdout);
 
 cleanup:
-    kadm5_free_kadm5_key_data(context, nkeys, key_data);
-    krb5_free_principal(context, princ);
+    for (i = 0; i < count && res != NULL; i++)
+        kadm5_free_kadm5_key_data(context, res[i].n_key_data, res[i].key_data);
+    for (i = 0; i < count && princs != NULL; i++)
+        krb5_free_principal(context, princs[i]);
+    free(entries);
+    free(princs);
+    free(res);
+    free(batch);
+    free(bres);
+    free(idx);
 }
 
 static void
@@ -29,6 +29,7 @@
  */
 
 #include <k5-int.h>
+#include <k5-input.h>
 #include <kadm5/admin.h>
 #include <kadm5/server_internal.h>
 #include <kdb.h>
@@ -37,6 +38,7 @@
 #if defined(HAVE_REGEX_H) && defined(HAVE_REGCOMP)
 #include <regex.h>
 #endif  /* HAVE_REGEX_H */
+#include <sys/mman.h>
 
 /* Needed for master key conversion. */
 static krb5_boolean mkey_convert;
@@ -87,6 +89,28 @@ struct dump_args {
     dump_version *dump;
 };
 
+/*
+ * When loading into a new database, principal entries are accumulated and
+ * stored in batches sorted by name.  Sorted insertion lets the KDB module
+ * append to its index rather than searching it (LMDB uses MDB_APPEND), and
+ * each batch is stored while holding the database lock so that the module
+ * does not reopen the database for every entry.
+ */
+#define LOAD_BATCH_SIZE 4096
+
+struct load_batch_entry {
+    char *name;
+    size_t seq;
+    krb5_db_entry *entry;
+};
+
+static struct {
+    krb5_boolean active;
+    krb5_boolean verbose;
+    size_t count;
+    struct load_batch_entry ents[LOAD_BATCH_SIZE];
+} load_batch;
+
 /* External data */
 extern krb5_db_entry *master_entry;
 
@@ -475,6 +499,262 @@ dump_r1_11_policy(void *data, osa_policy_ent_t entry)
     fprintf(arg->ofile, "\n");
 }
 
+/*
+ * A binary dump begins with a text header line, so that it can be recognized
+ * by the same code as the text formats:
+ *
+ *     kdb5_util binary_dump version 1[ iprop SNO SECONDS USECONDS]
+ *
+ * The header line is followed by a section of principal records, a section
+ * of policy records, a section index, and a fixed-length trailer, so that a
+ * loader can map the file and walk the records without tokenizing.  Each
+ * section is followed by a zero record length, which is not part of the
+ * section, so that a loader reading from a pipe can load records as they
+ * arrive.  All integers are big-endian.
+ *
+ *     record:  length (4 bytes, nonzero), contents
+ *     index:   "KDBI", section count (4), then for each section:
+ *              type (4), record count (4), offset (8), length (8),
+ *              checksum length (4), SHA-256 checksum of the section or empty
+ *     trailer: index offset (8), index length (4), "KDBX"
+ *
+ * A principal record contains the unparsed name (4-byte length), len (2),
+ * attributes through fail_auth_count (4 each), n_tl_data (2) and each tl-data
+ * type and length (2 each) with contents, n_key_data (2) and each key data
+ * version and kvno (2 each) followed by each component type and length (2
+ * each) with contents, and e_data (2-byte length).  A policy record contains
+ * the name (4-byte length), the numeric fields from pw_min_life through
+ * max_renewable_life except policy_refcnt (4 each), allowed_keysalts (4-byte
+ * length, zero for none), and tl-data as for principals.
+ */
+#define BINARY_SECTION_PRINC 1
+#define BINARY_SECTION_POLICY 2
+#define BINARY_INDEX_MAGIC "KDBI"
+#define BINARY_TRAILER_MAGIC "KDBX"
+#define BINARY_TRAILER_LEN 16
+
+struct binary_section {
+    uint32_t type;
+    uint32_t count;
+    off_t offset;
+    off_t length;
+};
+
+/* Record counts and the first error encountered while writing a binary
+ * dump.  Policies are written from an iteration callback which cannot return
+ * an error. */
+static struct {
+    uint32_t princ_count;
+    uint32_t policy_count;
+    krb5_error_code error;
+} binary_dump_state;
+
+static void
+add_binary_tl_data(struct k5buf *buf, krb5_tl_data *tl_data)
+{
+    krb5_tl_data *tlp;
+    uint16_t count = 0;
+
+    for (tlp = tl_data; tlp != NULL; tlp = tlp->tl_data_next)
+        count++;
+    k5_buf_add_uint16_be(buf, count);
+    for (tlp = tl_data; tlp != NULL; tlp = tlp->tl_data_next) {
+        k5_buf_add_uint16_be(buf, tlp->tl_data_type);
+        k5_buf_add_uint16_be(buf, tlp->tl_data_length);
+        k5_buf_add_len(buf, tlp->tl_data_contents, tlp->tl_data_length);
+    }
+}
+
+/* Write the contents of buf to fp as a length-prefixed record, and free
+ * buf. */
+static krb5_error_code
+write_binary_record(FILE *fp, struct k5buf *buf)
+{
+    krb5_error_code ret = 0;
+    uint8_t lenbytes[4];
+
+    if (k5_buf_status(buf) != 0) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    store_32_be(buf->len, lenbytes);
+    errno = 0;
+    if (fwrite(lenbytes, 1, 4, fp) != 4 ||
+        fwrite(buf->data, 1, buf->len, fp) != buf->len) {
+        ret = errno;
+        if (ret == 0)
+            ret = EIO;
+    }
+
+cleanup:
+    k5_buf_free(buf);
+    return ret;
+}
+
+/* Output a principal record in binary format. */
+static krb5_error_code
+dump_binary_princ(krb5_context context, krb5_db_entry *entry,
+                  const char *name, FILE *fp, krb5_boolean verbose,
+                  krb5_boolean omit_nra)
+{
+    krb5_error_code ret;
+    struct k5buf buf;
+    krb5_key_data *kdata;
+    size_t namelen = strlen(name);
+    int i, j;
+
+    k5_buf_init_dynamic_zap(&buf);
+    k5_buf_add_uint32_be(&buf, namelen);
+    k5_buf_add_len(&buf, name, namelen);
+    k5_buf_add_uint16_be(&buf, entry->len);
+    k5_buf_add_uint32_be(&buf, entry->attributes);
+    k5_buf_add_uint32_be(&buf, entry->max_life);
+    k5_buf_add_uint32_be(&buf, entry->max_renewable_life);
+    k5_buf_add_uint32_be(&buf, entry->expiration);
+    k5_buf_add_uint32_be(&buf, entry->pw_expiration);
+    k5_buf_add_uint32_be(&buf, omit_nra ? 0 : entry->last_success);
+    k5_buf_add_uint32_be(&buf, omit_nra ? 0 : entry->last_failed);
+    k5_buf_add_uint32_be(&buf, omit_nra ? 0 : entry->fail_auth_count);
+    add_binary_tl_data(&buf, entry->tl_data);
+    k5_buf_add_uint16_be(&buf, entry->n_key_data);
+    for (i = 0; i < entry->n_key_data; i++) {
+        kdata = &entry->key_data[i];
+        k5_buf_add_uint16_be(&buf, kdata->key_data_ver);
+        k5_buf_add_uint16_be(&buf, kdata->key_data_kvno);
+        for (j = 0; j < kdata->key_data_ver; j++) {
+            k5_buf_add_uint16_be(&buf, kdata->key_data_type[j]);
+            k5_buf_add_uint16_be(&buf, kdata->key_data_length[j]);
+            k5_buf_add_len(&buf, kdata->key_data_contents[j],
+                           kdata->key_data_length[j]);
+        }
+    }
+    k5_buf_add_uint16_be(&buf, entry->e_length);
+    k5_buf_add_len(&buf, entry->e_data, entry->e_length);
+
+    ret = write_binary_record(fp, &buf);
+    if (ret)
+        return ret;
+    binary_dump_state.princ_count++;
+
+    if (verbose)
+        fprintf(stderr, "%s\n", name);
+    return 0;
+}
+
+/* Output a policy record in binary format. */
+static void
+dump_binary_policy(void *data, osa_policy_ent_t entry)
+{
+    struct dump_args *arg = data;
+    struct k5buf buf;
+    size_t len;
+    krb5_error_code ret;
+
+    if (binary_dump_state.error)
+        return;
+
+    k5_buf_init_dynamic(&buf);
+    len = strlen(entry->name);
+    k5_buf_add_uint32_be(&buf, len);
+    k5_buf_add_len(&buf, entry->name, len);
+    k5_buf_add_uint32_be(&buf, entry->pw_min_life);
+    k5_buf_add_uint32_be(&buf, entry->pw_max_life);
+    k5_buf_add_uint32_be(&buf, entry->pw_min_length);
+    k5_buf_add_uint32_be(&buf, entry->pw_min_classes);
+    k5_buf_add_uint32_be(&buf, entry->pw_history_num);
+    k5_buf_add_uint32_be(&buf, entry->pw_max_fail);
+    k5_buf_add_uint32_be(&buf, entry->pw_failcnt_interval);
+    k5_buf_add_uint32_be(&buf, entry->pw_lockout_duration);
+    k5_buf_add_uint32_be(&buf, entry->attributes);
+    k5_buf_add_uint32_be(&buf, entry->max_life);
+    k5_buf_add_uint32_be(&buf, entry->max_renewable_life);
+    len = (entry->allowed_keysalts != NULL) ? strlen(entry->allowed_keysalts) :
+        0;
+    k5_buf_add_uint32_be(&buf, len);
+    k5_buf_add_len(&buf, entry->allowed_keysalts, len);
+    add_binary_tl_data(&buf, entry->tl_data);
+
+    ret = write_binary_record(arg->ofile, &buf);
+    if (ret)
+        binary_dump_state.error = ret;
+    else
+        binary_dump_state.policy_count++;
+}
+
+/* Write the zero record length which ends a binary dump section to f. */
+static krb5_error_code
+end_binary_section(FILE *f)
+{
+    static const uint8_t zero[4];
+
+    errno = 0;
+    if (fwrite(zero, 1, sizeof(zero), f) != sizeof(zero))
+        return errno ? errno : EIO;
+    return 0;
+}
+
+/* Write the section index and trailer of a binary dump to f, which must be
+ * a regular file open for reading and writing. */
+static krb5_error_code
+finish_binary_dump(FILE *f, struct binary_section *sections, int nsections)
+{
+    krb5_error_code ret = 0;
+    struct k5buf buf;
+    uint8_t cksum[K5_SHA256_HASHLEN], trailer[BINARY_TRAILER_LEN];
+    unsigned char *map = MAP_FAILED;
+    krb5_data d;
+    off_t index_offset;
+    size_t maplen = 0;
+    int i;
+
+    if (fflush(f) != 0)
+        return errno;
+    index_offset = ftello(f);
+    if (index_offset < 0)
+        return errno;
+
+    maplen = index_offset;
+    if (maplen > 0) {
+        map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fileno(f), 0);
+        if (map == MAP_FAILED)
+            return errno;
+    }
+
+    k5_buf_init_dynamic(&buf);
+    k5_buf_add_len(&buf, BINARY_INDEX_MAGIC, 4);
+    k5_buf_add_uint32_be(&buf, nsections);
+    for (i = 0; i < nsections; i++) {
+        k5_buf_add_uint32_be(&buf, sections[i].type);
+        k5_buf_add_uint32_be(&buf, sections[i].count);
+        k5_buf_add_uint64_be(&buf, sections[i].offset);
+        k5_buf_add_uint64_be(&buf, sections[i].length);
+        d = make_data(map + sections[i].offset, sections[i].length);
+        ret = k5_sha256(&d, 1, cksum);
+        if (ret)
+            goto cleanup;
+        k5_buf_add_uint32_be(&buf, sizeof(cksum));
+        k5_buf_add_len(&buf, cksum, sizeof(cksum));
+    }
+    if (k5_buf_status(&buf) != 0) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+
+    store_64_be(index_offset, trailer);
+    store_32_be(buf.len, trailer + 8);
+    memcpy(trailer + 12, BINARY_TRAILER_MAGIC, 4);
+    if (fwrite(buf.data, 1, buf.len, f) != buf.len ||
+        fwrite(trailer, 1, sizeof(trailer), f) != sizeof(trailer) ||
+        fflush(f) != 0)
+        ret = errno ? errno : EIO;
+
+cleanup:
+    if (map != MAP_FAILED)
+        munmap(map, maplen);
+    k5_buf_free(&buf);
+    return ret;
+}
+
 static krb5_error_code
 dump_iterator(void *ptr, krb5_db_entry *entry)
 {
@@ -638,6 +918,138 @@ process_tl_data(const char *fname, FILE *filep, int lineno,
     return 0;
 }
 
+/* Sort batch entries by name, preserving dump order for duplicates so that
+ * the last record for a principal still wins. */
+static int
+compare_batch_entries(const void *a, const void *b)
+{
+    const struct load_batch_entry *ea = a, *eb = b;
+    int cmp;
+
+    cmp = strcmp(ea->name, eb->name);
+    if (cmp != 0)
+        return cmp;
+    return (ea->seq < eb->seq) ? -1 : (ea->seq > eb->seq);
+}
+
+static void
+discard_load_batch(krb5_context context)
+{
+    size_t i;
+
+    for (i = 0; i < load_batch.count; i++) {
+        free(load_batch.ents[i].name);
+        krb5_db_free_principal(context, load_batch.ents[i].entry);
+    }
+    load_batch.count = 0;
+}
+
+/* Store the pending batch of principal entries in sorted order.  Return 0 on
+ * success and 1 on failure. */
+static int
+flush_load_batch(krb5_context context)
+{
+    krb5_error_code ret;
+    krb5_boolean locked = FALSE;
+    struct load_batch_entry *ent;
+    size_t i;
+    int retval = 1;
+
+    if (load_batch.count == 0)
+        return 0;
+
+    qsort(load_batch.ents, load_batch.count, sizeof(*load_batch.ents),
+          compare_batch_entries);
+
+    ret = krb5_db_lock(context, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (ret == 0) {
+        locked = TRUE;
+    } else if (ret != KRB5_PLUGIN_OP_NOTSUPP) {
+        com_err(progname, ret, _("while locking database"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < load_batch.count; i++) {
+        ent = &load_batch.ents[i];
+        ret = krb5_db_put_principal(context, ent->entry);
+        if (ret) {
+            com_err(progname, ret, _("while storing %s"), ent->name);
+            goto cleanup;
+        }
+        if (load_batch.verbose)
+            fprintf(stderr, "%s\n", ent->name);
+    }
+    retval = 0;
+
+cleanup:
+    if (locked)
+        (void)krb5_db_unlock(context);
+    discard_load_batch(context);
+    return retval;
+}
+
+/* Store a principal entry parsed from a dump, or queue it for a batched store
+ * if a bulk load is active.  Take ownership of *name and *entry in the latter
+ * case.  Return 0 on success and 1 on failure. */
+static int
+store_loaded_princ(krb5_context context, char **name, krb5_db_entry **entry,
+                   krb5_boolean verbose)
+{
+    krb5_error_code ret;
+    struct load_batch_entry *ent;
+
+    if (load_batch.active) {
+        ent = &load_batch.ents[load_batch.count];
+        ent->name = *name;
+        ent->seq = load_batch.count;
+        ent->entry = *entry;
+        *name = NULL;
+        *entry = NULL;
+        if (++load_batch.count == LOAD_BATCH_SIZE)
+            return flush_load_batch(context);
+        return 0;
+    }
+
+    ret = krb5_db_put_principal(context, *entry);
+    if (ret) {
+        com_err(progname, ret, _("while storing %s"), *name);
+        return 1;
+    }
+    if (verbose)
+        fprintf(stderr, "%s\n", *name);
+    return 0;
+}
+
+/* Set the mask bits of a loaded principal entry implied by its tl-data. */
+static void
+set_tl_data_mask(krb5_db_entry *dbentry)
+{
+    krb5_tl_data *tl;
+    XDR xdrs;
+    osa_princ_ent_rec osa_princ_ent;
+
+    for (tl = dbentry->tl_data; tl; tl = tl->tl_data_next) {
+        /* test to set mask fields */
+        if (tl->tl_data_type == KRB5_TL_KADM_DATA) {
+            /* Assuming aux_attributes will always be there */
+            dbentry->mask |= KADM5_AUX_ATTRIBUTES;
+
+            /* test for an actual policy reference */
+            memset(&osa_princ_ent, 0, sizeof(osa_princ_ent));
+            xdrmem_create(&xdrs, (char *)tl->tl_data_contents,
+                          tl->tl_data_length, XDR_DECODE);
+            if (xdr_osa_princ_ent_rec(&xdrs, &osa_princ_ent)) {
+                if ((osa_princ_ent.aux_attributes & KADM5_POLICY) &&
+                    osa_princ_ent.policy != NULL)
+                    dbentry->mask |= KADM5_POLICY;
+                kdb_free_entry(NULL, NULL, &osa_princ_ent);
+            }
+            xdr_destroy(&xdrs);
+        }
+    }
+    dbentry->mask |= KADM5_TL_DATA;
+}
+
 /* Read a beta 7 entry and add it to the database.  Return -1 for end of file,
  * 0 for success and 1 for failure. */
 static int
@@ -650,7 +1062,6 @@ process_k5beta7_princ(krb5_context context, const char *fname, FILE *filep,
     unsigned int u1, u2, u3, u4, u5;
     char *name = NULL;
     krb5_key_data *kp = NULL, *kd;
-    krb5_tl_data *tl;
     krb5_error_code ret;
 
     dbentry = calloc(1, sizeof(*dbentry));
@@ -737,32 +1148,7 @@ process_k5beta7_princ(krb5_context context, const char *fname, FILE *filep,
     if (dbentry->n_tl_data) {
         if (process_tl_data(fname, filep, *linenop, dbentry->tl_data))
             goto fail;
-        for (tl = dbentry->tl_data; tl; tl = tl->tl_data_next) {
-            /* test to set mask fields */
-            if (tl->tl_data_type == KRB5_TL_KADM_DATA) {
-                XDR xdrs;
-                osa_princ_ent_rec osa_princ_ent;
-
-                /*
-                 * Assuming aux_attributes will always be
-                 * there
-                 */
-                dbentry->mask |= KADM5_AUX_ATTRIBUTES;
-
-                /* test for an actual policy reference */
-                memset(&osa_princ_ent, 0, sizeof(osa_princ_ent));
-                xdrmem_create(&xdrs, (char *)tl->tl_data_contents,
-                              tl->tl_data_length, XDR_DECODE);
-                if (xdr_osa_princ_ent_rec(&xdrs, &osa_princ_ent)) {
-                    if ((osa_princ_ent.aux_attributes & KADM5_POLICY) &&
-                        osa_princ_ent.policy != NULL)
-                        dbentry->mask |= KADM5_POLICY;
-                    kdb_free_entry(NULL, NULL, &osa_princ_ent);
-                }
-                xdr_destroy(&xdrs);
-            }
-        }
-        dbentry->mask |= KADM5_TL_DATA;
+        set_tl_data_mask(dbentry);
     }
 
     /* Get the key data. */
@@ -812,14 +1198,8 @@ process_k5beta7_princ(krb5_context context, const char *fname, FILE *filep,
     /* Finally, find the end of the record. */
     read_record_end(filep, fname, *linenop);
 
-    ret = krb5_db_put_principal(context, dbentry);
-    if (ret) {
-        com_err(progname, ret, _("while storing %s"), name);
+    if (store_loaded_princ(context, &name, &dbentry, verbose))
         goto fail;
-    }
-
-    if (verbose)
-        fprintf(stderr, "%s\n", name);
     retval = 0;
 
 cleanup:
@@ -1043,6 +1423,463 @@ process_r1_11_record(krb5_context context, const char *fname, FILE *filep,
                           process_k5beta7_princ, process_r1_11_policy);
 }
 
+/* Return a copy of len bytes from in, or NULL on failure.  If nul is true,
+ * terminate the copy, and allocate a byte even if len is zero. */
+static void *
+get_binary_bytes(struct k5input *in, size_t len, krb5_boolean nul)
+{
+    const unsigned char *ptr;
+    char *copy;
+
+    ptr = k5_input_get_bytes(in, len);
+    if (ptr == NULL || (len == 0 && !nul))
+        return NULL;
+    copy = malloc(len + (nul ? 1 : 0));
+    if (copy == NULL) {
+        k5_input_set_status(in, ENOMEM);
+        return NULL;
+    }
+    memcpy(copy, ptr, len);
+    if (nul)
+        copy[len] = '\0';
+    return copy;
+}
+
+/* Decode a tl-data list from in into *tl_out and *count_out. */
+static void
+get_binary_tl_data(struct k5input *in, krb5_tl_data **tl_out,
+                   krb5_int16 *count_out)
+{
+    krb5_tl_data **tlp = tl_out;
+    uint16_t count, i;
+
+    count = k5_input_get_uint16_be(in);
+    if (count > INT16_MAX) {
+        k5_input_set_status(in, EINVAL);
+        return;
+    }
+    if (alloc_tl_data(count, tl_out)) {
+        k5_input_set_status(in, ENOMEM);
+        return;
+    }
+    *count_out = count;
+    for (i = 0; i < count && !in->status; i++) {
+        (*tlp)->tl_data_type = k5_input_get_uint16_be(in);
+        (*tlp)->tl_data_length = k5_input_get_uint16_be(in);
+        (*tlp)->tl_data_contents = get_binary_bytes(in,
+                                                    (*tlp)->tl_data_length,
+                                                    FALSE);
+        tlp = &(*tlp)->tl_data_next;
+    }
+}
+
+/* Decode a binary principal record and store it in the database.  Return 0
+ * on success and 1 on failure. */
+static int
+load_binary_princ(krb5_context context, const unsigned char *data, size_t len,
+                  krb5_boolean verbose)
+{
+    krb5_error_code ret;
+    struct k5input in;
+    krb5_db_entry *dbentry;
+    krb5_key_data *kd;
+    char *name = NULL;
+    uint16_t nkeys;
+    int i, j, retval = 1;
+
+    dbentry = calloc(1, sizeof(*dbentry));
+    if (dbentry == NULL)
+        return 1;
+
+    k5_input_init(&in, data, len);
+    name = get_binary_bytes(&in, k5_input_get_uint32_be(&in), TRUE);
+    dbentry->len = k5_input_get_uint16_be(&in);
+    dbentry->attributes = k5_input_get_uint32_be(&in);
+    dbentry->max_life = k5_input_get_uint32_be(&in);
+    dbentry->max_renewable_life = k5_input_get_uint32_be(&in);
+    dbentry->expiration = k5_input_get_uint32_be(&in);
+    dbentry->pw_expiration = k5_input_get_uint32_be(&in);
+    dbentry->last_success = k5_input_get_uint32_be(&in);
+    dbentry->last_failed = k5_input_get_uint32_be(&in);
+    dbentry->fail_auth_count = k5_input_get_uint32_be(&in);
+    dbentry->mask = KADM5_LOAD | KADM5_PRINCIPAL | KADM5_ATTRIBUTES |
+        KADM5_MAX_LIFE | KADM5_MAX_RLIFE |
+        KADM5_PRINC_EXPIRE_TIME | KADM5_PW_EXPIRATION | KADM5_LAST_SUCCESS |
+        KADM5_LAST_FAILED | KADM5_FAIL_AUTH_COUNT;
+
+    get_binary_tl_data(&in, &dbentry->tl_data, &dbentry->n_tl_data);
+    if (!in.status && dbentry->n_tl_data)
+        set_tl_data_mask(dbentry);
+
+    nkeys = k5_input_get_uint16_be(&in);
+    if (!in.status && nkeys > 0) {
+        if (nkeys > INT16_MAX) {
+            k5_input_set_status(&in, EINVAL);
+        } else {
+            dbentry->key_data = calloc(nkeys, sizeof(*dbentry->key_data));
+            if (dbentry->key_data == NULL)
+                k5_input_set_status(&in, ENOMEM);
+            else
+                dbentry->n_key_data = nkeys;
+        }
+    }
+    for (i = 0; i < dbentry->n_key_data && !in.status; i++) {
+        kd = &dbentry->key_data[i];
+        kd->key_data_ver = k5_input_get_uint16_be(&in);
+        kd->key_data_kvno = k5_input_get_uint16_be(&in);
+        if (kd->key_data_ver > KRB5_KDB_V1_KEY_DATA_ARRAY) {
+            k5_input_set_status(&in, EINVAL);
+            break;
+        }
+        for (j = 0; j < kd->key_data_ver; j++) {
+            kd->key_data_type[j] = k5_input_get_uint16_be(&in);
+            kd->key_data_length[j] = k5_input_get_uint16_be(&in);
+            kd->key_data_contents[j] =
+                get_binary_bytes(&in, kd->key_data_length[j], FALSE);
+        }
+    }
+    if (dbentry->n_key_data)
+        dbentry->mask |= KADM5_KEY_DATA;
+
+    dbentry->e_length = k5_input_get_uint16_be(&in);
+    dbentry->e_data = get_binary_bytes(&in, dbentry->e_length, FALSE);
+
+    if (!in.status && in.len != 0)
+        k5_input_set_status(&in, EINVAL);
+    if (in.status) {
+        com_err(progname, in.status, _("while decoding binary record for %s"),
+                (name != NULL) ? name : "?");
+        goto cleanup;
+    }
+
+    ret = krb5_parse_name(context, name, &dbentry->princ);
+    if (ret) {
+        com_err(progname, ret, _("while parsing name %s"), name);
+        goto cleanup;
+    }
+
+    retval = store_loaded_princ(context, &name, &dbentry, verbose);
+
+cleanup:
+    free(name);
+    krb5_db_free_principal(context, dbentry);
+    return retval;
+}
+
+/* Decode a binary policy record and store it in the database.  Return 0 on
+ * success and 1 on failure. */
+static int
+load_binary_policy(krb5_context context, const unsigned char *data,
+                   size_t len, krb5_boolean verbose)
+{
+    krb5_error_code ret;
+    struct k5input in;
+    osa_policy_ent_rec rec;
+    krb5_tl_data *tl, *tl_next;
+    size_t kslen;
+    int retval = 1;
+
+    memset(&rec, 0, sizeof(rec));
+    k5_input_init(&in, data, len);
+    rec.name = get_binary_bytes(&in, k5_input_get_uint32_be(&in), TRUE);
+    rec.pw_min_life = k5_input_get_uint32_be(&in);
+    rec.pw_max_life = k5_input_get_uint32_be(&in);
+    rec.pw_min_length = k5_input_get_uint32_be(&in);
+    rec.pw_min_classes = k5_input_get_uint32_be(&in);
+    rec.pw_history_num = k5_input_get_uint32_be(&in);
+    rec.pw_max_fail = k5_input_get_uint32_be(&in);
+    rec.pw_failcnt_interval = k5_input_get_uint32_be(&in);
+    rec.pw_lockout_duration = k5_input_get_uint32_be(&in);
+    rec.attributes = k5_input_get_uint32_be(&in);
+    rec.max_life = k5_input_get_uint32_be(&in);
+    rec.max_renewable_life = k5_input_get_uint32_be(&in);
+    kslen = k5_input_get_uint32_be(&in);
+    if (kslen > 0)
+        rec.allowed_keysalts = get_binary_bytes(&in, kslen, TRUE);
+    get_binary_tl_data(&in, &rec.tl_data, &rec.n_tl_data);
+
+    if (!in.status && in.len != 0)
+        k5_input_set_status(&in, EINVAL);
+    if (in.status) {
+        com_err(progname, in.status, _("while decoding binary policy record"));
+        goto cleanup;
+    }
+
+    ret = krb5_db_create_policy(context, &rec);
+    if (ret)
+        ret = krb5_db_put_policy(context, &rec);
+    if (ret) {
+        com_err(progname, ret, _("while creating policy"));
+        goto cleanup;
+    }
+    if (verbose)
+        fprintf(stderr, _("created policy %s\n"), rec.name);
+    retval = 0;
+
+cleanup:
+    free(rec.name);
+    free(rec.allowed_keysalts);
+    for (tl = rec.tl_data; tl; tl = tl_next) {
+        tl_next = tl->tl_data_next;
+        free(tl->tl_data_contents);
+        free(tl);
+    }
+    return retval;
+}
+
+/* Walk the records of one binary dump section, storing each one.  Return 0 on
+ * success and 1 on failure. */
+static int
+load_binary_section(krb5_context context, const char *fname,
+                    const unsigned char *data, size_t len, uint32_t type,
+                    uint32_t count, krb5_boolean verbose)
+{
+    struct k5input in;
+    const unsigned char *rec;
+    uint32_t i, reclen;
+    int ret;
+
+    k5_input_init(&in, data, len);
+    for (i = 0; i < count; i++) {
+        reclen = k5_input_get_uint32_be(&in);
+        rec = k5_input_get_bytes(&in, reclen);
+        if (rec == NULL) {
+            fprintf(stderr, _("%s: truncated record in %s\n"), progname,
+                    fname);
+            return 1;
+        }
+        if (type == BINARY_SECTION_PRINC)
+            ret = load_binary_princ(context, rec, reclen, verbose);
+        else
+            ret = load_binary_policy(context, rec, reclen, verbose);
+        if (ret)
+            return ret;
+    }
+    if (in.len != 0) {
+        fprintf(stderr, _("%s: extra data in section of %s\n"), progname,
+                fname);
+        return 1;
+    }
+    return 0;
+}
+
+/* Read len bytes from f into buf.  Return 0 on success and 1 on failure. */
+static int
+read_dump_bytes(FILE *f, const char *fname, void *buf, size_t len)
+{
+    if (len == 0 || fread(buf, 1, len, f) == len)
+        return 0;
+    if (ferror(f))
+        com_err(progname, errno, _("while reading %s"), fname);
+    else
+        fprintf(stderr, _("%s: truncated record in %s\n"), progname, fname);
+    return 1;
+}
+
+/*
+ * Load the records of a binary dump from the stream f as they arrive, for a
+ * dump which cannot be mapped (for instance, one which kpropd is piping to us
+ * while it is received).  hdrlen is the length of the header line already
+ * read from f.  Each section ends with a zero length, so the records can be
+ * loaded without first reading the index; the index and trailer are checked
+ * against what was loaded afterwards.  Section checksums cannot be verified
+ * without holding the whole dump, so they are ignored.  Return 0 on success
+ * and 1 on failure.
+ */
+static int
+stream_binary_dump(krb5_context context, const char *fname, FILE *f,
+                   size_t hdrlen, krb5_boolean verbose)
+{
+    static const uint32_t types[2] = {
+        BINARY_SECTION_PRINC, BINARY_SECTION_POLICY
+    };
+    struct k5input in;
+    struct k5buf rest;
+    unsigned char *rec = NULL, *newrec, lenbytes[4], chunk[BUFSIZ];
+    const unsigned char *trailer;
+    uint64_t offset, counts[2], lengths[2], index_offset;
+    uint32_t reclen, recsize = 0, i, cksum_len;
+    size_t n;
+    int ret, err = 1;
+
+    k5_buf_init_dynamic(&rest);
+    offset = hdrlen;
+    for (i = 0; i < 2; i++) {
+        counts[i] = lengths[i] = 0;
+        for (;;) {
+            if (read_dump_bytes(f, fname, lenbytes, 4))
+                goto cleanup;
+            reclen = load_32_be(lenbytes);
+            if (reclen == 0)
+                break;
+            if (reclen > recsize) {
+                newrec = realloc(rec, reclen);
+                if (newrec == NULL) {
+                    com_err(progname, ENOMEM, _("while reading %s"), fname);
+                    goto cleanup;
+                }
+                rec = newrec;
+                recsize = reclen;
+            }
+            if (read_dump_bytes(f, fname, rec, reclen))
+                goto cleanup;
+            if (types[i] == BINARY_SECTION_PRINC)
+                ret = load_binary_princ(context, rec, reclen, verbose);
+            else
+                ret = load_binary_policy(context, rec, reclen, verbose);
+            if (ret)
+                goto cleanup;
+            counts[i]++;
+            lengths[i] += 4 + (uint64_t)reclen;
+        }
+        offset += lengths[i] + 4;
+    }
+
+    /* Read the index and trailer, which are small. */
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        k5_buf_add_len(&rest, chunk, n);
+    if (ferror(f)) {
+        com_err(progname, errno, _("while reading %s"), fname);
+        goto cleanup;
+    }
+    if (k5_buf_status(&rest) != 0) {
+        com_err(progname, ENOMEM, _("while reading %s"), fname);
+        goto cleanup;
+    }
+
+    /* The index must describe exactly the sections we loaded. */
+    if (rest.len < BINARY_TRAILER_LEN)
+        goto bad_format;
+    trailer = (unsigned char *)rest.data + rest.len - BINARY_TRAILER_LEN;
+    index_offset = load_64_be(trailer);
+    if (memcmp(trailer + 12, BINARY_TRAILER_MAGIC, 4) != 0 ||
+        index_offset != offset ||
+        load_32_be(trailer + 8) != rest.len - BINARY_TRAILER_LEN)
+        goto bad_format;
+    k5_input_init(&in, rest.data, rest.len - BINARY_TRAILER_LEN);
+    if (k5_input_get_bytes(&in, 4) == NULL ||
+        memcmp(rest.data, BINARY_INDEX_MAGIC, 4) != 0 ||
+        k5_input_get_uint32_be(&in) != 2)
+        goto bad_format;
+    offset = hdrlen;
+    for (i = 0; i < 2 && !in.status; i++) {
+        if (k5_input_get_uint32_be(&in) != types[i] ||
+            k5_input_get_uint32_be(&in) != counts[i] ||
+            k5_input_get_uint64_be(&in) != offset ||
+            k5_input_get_uint64_be(&in) != lengths[i])
+            goto bad_format;
+        cksum_len = k5_input_get_uint32_be(&in);
+        (void)k5_input_get_bytes(&in, cksum_len);
+        offset += lengths[i] + 4;
+    }
+    if (in.status || in.len != 0)
+        goto bad_format;
+
+    err = 0;
+    goto cleanup;
+
+bad_format:
+    fprintf(stderr, _("%s: invalid binary dump structure in %s\n"), progname,
+            fname);
+cleanup:
+    free(rec);
+    k5_buf_free(&rest);
+    return err;
+}
+
+/* Restore the database from a binary dump.  If bulk is true, store principal
+ * entries in sorted batches. */
+static int
+restore_binary_dump(krb5_context context, char *dumpfile, FILE *f,
+                    size_t hdrlen, krb5_boolean verbose, krb5_boolean bulk)
+{
+    struct k5input in;
+    struct stat st;
+    const unsigned char *trailer, *cksum;
+    unsigned char *data = MAP_FAILED;
+    uint8_t hash[K5_SHA256_HASHLEN];
+    uint64_t index_offset, offset, length;
+    uint32_t index_len, nsections, type, count, cksum_len, i;
+    size_t len = 0;
+    krb5_data d;
+    int err = 1;
+
+    load_batch.active = bulk;
+    load_batch.verbose = verbose;
+    load_batch.count = 0;
+
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        len = st.st_size;
+        data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    }
+    if (data == MAP_FAILED) {
+        if (stream_binary_dump(context, dumpfile, f, hdrlen, verbose) == 0)
+            err = flush_load_batch(context);
+        goto cleanup;
+    }
+
+    /* Locate the section index using the trailer. */
+    if (len < BINARY_TRAILER_LEN)
+        goto bad_format;
+    trailer = data + len - BINARY_TRAILER_LEN;
+    index_offset = load_64_be(trailer);
+    index_len = load_32_be(trailer + 8);
+    if (memcmp(trailer + 12, BINARY_TRAILER_MAGIC, 4) != 0 ||
+        index_offset > len - BINARY_TRAILER_LEN ||
+        index_len != len - BINARY_TRAILER_LEN - index_offset)
+        goto bad_format;
+
+    k5_input_init(&in, data + index_offset, index_len);
+    if (k5_input_get_bytes(&in, 4) == NULL ||
+        memcmp(data + index_offset, BINARY_INDEX_MAGIC, 4) != 0)
+        goto bad_format;
+    nsections = k5_input_get_uint32_be(&in);
+    for (i = 0; i < nsections && !in.status; i++) {
+        type = k5_input_get_uint32_be(&in);
+        count = k5_input_get_uint32_be(&in);
+        offset = k5_input_get_uint64_be(&in);
+        length = k5_input_get_uint64_be(&in);
+        cksum_len = k5_input_get_uint32_be(&in);
+        cksum = k5_input_get_bytes(&in, cksum_len);
+        if (in.status || offset > index_offset ||
+            length > index_offset - offset)
+            goto bad_format;
+
+        /* A section may omit its checksum; verify it if present. */
+        if (cksum_len != 0) {
+            d = make_data(data + offset, length);
+            if (cksum_len != sizeof(hash) || k5_sha256(&d, 1, hash) != 0 ||
+                memcmp(hash, cksum, sizeof(hash)) != 0) {
+                fprintf(stderr, _("%s: checksum mismatch in %s\n"), progname,
+                        dumpfile);
+                goto cleanup;
+            }
+        }
+
+        /* Skip section types we don't know about. */
+        if (type != BINARY_SECTION_PRINC && type != BINARY_SECTION_POLICY)
+            continue;
+        if (load_binary_section(context, dumpfile, data + offset, length,
+                                type, count, verbose))
+            goto cleanup;
+    }
+    if (in.status || in.len != 0)
+        goto bad_format;
+
+    err = flush_load_batch(context);
+    goto cleanup;
+
+bad_format:
+    fprintf(stderr, _("%s: invalid binary dump structure in %s\n"), progname,
+            dumpfile);
+cleanup:
+    discard_load_batch(context);
+    load_batch.active = FALSE;
+    if (data != MAP_FAILED)
+        munmap(data, len);
+    return err;
+}
+
 dump_version beta7_version = {
     "Kerberos version 5",
     "kdb5_util load_dump version 4\n",
@@ -1104,6 +1941,27 @@ dump_version ipropx_1_version = {
     process_r1_11_record,
 };
 
+dump_version binary_version = {
+    "Kerberos binary dump version 1",
+    "kdb5_util binary_dump version 1",
+    0,
+    0,
+    0,
+    dump_binary_princ,
+    dump_binary_policy,
+    NULL,
+};
+
+/* Return true if the header line in buf identifies a binary dump. */
+static krb5_boolean
+is_binary_header(const char *buf)
+{
+    size_t len = strlen(binary_version.header);
+
+    return strncmp(buf, binary_version.header, len) == 0 &&
+        (buf[len] == '\n' || buf[len] == ' ');
+}
+
 /* Read the dump header.  Return 1 on success, 0 if the file is not a
  * recognized iprop dump format. */
 static int
@@ -1114,6 +1972,18 @@ parse_iprop_header(char *buf, dump_version **dv, kdb_last_t *last)
     uint32_t u[4];
     uint32_t *up = &u[0];
 
+    if (is_binary_header(buf)) {
+        nread = sscanf(buf + strlen(binary_version.header), " iprop %u %u %u",
+                       &u[0], &u[1], &u[2]);
+        if (nread != 3)
+            return 0;
+        *dv = &binary_version;
+        last->last_sno = u[0];
+        last->last_time.seconds = u[1];
+        last->last_time.useconds = u[2];
+        return 1;
+    }
+
     nread = sscanf(buf, "%127s %u %u %u %u", head, &u[0], &u[1], &u[2], &u[3]);
     if (nread < 1)
         return 0;
@@ -1147,12 +2017,13 @@ parse_iprop_header(char *buf, dump_version **dv, kdb_last_t *last)
 }
 
 /* Return true if the serial number and timestamp in an existing dump file is
- * in the ulog. */
+ * in the ulog, and the dump has the same binary or text format as dump. */
 static krb5_boolean
-current_dump_sno_in_ulog(krb5_context context, const char *ifile)
+current_dump_sno_in_ulog(krb5_context context, const char *ifile,
+                         dump_version *dump)
 {
     update_status_t status;
-    dump_version *junk;
+    dump_version *dv;
     kdb_last_t last;
     char buf[BUFSIZ], *r;
     FILE *f;
@@ -1166,7 +2037,9 @@ current_dump_sno_in_ulog(krb5_context context, const char *ifile)
     if (r == NULL)
         return errno ? -1 : 0;
 
-    if (!parse_iprop_header(buf, &junk, &last))
+    if (!parse_iprop_header(buf, &dv, &last))
+        return 0;
+    if ((dv == &binary_version) != (dump == &binary_version))
         return 0;
 
     status = ulog_get_sno_status(context, &last);
@@ -1189,6 +2062,7 @@ dump_db(int argc, char **argv)
     krb5_boolean conditional = FALSE;
     kdb_last_t last;
     krb5_flags iterflags = 0;
+    struct binary_section sections[2];
 
     /* Parse the arguments. */
     dump = &r1_11_version;
@@ -1210,12 +2084,19 @@ dump_db(int argc, char **argv)
             dump = &r1_3_version;
         } else if (!strcmp(argv[aindex], "-r18")) {
             dump = &r1_8_version;
+        } else if (!strcmp(argv[aindex], "-binary")) {
+            dump = &binary_version;
         } else if (!strncmp(argv[aindex], "-i", 2)) {
             /* Intentionally undocumented - only used by kadmin. */
             if (log_ctx && log_ctx->iproprole) {
                 /* ipropx_version is the maximum version acceptable. */
                 ipropx_version = atoi(argv[aindex] + 2);
-                dump = ipropx_version ? &ipropx_1_version : &iprop_version;
+                if (ipropx_version >= IPROPX_VERSION_2)
+                    dump = &binary_version;
+                else if (ipropx_version)
+                    dump = &ipropx_1_version;
+                else
+                    dump = &iprop_version;
                 /*
                  * dump_sno is used to indicate if the serial number should be
                  * populated in the output file to be used later by iprop for
@@ -1261,13 +2142,13 @@ dump_db(int argc, char **argv)
     /* If a conditional ipropx dump we check if the existing dump is
      * good enough. */
     if (ofile != NULL && conditional) {
-        if (!dump->iprop) {
+        if (!dump_sno) {
             com_err(progname, 0,
                     _("Conditional dump is an undocumented option for "
                       "use only for iprop dumps"));
             goto error;
         }
-        if (current_dump_sno_in_ulog(util_context, ofile))
+        if (current_dump_sno_in_ulog(util_context, ofile, dump))
             return;
     }
 
@@ -1346,6 +2227,10 @@ dump_db(int argc, char **argv)
             com_err(progname, errno, _("while opening %s for writing"), ofile);
             goto error;
         }
+    } else if (dump == &binary_version) {
+        com_err(progname, 0, _("Binary dumps cannot be written to standard "
+                               "output"));
+        goto error;
     } else {
         f = stdout;
     }
@@ -1361,7 +2246,9 @@ dump_db(int argc, char **argv)
             com_err(progname, ret, _("while reading update log header"));
             goto error;
         }
-        if (ipropx_version)
+        if (dump == &binary_version)
+            fprintf(f, " iprop");
+        else if (ipropx_version)
             fprintf(f, " %u", IPROPX_VERSION);
         fprintf(f, " %u", last.last_sno);
         fprintf(f, " %u", last.last_time.seconds);
@@ -1371,15 +2258,46 @@ dump_db(int argc, char **argv)
     if (dump->header[strlen(dump->header)-1] != '\n')
         fputc('\n', args.ofile);
 
+    memset(&binary_dump_state, 0, sizeof(binary_dump_state));
+    sections[0].type = BINARY_SECTION_PRINC;
+    sections[0].offset = ftello(f);
+
     ret = krb5_db_iterate(util_context, NULL, dump_iterator, &args, iterflags);
     if (ret) {
         com_err(progname, ret, _("performing %s dump"), dump->name);
         goto error;
     }
 
+    if (dump == &binary_version) {
+        sections[0].count = binary_dump_state.princ_count;
+        sections[0].length = ftello(f) - sections[0].offset;
+        ret = end_binary_section(f);
+        if (ret) {
+            com_err(progname, ret, _("performing %s dump"), dump->name);
+            goto error;
+        }
+    }
+
+    sections[1].type = BINARY_SECTION_POLICY;
+    sections[1].offset = ftello(f);
+
     /* Don't dump policies if specific principal entries were requested. */
     if (dump->dump_policy != NULL && args.nnames == 0) {
         ret = krb5_db_iter_policy(util_context, "*", dump->dump_policy, &args);
+        if (!ret)
+            ret = binary_dump_state.error;
+        if (ret) {
+            com_err(progname, ret, _("performing %s dump"), dump->name);
+            goto error;
+        }
+    }
+
+    if (dump == &binary_version) {
+        sections[1].count = binary_dump_state.policy_count;
+        sections[1].length = ftello(f) - sections[1].offset;
+        ret = end_binary_section(f);
+        if (!ret)
+            ret = finish_binary_dump(f, sections, 2);
         if (ret) {
             com_err(progname, ret, _("performing %s dump"), dump->name);
             goto error;
@@ -1400,22 +2318,45 @@ error:
     exit_status++;
 }
 
-/* Restore the database from any version dump file. */
+/* Restore the database from any version dump file.  If bulk is true, store
+ * principal entries in sorted batches. */
 static int
 restore_dump(krb5_context context, char *dumpfile, FILE *f,
-             krb5_boolean verbose, dump_version *dump)
+             krb5_boolean verbose, dump_version *dump, krb5_boolean bulk)
 {
     int err = 0;
     int lineno = 1;
 
+    load_batch.active = bulk;
+    load_batch.verbose = verbose;
+    load_batch.count = 0;
+
     /* Process the records. */
     while (!(err = dump->load_record(context, dumpfile, f, verbose, &lineno)));
-    if (err != -1) {
+    if (err == -1) {
+        err = flush_load_batch(context);
+    } else {
         fprintf(stderr, _("%s: error processing line %d of %s\n"), progname,
                 lineno, dumpfile);
-        return err;
     }
-    return 0;
+
+    discard_load_batch(context);
+    load_batch.active = FALSE;
+    return err;
+}
+
+/* Return true if a confirmation byte can be read from fd. */
+static krb5_boolean
+read_confirmation(int fd)
+{
+    ssize_t n;
+    char c;
+
+    do {
+        n = read(fd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+    close(fd);
+    return n == 1;
 }
 
 void
@@ -1425,7 +2366,7 @@ load_db(int argc, char **argv)
     FILE *f = NULL;
     char *dumpfile = NULL, *dbname, buf[BUFSIZ];
     dump_version *load = NULL;
-    int aindex;
+    int aindex, confirm_fd = -1;
     kdb_log_context *log_ctx;
     kdb_last_t last;
     krb5_boolean db_locked = FALSE, temp_db_created = FALSE;
@@ -1455,6 +2396,9 @@ load_db(int argc, char **argv)
                 fprintf(stderr, _("Iprop not enabled\n"));
                 goto error;
             }
+        } else if (!strcmp(argv[aindex], "-confirm") && aindex + 1 < argc) {
+            /* Intentionally undocumented - only used by kpropd. */
+            confirm_fd = atoi(argv[++aindex]);
         } else if (!strcmp(argv[aindex], "-verbose")) {
             verbose = TRUE;
         } else if (!strcmp(argv[aindex], "-update")){
@@ -1470,7 +2414,8 @@ load_db(int argc, char **argv)
     }
     if (argc - aindex != 1)
         usage();
-    dumpfile = argv[aindex];
+    if (strcmp(argv[aindex], "-") != 0)
+        dumpfile = argv[aindex];
 
     /* Open the dumpfile. */
     if (dumpfile != NULL) {
@@ -1492,8 +2437,11 @@ load_db(int argc, char **argv)
     }
     if (load) {
         /* Only check what we know; some headers only contain a prefix.
-         * NB: this should work for ipropx even though load is iprop */
-        if (strncmp(buf, load->header, strlen(load->header)) != 0) {
+         * NB: this should work for ipropx even though load is iprop, and for
+         * binary iprop dumps, for which parse_iprop_header() sets load. */
+        if (iprop_load && is_binary_header(buf)) {
+            load = &binary_version;
+        } else if (strncmp(buf, load->header, strlen(load->header)) != 0) {
             fprintf(stderr, _("%s: dump header bad in %s\n"), progname,
                     dumpfile);
             goto error;
@@ -1507,6 +2455,8 @@ load_db(int argc, char **argv)
             load = &r1_8_version;
         } else if (strcmp(buf, r1_11_version.header) == 0) {
             load = &r1_11_version;
+        } else if (is_binary_header(buf)) {
+            load = &binary_version;
         } else {
             fprintf(stderr, _("%s: dump header bad in %s\n"), progname,
                     dumpfile);
@@ -1577,12 +2527,32 @@ load_db(int argc, char **argv)
         }
     }
 
-    if (restore_dump(util_context, dumpfile ? dumpfile : _("standard input"),
-                     f, verbose, load)) {
+    /* Batch principal stores unless we are updating a live database, where
+     * each store must be individually logged and visible.  In that case, the
+     * update log can still be flushed once for the whole load. */
+    if (update)
+        (void)ulog_begin_batch(util_context);
+    if (load == &binary_version) {
+        ret = restore_binary_dump(util_context, dumpfile, f, strlen(buf),
+                                  verbose, !update);
+    } else {
+        ret = restore_dump(util_context, dumpfile, f, verbose, load, !update);
+    }
+    if (update)
+        (void)ulog_end_batch(util_context);
+    if (ret) {
         fprintf(stderr, _("%s: %s restore failed\n"), progname, load->name);
         goto error;
     }
 
+    /* kpropd streams the dump to us as it arrives; only make the result live
+     * once it confirms that the whole dump was received. */
+    if (confirm_fd != -1 && !read_confirmation(confirm_fd)) {
+        fprintf(stderr, _("%s: load of %s was not confirmed\n"), progname,
+                dumpfile);
+        goto error;
+    }
+
     if (db_locked && (ret = krb5_db_unlock(util_context))) {
         com_err(progname, ret, _("while unlocking database"));
         goto error;
@@ -9,6 +9,7 @@
 #include <kadm5/server_internal.h>
 #include <kadm5/admin.h>
 #include <adm_proto.h>
+#include <kdb_log.h>
 #include "kdb5_util.h"
 #include <time.h>
 
@@ -739,13 +740,30 @@ static int glob_to_regexp(char *glob, char *realm, char **regexp)
     return 0;
 }
 
+/* Return true if pname matches the principal pattern in p. */
+static krb5_boolean
+pattern_matches(struct update_enc_mkvno *p, const char *pname)
+{
+    int match;
+
+#ifdef SOLARIS_REGEXPS
+    match = (step(pname, p->expbuf) != 0);
+#endif
+#ifdef POSIX_REGEXPS
+    match = (regexec(&p->preg, pname, 0, NULL, 0) == 0);
+#endif
+#ifdef BSD_REGEXPS
+    match = (re_exec(pname) != 0);
+#endif
+    return match;
+}
+
 static int
 update_princ_encryption_1(void *cb, krb5_db_entry *ent)
 {
     struct update_enc_mkvno *p = cb;
     char *pname = 0;
     krb5_error_code retval;
-    int match;
     krb5_timestamp now;
     int result;
     krb5_kvno old_mkvno;
@@ -761,16 +779,7 @@ update_princ_encryption_1(void *cb, krb5_db_entry *ent)
         goto skip;
     }
 
-#ifdef SOLARIS_REGEXPS
-    match = (step(pname, p->expbuf) != 0);
-#endif
-#ifdef POSIX_REGEXPS
-    match = (regexec(&p->preg, pname, 0, NULL, 0) == 0);
-#endif
-#ifdef BSD_REGEXPS
-    match = (re_exec(pname) != 0);
-#endif
-    if (!match) {
+    if (!pattern_matches(p, pname)) {
         goto skip;
     }
     p->re_match_count++;
@@ -834,6 +843,633 @@ egress:
     return result;
 }
 
+/*
+ * With the -j option, update_princ_encryption works in batches instead of
+ * re-encrypting each principal inside one long write-locked iteration.  A
+ * name-ordered scan (or, if the module cannot scan in name order, a single
+ * full scan) picks out up to UPDATE_BATCH_SIZE principals which need updating.
+ * Each batch is then fetched and re-encrypted by a pool of threads without
+ * any lock held, and written back under one exclusive database lock and one
+ * update log batch.  An entry whose keys changed after it was fetched is
+ * re-encrypted again under the lock.  Other database users can run between
+ * batches, and since each batch is committed on its own, an interrupted run
+ * can simply be restarted: principals already using the new master key are
+ * skipped.
+ *
+ * Each worker thread has its own krb5 context with its own read-only handle
+ * on the database, so that the module's key data encryption functions are
+ * used, while the main thread's database context is only used by the main
+ * thread.
+ */
+
+#define UPDATE_BATCH_SIZE 1000
+
+/* Returned by a scan callback to end a name-ordered scan early. */
+#define SCAN_DONE -1
+
+struct update_item {
+    char *name;
+    krb5_db_entry *ent;         /* entry as fetched, not modified */
+    krb5_keyblock *old_mkey;
+    krb5_key_data *new_key_data; /* ent's key data under the new master key */
+    krb5_error_code ret;
+};
+
+struct update_scan {
+    struct update_enc_mkvno *p;
+    char **names;
+    size_t count;
+    size_t alloc;
+    size_t max;                 /* stop after this many names, or 0 */
+    char *after;                /* skip names which sort at or before this */
+    char *last;                 /* last name examined */
+    krb5_boolean more;
+    krb5_error_code ret;
+};
+
+static void
+free_key_data(krb5_context context, krb5_key_data *key_data, int n)
+{
+    int i;
+
+    if (key_data == NULL)
+        return;
+    for (i = 0; i < n; i++)
+        krb5_dbe_free_key_data_contents(context, &key_data[i]);
+    free(key_data);
+}
+
+/* Re-encrypt the key data of ent from old_mkey to the new master key, placing
+ * the result in a new array of ent->n_key_data elements. */
+static krb5_error_code
+reencrypt_key_data(krb5_context context, const krb5_keyblock *old_mkey,
+                   const krb5_db_entry *ent, krb5_key_data **key_data_out)
+{
+    krb5_error_code ret = 0;
+    krb5_keyblock plainkey;
+    krb5_keysalt keysalt;
+    krb5_key_data *key_data, *new_key_data;
+    int i;
+
+    *key_data_out = NULL;
+    new_key_data = calloc(ent->n_key_data ? ent->n_key_data : 1,
+                          sizeof(*new_key_data));
+    if (new_key_data == NULL)
+        return ENOMEM;
+    for (i = 0; i < ent->n_key_data; i++) {
+        key_data = &ent->key_data[i];
+        ret = krb5_dbe_decrypt_key_data(context, old_mkey, key_data,
+                                        &plainkey, &keysalt);
+        if (ret)
+            break;
+        ret = krb5_dbe_encrypt_key_data(context, &new_master_keyblock,
+                                        &plainkey, &keysalt,
+                                        key_data->key_data_kvno,
+                                        &new_key_data[i]);
+        krb5_free_keyblock_contents(context, &plainkey);
+        free(keysalt.data.data);
+        if (ret)
+            break;
+    }
+    if (ret) {
+        free_key_data(context, new_key_data, ent->n_key_data);
+        return ret;
+    }
+    *key_data_out = new_key_data;
+    return 0;
+}
+
+/* Return true if e1 and e2 have identical key data. */
+static krb5_boolean
+same_key_data(const krb5_db_entry *e1, const krb5_db_entry *e2)
+{
+    const krb5_key_data *kd1, *kd2;
+    int i, j;
+
+    if (e1->n_key_data != e2->n_key_data)
+        return FALSE;
+    for (i = 0; i < e1->n_key_data; i++) {
+        kd1 = &e1->key_data[i];
+        kd2 = &e2->key_data[i];
+        if (kd1->key_data_ver != kd2->key_data_ver ||
+            kd1->key_data_kvno != kd2->key_data_kvno)
+            return FALSE;
+        for (j = 0; j < kd1->key_data_ver; j++) {
+            if (kd1->key_data_type[j] != kd2->key_data_type[j] ||
+                kd1->key_data_length[j] != kd2->key_data_length[j] ||
+                (kd1->key_data_length[j] > 0 &&
+                 memcmp(kd1->key_data_contents[j], kd2->key_data_contents[j],
+                        kd1->key_data_length[j]) != 0))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+#if defined(ENABLE_THREADS) && defined(HAVE_PTHREAD)
+
+#include <pthread.h>
+
+struct update_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    struct update_item *items;
+    size_t count;
+    size_t next;
+    size_t done;
+    unsigned long gen;
+    krb5_boolean shutdown;
+    char *realm;
+    int nthreads;
+    pthread_t *threads;
+};
+
+/* Create a context for a worker thread, with the database open read-only in
+ * the same realm as util_context. */
+static krb5_error_code
+worker_context(struct update_pool *pool, krb5_context *context_out)
+{
+    krb5_error_code ret;
+    krb5_context context;
+
+    *context_out = NULL;
+    ret = kadm5_init_krb5_context(&context);
+    if (ret)
+        return ret;
+    ret = krb5_set_default_realm(context, pool->realm);
+    if (!ret) {
+        ret = krb5_db_open(context, db5util_db_args,
+                           KRB5_KDB_OPEN_RO | KRB5_KDB_SRV_TYPE_ADMIN);
+    }
+    if (ret) {
+        krb5_free_context(context);
+        return ret;
+    }
+    *context_out = context;
+    return 0;
+}
+
+static void *
+update_worker(void *arg)
+{
+    struct update_pool *pool = arg;
+    struct update_item *item;
+    krb5_context context;
+    krb5_error_code init_ret;
+    unsigned long seen = 0;
+
+    init_ret = worker_context(pool, &context);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->gen == seen)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->shutdown)
+            break;
+        seen = pool->gen;
+        while (pool->next < pool->count) {
+            item = &pool->items[pool->next++];
+            pthread_mutex_unlock(&pool->lock);
+            if (context == NULL) {
+                item->ret = init_ret;
+            } else {
+                item->ret = reencrypt_key_data(context, item->old_mkey,
+                                               item->ent, &item->new_key_data);
+            }
+            pthread_mutex_lock(&pool->lock);
+            if (++pool->done == pool->count)
+                pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (context != NULL) {
+        (void)krb5_db_fini(context);
+        krb5_free_context(context);
+    }
+    return NULL;
+}
+
+static void
+free_update_pool(struct update_pool *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = TRUE;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    krb5_free_default_realm(util_context, pool->realm);
+    free(pool->threads);
+    free(pool);
+}
+
+static krb5_error_code
+create_update_pool(int nthreads, struct update_pool **pool_out)
+{
+    krb5_error_code ret;
+    struct update_pool *pool;
+    int i;
+
+    *pool_out = NULL;
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return ENOMEM;
+    ret = krb5_get_default_realm(util_context, &pool->realm);
+    if (ret) {
+        free(pool);
+        return ret;
+    }
+    pool->threads = calloc(nthreads, sizeof(*pool->threads));
+    if (pool->threads == NULL) {
+        krb5_free_default_realm(util_context, pool->realm);
+        free(pool);
+        return ENOMEM;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, update_worker,
+                           pool) != 0) {
+            free_update_pool(pool);
+            return EAGAIN;
+        }
+        pool->nthreads++;
+    }
+    *pool_out = pool;
+    return 0;
+}
+
+/* Re-encrypt count items using the pool, returning when all are done. */
+static void
+run_update_pool(struct update_pool *pool, struct update_item *items,
+                size_t count)
+{
+    if (count == 0)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->items = items;
+    pool->count = count;
+    pool->next = pool->done = 0;
+    pool->gen++;
+    pthread_cond_broadcast(&pool->work_cond);
+    while (pool->done < pool->count)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pool->items = NULL;
+    pool->count = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+#else /* !(ENABLE_THREADS && HAVE_PTHREAD) */
+
+/* Without thread support, re-encrypt each batch in the main thread. */
+
+struct update_pool {
+    int unused;
+};
+
+static void
+free_update_pool(struct update_pool *pool)
+{
+    free(pool);
+}
+
+static krb5_error_code
+create_update_pool(int nthreads, struct update_pool **pool_out)
+{
+    *pool_out = calloc(1, sizeof(**pool_out));
+    return (*pool_out == NULL) ? ENOMEM : 0;
+}
+
+static void
+run_update_pool(struct update_pool *pool, struct update_item *items,
+                size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        items[i].ret = reencrypt_key_data(util_context, items[i].old_mkey,
+                                          items[i].ent,
+                                          &items[i].new_key_data);
+    }
+}
+
+#endif /* !(ENABLE_THREADS && HAVE_PTHREAD) */
+
+/* Scan callback: record the names of matching principals which do not yet
+ * use the new master key, counting and reporting those which do. */
+static int
+update_scan_1(void *arg, krb5_db_entry *ent)
+{
+    struct update_scan *scan = arg;
+    struct update_enc_mkvno *p = scan->p;
+    krb5_error_code ret;
+    krb5_kvno old_mkvno;
+    char *pname, **newnames;
+
+    ret = krb5_unparse_name(util_context, ent->princ, &pname);
+    if (ret) {
+        scan->ret = ret;
+        return ret;
+    }
+    if (scan->after != NULL && strcmp(pname, scan->after) <= 0)
+        goto skip;
+
+    if (krb5_principal_compare(util_context, ent->princ, master_princ) ||
+        !pattern_matches(p, pname))
+        goto done;
+
+    ret = krb5_dbe_get_mkvno(util_context, ent, &old_mkvno);
+    if (ret) {
+        com_err(progname, ret,
+                _("determining master key used for principal '%s'"), pname);
+        exit_status++;
+        goto done;
+    }
+    if (old_mkvno == new_mkvno) {
+        if (p->verbose)
+            printf(_("skipping: %s\n"), pname);
+        p->re_match_count++;
+        p->already_current++;
+        goto done;
+    }
+
+    if (scan->max > 0 && scan->count == scan->max) {
+        /* Leave this principal for the next scan. */
+        scan->more = TRUE;
+        free(pname);
+        return SCAN_DONE;
+    }
+    if (scan->count == scan->alloc) {
+        scan->alloc = (scan->alloc == 0) ? 64 : scan->alloc * 2;
+        newnames = realloc(scan->names, scan->alloc * sizeof(*newnames));
+        if (newnames == NULL) {
+            free(pname);
+            scan->ret = ENOMEM;
+            return ENOMEM;
+        }
+        scan->names = newnames;
+    }
+    p->re_match_count++;
+    scan->names[scan->count++] = strdup(pname);
+    if (scan->names[scan->count - 1] == NULL) {
+        scan->count--;
+        free(pname);
+        scan->ret = ENOMEM;
+        return ENOMEM;
+    }
+
+done:
+    free(scan->last);
+    scan->last = pname;
+    return 0;
+
+skip:
+    free(pname);
+    return 0;
+}
+
+/* With the database locked, store the re-encrypted key data of item.  If the
+ * principal's keys have changed since it was fetched, re-encrypt them
+ * again. */
+static krb5_error_code
+store_item(struct update_enc_mkvno *p, struct update_item *item)
+{
+    krb5_error_code ret;
+    krb5_db_entry *ent;
+    krb5_keyblock *old_mkey;
+    krb5_key_data *new_key_data = NULL;
+    krb5_timestamp now;
+    krb5_kvno old_mkvno;
+
+    ret = krb5_db_get_principal(util_context, item->ent->princ, 0, &ent);
+    if (ret == KRB5_KDB_NOENTRY) {
+        p->re_match_count--;
+        return 0;
+    }
+    if (ret)
+        return ret;
+
+    ret = krb5_dbe_get_mkvno(util_context, ent, &old_mkvno);
+    if (ret)
+        goto cleanup;
+    if (old_mkvno == new_mkvno) {
+        p->already_current++;
+        goto cleanup;
+    }
+    if (same_key_data(ent, item->ent)) {
+        new_key_data = item->new_key_data;
+        item->new_key_data = NULL;
+    } else {
+        ret = krb5_dbe_find_mkey(util_context, ent, &old_mkey);
+        if (!ret) {
+            ret = reencrypt_key_data(util_context, old_mkey, ent,
+                                     &new_key_data);
+        }
+        if (ret)
+            goto cleanup;
+    }
+    free_key_data(util_context, ent->key_data, ent->n_key_data);
+    ent->key_data = new_key_data;
+
+    if (p->verbose)
+        printf(_("updating: %s\n"), item->name);
+    ret = krb5_dbe_update_mkvno(util_context, ent, new_mkvno);
+    if (!ret)
+        ret = krb5_timeofday(util_context, &now);
+    if (!ret) {
+        ret = krb5_dbe_update_mod_princ_data(util_context, ent, now,
+                                             master_princ);
+    }
+    if (!ret) {
+        ent->mask |= KADM5_KEY_DATA;
+        ret = krb5_db_put_principal(util_context, ent);
+    }
+    if (!ret)
+        p->updated++;
+
+cleanup:
+    krb5_db_free_principal(util_context, ent);
+    return ret;
+}
+
+/* Fetch and re-encrypt the principals named in names[0..count-1], then store
+ * them under one database lock. */
+static void
+update_batch(struct update_enc_mkvno *p, struct update_pool *pool,
+             char **names, size_t count)
+{
+    krb5_error_code ret;
+    krb5_principal princ;
+    krb5_kvno old_mkvno;
+    krb5_boolean locked;
+    struct update_item *items;
+    size_t i, nitems = 0;
+
+    items = calloc(count, sizeof(*items));
+    if (items == NULL) {
+        com_err(progname, ENOMEM, _("while re-encrypting principals"));
+        exit_status++;
+        return;
+    }
+
+    /* Fetch the entries again, since they may have changed since the
+     * scan. */
+    for (i = 0; i < count; i++) {
+        ret = krb5_parse_name(util_context, names[i], &princ);
+        if (!ret) {
+            ret = krb5_db_get_principal(util_context, princ, 0,
+                                        &items[nitems].ent);
+            krb5_free_principal(util_context, princ);
+        }
+        if (ret == KRB5_KDB_NOENTRY) {
+            p->re_match_count--;
+            continue;
+        }
+        if (!ret)
+            ret = krb5_dbe_get_mkvno(util_context, items[nitems].ent,
+                                     &old_mkvno);
+        if (!ret && old_mkvno == new_mkvno) {
+            p->already_current++;
+            krb5_db_free_principal(util_context, items[nitems].ent);
+            items[nitems].ent = NULL;
+            continue;
+        }
+        if (!ret) {
+            ret = krb5_dbe_find_mkey(util_context, items[nitems].ent,
+                                     &items[nitems].old_mkey);
+        }
+        if (ret) {
+            com_err(progname, ret, _("while fetching principal '%s'"),
+                    names[i]);
+            exit_status++;
+            krb5_db_free_principal(util_context, items[nitems].ent);
+            items[nitems].ent = NULL;
+            continue;
+        }
+        items[nitems++].name = names[i];
+    }
+
+    run_update_pool(pool, items, nitems);
+
+    ret = krb5_db_lock(util_context, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (ret && ret != KRB5_PLUGIN_OP_NOTSUPP) {
+        com_err(progname, ret, _("while locking database"));
+        exit_status++;
+        goto cleanup;
+    }
+    locked = (ret == 0);
+    (void)ulog_begin_batch(util_context);
+
+    for (i = 0; i < nitems; i++) {
+        ret = items[i].ret;
+        if (ret) {
+            com_err(progname, ret,
+                    _("error re-encrypting key for principal '%s'"),
+                    items[i].name);
+            exit_status++;
+            continue;
+        }
+        ret = store_item(p, &items[i]);
+        if (ret) {
+            com_err(progname, ret, _("while updating principal '%s' key data "
+                                     "in the database"), items[i].name);
+            exit_status++;
+        }
+    }
+
+    (void)ulog_end_batch(util_context);
+    if (locked)
+        (void)krb5_db_unlock(util_context);
+
+cleanup:
+    for (i = 0; i < nitems; i++) {
+        free_key_data(util_context, items[i].new_key_data,
+                      items[i].ent->n_key_data);
+        krb5_db_free_principal(util_context, items[i].ent);
+    }
+    free(items);
+}
+
+static void
+free_scan_names(struct update_scan *scan)
+{
+    size_t i;
+
+    for (i = 0; i < scan->count; i++)
+        free(scan->names[i]);
+    scan->count = 0;
+}
+
+/* Re-encrypt matching principals in batches using nthreads threads. */
+static krb5_error_code
+update_princ_encryption_parallel(struct update_enc_mkvno *p, int nthreads)
+{
+    krb5_error_code ret;
+    struct update_pool *pool = NULL;
+    struct update_scan scan = { 0 };
+    krb5_boolean ordered = TRUE;
+    size_t i;
+
+    ret = create_update_pool(nthreads, &pool);
+    if (ret)
+        return ret;
+
+    scan.p = p;
+    scan.max = UPDATE_BATCH_SIZE;
+    do {
+        scan.more = FALSE;
+        if (ordered) {
+            /* Resume after the last principal examined by the previous
+             * scan. */
+            free(scan.after);
+            scan.after = scan.last;
+            scan.last = NULL;
+            ret = krb5_db_iterate_from(util_context,
+                                       scan.after ? scan.after : "",
+                                       update_scan_1, &scan, 0);
+            if (ret == SCAN_DONE)
+                ret = 0;
+            if (ret == KRB5_PLUGIN_OP_NOTSUPP) {
+                /* Collect every name in one scan instead. */
+                ordered = FALSE;
+                scan.max = 0;
+                ret = krb5_db_iterate(util_context, NULL, update_scan_1,
+                                      &scan, 0);
+            }
+        }
+        if (!ret && scan.ret)
+            ret = scan.ret;
+        if (ret)
+            break;
+
+        for (i = 0; i < scan.count; i += UPDATE_BATCH_SIZE) {
+            update_batch(p, pool, scan.names + i,
+                         (scan.count - i < UPDATE_BATCH_SIZE) ?
+                         scan.count - i : UPDATE_BATCH_SIZE);
+            printf(_("%u principals re-encrypted so far\n"), p->updated);
+            fflush(stdout);
+        }
+        free_scan_names(&scan);
+    } while (scan.more);
+
+    free_scan_names(&scan);
+    free(scan.names);
+    free(scan.after);
+    free(scan.last);
+    free_update_pool(pool);
+    return ret;
+}
+
 extern int are_you_sure (const char *, ...)
 #if !defined(__cplusplus) && (__GNUC__ > 2)
     __attribute__((__format__(__printf__, 1, 2)))
@@ -875,12 +1511,18 @@ kdb5_update_princ_encryption(int argc, char *argv[])
     krb5_keyblock *act_mkey;
     krb5_keylist_node *master_keylist = krb5_db_mkey_list_alias(util_context);
     krb5_flags iterflags = 0;
+    int nthreads = 0;
 
-    while ((optchar = getopt(argc, argv, "fnv")) != -1) {
+    while ((optchar = getopt(argc, argv, "fj:nv")) != -1) {
         switch (optchar) {
         case 'f':
             force = 1;
             break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads <= 0)
+                usage();
+            break;
         case 'n':
             data.dry_run = 1;
             break;
@@ -978,14 +1620,17 @@ kdb5_update_princ_encryption(int argc, char *argv[])
         }
     }
 
-    if (!data.dry_run) {
-        /* Grab a write lock so we don't have to upgrade to a write lock and
-         * reopen the DB while iterating. */
-        iterflags = KRB5_DB_ITER_WRITE;
+    if (nthreads > 0 && !data.dry_run) {
+        retval = update_princ_encryption_parallel(&data, nthreads);
+    } else {
+        if (!data.dry_run) {
+            /* Grab a write lock so we don't have to upgrade to a write lock
+             * and reopen the DB while iterating. */
+            iterflags = KRB5_DB_ITER_WRITE;
+        }
+        retval = krb5_db_iterate(util_context, name_pattern,
+                                 update_princ_encryption_1, &data, iterflags);
     }
-
-    retval = krb5_db_iterate(util_context, name_pattern,
-                             update_princ_encryption_1, &data, iterflags);
     /* If exit_status is set, then update_princ_encryption_1 already
        printed a message.  */
     if (retval != 0 && exit_status == 0) {
@@ -55,6 +55,7 @@
 
 #include <k5-int.h>
 #include <kadm5/admin.h>
+#include <kadm5/server_internal.h>
 #include <locale.h>
 #include <adm_proto.h>
 #include <time.h>
@@ -85,7 +86,7 @@ void usage()
               "\tcreate  [-s]\n"
               "\tdestroy [-f]\n"
               "\tstash   [-f keyfile]\n"
-              "\tdump    [-b7|-r13|-r18] [-verbose]\n"
+              "\tdump    [-b7|-r13|-r18|-binary] [-verbose]\n"
               "\t        [-mkey_convert] [-new_mkey_file mkey_file]\n"
               "\t        [-rev] [-recurse] [filename [princs...]]\n"
               "\tload    [-b7|-r13|-r18] [-hash] [-verbose] [-update] "
@@ -96,9 +97,11 @@ void usage()
               "\tlist_mkeys\n"));
     /* avoid a string length compiler warning */
     fprintf(stderr,
-            _("\tupdate_princ_encryption [-f] [-n] [-v] [princ-pattern]\n"
+            _("\tupdate_princ_encryption [-f] [-n] [-v] [-j threads] "
+              "[princ-pattern]\n"
               "\tpurge_mkeys [-f] [-n] [-v]\n"
               "\ttabdump [-H] [-c] [-e] [-n] [-o outfile] dumptype\n"
+              "\tcompile_dict [-s] infile outfile\n"
               "\nwhere,\n\t[-x db_args]* - any number of database specific "
               "arguments.\n"
               "\t\t\tLook at each database documentation for supported "
@@ -120,6 +123,7 @@ krb5_boolean dbactive = FALSE;
 static int open_db_and_mkey(void);
 
 static void add_random_key(int, char **);
+static void compile_dict(int, char **);
 
 typedef void (*cmd_func)(int, char **);
 
@@ -140,6 +144,7 @@ struct _cmd_table {
     {"update_princ_encryption", kdb5_update_princ_encryption, 1},
     {"purge_mkeys", kdb5_purge_mkeys, 1},
     {"tabdump", tabdump, 1},
+    {"compile_dict", compile_dict, 0},
     {NULL, NULL, 0},
 };
 
@@ -609,3 +614,33 @@ add_random_key(argc, argv)
     }
     printf(_("%s changed\n"), pr_str);
 }
+
+/* Compile a text password dictionary for use as the realm's dict_file. */
+static void
+compile_dict(int argc, char **argv)
+{
+    krb5_error_code ret;
+    krb5_boolean folded = TRUE;
+    int optchar;
+
+    optind = 1;
+    while ((optchar = getopt(argc, argv, "s")) != -1) {
+        switch (optchar) {
+        case 's':
+            folded = FALSE;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 2)
+        usage();
+
+    ret = k5_pwqual_dict_compile(util_context, argv[optind],
+                                 argv[optind + 1], folded);
+    if (ret) {
+        com_err(progname, ret, _("while compiling dictionary %s"),
+                argv[optind]);
+        exit_status++;
+    }
+}
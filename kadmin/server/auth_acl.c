@@ -25,6 +25,7 @@
  */
 
 #include "k5-int.h"
+#include "k5-hashtab.h"
 #include <syslog.h>
 #include <kadm5/admin.h>
 #include <krb5/kadm5_auth_plugin.h>
@@ -62,6 +63,7 @@ struct acl_op_table {
 
 struct acl_entry {
     struct acl_entry *next;
+    size_t seq;
     krb5_principal client;
     uint32_t op_allowed;
     krb5_principal target;
@@ -88,8 +90,35 @@ struct wildstate {
     const krb5_data *backref[9];
 };
 
+/*
+ * A node of the client principal index.  The path from a realm root to a node
+ * spells out the leading components of a client pattern; exact components are
+ * found through the children hash table and "*" components through wild.
+ * leaf holds the entries whose client pattern ends at this node, in file
+ * order.
+ */
+struct acl_node {
+    struct k5_hashtab *children;
+    struct acl_node *child_list;
+    struct acl_node *next;
+    struct acl_node *wild;
+    struct acl_entry **leaf;
+    size_t nleaf;
+};
+
+/*
+ * The entries are kept in file order in list.  any_client holds the entries
+ * with a "*" client; all other entries are indexed by realm (realm_roots, or
+ * wild_realm for a "*" realm) and then by component.
+ */
 struct acl_state {
     struct acl_entry *list;
+    struct acl_entry **any_client;
+    size_t nany_client;
+    struct k5_hashtab *realms;
+    struct acl_node *realm_roots;
+    struct acl_node *wild_realm;
+    uint8_t seed[K5_HASH_SEED_LEN];
 };
 
 /*
@@ -369,11 +398,44 @@ parse_line(krb5_context context, const char *line, const char *fname)
     return entry;
 }
 
-/* Free all ACL entries. */
+static void
+free_acl_node(struct acl_node *node)
+{
+    struct acl_node *child, *next;
+
+    if (node == NULL)
+        return;
+    for (child = node->child_list; child != NULL; child = next) {
+        next = child->next;
+        free_acl_node(child);
+    }
+    if (node->children != NULL)
+        k5_hashtab_free(node->children);
+    free_acl_node(node->wild);
+    free(node->leaf);
+    free(node);
+}
+
+/* Free all ACL entries and the index over them. */
 static void
 free_acl_entries(struct acl_state *state)
 {
     struct acl_entry *entry, *next;
+    struct acl_node *root, *next_root;
+
+    for (root = state->realm_roots; root != NULL; root = next_root) {
+        next_root = root->next;
+        free_acl_node(root);
+    }
+    state->realm_roots = NULL;
+    if (state->realms != NULL)
+        k5_hashtab_free(state->realms);
+    state->realms = NULL;
+    free_acl_node(state->wild_realm);
+    state->wild_realm = NULL;
+    free(state->any_client);
+    state->any_client = NULL;
+    state->nany_client = 0;
 
     for (entry = state->list; entry != NULL; entry = next) {
         next = entry->next;
@@ -382,6 +444,121 @@ free_acl_entries(struct acl_state *state)
     state->list = NULL;
 }
 
+/* Append entry to the list *leaf of length *nleaf. */
+static krb5_error_code
+add_leaf(struct acl_entry ***leaf, size_t *nleaf, struct acl_entry *entry)
+{
+    struct acl_entry **newleaf;
+
+    newleaf = realloc(*leaf, (*nleaf + 1) * sizeof(*newleaf));
+    if (newleaf == NULL)
+        return ENOMEM;
+    newleaf[(*nleaf)++] = entry;
+    *leaf = newleaf;
+    return 0;
+}
+
+/* Return the child of node for the pattern component comp, creating it if
+ * necessary.  Return NULL on allocation failure. */
+static struct acl_node *
+get_child(struct acl_state *state, struct acl_node *node,
+          const krb5_data *comp)
+{
+    struct acl_node *child;
+
+    if (data_eq_string(*comp, "*")) {
+        if (node->wild == NULL)
+            node->wild = calloc(1, sizeof(*node->wild));
+        return node->wild;
+    }
+
+    if (node->children == NULL) {
+        if (k5_hashtab_create(state->seed, 4, &node->children) != 0)
+            return NULL;
+    }
+    child = k5_hashtab_get(node->children, comp->data, comp->length);
+    if (child != NULL)
+        return child;
+    child = calloc(1, sizeof(*child));
+    if (child == NULL)
+        return NULL;
+    if (k5_hashtab_add(node->children, comp->data, comp->length, child) != 0) {
+        free(child);
+        return NULL;
+    }
+    child->next = node->child_list;
+    node->child_list = child;
+    return child;
+}
+
+/* Return the index root for the realm of the client pattern p, creating it if
+ * necessary.  Return NULL on allocation failure. */
+static struct acl_node *
+get_realm_root(struct acl_state *state, krb5_const_principal p)
+{
+    struct acl_node *root;
+
+    if (data_eq_string(p->realm, "*")) {
+        if (state->wild_realm == NULL)
+            state->wild_realm = calloc(1, sizeof(*state->wild_realm));
+        return state->wild_realm;
+    }
+
+    root = k5_hashtab_get(state->realms, p->realm.data, p->realm.length);
+    if (root != NULL)
+        return root;
+    root = calloc(1, sizeof(*root));
+    if (root == NULL)
+        return NULL;
+    if (k5_hashtab_add(state->realms, p->realm.data, p->realm.length,
+                       root) != 0) {
+        free(root);
+        return NULL;
+    }
+    root->next = state->realm_roots;
+    state->realm_roots = root;
+    return root;
+}
+
+/* Build the client principal index over the entries in state->list.  Entries
+ * are added in file order, so each leaf list is sorted by seq. */
+static krb5_error_code
+build_index(krb5_context context, struct acl_state *state)
+{
+    krb5_error_code ret;
+    struct acl_entry *entry;
+    struct acl_node *node;
+    krb5_data d = make_data(state->seed, sizeof(state->seed));
+    int i;
+
+    ret = krb5_c_random_make_octets(context, &d);
+    if (ret)
+        return ret;
+    ret = k5_hashtab_create(state->seed, 0, &state->realms);
+    if (ret)
+        return ret;
+
+    for (entry = state->list; entry != NULL; entry = entry->next) {
+        if (entry->client == NULL) {
+            ret = add_leaf(&state->any_client, &state->nany_client, entry);
+            if (ret)
+                return ret;
+            continue;
+        }
+
+        node = get_realm_root(state, entry->client);
+        for (i = 0; node != NULL && i < entry->client->length; i++)
+            node = get_child(state, node, &entry->client->data[i]);
+        if (node == NULL)
+            return ENOMEM;
+        ret = add_leaf(&node->leaf, &node->nleaf, entry);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
 /* Open and parse the ACL file. */
 static krb5_error_code
 load_acl_file(krb5_context context, const char *fname, struct acl_state *state)
@@ -391,8 +568,9 @@ load_acl_file(krb5_context context, const char *fname, struct acl_state *state)
     char *line;
     struct acl_entry **entry_slot;
     int lineno, incr;
+    size_t seq = 0;
 
-    state->list = NULL;
+    memset(state, 0, sizeof(*state));
 
     /* Open the ACL file for reading. */
     fp = fopen(fname, "r");
@@ -426,12 +604,17 @@ load_acl_file(krb5_context context, const char *fname, struct acl_state *state)
             fclose(fp);
             return EINVAL;
         }
+        (*entry_slot)->seq = seq++;
         entry_slot = &(*entry_slot)->next;
         free(line);
     }
 
     fclose(fp);
-    return 0;
+
+    ret = build_index(context, state);
+    if (ret)
+        free_acl_entries(state);
+    return ret;
 }
 
 /*
@@ -491,33 +674,84 @@ match_princ(krb5_const_principal p1, krb5_const_principal p2,
     return TRUE;
 }
 
-/* Find an ACL entry matching principal and target_principal.  Return NULL if
- * none is found. */
-static struct acl_entry *
-find_entry(struct acl_state *state, krb5_const_principal client,
-           krb5_const_principal target)
+/* Return true if entry matches client and target. */
+static krb5_boolean
+match_entry(const struct acl_entry *entry, krb5_const_principal client,
+            krb5_const_principal target)
 {
-    struct acl_entry *entry;
     struct wildstate ws;
 
-    for (entry = state->list; entry != NULL; entry = entry->next) {
-        memset(&ws, 0, sizeof(ws));
-        if (entry->client != NULL) {
-            if (!match_princ(entry->client, client, FALSE, &ws))
-                continue;
-        }
+    memset(&ws, 0, sizeof(ws));
+    if (entry->client != NULL) {
+        if (!match_princ(entry->client, client, FALSE, &ws))
+            return FALSE;
+    }
+
+    if (entry->target != NULL) {
+        if (target == NULL)
+            return FALSE;
+        if (!match_princ(entry->target, target, TRUE, &ws))
+            return FALSE;
+    }
+
+    return TRUE;
+}
 
-        if (entry->target != NULL) {
-            if (target == NULL)
-                continue;
-            if (!match_princ(entry->target, target, TRUE, &ws))
-                continue;
+/* Replace *best with the first entry of leaf matching client and target, if
+ * there is one earlier in the file than *best. */
+static void
+search_leaf(struct acl_entry **leaf, size_t nleaf,
+            krb5_const_principal client, krb5_const_principal target,
+            struct acl_entry **best)
+{
+    size_t i;
+
+    for (i = 0; i < nleaf; i++) {
+        if (*best != NULL && leaf[i]->seq >= (*best)->seq)
+            return;
+        if (match_entry(leaf[i], client, target)) {
+            *best = leaf[i];
+            return;
         }
+    }
+}
+
+/* Search the index below node for client components starting at depth. */
+static void
+search_node(const struct acl_node *node, krb5_const_principal client,
+            int depth, krb5_const_principal target, struct acl_entry **best)
+{
+    const krb5_data *comp;
 
-        return entry;
+    if (node == NULL)
+        return;
+    if (depth == client->length) {
+        search_leaf(node->leaf, node->nleaf, client, target, best);
+        return;
     }
 
-    return NULL;
+    comp = &client->data[depth];
+    if (node->children != NULL) {
+        search_node(k5_hashtab_get(node->children, comp->data, comp->length),
+                    client, depth + 1, target, best);
+    }
+    search_node(node->wild, client, depth + 1, target, best);
+}
+
+/* Find the first ACL entry in file order matching principal and
+ * target_principal.  Return NULL if none is found. */
+static struct acl_entry *
+find_entry(struct acl_state *state, krb5_const_principal client,
+           krb5_const_principal target)
+{
+    struct acl_entry *best = NULL;
+
+    search_leaf(state->any_client, state->nany_client, client, target, &best);
+    search_node(k5_hashtab_get(state->realms, client->realm.data,
+                               client->realm.length),
+                client, 0, target, &best);
+    search_node(state->wild_realm, client, 0, target, &best);
+    return best;
 }
 
 /* Return true if op is permitted for this principal.  Set *rs_out (if not
@@ -554,7 +788,8 @@ acl_init(krb5_context context, const char *acl_file,
     if (acl_file == NULL)
         return KRB5_PLUGIN_NO_HANDLE;
     state = malloc(sizeof(*state));
-    state->list = NULL;
+    if (state == NULL)
+        return ENOMEM;
     ret = load_acl_file(context, acl_file, state);
     if (ret) {
         free(state);
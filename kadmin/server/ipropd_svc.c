@@ -11,6 +11,7 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/resource.h> /* rlimit */
+#include <sys/stat.h>
 #include <syslog.h>
 
 #include <kadm5/admin.h>
@@ -143,75 +144,77 @@ iprop_acl_check(krb5_context context, const char *client_name)
     return result;
 }
 
-kdb_incr_result_t *
-iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+/*
+ * Record printable client and service names for rqstp in *client_out and
+ * *service_out, and check the client against the iprop ACL.  Return
+ * UPDATE_OK if the request may proceed.
+ */
+static update_status_t
+check_client(struct svc_req *rqstp, const char *whoami, char **client_out,
+	     char **service_out)
 {
-    static kdb_incr_result_t ret;
-    char *whoami = "iprop_get_updates_1";
-    int kret;
     kadm5_server_handle_t handle = global_server_handle;
-    char *client_name = 0, *service_name = 0;
-    char obuf[256] = {0};
-
-    /* default return code */
-    ret.ret = UPDATE_ERROR;
+    gss_buffer_desc client_desc, service_desc;
+    char *client_name, *service_name;
 
-    DPRINT("%s: start, last_sno=%lu\n", whoami,
-	    (unsigned long)arg->last_sno);
+    *client_out = *service_out = NULL;
 
     if (!handle) {
 	krb5_klog_syslog(LOG_ERR,
 			 _("%s: server handle is NULL"),
 			 whoami);
-	goto out;
+	return UPDATE_ERROR;
     }
 
-    {
-	gss_buffer_desc client_desc, service_desc;
-
-	if (setup_gss_names(rqstp, &client_desc, &service_desc) < 0) {
-	    krb5_klog_syslog(LOG_ERR,
-			     _("%s: setup_gss_names failed"),
-			     whoami);
-	    goto out;
-	}
-	client_name = buf_to_string(&client_desc);
-	service_name = buf_to_string(&service_desc);
-	if (client_name == NULL || service_name == NULL) {
-	    krb5_klog_syslog(LOG_ERR,
-			     _("%s: out of memory recording principal names"),
-			     whoami);
-	    goto out;
-	}
+    if (setup_gss_names(rqstp, &client_desc, &service_desc) < 0) {
+	krb5_klog_syslog(LOG_ERR,
+			 _("%s: setup_gss_names failed"),
+			 whoami);
+	return UPDATE_ERROR;
+    }
+    *client_out = client_name = buf_to_string(&client_desc);
+    *service_out = service_name = buf_to_string(&service_desc);
+    if (client_name == NULL || service_name == NULL) {
+	krb5_klog_syslog(LOG_ERR,
+			 _("%s: out of memory recording principal names"),
+			 whoami);
+	return UPDATE_ERROR;
     }
 
     DPRINT("%s: clprinc=`%s'\n\tsvcprinc=`%s'\n", whoami, client_name,
 	   service_name);
 
     if (!iprop_acl_check(handle->context, client_name)) {
-	ret.ret = UPDATE_PERM_DENIED;
-
 	DPRINT("%s: PERMISSION DENIED: clprinc=`%s'\n\tsvcprinc=`%s'\n",
 		whoami, client_name, service_name);
 
 	krb5_klog_syslog(LOG_NOTICE, LOG_UNAUTH, whoami,
 			 client_name, service_name,
 			 client_addr(rqstp->rq_xprt));
-	goto out;
+	return UPDATE_PERM_DENIED;
     }
 
-    kret = ulog_get_entries(handle->context, arg, &ret);
+    return UPDATE_OK;
+}
 
-    if (ret.ret == UPDATE_OK) {
+/* Log the outcome of an update request. */
+static void
+log_updates(const char *whoami, kdb_last_t *arg, kdb_incr_result_t *ret,
+	    int kret, const char *client_name, const char *service_name,
+	    SVCXPRT *xprt)
+{
+    char obuf[256] = {0};
+
+    if (ret->ret == UPDATE_OK) {
 	(void) snprintf(obuf, sizeof (obuf),
 			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=%lu"),
-			replystr(ret.ret),
+			replystr(ret->ret),
 			(unsigned long)arg->last_sno,
-			(unsigned long)ret.lastentry.last_sno);
+			(unsigned long)ret->lastentry.last_sno);
     } else {
 	(void) snprintf(obuf, sizeof (obuf),
 			_("%s; Incoming SerialNo=%lu; Outgoing SerialNo=N/A"),
-			replystr(ret.ret),
+			replystr(ret->ret),
 			(unsigned long)arg->last_sno);
     }
 
@@ -226,7 +229,28 @@ iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
 		     obuf,
 		     ((kret == 0) ? "success" : error_message(kret)),
 		     client_name, service_name,
-		     client_addr(rqstp->rq_xprt));
+		     client_addr(xprt));
+}
+
+kdb_incr_result_t *
+iprop_get_updates_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+{
+    static kdb_incr_result_t ret;
+    char *whoami = "iprop_get_updates_1";
+    int kret;
+    kadm5_server_handle_t handle = global_server_handle;
+    char *client_name = 0, *service_name = 0;
+
+    DPRINT("%s: start, last_sno=%lu\n", whoami,
+	    (unsigned long)arg->last_sno);
+
+    ret.ret = check_client(rqstp, whoami, &client_name, &service_name);
+    if (ret.ret != UPDATE_OK)
+	goto out;
+
+    kret = ulog_get_entries(handle->context, arg, &ret);
+    log_updates(whoami, arg, &ret, kret, client_name, service_name,
+		rqstp->rq_xprt);
 
 out:
     if (nofork)
@@ -236,6 +260,33 @@ out:
     return (&ret);
 }
 
+kdb_incr_result_t *
+iprop_get_delta_1_svc(kdb_last_t *arg, struct svc_req *rqstp)
+{
+    static kdb_incr_result_t ret;
+    char *whoami = "iprop_get_delta_1";
+    int kret;
+    kadm5_server_handle_t handle = global_server_handle;
+    char *client_name = 0, *service_name = 0;
+
+    DPRINT("%s: start, last_sno=%lu\n", whoami,
+	    (unsigned long)arg->last_sno);
+
+    ret.ret = check_client(rqstp, whoami, &client_name, &service_name);
+    if (ret.ret != UPDATE_OK)
+	goto out;
+
+    kret = ulog_get_delta(handle->context, arg, &ret);
+    log_updates(whoami, arg, &ret, kret, client_name, service_name,
+		rqstp->rq_xprt);
+
+out:
+    if (nofork)
+	debprret(whoami, ret.ret, ret.lastentry.last_sno);
+    free(client_name);
+    free(service_name);
+    return (&ret);
+}
 
 /*
  * Given a client princ (foo/fqdn@R), copy (in arg cl) the fqdn substring.
@@ -527,6 +578,264 @@ fail_name:
      return success;
 }
 
+/*
+ * A replica blocked in IPROP_WAIT_UPDATES.  The RPC transport keeps the
+ * request's XID and RPCSEC_GSS verifier until the next request arrives on it,
+ * so the reply can be sent later with svc_sendreply().  The socket's identity
+ * is recorded so that we never reply on a transport which has since been
+ * destroyed and its descriptor reused.
+ */
+struct iprop_waiter {
+    struct iprop_waiter *next;
+    SVCXPRT *xprt;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    kdb_last_t last;
+    time_t deadline;
+    char *client_name;
+    char *service_name;
+};
+
+/* Upper bound on how long a replica may ask us to hold a request. */
+#define IPROP_MAX_WAIT		(5 * 60)
+
+/* How often to look for updates made by other processes while replicas are
+ * waiting, in milliseconds. */
+#define IPROP_WAIT_CHECK_MS	50
+
+static struct iprop_waiter *waiters;
+static verto_ctx *wait_ctx;
+static verto_ev *wait_ev;
+
+/* Return true if w's transport still exists. */
+static krb5_boolean
+waiter_alive(struct iprop_waiter *w)
+{
+    struct stat st;
+
+    if (w->fd >= FD_SETSIZE || !FD_ISSET(w->fd, &svc_fdset))
+	return FALSE;
+    return fstat(w->fd, &st) == 0 && st.st_dev == w->dev &&
+	st.st_ino == w->ino;
+}
+
+static void
+free_waiter(struct iprop_waiter *w)
+{
+    free(w->client_name);
+    free(w->service_name);
+    free(w);
+}
+
+/* Send ret as the reply to w and free the update entries in it. */
+static void
+reply_waiter(struct iprop_waiter *w, kdb_incr_result_t *ret, int kret)
+{
+    char *whoami = "iprop_wait_updates_1";
+
+    log_updates(whoami, &w->last, ret, kret, w->client_name,
+		w->service_name, w->xprt);
+    if (nofork)
+	debprret(whoami, ret->ret, ret->lastentry.last_sno);
+    if (!svc_sendreply(w->xprt, xdr_kdb_incr_result_t, (caddr_t)ret)) {
+	krb5_klog_syslog(LOG_ERR,
+			 _("RPC svc_sendreply failed (%s)"),
+			 whoami);
+    }
+    if (ret->ret == UPDATE_OK) {
+	ulog_free_entries(ret->updates.kdb_ulog_t_val,
+			  ret->updates.kdb_ulog_t_len);
+	ret->updates.kdb_ulog_t_val = NULL;
+	ret->updates.kdb_ulog_t_len = 0;
+    }
+}
+
+/* Remove any waiter for xprt without replying. */
+static void
+cancel_waiter(SVCXPRT *xprt)
+{
+    struct iprop_waiter **wp, *w;
+
+    for (wp = &waiters; *wp != NULL; wp = &(*wp)->next) {
+	if ((*wp)->xprt == xprt) {
+	    w = *wp;
+	    *wp = w->next;
+	    free_waiter(w);
+	    return;
+	}
+    }
+}
+
+/* Set the loop used to schedule checks for waiting replicas. */
+void
+iprop_set_wait_loop(verto_ctx *ctx)
+{
+    wait_ctx = ctx;
+}
+
+/*
+ * Reply to each waiting replica whose serial number is behind the update
+ * log, or whose wait has expired.  Called periodically while replicas are
+ * waiting, and after each kadmin request so that our own changes are pushed
+ * out immediately.
+ */
+void
+iprop_check_waiters(void)
+{
+    kadm5_server_handle_t handle = global_server_handle;
+    struct iprop_waiter **wp, *w;
+    kdb_incr_result_t ret;
+    kdb_last_t last;
+    time_t now;
+    int kret, wret;
+
+    if (waiters == NULL)
+	return;
+
+    kret = ulog_get_last(handle->context, &last);
+    now = time(NULL);
+    for (wp = &waiters; *wp != NULL;) {
+	w = *wp;
+	if (!waiter_alive(w)) {
+	    *wp = w->next;
+	    free_waiter(w);
+	    continue;
+	}
+
+	memset(&ret, 0, sizeof(ret));
+	wret = kret;
+	if (kret != 0) {
+	    ret.ret = UPDATE_ERROR;
+	} else if (last.last_sno != w->last.last_sno ||
+		   last.last_time.seconds != w->last.last_time.seconds ||
+		   last.last_time.useconds != w->last.last_time.useconds) {
+	    wret = ulog_get_entries(handle->context, &w->last, &ret);
+	} else {
+	    ret.ret = UPDATE_NIL;
+	}
+	if (ret.ret == UPDATE_NIL && now < w->deadline) {
+	    wp = &w->next;
+	    continue;
+	}
+
+	*wp = w->next;
+	reply_waiter(w, &ret, wret);
+	free_waiter(w);
+    }
+
+    if (waiters == NULL && wait_ev != NULL) {
+	verto_del(wait_ev);
+	wait_ev = NULL;
+    }
+}
+
+static void
+check_waiters_cb(verto_ctx *ctx, verto_ev *ev)
+{
+    iprop_check_waiters();
+}
+
+/*
+ * Queue transp to be answered by iprop_check_waiters() once the update log
+ * moves past *last, taking ownership of client_name and service_name.
+ */
+static krb5_error_code
+add_waiter(SVCXPRT *transp, kdb_last_t *last, uint32_t wait_secs,
+	   char *client_name, char *service_name)
+{
+    struct iprop_waiter *w;
+    struct stat st;
+
+    if (wait_ctx == NULL)
+	return EINVAL;
+    if (fstat(transp->xp_sock, &st) != 0)
+	return errno;
+    w = calloc(1, sizeof(*w));
+    if (w == NULL)
+	return ENOMEM;
+    if (wait_ev == NULL) {
+	wait_ev = verto_add_timeout(wait_ctx, VERTO_EV_FLAG_PERSIST,
+				    check_waiters_cb, IPROP_WAIT_CHECK_MS);
+	if (wait_ev == NULL) {
+	    free(w);
+	    return ENOMEM;
+	}
+    }
+    w->xprt = transp;
+    w->fd = transp->xp_sock;
+    w->dev = st.st_dev;
+    w->ino = st.st_ino;
+    w->last = *last;
+    if (wait_secs > IPROP_MAX_WAIT)
+	wait_secs = IPROP_MAX_WAIT;
+    w->deadline = time(NULL) + wait_secs;
+    w->client_name = client_name;
+    w->service_name = service_name;
+    w->next = waiters;
+    waiters = w;
+    return 0;
+}
+
+/*
+ * Handle IPROP_WAIT_UPDATES.  If updates are already available (or the
+ * replica needs a full resync), reply immediately as for IPROP_GET_UPDATES.
+ * Otherwise queue the request and reply from iprop_check_waiters().
+ */
+static void
+wait_updates(struct svc_req *rqstp, SVCXPRT *transp)
+{
+    kdb_incr_result_t ret;
+    char *whoami = "iprop_wait_updates_1";
+    kadm5_server_handle_t handle = global_server_handle;
+    kdb_wait_args_t arg;
+    char *client_name = NULL, *service_name = NULL;
+    int kret;
+
+    memset(&arg, 0, sizeof(arg));
+    if (!svc_getargs(transp, xdr_kdb_wait_args_t, (caddr_t)&arg)) {
+	krb5_klog_syslog(LOG_ERR,
+			 _("RPC svc_getargs failed (%s)"),
+			 whoami);
+	svcerr_decode(transp);
+	return;
+    }
+
+    DPRINT("%s: start, last_sno=%lu, wait=%lu\n", whoami,
+	   (unsigned long)arg.last.last_sno, (unsigned long)arg.wait_secs);
+
+    memset(&ret, 0, sizeof(ret));
+    ret.ret = check_client(rqstp, whoami, &client_name, &service_name);
+    if (ret.ret != UPDATE_OK)
+	goto reply;
+
+    kret = ulog_get_entries(handle->context, &arg.last, &ret);
+    if (ret.ret == UPDATE_NIL && arg.wait_secs > 0 &&
+	add_waiter(transp, &arg.last, arg.wait_secs, client_name,
+		   service_name) == 0)
+	return;
+    log_updates(whoami, &arg.last, &ret, kret, client_name, service_name,
+		transp);
+
+reply:
+    if (nofork)
+	debprret(whoami, ret.ret, ret.lastentry.last_sno);
+    if (!svc_sendreply(transp, xdr_kdb_incr_result_t, (caddr_t)&ret)) {
+	krb5_klog_syslog(LOG_ERR,
+			 _("RPC svc_sendreply failed (%s)"),
+			 whoami);
+	svcerr_systemerr(transp);
+    }
+    if (ret.ret == UPDATE_OK) {
+	ulog_free_entries(ret.updates.kdb_ulog_t_val,
+			  ret.updates.kdb_ulog_t_len);
+	ret.updates.kdb_ulog_t_val = NULL;
+	ret.updates.kdb_ulog_t_len = 0;
+    }
+    free(client_name);
+    free(service_name);
+}
+
 void
 krb5_iprop_prog_1(struct svc_req *rqstp,
 		  SVCXPRT *transp)
@@ -548,6 +857,9 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	return;
     }
 
+    /* A new request on this transport means any earlier wait was given up. */
+    cancel_waiter(transp);
+
     switch (rqstp->rq_proc) {
     case NULLPROC:
 	(void) svc_sendreply(transp, xdr_void,
@@ -560,6 +872,12 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	local = (void *(*)()) iprop_get_updates_1_svc;
 	break;
 
+    case IPROP_GET_DELTA:
+	_xdr_argument = xdr_kdb_last_t;
+	_xdr_result = xdr_kdb_incr_result_t;
+	local = (void *(*)()) iprop_get_delta_1_svc;
+	break;
+
     case IPROP_FULL_RESYNC:
 	_xdr_argument = xdr_void;
 	_xdr_result = xdr_kdb_fullresync_result_t;
@@ -572,6 +890,11 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	local = (void *(*)()) iprop_full_resync_ext_1_svc;
 	break;
 
+    case IPROP_WAIT_UPDATES:
+	/* The reply may be deferred, so this is handled separately. */
+	wait_updates(rqstp, transp);
+	return;
+
     default:
 	krb5_klog_syslog(LOG_ERR,
 			 _("RPC unknown request: %d (%s)"),
@@ -604,7 +927,8 @@ krb5_iprop_prog_1(struct svc_req *rqstp,
 	exit(1);
     }
 
-    if (rqstp->rq_proc == IPROP_GET_UPDATES) {
+    if (rqstp->rq_proc == IPROP_GET_UPDATES ||
+	rqstp->rq_proc == IPROP_GET_DELTA) {
 	/* LINTED */
 	kdb_incr_result_t *r = (kdb_incr_result_t *)result;
 
@@ -19,6 +19,25 @@ extern void *global_server_handle;
 
 static int check_rpcsec_auth(struct svc_req *);
 
+/* Return true if proc only reads the database. */
+static krb5_boolean
+read_only_proc(rpcproc_t proc)
+{
+     switch (proc) {
+     case GET_PRINCIPAL:
+     case GET_PRINCS:
+     case GET_PRINCS_PAGE:
+     case GET_POLICY:
+     case GET_POLS:
+     case GET_PRIVS:
+     case GET_STRINGS:
+     case EXTRACT_KEYS:
+	  return TRUE;
+     default:
+	  return FALSE;
+     }
+}
+
 /*
  * Function: kadm_1
  *
@@ -59,6 +78,9 @@ void kadm_1(rqstp, transp)
 	  setkey3_arg setkey_principal3_2_arg;
 	  setkey4_arg setkey_principal4_2_arg;
 	  getpkeys_arg get_principal_keys_2_arg;
+	  bprinc_arg principals_2_arg;
+	  gprincs_page_arg get_princs_page_2_arg;
+	  brandkey_arg randkey_principals_2_arg;
      } argument;
      union {
 	  generic_ret gen_ret;
@@ -71,6 +93,9 @@ void kadm_1(rqstp, transp)
 	  chrand_ret chrand_principal3_2_ret;
 	  gstrings_ret get_string_2_ret;
 	  getpkeys_ret get_principal_keys_ret;
+	  bprinc_ret principals_2_ret;
+	  gprincs_page_ret get_princs_page_2_ret;
+	  brandkey_ret randkey_principals_2_ret;
      } result;
      bool_t retval;
      bool_t (*xdr_argument)(), (*xdr_result)();
@@ -241,6 +266,30 @@ void kadm_1(rqstp, transp)
 	  local = (bool_t (*)()) get_principal_keys_2_svc;
 	  break;
 
+     case CREATE_PRINCIPALS:
+	  xdr_argument = xdr_bprinc_arg;
+	  xdr_result = xdr_bprinc_ret;
+	  local = (bool_t (*)()) create_principals_2_svc;
+	  break;
+
+     case MODIFY_PRINCIPALS:
+	  xdr_argument = xdr_bprinc_arg;
+	  xdr_result = xdr_bprinc_ret;
+	  local = (bool_t (*)()) modify_principals_2_svc;
+	  break;
+
+     case GET_PRINCS_PAGE:
+	  xdr_argument = xdr_gprincs_page_arg;
+	  xdr_result = xdr_gprincs_page_ret;
+	  local = (bool_t (*)()) get_princs_page_2_svc;
+	  break;
+
+     case RANDKEY_PRINCIPALS:
+	  xdr_argument = xdr_brandkey_arg;
+	  xdr_result = xdr_brandkey_ret;
+	  local = (bool_t (*)()) randkey_principals_2_svc;
+	  break;
+
      default:
 	  krb5_klog_syslog(LOG_ERR, "Invalid KADM5 procedure number: %s, %d",
 			   client_addr(rqstp->rq_xprt), rqstp->rq_proc);
@@ -252,6 +301,13 @@ void kadm_1(rqstp, transp)
 	  svcerr_decode(transp);
 	  return;
      }
+     /* Leave the work to a worker thread if there are any.  INIT is cheap
+      * and is answered here. */
+     if (rqstp->rq_proc != INIT &&
+	 worker_submit(rqstp, transp, local, (xdrproc_t)xdr_argument,
+		       &argument, sizeof(argument), (xdrproc_t)xdr_result,
+		       sizeof(result), !read_only_proc(rqstp->rq_proc)))
+	  return;
      memset(&result, 0, sizeof(result));
      retval = (*local)(&argument, &result, rqstp);
      if (retval && !svc_sendreply(transp, xdr_result, (void *)&result)) {
@@ -267,6 +323,9 @@ void kadm_1(rqstp, transp)
 	  krb5_klog_syslog(LOG_ERR, "WARNING! Unable to free results, "
 		 "continuing.");
      }
+
+     /* Push any update we just logged to replicas waiting for one. */
+     iprop_check_waiters();
      return;
 }
 
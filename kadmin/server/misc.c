@@ -10,24 +10,16 @@
 #include    "misc.h"
 #include    "auth.h"
 #include    "net-server.h"
-kadm5_ret_t
-schpw_util_wrapper(void *server_handle,
-                   krb5_principal client,
-                   krb5_principal target,
-                   krb5_boolean initial_flag,
-                   char *new_pw, char **ret_pw,
-                   char *msg_ret, unsigned int msg_len)
+/* Check whether client may change target's password, placing a message in
+ * msg_ret if not. */
+static kadm5_ret_t
+check_chpw_access(void *server_handle, krb5_principal client,
+                  krb5_principal target, krb5_boolean initial_flag,
+                  char *msg_ret, unsigned int msg_len)
 {
     kadm5_ret_t                 ret;
     kadm5_server_handle_t       handle = server_handle;
 
-    /*
-     * If no target is explicitly provided, then the target principal
-     * is the client principal.
-     */
-    if (target == NULL)
-        target = client;
-
     /* If the client is changing its own password, require it to use an initial
      * ticket, and enforce the policy min_life. */
     if (krb5_principal_compare(handle->context, client, target)) {
@@ -42,17 +34,88 @@ schpw_util_wrapper(void *server_handle,
             return ret;
     }
 
-    if (auth(handle->context, OP_CPW, client, target,
-             NULL, NULL, NULL, NULL, 0)) {
-        ret = kadm5_chpass_principal_util(server_handle,
-                                          target,
-                                          new_pw, ret_pw,
-                                          msg_ret, msg_len);
-    } else {
-        ret = KADM5_AUTH_CHANGEPW;
+    if (!auth(handle->context, OP_CPW, client, target,
+              NULL, NULL, NULL, NULL, 0)) {
         strlcpy(msg_ret, "Unauthorized request", msg_len);
+        return KADM5_AUTH_CHANGEPW;
+    }
+
+    return 0;
+}
+
+kadm5_ret_t
+schpw_util_wrapper(void *server_handle,
+                   krb5_principal client,
+                   krb5_principal target,
+                   krb5_boolean initial_flag,
+                   char *new_pw, char **ret_pw,
+                   char *msg_ret, unsigned int msg_len)
+{
+    kadm5_ret_t                 ret;
+
+    /*
+     * If no target is explicitly provided, then the target principal
+     * is the client principal.
+     */
+    if (target == NULL)
+        target = client;
+
+    ret = check_chpw_access(server_handle, client, target, initial_flag,
+                            msg_ret, msg_len);
+    if (ret)
+        return ret;
+
+    return kadm5_chpass_principal_util(server_handle, target, new_pw, ret_pw,
+                                       msg_ret, msg_len);
+}
+
+/*
+ * Perform the checks of schpw_util_wrapper() which do not modify the
+ * database, including the password quality checks for target's policy.  Any
+ * failure is reported in msg_ret as schpw_util_wrapper() would report it.
+ * The checks are repeated when the password is changed.
+ */
+kadm5_ret_t
+schpw_util_precheck(void *server_handle, krb5_principal client,
+                    krb5_principal target, krb5_boolean initial_flag,
+                    const char *new_pw, char *msg_ret, unsigned int msg_len)
+{
+    kadm5_ret_t                 ret;
+    kadm5_server_handle_t       handle = server_handle;
+    kadm5_principal_ent_rec     princ;
+    kadm5_policy_ent_rec        pol;
+    krb5_boolean                have_pol = FALSE;
+
+    if (target == NULL)
+        target = client;
+
+    ret = check_chpw_access(server_handle, client, target, initial_flag,
+                            msg_ret, msg_len);
+    if (ret)
+        return ret;
+
+    ret = kadm5_get_principal(handle->lhandle, target, &princ,
+                              KADM5_PRINCIPAL_NORMAL_MASK);
+    if (ret)
+        goto done;
+    if (princ.aux_attributes & KADM5_POLICY) {
+        /* Treat a nonexistent policy as no policy, as chpass does. */
+        ret = kadm5_get_policy(handle->lhandle, princ.policy, &pol);
+        if (ret == 0)
+            have_pol = TRUE;
+        else if (ret == KADM5_UNK_POLICY)
+            ret = 0;
     }
+    if (ret == 0)
+        ret = passwd_check(handle, new_pw, have_pol ? &pol : NULL, target);
+    if (have_pol)
+        (void)kadm5_free_policy_ent(handle->lhandle, &pol);
+    (void)kadm5_free_principal_ent(handle->lhandle, &princ);
 
+done:
+    if (ret)
+        (void)_kadm5_chpass_principal_message(handle->lhandle, target, ret,
+                                              msg_ret, msg_len);
     return ret;
 }
 
@@ -19,6 +19,11 @@ schpw_util_wrapper(void *server_handle, krb5_principal client,
                    char *new_pw, char **ret_pw,
                    char *msg_ret, unsigned int msg_len);
 
+kadm5_ret_t
+schpw_util_precheck(void *server_handle, krb5_principal client,
+                    krb5_principal target, krb5_boolean initial_flag,
+                    const char *new_pw, char *msg_ret, unsigned int msg_len);
+
 kadm5_ret_t check_min_life(void *server_handle, krb5_principal principal,
                            char *msg_ret, unsigned int msg_len);
 
@@ -36,6 +41,9 @@ void reset_db(void);
 
 void log_badauth(OM_uint32 major, OM_uint32 minor, SVCXPRT *xprt, char *data);
 
+/* Size of the buffer used by client_addr(). */
+#define CLIENT_ADDR_BUFSIZE 128
+
 const char *client_addr(SVCXPRT *xprt);
 
 /* network.c */
@@ -45,6 +53,35 @@ const char *client_addr(SVCXPRT *xprt);
 void
 krb5_iprop_prog_1(struct svc_req *rqstp, SVCXPRT *transp);
 
+void iprop_set_wait_loop(verto_ctx *ctx);
+
+void iprop_check_waiters(void);
+
+/* worker.c */
+krb5_error_code worker_init(krb5_context context, verto_ctx *vctx,
+                            kadm5_config_params *params, char **db_args);
+
+void worker_fini(void);
+
+krb5_boolean worker_submit(struct svc_req *rqstp, SVCXPRT *transp,
+                           bool_t (*local)(), xdrproc_t xdr_argument,
+                           void *argument, size_t argsize,
+                           xdrproc_t xdr_result, size_t ressize,
+                           krb5_boolean write);
+
+krb5_boolean worker_submit_task(void (*run)(void *handle, void *arg),
+                                void (*done)(void *arg), void *arg,
+                                krb5_boolean write);
+
+/* Keep the worker threads from using the database until worker_unlock_db()
+ * is called, for main loop code which uses the global server handle. */
+void worker_lock_db(void);
+void worker_unlock_db(void);
+
+void *current_server_handle(void);
+
+char *worker_addr_buf(void);
+
 kadm5_ret_t
 kiprop_get_adm_host_srv_name(krb5_context,
                              const char *,
@@ -129,6 +129,13 @@ write_pid_file(const char *pid_file)
     return st1 ? st1 : st2;
 }
 
+/* Flush ulog updates deferred under iprop_ulog_sync = interval. */
+static void
+sync_ulog(verto_ctx *ctx, verto_ev *ev)
+{
+    ulog_sync(context);
+}
+
 /* Set up the main loop.  If proponly is set, don't set up ports for kpasswd or
  * kadmin.  May set *ctx_out even on error. */
 static krb5_error_code
@@ -230,7 +237,11 @@ log_badverf(gss_name_t client_name, gss_name_t server_name,
         {21, "SETKEY_PRINCIPAL3"},
         {22, "PURGEKEYS"},
         {23, "GET_STRINGS"},
-        {24, "SET_STRING"}
+        {24, "SET_STRING"},
+        {27, "CREATE_PRINCIPALS"},
+        {28, "MODIFY_PRINCIPALS"},
+        {29, "GET_PRINCS_PAGE"},
+        {30, "RANDKEY_PRINCIPALS"}
     };
     OM_uint32 minor;
     gss_buffer_desc client, server;
@@ -350,6 +361,7 @@ main(int argc, char *argv[])
     char **db_args = NULL, **tmpargs;
     const char *acl_file;
     int ret, i, db_args_size = 0, proponly = 0;
+    krb5_deltat interval;
 
     setlocale(LC_ALL, "");
     setvbuf(stderr, NULL, _IONBF, 0);
@@ -529,6 +541,14 @@ main(int argc, char *argv[])
         if (ret)
             fail_to_start(ret, _("mapping update log"));
 
+        interval = ulog_get_sync_interval(context);
+        if (interval > 0 &&
+            verto_add_timeout(vctx, VERTO_EV_FLAG_PERSIST, sync_ulog,
+                              (time_t)interval * 1000) == NULL)
+            fail_to_start(ENOMEM, _("scheduling update log sync"));
+
+        iprop_set_wait_loop(vctx);
+
         if (nofork) {
             fprintf(stderr,
                     _("%s: create IPROP svc (PROG=%d, VERS=%d)\n"),
@@ -536,6 +556,12 @@ main(int argc, char *argv[])
         }
     }
 
+    if (!proponly) {
+        ret = worker_init(context, vctx, &params, db_args);
+        if (ret)
+            fail_to_start(ret, _("starting worker threads"));
+    }
+
     if (kprop_port == NULL)
         kprop_port = getenv("KPROP_PORT");
 
@@ -547,6 +573,7 @@ main(int argc, char *argv[])
     krb5_klog_syslog(LOG_INFO, _("finished, exiting"));
 
     /* Clean up memory, etc */
+    worker_fini();
     svcauth_gssapi_unset_names();
     kadm5_destroy(global_server_handle);
     loop_free(vctx);
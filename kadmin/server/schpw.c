@@ -16,43 +16,77 @@
 
 #define RFC3244_VERSION 0xff80
 
+/*
+ * State for a kpasswd request.  The request is parsed and authenticated, and
+ * the reply is built, by the main loop.  If kadmind has worker threads, the
+ * password is first checked by a reader thread, so that requests which fail
+ * authorization or the password quality checks are answered without waiting
+ * for the writer thread, and then changed by the writer thread.  Otherwise
+ * the password is changed by the main loop.
+ */
+struct chpw_req {
+    kadm5_server_handle_t server_handle;
+    const krb5_fulladdr *local_addr;
+    const krb5_fulladdr *remote_addr;
+    loop_respond_fn respond;
+    void *respond_arg;
+    unsigned int vno;
+    krb5_auth_context auth_context;
+    krb5_ticket *ticket;
+    krb5_replay_data replay;
+    krb5_data ap_rep;
+    krb5_principal target;
+    char *clientstr;
+    char *targetstr;
+    char *password;
+    krb5_boolean finished;      /* numresult and strresult are set */
+    int numresult;
+    char strresult[1024];
+};
+
+static void
+free_chpw_req(krb5_context context, struct chpw_req *creq)
+{
+    krb5_auth_con_free(context, creq->auth_context);
+    krb5_free_ticket(context, creq->ticket);
+    free(creq->ap_rep.data);
+    krb5_free_principal(context, creq->target);
+    krb5_free_unparsed_name(context, creq->targetstr);
+    krb5_free_unparsed_name(context, creq->clientstr);
+    if (creq->password != NULL)
+        zapfree(creq->password, strlen(creq->password));
+    free(creq);
+}
+
+/* Set the result code and message to be sent in the reply for creq. */
+static void
+set_result(struct chpw_req *creq, int numresult, const char *strresult)
+{
+    creq->numresult = numresult;
+    strlcpy(creq->strresult, strresult, sizeof(creq->strresult));
+    creq->finished = TRUE;
+}
+
+/*
+ * Parse and authenticate the kpasswd request req into creq.  Return an error
+ * if no reply should be sent.  If the request is invalid but can be answered,
+ * set a result in creq and return 0.
+ */
 static krb5_error_code
-process_chpw_request(krb5_context context, void *server_handle, char *realm,
-                     krb5_keytab keytab, const krb5_fulladdr *local_addr,
-                     const krb5_fulladdr *remote_addr, krb5_data *req,
-                     krb5_data *rep)
+parse_chpw_request(krb5_context context, struct chpw_req *creq,
+                   const char *realm, krb5_keytab keytab, krb5_data *req)
 {
     krb5_error_code ret;
     char *ptr;
     unsigned int plen, vno;
-    krb5_data ap_req, ap_rep = empty_data();
-    krb5_data cipher = empty_data(), clear = empty_data();
-    krb5_auth_context auth_context = NULL;
+    krb5_data ap_req, cipher, clear = empty_data();
     krb5_principal changepw = NULL;
-    krb5_principal client, target = NULL;
-    krb5_ticket *ticket = NULL;
-    krb5_replay_data replay;
-    krb5_error krberror;
-    int numresult;
-    char strresult[1024];
-    char *clientstr = NULL, *targetstr = NULL;
-    const char *errmsg = NULL;
-    size_t clen;
-    char *cdots;
-    struct sockaddr_storage ss;
-    socklen_t salen;
-    char addrbuf[100];
-    krb5_address *addr = remote_addr->address;
-
-    *rep = empty_data();
+    krb5_data *clear_data;
 
     if (req->length < 4) {
         /* either this, or the server is printing bad messages,
            or the caller passed in garbage */
-        ret = KRB5KRB_AP_ERR_MODIFIED;
-        numresult = KRB5_KPASSWD_MALFORMED;
-        strlcpy(strresult, "Request was truncated", sizeof(strresult));
-        goto bailout;
+        return KRB5KRB_AP_ERR_MODIFIED;
     }
 
     ptr = req->data;
@@ -62,89 +96,70 @@ process_chpw_request(krb5_context context, void *server_handle, char *realm,
     plen = (*ptr++ & 0xff);
     plen = (plen<<8) | (*ptr++ & 0xff);
 
-    if (plen != req->length) {
-        ret = KRB5KRB_AP_ERR_MODIFIED;
-        numresult = KRB5_KPASSWD_MALFORMED;
-        strlcpy(strresult, "Request length was inconsistent",
-                sizeof(strresult));
-        goto bailout;
-    }
+    if (plen != req->length)
+        return KRB5KRB_AP_ERR_MODIFIED;
 
     /* verify version number */
 
     vno = (*ptr++ & 0xff) ;
     vno = (vno<<8) | (*ptr++ & 0xff);
 
-    if (vno != 1 && vno != RFC3244_VERSION) {
-        ret = KRB5KDC_ERR_BAD_PVNO;
-        numresult = KRB5_KPASSWD_BAD_VERSION;
-        snprintf(strresult, sizeof(strresult),
-                 "Request contained unknown protocol version number %d", vno);
-        goto bailout;
-    }
+    if (vno != 1 && vno != RFC3244_VERSION)
+        return KRB5KDC_ERR_BAD_PVNO;
+    creq->vno = vno;
 
     /* read, check ap-req length */
 
     ap_req.length = (*ptr++ & 0xff);
     ap_req.length = (ap_req.length<<8) | (*ptr++ & 0xff);
 
-    if (ptr + ap_req.length >= req->data + req->length) {
-        ret = KRB5KRB_AP_ERR_MODIFIED;
-        numresult = KRB5_KPASSWD_MALFORMED;
-        strlcpy(strresult, "Request was truncated in AP-REQ",
-                sizeof(strresult));
-        goto bailout;
-    }
+    if (ptr + ap_req.length >= req->data + req->length)
+        return KRB5KRB_AP_ERR_MODIFIED;
 
     /* verify ap_req */
 
     ap_req.data = ptr;
     ptr += ap_req.length;
 
-    ret = krb5_auth_con_init(context, &auth_context);
+    ret = krb5_auth_con_init(context, &creq->auth_context);
     if (ret) {
-        numresult = KRB5_KPASSWD_HARDERROR;
-        strlcpy(strresult, "Failed initializing auth context",
-                sizeof(strresult));
-        goto chpwfail;
+        set_result(creq, KRB5_KPASSWD_HARDERROR,
+                   "Failed initializing auth context");
+        return 0;
     }
 
-    ret = krb5_auth_con_setflags(context, auth_context,
+    ret = krb5_auth_con_setflags(context, creq->auth_context,
                                  KRB5_AUTH_CONTEXT_DO_SEQUENCE);
     if (ret) {
-        numresult = KRB5_KPASSWD_HARDERROR;
-        strlcpy(strresult, "Failed initializing auth context",
-                sizeof(strresult));
-        goto chpwfail;
+        set_result(creq, KRB5_KPASSWD_HARDERROR,
+                   "Failed initializing auth context");
+        return 0;
     }
 
     ret = krb5_build_principal(context, &changepw, strlen(realm), realm,
                                "kadmin", "changepw", NULL);
     if (ret) {
-        numresult = KRB5_KPASSWD_HARDERROR;
-        strlcpy(strresult, "Failed building kadmin/changepw principal",
-                sizeof(strresult));
-        goto chpwfail;
+        set_result(creq, KRB5_KPASSWD_HARDERROR,
+                   "Failed building kadmin/changepw principal");
+        return 0;
     }
 
-    ret = krb5_rd_req(context, &auth_context, &ap_req, changepw, keytab,
-                      NULL, &ticket);
-
+    ret = krb5_rd_req(context, &creq->auth_context, &ap_req, changepw,
+                      keytab, NULL, &creq->ticket);
+    krb5_free_principal(context, changepw);
     if (ret) {
-        numresult = KRB5_KPASSWD_AUTHERROR;
-        strlcpy(strresult, "Failed reading application request",
-                sizeof(strresult));
-        goto chpwfail;
+        set_result(creq, KRB5_KPASSWD_AUTHERROR,
+                   "Failed reading application request");
+        return 0;
     }
 
     /* construct the ap-rep */
 
-    ret = krb5_mk_rep(context, auth_context, &ap_rep);
+    ret = krb5_mk_rep(context, creq->auth_context, &creq->ap_rep);
     if (ret) {
-        numresult = KRB5_KPASSWD_AUTHERROR;
-        strlcpy(strresult, "Failed replying to application request",
-                sizeof(strresult));
-        goto chpwfail;
+        set_result(creq, KRB5_KPASSWD_AUTHERROR,
+                   "Failed replying to application request");
+        return 0;
     }
 
     /* decrypt the ChangePasswdData */
@@ -160,66 +175,64 @@ process_chpw_request(krb5_context context, void *server_handle, char *realm,
      * since we don't know what interface the request was received on.
      */
 
-    ret = krb5_rd_priv(context, auth_context, &cipher, &clear, &replay);
+    ret = krb5_rd_priv(context, creq->auth_context, &cipher, &clear,
+                       &creq->replay);
     if (ret) {
-        numresult = KRB5_KPASSWD_HARDERROR;
-        strlcpy(strresult, "Failed decrypting request", sizeof(strresult));
-        goto chpwfail;
+        set_result(creq, KRB5_KPASSWD_HARDERROR, "Failed decrypting request");
+        return 0;
     }
 
-    client = ticket->enc_part2->client;
-
     /* decode ChangePasswdData for setpw requests */
     if (vno == RFC3244_VERSION) {
-        krb5_data *clear_data;
-
-        ret = decode_krb5_setpw_req(&clear, &clear_data, &target);
+        ret = decode_krb5_setpw_req(&clear, &clear_data, &creq->target);
+        zapfree(clear.data, clear.length);
         if (ret != 0) {
-            numresult = KRB5_KPASSWD_MALFORMED;
-            strlcpy(strresult, "Failed decoding ChangePasswdData",
-                    sizeof(strresult));
-            goto chpwfail;
+            set_result(creq, KRB5_KPASSWD_MALFORMED,
+                       "Failed decoding ChangePasswdData");
+            return 0;
         }
 
-        zapfree(clear.data, clear.length);
-
         clear = *clear_data;
         free(clear_data);
 
-        if (target != NULL) {
-            ret = krb5_unparse_name(context, target, &targetstr);
+        if (creq->target != NULL) {
+            ret = krb5_unparse_name(context, creq->target, &creq->targetstr);
             if (ret != 0) {
-                numresult = KRB5_KPASSWD_HARDERROR;
-                strlcpy(strresult, "Failed unparsing target name for log",
-                        sizeof(strresult));
-                goto chpwfail;
+                zapfree(clear.data, clear.length);
+                set_result(creq, KRB5_KPASSWD_HARDERROR,
+                           "Failed unparsing target name for log");
+                return 0;
             }
         }
     }
 
-    ret = krb5_unparse_name(context, client, &clientstr);
+    ret = krb5_unparse_name(context, creq->ticket->enc_part2->client,
+                            &creq->clientstr);
     if (ret) {
-        numresult = KRB5_KPASSWD_HARDERROR;
-        strlcpy(strresult, "Failed unparsing client name for log",
-                sizeof(strresult));
-        goto chpwfail;
+        zapfree(clear.data, clear.length);
+        set_result(creq, KRB5_KPASSWD_HARDERROR,
+                   "Failed unparsing client name for log");
+        return 0;
     }
 
-    /* change the password */
-
-    ptr = k5memdup0(clear.data, clear.length, &ret);
-    ret = schpw_util_wrapper(server_handle, client, target,
-                             (ticket->enc_part2->flags & TKT_FLG_INITIAL) != 0,
-                             ptr, NULL, strresult, sizeof(strresult));
-    if (ret)
-        errmsg = krb5_get_error_message(context, ret);
-
-    /* zap the password */
+    creq->password = k5memdup0(clear.data, clear.length, &ret);
     zapfree(clear.data, clear.length);
-    zapfree(ptr, clear.length);
-    clear = empty_data();
+    return ret;
+}
+
+/* Log the result of a password change request. */
+static void
+log_chpw_result(struct chpw_req *creq, const char *errmsg)
+{
+    const krb5_fulladdr *remote_addr = creq->remote_addr;
+    krb5_address *addr = remote_addr->address;
+    size_t clen;
+    char *cdots;
+    struct sockaddr_storage ss;
+    socklen_t salen;
+    char addrbuf[100];
 
-    clen = strlen(clientstr);
+    clen = strlen(creq->clientstr);
     trunc_name(&clen, &cdots);
 
     switch (addr->addrtype) {
@@ -255,36 +268,76 @@ process_chpw_request(krb5_context context, void *server_handle, char *realm,
                     NI_NUMERICHOST | NI_NUMERICSERV) != 0)
         strlcpy(addrbuf, "<unprintable>", sizeof(addrbuf));
 
-    if (vno == RFC3244_VERSION) {
+    if (creq->vno == RFC3244_VERSION) {
         size_t tlen;
         char *tdots;
         const char *targetp;
 
-        if (target == NULL) {
+        if (creq->target == NULL) {
             tlen = clen;
             tdots = cdots;
-            targetp = targetstr;
+            targetp = creq->targetstr;
         } else {
-            tlen = strlen(targetstr);
+            tlen = strlen(creq->targetstr);
             trunc_name(&tlen, &tdots);
-            targetp = clientstr;
+            targetp = creq->clientstr;
         }
 
         krb5_klog_syslog(LOG_NOTICE, _("setpw request from %s by %.*s%s for "
                                        "%.*s%s: %s"), addrbuf, (int) clen,
-                         clientstr, cdots, (int) tlen, targetp, tdots,
+                         creq->clientstr, cdots, (int) tlen, targetp, tdots,
                          errmsg ? errmsg : "success");
     } else {
         krb5_klog_syslog(LOG_NOTICE, _("chpw request from %s for %.*s%s: %s"),
-                         addrbuf, (int) clen, clientstr, cdots,
+                         addrbuf, (int) clen, creq->clientstr, cdots,
                          errmsg ? errmsg : "success");
     }
+}
+
+/*
+ * Change the password for creq using server_handle, and set the result.  If
+ * precheck is true, only perform the checks which do not modify the database,
+ * and leave the result unset if they pass.
+ */
+static void
+change_password(void *server_handle, struct chpw_req *creq,
+                krb5_boolean precheck)
+{
+    kadm5_server_handle_t handle = server_handle;
+    krb5_context context = handle->context;
+    krb5_principal client = creq->ticket->enc_part2->client;
+    krb5_boolean initial;
+    krb5_error_code ret;
+    const char *errmsg = NULL;
+
+    initial = (creq->ticket->enc_part2->flags & TKT_FLG_INITIAL) != 0;
+    if (precheck) {
+        ret = schpw_util_precheck(handle, client, creq->target, initial,
+                                  creq->password, creq->strresult,
+                                  sizeof(creq->strresult));
+        if (ret == 0)
+            return;
+    } else {
+        ret = schpw_util_wrapper(handle, client, creq->target, initial,
+                                 creq->password, NULL, creq->strresult,
+                                 sizeof(creq->strresult));
+    }
+
+    /* zap the password */
+    zapfree(creq->password, strlen(creq->password));
+    creq->password = NULL;
+
+    if (ret)
+        errmsg = krb5_get_error_message(context, ret);
+    log_chpw_result(creq, errmsg);
+    krb5_free_error_message(context, errmsg);
+
     switch (ret) {
     case KADM5_AUTH_CHANGEPW:
-        numresult = KRB5_KPASSWD_ACCESSDENIED;
+        creq->numresult = KRB5_KPASSWD_ACCESSDENIED;
         break;
     case KADM5_AUTH_INITIAL:
-        numresult = KRB5_KPASSWD_INITIAL_FLAG_NEEDED;
+        creq->numresult = KRB5_KPASSWD_INITIAL_FLAG_NEEDED;
         break;
     case KADM5_PASS_Q_TOOSHORT:
     case KADM5_PASS_REUSE:
@@ -292,18 +345,34 @@ process_chpw_request(krb5_context context, void *server_handle, char *realm,
     case KADM5_PASS_Q_DICT:
     case KADM5_PASS_Q_GENERIC:
     case KADM5_PASS_TOOSOON:
-        numresult = KRB5_KPASSWD_SOFTERROR;
+        creq->numresult = KRB5_KPASSWD_SOFTERROR;
         break;
     case 0:
-        numresult = KRB5_KPASSWD_SUCCESS;
-        strlcpy(strresult, "", sizeof(strresult));
+        creq->numresult = KRB5_KPASSWD_SUCCESS;
+        strlcpy(creq->strresult, "", sizeof(creq->strresult));
         break;
     default:
-        numresult = KRB5_KPASSWD_HARDERROR;
+        creq->numresult = KRB5_KPASSWD_HARDERROR;
         break;
     }
+    creq->finished = TRUE;
+}
+
+/* Construct the kpasswd reply for the result in creq. */
+static krb5_error_code
+build_chpw_reply(krb5_context context, struct chpw_req *creq,
+                 const char *realm, krb5_data *rep)
+{
+    krb5_error_code ret;
+    char *ptr;
+    krb5_data ap_rep = creq->ap_rep;
+    krb5_data cipher = empty_data(), clear = empty_data();
+    krb5_error krberror;
+    int numresult = creq->numresult;
+    char *strresult = creq->strresult;
+    size_t strsize = sizeof(creq->strresult);
 
-chpwfail:
+    *rep = empty_data();
 
     ret = alloc_data(&clear, 2 + strlen(strresult));
     if (ret)
@@ -316,23 +385,20 @@ chpwfail:
 
     memcpy(ptr, strresult, strlen(strresult));
 
-    cipher = empty_data();
-
     if (ap_rep.length) {
-        ret = krb5_auth_con_setaddrs(context, auth_context,
-                                     local_addr->address, NULL);
+        ret = krb5_auth_con_setaddrs(context, creq->auth_context,
+                                     creq->local_addr->address, NULL);
         if (ret) {
             numresult = KRB5_KPASSWD_HARDERROR;
             strlcpy(strresult,
                     "Failed storing client and server internet addresses",
-                    sizeof(strresult));
+                    strsize);
         } else {
-            ret = krb5_mk_priv(context, auth_context, &clear, &cipher,
-                               &replay);
+            ret = krb5_mk_priv(context, creq->auth_context, &clear, &cipher,
+                               &creq->replay);
             if (ret) {
                 numresult = KRB5_KPASSWD_HARDERROR;
-                strlcpy(strresult, "Failed encrypting reply",
-                        sizeof(strresult));
+                strlcpy(strresult, "Failed encrypting reply", strsize);
             }
         }
     }
@@ -344,10 +410,7 @@ chpwfail:
         /* clear out ap_rep now, so that it won't be inserted in the
            reply */
 
-        if (ap_rep.length) {
-            free(ap_rep.data);
-            ap_rep = empty_data();
-        }
+        ap_rep = empty_data();
 
         krberror.ctime = 0;
         krberror.cusec = 0;
@@ -415,19 +478,67 @@ chpwfail:
     memcpy(ptr, cipher.data, cipher.length);
 
 bailout:
-    krb5_auth_con_free(context, auth_context);
-    krb5_free_principal(context, changepw);
-    krb5_free_ticket(context, ticket);
-    free(ap_rep.data);
     free(clear.data);
     free(cipher.data);
-    krb5_free_principal(context, target);
-    krb5_free_unparsed_name(context, targetstr);
-    krb5_free_unparsed_name(context, clientstr);
-    krb5_free_error_message(context, errmsg);
     return ret;
 }
 
+/* Send the reply for creq (or no reply if code is set) and free it. */
+static void
+finish_chpw_request(struct chpw_req *creq, krb5_error_code code)
+{
+    kadm5_server_handle_t server_handle = creq->server_handle;
+    krb5_context context = server_handle->context;
+    krb5_data *response = NULL;
+
+    if (code == 0) {
+        response = k5alloc(sizeof(*response), &code);
+        if (response != NULL) {
+            code = build_chpw_reply(context, creq, server_handle->params.realm,
+                                    response);
+        }
+        if (code) {
+            krb5_free_data(context, response);
+            response = NULL;
+        }
+    }
+    (*creq->respond)(creq->respond_arg, code, response, NULL);
+    free_chpw_req(context, creq);
+}
+
+static void
+precheck_task(void *handle, void *arg)
+{
+    change_password(handle, arg, TRUE);
+}
+
+static void
+change_task(void *handle, void *arg)
+{
+    change_password(handle, arg, FALSE);
+}
+
+static void
+change_done(void *arg)
+{
+    finish_chpw_request(arg, 0);
+}
+
+static void
+precheck_done(void *arg)
+{
+    struct chpw_req *creq = arg;
+
+    if (!creq->finished) {
+        if (worker_submit_task(change_task, change_done, creq, TRUE))
+            return;
+        worker_lock_db();
+        change_password(creq->server_handle, creq, FALSE);
+        worker_unlock_db();
+    }
+    finish_chpw_request(creq, 0);
+}
+
 /* Dispatch routine for set/change password */
 void
 dispatch(void *handle, const krb5_fulladdr *local_addr,
@@ -437,9 +548,20 @@ dispatch(void *handle, const krb5_fulladdr *local_addr,
     krb5_error_code ret;
     krb5_keytab kt = NULL;
     kadm5_server_handle_t server_handle = *(void **)handle;
-    krb5_data *response = NULL;
+    struct chpw_req *creq;
     const char *emsg;
 
+    creq = k5alloc(sizeof(*creq), &ret);
+    if (creq == NULL) {
+        (*respond)(arg, ret, NULL, NULL);
+        return;
+    }
+    creq->server_handle = server_handle;
+    creq->local_addr = local_addr;
+    creq->remote_addr = remote_addr;
+    creq->respond = respond;
+    creq->respond_arg = arg;
+
     ret = krb5_kt_resolve(server_handle->context, "KDB:", &kt);
     if (ret != 0) {
         emsg = krb5_get_error_message(server_handle->context, ret);
@@ -449,21 +571,22 @@ dispatch(void *handle, const krb5_fulladdr *local_addr,
         goto egress;
     }
 
-    response = k5alloc(sizeof(krb5_data), &ret);
-    if (response == NULL)
+    worker_lock_db();
+    ret = parse_chpw_request(server_handle->context, creq,
+                             server_handle->params.realm, kt, request);
+    worker_unlock_db();
+    krb5_kt_close(server_handle->context, kt);
+    if (ret || creq->finished)
         goto egress;
 
-    ret = process_chpw_request(server_handle->context,
-                               server_handle,
-                               server_handle->params.realm,
-                               kt,
-                               local_addr,
-                               remote_addr,
-                               request,
-                               response);
+    /* Check and change the password on the worker threads if there are
+     * any. */
+    if (worker_submit_task(precheck_task, precheck_done, creq, FALSE))
+        return;
+    worker_lock_db();
+    change_password(server_handle, creq, FALSE);
+    worker_unlock_db();
+
 egress:
-    if (ret)
-        krb5_free_data(server_handle->context, response);
-    krb5_kt_close(server_handle->context, kt);
-    (*respond)(arg, ret, ret == 0 ? response : NULL, NULL);
+    finish_chpw_request(creq, ret);
 }
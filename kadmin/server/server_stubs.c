@@ -114,7 +114,7 @@ static kadm5_ret_t new_server_handle(krb5_ui_4 api_version,
            malloc(sizeof(*handle))))
         return ENOMEM;
 
-    *handle = *(kadm5_server_handle_t)global_server_handle;
+    *handle = *(kadm5_server_handle_t)current_server_handle();
     handle->api_version = api_version;
 
     if (! gss_to_krb5_name(handle, rqst2name(rqstp),
@@ -143,21 +143,27 @@ static void free_server_handle(kadm5_server_handle_t handle)
     free(handle);
 }
 
-/* Result is stored in a static buffer and is invalidated by the next call. */
+/* Result is stored in a static (or, in a worker thread, per-thread) buffer
+ * and is invalidated by the next call. */
 const char *
 client_addr(SVCXPRT *xprt)
 {
-    static char abuf[128];
+    static char sbuf[CLIENT_ADDR_BUFSIZE];
+    char *abuf = worker_addr_buf();
     struct sockaddr_storage ss;
     socklen_t len = sizeof(ss);
     const char *p = NULL;
 
+    if (abuf == NULL)
+        abuf = sbuf;
     if (getpeername(xprt->xp_sock, ss2sa(&ss), &len) != 0)
         return "(unknown)";
     if (ss2sa(&ss)->sa_family == AF_INET)
-        p = inet_ntop(AF_INET, &ss2sin(&ss)->sin_addr, abuf, sizeof(abuf));
+        p = inet_ntop(AF_INET, &ss2sin(&ss)->sin_addr, abuf,
+                      CLIENT_ADDR_BUFSIZE);
     else if (ss2sa(&ss)->sa_family == AF_INET6)
-        p = inet_ntop(AF_INET6, &ss2sin6(&ss)->sin6_addr, abuf, sizeof(abuf));
+        p = inet_ntop(AF_INET6, &ss2sin6(&ss)->sin6_addr, abuf,
+                      CLIENT_ADDR_BUFSIZE);
     return (p == NULL) ? "(unknown)" : p;
 }
 
@@ -624,6 +630,250 @@ exit_func:
     return TRUE;
 }
 
+
+/*
+ * Service a batch of creates or modifies.  Authorization is checked and logged
+ * per item; the authorized items are then applied together so that they
+ * share one database lock and one update log flush.
+ */
+static void
+batch_principals(bprinc_arg *arg, bprinc_ret *ret, struct svc_req *rqstp,
+                 krb5_boolean create)
+{
+    gss_buffer_desc                 client_name = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc                 service_name = GSS_C_EMPTY_BUFFER;
+    kadm5_server_handle_t           handle;
+    kadm5_principal_op_t            op, allowed = NULL;
+    kadm5_ret_t                     *codes = NULL;
+    const char                      *errmsg;
+    char                            **names = NULL;
+    char                            *opname;
+    int                             i, n, *idx = NULL, count = arg->count;
+
+    opname = create ? "kadm5_create_principal" : "kadm5_modify_principal";
+    ret->code = stub_setup(arg->api_version, rqstp, NULL, &handle,
+                           &ret->api_version, &client_name, &service_name,
+                           NULL);
+    if (ret->code)
+        goto exit_func;
+
+    if (count < 0) {
+        ret->code = EINVAL;
+        goto exit_func;
+    }
+    ret->codes = calloc(count + 1, sizeof(*ret->codes));
+    names = calloc(count + 1, sizeof(*names));
+    allowed = calloc(count + 1, sizeof(*allowed));
+    idx = calloc(count + 1, sizeof(*idx));
+    codes = calloc(count + 1, sizeof(*codes));
+    if (ret->codes == NULL || names == NULL || allowed == NULL ||
+        idx == NULL || codes == NULL) {
+        ret->code = ENOMEM;
+        goto exit_func;
+    }
+    ret->count = count;
+
+    for (i = n = 0; i < count; i++) {
+        op = &arg->ops[i];
+        if (op->rec.principal == NULL ||
+            krb5_unparse_name(handle->context, op->rec.principal,
+                              &names[i]) != 0) {
+            ret->codes[i] = KADM5_BAD_PRINCIPAL;
+            continue;
+        }
+
+        if (CHANGEPW_SERVICE(rqstp) ||
+            !stub_auth_restrict(handle, create ? OP_ADDPRINC : OP_MODPRINC,
+                                &op->rec, &op->mask)) {
+            ret->codes[i] = create ? KADM5_AUTH_ADD : KADM5_AUTH_MODIFY;
+            log_unauth(opname, names[i], &client_name, &service_name, rqstp);
+            continue;
+        }
+        if (!create && (op->mask & KADM5_ATTRIBUTES) &&
+            !(op->rec.attributes & KRB5_KDB_LOCKDOWN_KEYS)) {
+            ret->codes[i] = check_lockdown_keys(handle, op->rec.principal);
+            if (ret->codes[i] == KADM5_PROTECT_KEYS) {
+                log_unauth(opname, names[i], &client_name, &service_name,
+                           rqstp);
+                ret->codes[i] = KADM5_AUTH_MODIFY;
+            }
+            if (ret->codes[i] != KADM5_OK)
+                continue;
+        }
+        allowed[n] = *op;
+        idx[n++] = i;
+    }
+
+    if (create)
+        ret->code = kadm5_create_principals(handle, allowed, n, codes);
+    else
+        ret->code = kadm5_modify_principals(handle, allowed, n, codes);
+    if (ret->code)
+        goto exit_func;
+
+    for (i = 0; i < n; i++) {
+        ret->codes[idx[i]] = codes[i];
+        errmsg = NULL;
+        if (codes[i] != 0)
+            errmsg = krb5_get_error_message(handle->context, codes[i]);
+        log_done(opname, names[idx[i]], errmsg, &client_name, &service_name,
+                 rqstp);
+        if (errmsg != NULL)
+            krb5_free_error_message(handle->context, errmsg);
+    }
+
+exit_func:
+    if (ret->code) {
+        free(ret->codes);
+        ret->codes = NULL;
+        ret->count = 0;
+    }
+    if (names != NULL) {
+        for (i = 0; i < count; i++)
+            krb5_free_unparsed_name(handle->context, names[i]);
+        free(names);
+    }
+    free(allowed);
+    free(idx);
+    free(codes);
+    stub_cleanup(handle, NULL, &client_name, &service_name);
+}
+
+bool_t
+create_principals_2_svc(bprinc_arg *arg, bprinc_ret *ret,
+                        struct svc_req *rqstp)
+{
+    batch_principals(arg, ret, rqstp, TRUE);
+    return TRUE;
+}
+
+bool_t
+modify_principals_2_svc(bprinc_arg *arg, bprinc_ret *ret,
+                        struct svc_req *rqstp)
+{
+    batch_principals(arg, ret, rqstp, FALSE);
+    return TRUE;
+}
+
+/*
+ * Service a batch of key randomizations.  As with batch_principals(),
+ * authorization is checked and logged per item and the authorized items are
+ * applied together.  Keys are not returned for principals with the lockdown
+ * attribute.
+ */
+bool_t
+randkey_principals_2_svc(brandkey_arg *arg, brandkey_ret *ret,
+                         struct svc_req *rqstp)
+{
+    gss_buffer_desc                 client_name = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc                 service_name = GSS_C_EMPTY_BUFFER;
+    kadm5_server_handle_t           handle;
+    kadm5_principal_keys_t          results = NULL, res;
+    krb5_principal                  *allowed = NULL;
+    kadm5_ret_t                     code;
+    const char                      *errmsg;
+    char                            **names = NULL;
+    char                            *funcname = "kadm5_randkey_principal";
+    int                             i, n, *idx = NULL, count = arg->count;
+
+    ret->code = stub_setup(arg->api_version, rqstp, NULL, &handle,
+                           &ret->api_version, &client_name, &service_name,
+                           NULL);
+    if (ret->code)
+        goto exit_func;
+
+    if (count < 0) {
+        ret->code = EINVAL;
+        goto exit_func;
+    }
+    ret->results = calloc(count + 1, sizeof(*ret->results));
+    names = calloc(count + 1, sizeof(*names));
+    allowed = calloc(count + 1, sizeof(*allowed));
+    idx = calloc(count + 1, sizeof(*idx));
+    results = calloc(count + 1, sizeof(*results));
+    if (ret->results == NULL || names == NULL || allowed == NULL ||
+        idx == NULL || results == NULL) {
+        ret->code = ENOMEM;
+        goto exit_func;
+    }
+    ret->count = count;
+
+    for (i = n = 0; i < count; i++) {
+        if (arg->princs[i] == NULL ||
+            krb5_unparse_name(handle->context, arg->princs[i],
+                              &names[i]) != 0) {
+            ret->results[i].code = KADM5_BAD_PRINCIPAL;
+            continue;
+        }
+
+        if (changepw_not_self(handle, rqstp, arg->princs[i]) ||
+            !stub_auth(handle, OP_CHRAND, arg->princs[i], NULL, NULL, NULL)) {
+            ret->results[i].code = KADM5_AUTH_CHANGEPW;
+            log_unauth(funcname, names[i], &client_name, &service_name,
+                       rqstp);
+            continue;
+        }
+        code = check_self_keychange(handle, rqstp, arg->princs[i]);
+        if (code) {
+            ret->results[i].code = code;
+            errmsg = krb5_get_error_message(handle->context, code);
+            log_done(funcname, names[i], errmsg, &client_name, &service_name,
+                     rqstp);
+            krb5_free_error_message(handle->context, errmsg);
+            continue;
+        }
+        allowed[n] = arg->princs[i];
+        idx[n++] = i;
+    }
+
+    ret->code = kadm5_randkey_principals(handle, allowed, n, arg->keepold,
+                                         arg->n_ks_tuple, arg->ks_tuple,
+                                         results);
+    if (ret->code)
+        goto exit_func;
+
+    for (i = 0; i < n; i++) {
+        res = &results[i];
+        if (res->code == 0) {
+            code = check_lockdown_keys(handle, allowed[i]);
+            if (code) {
+                kadm5_free_kadm5_key_data(handle->context, res->n_key_data,
+                                          res->key_data);
+                res->key_data = NULL;
+                res->n_key_data = 0;
+                if (code != KADM5_PROTECT_KEYS)
+                    res->code = code;
+            }
+        }
+        ret->results[idx[i]] = *res;
+
+        errmsg = NULL;
+        if (res->code != 0)
+            errmsg = krb5_get_error_message(handle->context, res->code);
+        log_done(funcname, names[idx[i]], errmsg, &client_name, &service_name,
+                 rqstp);
+        if (errmsg != NULL)
+            krb5_free_error_message(handle->context, errmsg);
+    }
+
+exit_func:
+    if (ret->code) {
+        free(ret->results);
+        ret->results = NULL;
+        ret->count = 0;
+    }
+    if (names != NULL) {
+        for (i = 0; i < count; i++)
+            krb5_free_unparsed_name(handle->context, names[i]);
+        free(names);
+    }
+    free(allowed);
+    free(idx);
+    free(results);
+    stub_cleanup(handle, NULL, &client_name, &service_name);
+    return TRUE;
+}
+
 bool_t
 rename_principal_2_svc(rprinc_arg *arg, generic_ret *ret,
                        struct svc_req *rqstp)
@@ -792,6 +1042,54 @@ exit_func:
     return TRUE;
 }
 
+bool_t
+get_princs_page_2_svc(gprincs_page_arg *arg, gprincs_page_ret *ret,
+                      struct svc_req *rqstp)
+{
+    char                            *prime_arg = NULL;
+    gss_buffer_desc                 client_name = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc                 service_name = GSS_C_EMPTY_BUFFER;
+    kadm5_server_handle_t           handle;
+    const char                      *errmsg = NULL;
+
+    ret->code = stub_setup(arg->api_version, rqstp, NULL, &handle,
+                           &ret->api_version, &client_name, &service_name,
+                           NULL);
+    if (ret->code)
+        goto exit_func;
+
+    prime_arg = arg->exp;
+    if (prime_arg == NULL)
+        prime_arg = "*";
+
+    if (CHANGEPW_SERVICE(rqstp) ||
+        !stub_auth(handle, OP_LISTPRINCS, NULL, NULL, NULL, NULL)) {
+        ret->code = KADM5_AUTH_LIST;
+        log_unauth("kadm5_get_principals", prime_arg,
+                   &client_name, &service_name, rqstp);
+    } else {
+        ret->code = kadm5_get_principals_page(handle, arg->exp, arg->cursor,
+                                              arg->max, &ret->princs,
+                                              &ret->count,
+                                              &ret->next_cursor);
+        if (ret->code != 0)
+            errmsg = krb5_get_error_message(handle->context, ret->code);
+
+        /* Log only the first page of a listing. */
+        if (arg->cursor == NULL || ret->code != 0) {
+            log_done("kadm5_get_principals", prime_arg, errmsg,
+                     &client_name, &service_name, rqstp);
+        }
+
+        if (errmsg != NULL)
+            krb5_free_error_message(handle->context, errmsg);
+    }
+
+exit_func:
+    stub_cleanup(handle, NULL, &client_name, &service_name);
+    return TRUE;
+}
+
 bool_t
 chpass_principal_2_svc(chpass_arg *arg, generic_ret *ret,
                        struct svc_req *rqstp)
@@ -0,0 +1,159 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kadmin/server/t_aclperf.c - ACL module lookup performance harness */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This file contains a harness to measure the cost of authorization checks
+ * against a large generated ACL file, modeled on a site with many delegated
+ * administrators.  Sample usage:
+ *
+ *     ./t_aclperf 5000 1000000
+ *
+ * This writes an ACL file with five thousand lines granting deleg<n>/admin
+ * inquire, list, and changepw access to any two-component principal with
+ * second component ou<n>, followed by a few wildcard lines, and then performs
+ * a million getprinc authorization checks.  Half of the checks are for a
+ * target in the administrator's own organizational unit and succeed; the
+ * other half are for a different unit, which can only be denied after
+ * considering every entry.
+ * The results are verified against the expected answers.  Run the command
+ * under "time" to measure how much time is used by the checks.
+ */
+
+#include "k5-int.h"
+#include <kadm5/admin.h>
+#include <krb5/kadm5_auth_plugin.h>
+#include "auth.h"
+
+#define ACL_FILE "t_aclperf.acl"
+
+static void
+check(krb5_error_code code)
+{
+    if (code != 0) {
+        com_err("t_aclperf", code, NULL);
+        abort();
+    }
+}
+
+static void
+write_acl(int nentries)
+{
+    FILE *fp;
+    int i;
+
+    fp = fopen(ACL_FILE, "w");
+    assert(fp != NULL);
+    fprintf(fp, "# Generated by t_aclperf\n");
+    fprintf(fp, "root/admin@KRBTEST.COM  *\n");
+    for (i = 0; i < nentries; i++)
+        fprintf(fp, "deleg%d/admin@KRBTEST.COM  ilc  */ou%d@KRBTEST.COM\n",
+                i, i);
+    fprintf(fp, "*/admin@KRBTEST.COM  l\n");
+    fprintf(fp, "*/*@OTHER.COM  i  */service@*\n");
+    fprintf(fp, "*  i  *@KRBTEST.COM\n");
+    assert(fclose(fp) == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    krb5_context ctx;
+    struct kadm5_auth_vtable_st vt;
+    kadm5_auth_moddata data;
+    krb5_principal *clients, *targets, client, target;
+    krb5_error_code ret;
+    char name[128];
+    int nentries, nlookups, i, n;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: t_aclperf nentries nlookups\n");
+        exit(1);
+    }
+    nentries = atoi(argv[1]);
+    nlookups = atoi(argv[2]);
+    assert(nentries > 1 && nlookups > 0);
+
+    check(krb5_init_context(&ctx));
+    write_acl(nentries);
+
+    memset(&vt, 0, sizeof(vt));
+    check(kadm5_auth_acl_initvt(ctx, 1, 1, (krb5_plugin_vtable)&vt));
+    check(vt.init(ctx, ACL_FILE, &data));
+    unlink(ACL_FILE);
+
+    clients = k5calloc(nentries, sizeof(*clients), &ret);
+    check(ret);
+    targets = k5calloc(nentries, sizeof(*targets), &ret);
+    check(ret);
+    for (i = 0; i < nentries; i++) {
+        snprintf(name, sizeof(name), "deleg%d/admin@KRBTEST.COM", i);
+        check(krb5_parse_name(ctx, name, &clients[i]));
+        snprintf(name, sizeof(name), "user%d/ou%d@KRBTEST.COM", i, i);
+        check(krb5_parse_name(ctx, name, &targets[i]));
+    }
+
+    for (i = 0; i < nlookups; i++) {
+        n = (i / 2) % nentries;
+        if (i % 2 == 0) {
+            ret = vt.getprinc(ctx, data, clients[n], targets[n]);
+            assert(ret == 0);
+        } else {
+            ret = vt.getprinc(ctx, data, clients[n],
+                              targets[(n + 1) % nentries]);
+            assert(ret == KRB5_PLUGIN_NO_HANDLE);
+        }
+    }
+
+    /* Spot-check the wildcard lines. */
+    assert(vt.listprincs(ctx, data, clients[0]) == 0);
+    check(krb5_parse_name(ctx, "a/b@OTHER.COM", &client));
+    check(krb5_parse_name(ctx, "host/service@KRBTEST.COM", &target));
+    assert(vt.getprinc(ctx, data, client, target) == 0);
+    krb5_free_principal(ctx, client);
+    check(krb5_parse_name(ctx, "a@OTHER.COM", &client));
+    assert(vt.getprinc(ctx, data, client, target) == KRB5_PLUGIN_NO_HANDLE);
+    krb5_free_principal(ctx, target);
+    check(krb5_parse_name(ctx, "a@KRBTEST.COM", &target));
+    assert(vt.getprinc(ctx, data, client, target) == 0);
+    krb5_free_principal(ctx, client);
+    krb5_free_principal(ctx, target);
+
+    for (i = 0; i < nentries; i++) {
+        krb5_free_principal(ctx, clients[i]);
+        krb5_free_principal(ctx, targets[i]);
+    }
+    free(clients);
+    free(targets);
+    vt.fini(ctx, data);
+    krb5_free_context(ctx);
+    return 0;
+}
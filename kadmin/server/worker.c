@@ -0,0 +1,631 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* kadmin/server/worker.c - Worker threads for kadmin RPC requests */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * When kadmind_workers is set, kadmin RPC requests are decoded and answered
+ * on the main loop as usual, but the work in between is done by a pool of
+ * threads.  Read-only requests are spread across kadmind_workers reader
+ * threads; requests which modify the database are run in order by a single
+ * writer thread, which also owns the update log mapping used to record them.
+ * Each thread has its own krb5 context and kadm5 server handle, so the only
+ * state shared with the main loop is the job queues below.
+ *
+ * The DB2 module serializes its calls with a process-wide mutex but takes its
+ * file locks per database handle, so a reader holding a shared lock across an
+ * iteration, or the writer holding an exclusive lock across a batch, could
+ * deadlock against another thread waiting for that lock inside the mutex.
+ * To avoid that, the writer does not run a request while any reader is
+ * running one.  Main loop code which uses the database through the global
+ * server handle, such as kpasswd request parsing, takes the same lock as a
+ * writer (see worker_lock_db()).
+ *
+ * While a request is being worked on, its RPC connection is held by the main
+ * loop (see loop_hold_rpc_connection()), so the transport, its GSS context,
+ * and the reply state saved from the request stay untouched until the main
+ * loop sends the reply.
+ *
+ * Other work can be submitted as a task, which is a function run by a worker
+ * thread with its server handle, followed by a completion function run by the
+ * main loop.  kpasswd requests are handled this way (see schpw.c).
+ */
+
+#include <k5-int.h>
+#include <syslog.h>
+#include <gssrpc/rpc.h>
+#include <kadm5/admin.h>
+#include <kadm5/server_internal.h>
+#include <adm_proto.h>
+#include <kdb_log.h>
+#include "misc.h"
+
+#if defined(ENABLE_THREADS) && defined(HAVE_PTHREAD)
+
+#include <pthread.h>
+#include <signal.h>
+
+/* How often to log queue statistics, in milliseconds. */
+#define STATS_INTERVAL_MS       (60 * 1000)
+
+extern void *global_server_handle;
+
+struct job {
+    struct job *next;
+    struct svc_req rqst;
+    SVCXPRT *xprt;
+    SVCAUTH *auth;
+    int fd;
+    krb5_boolean write;
+    bool_t (*local)();
+    xdrproc_t xdr_argument;
+    xdrproc_t xdr_result;
+    void *argument;
+    void *result;
+    bool_t retval;
+    void (*run)(void *handle, void *arg);
+    void (*done)(void *arg);
+    void *arg;
+    struct timeval queued;
+};
+
+struct job_queue {
+    struct job *head;
+    struct job **tailp;
+    unsigned int depth;
+    unsigned int max_depth;
+    pthread_cond_t cond;
+};
+
+struct worker {
+    pthread_t thread;
+    krb5_context context;
+    void *handle;
+    struct job_queue *queue;
+    krb5_boolean started;
+    char addrbuf[CLIENT_ADDR_BUFSIZE];
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t db_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_key_t worker_key;
+static struct job_queue read_queue, write_queue;
+static struct job *done_list;
+static krb5_boolean shutting_down;
+static int done_pipe[2] = { -1, -1 };
+
+static struct worker *workers;
+static int nworkers;
+
+/* Counters since the last statistics message, protected by queue_lock. */
+static unsigned long nreads, nwrites;
+static unsigned long long total_wait_us;
+
+static void
+queue_init(struct job_queue *q)
+{
+    q->head = NULL;
+    q->tailp = &q->head;
+    q->depth = q->max_depth = 0;
+    pthread_cond_init(&q->cond, NULL);
+}
+
+/* Append job to q.  queue_lock must be held. */
+static void
+queue_push(struct job_queue *q, struct job *job)
+{
+    job->next = NULL;
+    *q->tailp = job;
+    q->tailp = &job->next;
+    if (++q->depth > q->max_depth)
+        q->max_depth = q->depth;
+    pthread_cond_signal(&q->cond);
+}
+
+/* Remove and return the first job on q.  queue_lock must be held. */
+static struct job *
+queue_pop(struct job_queue *q)
+{
+    struct job *job = q->head;
+
+    q->head = job->next;
+    if (q->head == NULL)
+        q->tailp = &q->head;
+    q->depth--;
+    return job;
+}
+
+static void
+free_job(struct job *job)
+{
+    if (job == NULL)
+        return;
+    free(job->argument);
+    free(job->result);
+    free(job);
+}
+
+static long long
+elapsed_us(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000LL +
+        (now.tv_usec - start->tv_usec);
+}
+
+/* Wait for a job on w's queue.  Return NULL if the pool is shutting down.
+ * The writer thread flushes deferred update log writes when it has been idle
+ * for the sync interval. */
+static struct job *
+next_job(struct worker *w)
+{
+    struct job_queue *q = w->queue;
+    struct timespec ts;
+    krb5_deltat interval = 0;
+    struct job *job;
+    int st;
+
+    if (q == &write_queue)
+        interval = ulog_get_sync_interval(w->context);
+
+    pthread_mutex_lock(&queue_lock);
+    while (q->head == NULL && !shutting_down) {
+        if (interval > 0) {
+            ts.tv_sec = time(NULL) + interval;
+            ts.tv_nsec = 0;
+            st = pthread_cond_timedwait(&q->cond, &queue_lock, &ts);
+            if (st == ETIMEDOUT) {
+                pthread_mutex_unlock(&queue_lock);
+                ulog_sync(w->context);
+                pthread_mutex_lock(&queue_lock);
+            }
+        } else {
+            pthread_cond_wait(&q->cond, &queue_lock);
+        }
+    }
+    job = shutting_down ? NULL : queue_pop(q);
+    if (job != NULL) {
+        total_wait_us += elapsed_us(&job->queued);
+        if (job->write)
+            nwrites++;
+        else
+            nreads++;
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return job;
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct job *job;
+    ssize_t st;
+
+    pthread_setspecific(worker_key, w);
+    while ((job = next_job(w)) != NULL) {
+        if (job->write)
+            pthread_rwlock_wrlock(&db_rwlock);
+        else
+            pthread_rwlock_rdlock(&db_rwlock);
+        if (job->run != NULL)
+            (*job->run)(w->handle, job->arg);
+        else
+            job->retval = (*job->local)(job->argument, job->result,
+                                        &job->rqst);
+        pthread_rwlock_unlock(&db_rwlock);
+
+        pthread_mutex_lock(&queue_lock);
+        job->next = done_list;
+        done_list = job;
+        pthread_mutex_unlock(&queue_lock);
+        do {
+            st = write(done_pipe[1], "", 1);
+        } while (st < 0 && errno == EINTR);
+    }
+    if (w->queue == &write_queue)
+        ulog_sync(w->context);
+    return NULL;
+}
+
+/* Send the reply for a completed job and let its connection be read from
+ * again. */
+static void
+finish_job(struct job *job)
+{
+    SVCXPRT *xprt = job->xprt;
+    SVCAUTH *saved_auth;
+
+    /* The dispatcher clears xp_auth after each AUTH_GSSAPI request; put back
+     * the one the request arrived with so the reply is wrapped with it. */
+    saved_auth = xprt->xp_auth;
+    xprt->xp_auth = job->auth;
+    if (job->retval &&
+        !svc_sendreply(xprt, job->xdr_result, job->result)) {
+        krb5_klog_syslog(LOG_ERR, "WARNING! Unable to send function results, "
+                         "continuing.");
+        svcerr_systemerr(xprt);
+    }
+    xprt->xp_auth = saved_auth;
+    if (!svc_freeargs(xprt, job->xdr_argument, job->argument)) {
+        krb5_klog_syslog(LOG_ERR, "WARNING! Unable to free arguments, "
+                         "continuing.");
+    }
+    if (!svc_freeargs(xprt, job->xdr_result, job->result)) {
+        krb5_klog_syslog(LOG_ERR, "WARNING! Unable to free results, "
+                         "continuing.");
+    }
+    loop_release_rpc_connection(job->fd);
+}
+
+/* Main loop callback for the completion pipe. */
+static void
+process_done(verto_ctx *ctx, verto_ev *ev)
+{
+    struct job *list, *job, *rev = NULL;
+    krb5_boolean wrote = FALSE;
+    char buf[64];
+
+    while (read(done_pipe[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&queue_lock);
+    list = done_list;
+    done_list = NULL;
+    pthread_mutex_unlock(&queue_lock);
+
+    /* Answer in completion order. */
+    while (list != NULL) {
+        job = list;
+        list = job->next;
+        job->next = rev;
+        rev = job;
+    }
+    while (rev != NULL) {
+        job = rev;
+        rev = job->next;
+        wrote = wrote || job->write;
+        if (job->done != NULL)
+            (*job->done)(job->arg);
+        else
+            finish_job(job);
+        free_job(job);
+    }
+
+    /* Push any updates just logged to replicas waiting for one. */
+    if (wrote)
+        iprop_check_waiters();
+}
+
+/* Periodically log how busy the worker queues have been. */
+static void
+log_stats(verto_ctx *ctx, verto_ev *ev)
+{
+    unsigned long reads, writes;
+    unsigned int rdepth, wdepth, rmax, wmax;
+    unsigned long long wait_us;
+
+    pthread_mutex_lock(&queue_lock);
+    reads = nreads;
+    writes = nwrites;
+    wait_us = total_wait_us;
+    rdepth = read_queue.depth;
+    wdepth = write_queue.depth;
+    rmax = read_queue.max_depth;
+    wmax = write_queue.max_depth;
+    nreads = nwrites = 0;
+    total_wait_us = 0;
+    read_queue.max_depth = rdepth;
+    write_queue.max_depth = wdepth;
+    pthread_mutex_unlock(&queue_lock);
+
+    if (reads + writes == 0)
+        return;
+    krb5_klog_syslog(LOG_INFO, _("worker queues: %lu reads, %lu writes, "
+                                 "read depth %u (max %u), write depth %u "
+                                 "(max %u), average wait %llu.%03llu ms"),
+                     reads, writes, rdepth, rmax, wdepth, wmax,
+                     wait_us / (reads + writes) / 1000,
+                     wait_us / (reads + writes) % 1000);
+}
+
+/* Create a server handle for a worker thread, with its own krb5 context. */
+static krb5_error_code
+init_worker(struct worker *w, kadm5_config_params *params, char **db_args,
+            krb5_boolean writer)
+{
+    krb5_error_code ret;
+
+    ret = kadm5_init_krb5_context(&w->context);
+    if (ret)
+        return ret;
+    ret = kadm5_init(w->context, "kadmind", NULL, NULL, params,
+                     KADM5_STRUCT_VERSION, KADM5_API_VERSION_4, db_args,
+                     &w->handle);
+    if (ret)
+        return ret;
+    w->queue = writer ? &write_queue : &read_queue;
+    if (writer)
+        return kadm5_init_iprop(w->handle, db_args);
+    return 0;
+}
+
+/* Start the number of reader threads given by the kadmind_workers realm
+ * relation, plus a writer thread, if it is positive. */
+krb5_error_code
+worker_init(krb5_context context, verto_ctx *vctx,
+            kadm5_config_params *params, char **db_args)
+{
+    krb5_error_code ret;
+    sigset_t all, old;
+    int i, nreaders;
+
+    ret = profile_get_integer(context->profile, KRB5_CONF_REALMS,
+                              params->realm, KRB5_CONF_KADMIND_WORKERS, 0,
+                              &nreaders);
+    if (ret || nreaders <= 0)
+        return ret;
+
+    queue_init(&read_queue);
+    queue_init(&write_queue);
+    ret = pthread_key_create(&worker_key, NULL);
+    if (ret)
+        return ret;
+    if (pipe(done_pipe) != 0)
+        return errno;
+    set_cloexec_fd(done_pipe[0]);
+    set_cloexec_fd(done_pipe[1]);
+    if (fcntl(done_pipe[0], F_SETFL, O_NONBLOCK) != 0)
+        return errno;
+    if (verto_add_io(vctx, VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_PERSIST,
+                     process_done, done_pipe[0]) == NULL)
+        return ENOMEM;
+    if (verto_add_timeout(vctx, VERTO_EV_FLAG_PERSIST, log_stats,
+                          STATS_INTERVAL_MS) == NULL)
+        return ENOMEM;
+
+    /* The last worker is the writer. */
+    workers = k5calloc(nreaders + 1, sizeof(*workers), &ret);
+    if (workers == NULL)
+        return ret;
+    nworkers = nreaders + 1;
+    for (i = 0; i < nworkers; i++) {
+        ret = init_worker(&workers[i], params, db_args, i == nreaders);
+        if (ret)
+            return ret;
+    }
+
+    /* Leave signal handling to the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < nworkers; i++) {
+        ret = pthread_create(&workers[i].thread, NULL, worker_main,
+                             &workers[i]);
+        if (ret)
+            break;
+        workers[i].started = TRUE;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return ret;
+}
+
+void
+worker_fini(void)
+{
+    int i;
+
+    if (workers == NULL)
+        return;
+
+    pthread_mutex_lock(&queue_lock);
+    shutting_down = TRUE;
+    pthread_cond_broadcast(&read_queue.cond);
+    pthread_cond_broadcast(&write_queue.cond);
+    pthread_mutex_unlock(&queue_lock);
+
+    for (i = 0; i < nworkers; i++) {
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+        if (workers[i].handle != NULL)
+            kadm5_destroy(workers[i].handle);
+        if (workers[i].context != NULL)
+            krb5_free_context(workers[i].context);
+    }
+    free(workers);
+    workers = NULL;
+    nworkers = 0;
+}
+
+krb5_boolean
+worker_submit(struct svc_req *rqstp, SVCXPRT *transp, bool_t (*local)(),
+              xdrproc_t xdr_argument, void *argument, size_t argsize,
+              xdrproc_t xdr_result, size_t ressize, krb5_boolean write)
+{
+    struct job *job;
+
+    if (workers == NULL)
+        return FALSE;
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL)
+        return FALSE;
+    job->argument = malloc(argsize);
+    job->result = calloc(1, ressize);
+    if (job->argument == NULL || job->result == NULL) {
+        free_job(job);
+        return FALSE;
+    }
+    if (loop_hold_rpc_connection(transp->xp_sock) != 0) {
+        free_job(job);
+        return FALSE;
+    }
+
+    /* Take ownership of the decoded arguments. */
+    memcpy(job->argument, argument, argsize);
+    job->rqst = *rqstp;
+    job->xprt = transp;
+    job->auth = transp->xp_auth;
+    job->fd = transp->xp_sock;
+    job->write = write;
+    job->local = local;
+    job->xdr_argument = xdr_argument;
+    job->xdr_result = xdr_result;
+    gettimeofday(&job->queued, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    queue_push(write ? &write_queue : &read_queue, job);
+    pthread_mutex_unlock(&queue_lock);
+    return TRUE;
+}
+
+krb5_boolean
+worker_submit_task(void (*run)(void *handle, void *arg),
+                   void (*done)(void *arg), void *arg, krb5_boolean write)
+{
+    struct job *job;
+
+    if (workers == NULL)
+        return FALSE;
+
+    job = calloc(1, sizeof(*job));
+    if (job == NULL)
+        return FALSE;
+    job->write = write;
+    job->run = run;
+    job->done = done;
+    job->arg = arg;
+    gettimeofday(&job->queued, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    queue_push(write ? &write_queue : &read_queue, job);
+    pthread_mutex_unlock(&queue_lock);
+    return TRUE;
+}
+
+void
+worker_lock_db(void)
+{
+    if (workers != NULL)
+        pthread_rwlock_wrlock(&db_rwlock);
+}
+
+void
+worker_unlock_db(void)
+{
+    if (workers != NULL)
+        pthread_rwlock_unlock(&db_rwlock);
+}
+
+void *
+current_server_handle(void)
+{
+    struct worker *w;
+
+    if (workers == NULL)
+        return global_server_handle;
+    w = pthread_getspecific(worker_key);
+    return (w != NULL) ? w->handle : global_server_handle;
+}
+
+char *
+worker_addr_buf(void)
+{
+    struct worker *w;
+
+    if (workers == NULL)
+        return NULL;
+    w = pthread_getspecific(worker_key);
+    return (w != NULL) ? w->addrbuf : NULL;
+}
+
+#else /* !(ENABLE_THREADS && HAVE_PTHREAD) */
+
+extern void *global_server_handle;
+
+krb5_error_code
+worker_init(krb5_context context, verto_ctx *vctx,
+            kadm5_config_params *params, char **db_args)
+{
+    int nreaders = 0;
+
+    (void)profile_get_integer(context->profile, KRB5_CONF_REALMS,
+                              params->realm, KRB5_CONF_KADMIND_WORKERS, 0,
+                              &nreaders);
+    if (nreaders > 0) {
+        krb5_klog_syslog(LOG_WARNING, _("kadmind_workers is not supported "
+                                        "without thread support; ignoring"));
+    }
+    return 0;
+}
+
+void
+worker_fini(void)
+{
+}
+
+krb5_boolean
+worker_submit(struct svc_req *rqstp, SVCXPRT *transp, bool_t (*local)(),
+              xdrproc_t xdr_argument, void *argument, size_t argsize,
+              xdrproc_t xdr_result, size_t ressize, krb5_boolean write)
+{
+    return FALSE;
+}
+
+krb5_boolean
+worker_submit_task(void (*run)(void *handle, void *arg),
+                   void (*done)(void *arg), void *arg, krb5_boolean write)
+{
+    return FALSE;
+}
+
+void
+worker_lock_db(void)
+{
+}
+
+void
+worker_unlock_db(void)
+{
+}
+
+void *
+current_server_handle(void)
+{
+    return global_server_handle;
+}
+
+char *
+worker_addr_buf(void)
+{
+    return NULL;
+}
+
+#endif /* !(ENABLE_THREADS && HAVE_PTHREAD) */
@@ -42,12 +42,14 @@
 #include "fake-addrinfo.h"
 #include "kprop.h"
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifndef GETSOCKNAME_ARG3_TYPE
 #define GETSOCKNAME_ARG3_TYPE unsigned int
 #endif
 
-static char *kprop_version = KPROP_PROT_VERSION;
-
 static char *progname = NULL;
 static int debug = 0;
 static char *keytab_path = NULL;
@@ -68,14 +70,21 @@ static void parse_args(krb5_context context, int argc, char **argv);
 static void get_tickets(krb5_context context);
 static void usage(void);
 static void open_connection(krb5_context context, char *host, int *fd_out);
-static void kerberos_authenticate(krb5_context context,
-                                  krb5_auth_context *auth_context, int fd,
-                                  krb5_principal me, krb5_creds **new_creds);
-static int open_database(krb5_context context, char *data_fn, off_t *size);
+static krb5_error_code kerberos_authenticate(krb5_context context,
+                                             krb5_auth_context *auth_context,
+                                             int fd, const char *version,
+                                             krb5_principal me,
+                                             krb5_creds **new_creds);
+static int open_database(krb5_context context, char *data_fn,
+                         struct stat *st_out);
 static void close_database(krb5_context context, int fd);
 static void xmit_database(krb5_context context,
                           krb5_auth_context auth_context, krb5_creds *my_creds,
                           int fd, int database_fd, off_t in_database_size);
+static void xmit_database_v2(krb5_context context,
+                             krb5_auth_context auth_context,
+                             krb5_creds *my_creds, int fd, int database_fd,
+                             const struct stat *st);
 static void send_error(krb5_context context, krb5_creds *my_creds, int fd,
                        char *err_text, krb5_error_code err_code);
 static void update_last_prop_file(char *hostname, char *file_name);
@@ -91,7 +100,7 @@ int
 main(int argc, char **argv)
 {
     int fd, database_fd;
-    off_t database_size;
+    struct stat st;
     krb5_error_code retval;
     krb5_context context;
     krb5_creds *my_creds;
@@ -106,11 +115,30 @@ main(int argc, char **argv)
     parse_args(context, argc, argv);
     get_tickets(context);
 
-    database_fd = open_database(context, file, &database_size);
+    database_fd = open_database(context, file, &st);
     open_connection(context, replica_host, &fd);
-    kerberos_authenticate(context, &auth_context, fd, my_principal, &my_creds);
-    xmit_database(context, auth_context, my_creds, fd, database_fd,
-                  database_size);
+    retval = kerberos_authenticate(context, &auth_context, fd,
+                                   KPROP_PROT_VERSION_2, my_principal,
+                                   &my_creds);
+    if (retval == KRB5_SENDAUTH_BADAPPLVERS) {
+        /* The replica's kpropd predates protocol version 2; reconnect and
+         * send the whole dump the old way. */
+        if (debug)
+            printf(_("Falling back to protocol version %s\n"),
+                   KPROP_PROT_VERSION);
+        close(fd);
+        krb5_auth_con_free(context, auth_context);
+        krb5_free_address(context, sender_addr);
+        open_connection(context, replica_host, &fd);
+        (void)kerberos_authenticate(context, &auth_context, fd,
+                                    KPROP_PROT_VERSION, my_principal,
+                                    &my_creds);
+        xmit_database(context, auth_context, my_creds, fd, database_fd,
+                      st.st_size);
+    } else {
+        xmit_database_v2(context, auth_context, my_creds, fd, database_fd,
+                         &st);
+    }
     update_last_prop_file(replica_host, file);
     printf(_("Database propagation to %s: SUCCEEDED\n"), replica_host);
     krb5_free_cred_contents(context, my_creds);
@@ -276,9 +304,15 @@ open_connection(krb5_context context, char *host, int *fd_out)
     }
 }
 
-static void
+/*
+ * Authenticate to kpropd using the application version string version.
+ * Return KRB5_SENDAUTH_BADAPPLVERS if the server does not accept that
+ * version; exit on any other failure.
+ */
+static krb5_error_code
 kerberos_authenticate(krb5_context context, krb5_auth_context *auth_context,
-                      int fd, krb5_principal me, krb5_creds **new_creds)
+                      int fd, const char *version, krb5_principal me,
+                      krb5_creds **new_creds)
 {
     krb5_error_code retval;
     krb5_error *error = NULL;
@@ -297,9 +331,12 @@ kerberos_authenticate(krb5_context context, krb5_auth_context *auth_context,
         exit(1);
     }
 
-    retval = krb5_sendauth(context, auth_context, &fd, kprop_version,
+    retval = krb5_sendauth(context, auth_context, &fd, (char *)version,
                            me, creds.server, AP_OPTS_MUTUAL_REQUIRED, NULL,
                            &creds, NULL, &error, &rep_result, new_creds);
+    if (retval == KRB5_SENDAUTH_BADAPPLVERS &&
+        strcmp(version, KPROP_PROT_VERSION) != 0)
+        return retval;
     if (retval) {
         com_err(progname, retval, _("while authenticating to server"));
         if (error != NULL) {
@@ -322,6 +359,7 @@ kerberos_authenticate(krb5_context context, krb5_auth_context *auth_context,
         exit(1);
     }
     krb5_free_ap_rep_enc_part(context, rep_result);
+    return 0;
 }
 
 /*
@@ -330,10 +368,11 @@ kerberos_authenticate(krb5_context context, krb5_auth_context *auth_context,
  * dump file itself.
  *
  * Returns the file descriptor of the database dump file.  Also fills
- * in the size of the database file.
+ * in the file status, from which the size and identity of the dump are
+ * taken.
  */
 static int
-open_database(krb5_context context, char *data_fn, off_t *size)
+open_database(krb5_context context, char *data_fn, struct stat *st_out)
 {
     struct stat stbuf, stbuf_ok;
     char *data_ok_fn;
@@ -379,7 +418,7 @@ open_database(krb5_context context, char *data_fn, off_t *size)
         exit(1);
     }
     free(data_ok_fn);
-    *size = stbuf.st_size;
+    *st_out = stbuf;
     return fd;
 }
 
@@ -395,6 +434,110 @@ close_database(krb5_context context, int fd)
     close(fd);
 }
 
+/* If inbuf is a KRB-ERROR message from kpropd, display it and exit. */
+static void
+check_remote_error(krb5_context context, krb5_data *inbuf)
+{
+    krb5_error_code retval;
+    krb5_error *error;
+
+    if (!krb5_is_krb_error(inbuf))
+        return;
+
+    retval = krb5_rd_error(context, inbuf, &error);
+    if (retval) {
+        com_err(progname, retval,
+                _("while decoding error response from server"));
+        exit(1);
+    }
+    if (error->error == KRB_ERR_GENERIC) {
+        if (error->text.data) {
+            fprintf(stderr, _("Generic remote error: %s\n"),
+                    error->text.data);
+        }
+    } else if (error->error) {
+        com_err(progname,
+                (krb5_error_code)error->error + ERROR_TABLE_BASE_krb5,
+                _("signalled from server"));
+        if (error->text.data) {
+            fprintf(stderr, _("Error text from server: %s\n"),
+                    error->text.data);
+        }
+    }
+    krb5_free_error(context, error);
+    exit(1);
+}
+
+/* Wrap data in a KRB-PRIV message and send it to kpropd, or exit. */
+static void
+send_priv_block(krb5_context context, krb5_auth_context auth_context,
+                krb5_creds *my_creds, int fd, krb5_data *data,
+                uint64_t offset)
+{
+    krb5_error_code retval;
+    krb5_data outbuf;
+    char msg[128];
+
+    retval = krb5_mk_priv(context, auth_context, data, &outbuf, NULL);
+    if (retval) {
+        snprintf(msg, sizeof(msg),
+                 "while encoding database block starting at %"PRIu64, offset);
+        com_err(progname, retval, "%s", msg);
+        send_error(context, my_creds, fd, msg, retval);
+        exit(1);
+    }
+
+    retval = krb5_write_message(context, &fd, &outbuf);
+    krb5_free_data_contents(context, &outbuf);
+    if (retval) {
+        com_err(progname, retval,
+                _("while sending database block starting at %"PRIu64),
+                offset);
+        exit(1);
+    }
+}
+
+/*
+ * Wait for kpropd to acknowledge the transfer with a KRB_SAFE message
+ * containing the database size, which it sends after loading the database.
+ */
+static void
+recv_confirmation(krb5_context context, krb5_auth_context auth_context,
+                  int fd, uint64_t database_size)
+{
+    krb5_error_code retval;
+    krb5_data inbuf, outbuf;
+    uint64_t send_size;
+
+    retval = krb5_read_message(context, &fd, &inbuf);
+    if (retval) {
+        com_err(progname, retval, _("while reading response from server"));
+        exit(1);
+    }
+    check_remote_error(context, &inbuf);
+
+    retval = krb5_rd_safe(context,auth_context,&inbuf,&outbuf,NULL);
+    if (retval) {
+        com_err(progname, retval,
+                "while decoding final size packet from server");
+        exit(1);
+    }
+
+    retval = decode_database_size(&outbuf, &send_size);
+    if (retval) {
+        com_err(progname, retval, _("malformed sent database size message"));
+        exit(1);
+    }
+    if (send_size != database_size) {
+        com_err(progname, 0, _("Kpropd sent database size %"PRIu64
+                               ", expecting %"PRIu64),
+                send_size, database_size);
+        exit(1);
+    }
+    free(inbuf.data);
+    free(outbuf.data);
+}
+
 /*
  * Now we send over the database.  We use the following protocol:
  * Send over a KRB_SAFE message with the size.  Then we send over the
@@ -413,8 +556,7 @@ xmit_database(krb5_context context, krb5_auth_context auth_context,
     krb5_data inbuf, outbuf;
     char buf[KPROP_BUFSIZ], dbsize_buf[KPROP_DBSIZE_MAX_BUFSIZ];
     krb5_error_code retval;
-    krb5_error *error;
-    uint64_t database_size = in_database_size, send_size, sent_size;
+    uint64_t database_size = in_database_size, sent_size;
 
     /* Send over the size. */
     inbuf = make_data(dbsize_buf, sizeof(dbsize_buf));
@@ -450,25 +592,8 @@ xmit_database(krb5_context context, krb5_auth_context auth_context,
     sent_size = 0;
     while ((n = read(database_fd, buf, sizeof(buf)))) {
         inbuf.length = n;
-        retval = krb5_mk_priv(context, auth_context, &inbuf, &outbuf, NULL);
-        if (retval) {
-            snprintf(buf, sizeof(buf),
-                     "while encoding database block starting at %"PRIu64,
-                     sent_size);
-            com_err(progname, retval, "%s", buf);
-            send_error(context, my_creds, fd, buf, retval);
-            exit(1);
-        }
-
-        retval = krb5_write_message(context, &fd, &outbuf);
-        if (retval) {
-            krb5_free_data_contents(context, &outbuf);
-            com_err(progname, retval,
-                    _("while sending database block starting at %"PRIu64),
-                    sent_size);
-            exit(1);
-        }
-        krb5_free_data_contents(context, &outbuf);
+        send_priv_block(context, auth_context, my_creds, fd, &inbuf,
+                        sent_size);
         sent_size += n;
         if (debug)
             printf("%"PRIu64" bytes sent.\n", sent_size);
@@ -481,64 +606,176 @@ xmit_database(krb5_context context, krb5_auth_context auth_context,
         exit(1);
     }
 
-    /*
-     * OK, we've sent the database; now let's wait for a success
-     * indication from the remote end.
-     */
-    retval = krb5_read_message(context, &fd, &inbuf);
-    if (retval) {
-        com_err(progname, retval, _("while reading response from server"));
+    recv_confirmation(context, auth_context, fd, database_size);
+}
+
+#ifdef HAVE_ZLIB
+/* Deflate the dump from database_fd and send it in KRB_PRIV blocks. */
+static uint64_t
+send_deflated(krb5_context context, krb5_auth_context auth_context,
+              krb5_creds *my_creds, int fd, int database_fd)
+{
+    z_stream zs;
+    char inbuf[KPROP_BUFSIZ], outbuf[KPROP_BUFSIZ];
+    krb5_data block;
+    ssize_t n;
+    uint64_t read_size = 0, sent_size = 0;
+    int zret, flush;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        com_err(progname, ENOMEM, _("while initializing compression"));
+        send_error(context, my_creds, fd, "while initializing compression",
+                   KRB5KRB_ERR_GENERIC);
         exit(1);
     }
-    /*
-     * If we got an error response back from the server, display
-     * the error message
-     */
-    if (krb5_is_krb_error(&inbuf)) {
-        retval = krb5_rd_error(context, &inbuf, &error);
-        if (retval) {
-            com_err(progname, retval,
-                    _("while decoding error response from server"));
+
+    do {
+        n = read(database_fd, inbuf, sizeof(inbuf));
+        if (n < 0) {
+            com_err(progname, errno, _("while reading database file"));
+            send_error(context, my_creds, fd, "while reading database file",
+                       KRB5KRB_ERR_GENERIC);
             exit(1);
         }
-        if (error->error == KRB_ERR_GENERIC) {
-            if (error->text.data) {
-                fprintf(stderr, _("Generic remote error: %s\n"),
-                        error->text.data);
-            }
-        } else if (error->error) {
-            com_err(progname,
-                    (krb5_error_code)error->error + ERROR_TABLE_BASE_krb5,
-                    _("signalled from server"));
-            if (error->text.data) {
-                fprintf(stderr, _("Error text from server: %s\n"),
-                        error->text.data);
+        read_size += n;
+        flush = (n == 0) ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = (Bytef *)inbuf;
+        zs.avail_in = n;
+        do {
+            zs.next_out = (Bytef *)outbuf;
+            zs.avail_out = sizeof(outbuf);
+            zret = deflate(&zs, flush);
+            assert(zret != Z_STREAM_ERROR);
+            block = make_data(outbuf, sizeof(outbuf) - zs.avail_out);
+            if (block.length > 0) {
+                send_priv_block(context, auth_context, my_creds, fd, &block,
+                                sent_size);
+                sent_size += block.length;
             }
-        }
-        krb5_free_error(context, error);
+        } while (zs.avail_out == 0);
+        if (debug)
+            printf("%"PRIu64" bytes read, %"PRIu64" bytes sent.\n",
+                   read_size, sent_size);
+    } while (flush != Z_FINISH);
+    assert(zret == Z_STREAM_END);
+
+    deflateEnd(&zs);
+    return read_size;
+}
+#endif
+
+/*
+ * Send the database using protocol version 2 (see kprop.h).  If kpropd
+ * already holds a prefix of this dump from an interrupted transfer, only the
+ * remainder is sent.
+ */
+static void
+xmit_database_v2(krb5_context context, krb5_auth_context auth_context,
+                 krb5_creds *my_creds, int fd, int database_fd,
+                 const struct stat *st)
+{
+    krb5_error_code retval;
+    krb5_data inbuf, outbuf;
+    char buf[KPROP_BUFSIZ], offer[KPROP_OFFER_LEN];
+    uint64_t database_size = st->st_size, offset, sent_size;
+    uint32_t flags;
+    ssize_t n;
+
+    /* Offer the dump size, identity, and the transfer flags we support. */
+    store_64_be(database_size, offer);
+    store_64_be(st->st_mtime, offer + 8);
+    store_64_be(st->st_ino, offer + 16);
+    store_32_be(KPROP_SUPPORTED_FLAGS, offer + 24);
+    inbuf = make_data(offer, sizeof(offer));
+    retval = krb5_mk_safe(context, auth_context, &inbuf, &outbuf, NULL);
+    if (retval) {
+        com_err(progname, retval, _("while encoding transfer offer"));
+        send_error(context, my_creds, fd, "while encoding transfer offer",
+                   retval);
+        exit(1);
+    }
+    retval = krb5_write_message(context, &fd, &outbuf);
+    krb5_free_data_contents(context, &outbuf);
+    if (retval) {
+        com_err(progname, retval, _("while sending transfer offer"));
         exit(1);
     }
 
-    retval = krb5_rd_safe(context,auth_context,&inbuf,&outbuf,NULL);
+    /* Read the resume offset and the flags kpropd accepted. */
+    retval = krb5_read_message(context, &fd, &inbuf);
     if (retval) {
-        com_err(progname, retval,
-                "while decoding final size packet from server");
+        com_err(progname, retval, _("while reading transfer reply"));
+        exit(1);
+    }
+    check_remote_error(context, &inbuf);
+    retval = krb5_rd_safe(context, auth_context, &inbuf, &outbuf, NULL);
+    krb5_free_data_contents(context, &inbuf);
+    if (retval) {
+        com_err(progname, retval, _("while decoding transfer reply"));
+        exit(1);
+    }
+    if (outbuf.length != KPROP_ACCEPT_LEN) {
+        com_err(progname, KRB5KRB_ERR_GENERIC,
+                _("malformed transfer reply from server"));
+        exit(1);
+    }
+    offset = load_64_be(outbuf.data);
+    flags = load_32_be(outbuf.data + 8);
+    krb5_free_data_contents(context, &outbuf);
+    if (offset > database_size || (flags & ~KPROP_SUPPORTED_FLAGS)) {
+        com_err(progname, KRB5KRB_ERR_GENERIC,
+                _("invalid transfer reply from server"));
+        send_error(context, my_creds, fd, "invalid transfer reply",
+                   KRB5KRB_ERR_GENERIC);
         exit(1);
     }
+    if (debug) {
+        printf(_("Resuming at offset %"PRIu64"%s\n"), offset,
+               (flags & KPROP_FLAG_DEFLATE) ? _(", compressed") : "");
+    }
 
-    retval = decode_database_size(&outbuf, &send_size);
+    if (lseek(database_fd, offset, SEEK_SET) == (off_t)-1) {
+        com_err(progname, errno, _("while seeking in database file"));
+        send_error(context, my_creds, fd, "while seeking in database file",
+                   KRB5KRB_ERR_GENERIC);
+        exit(1);
+    }
+
+    retval = krb5_auth_con_initivector(context, auth_context);
     if (retval) {
-        com_err(progname, retval, _("malformed sent database size message"));
+        send_error(context, my_creds, fd,
+                   "failed while initializing i_vector", retval);
+        com_err(progname, retval, _("while allocating i_vector"));
         exit(1);
     }
-    if (send_size != database_size) {
-        com_err(progname, 0, _("Kpropd sent database size %"PRIu64
-                               ", expecting %"PRIu64),
-                send_size, database_size);
+
+#ifdef HAVE_ZLIB
+    if (flags & KPROP_FLAG_DEFLATE) {
+        sent_size = offset + send_deflated(context, auth_context, my_creds, fd,
+                                           database_fd);
+    } else
+#endif
+    {
+        sent_size = offset;
+        while ((n = read(database_fd, buf, sizeof(buf))) > 0) {
+            inbuf = make_data(buf, n);
+            send_priv_block(context, auth_context, my_creds, fd, &inbuf,
+                            sent_size);
+            sent_size += n;
+            if (debug)
+                printf("%"PRIu64" bytes sent.\n", sent_size);
+        }
+    }
+    if (sent_size != database_size) {
+        com_err(progname, 0, _("Premature EOF found for database file!"));
+        send_error(context, my_creds, fd,
+                   "Premature EOF found for database file!",
+                   KRB5KRB_ERR_GENERIC);
         exit(1);
     }
-    free(inbuf.data);
-    free(outbuf.data);
+
+    recv_confirmation(context, auth_context, fd, database_size);
 }
 
 static void
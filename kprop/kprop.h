@@ -31,6 +31,27 @@
 
 #define KPROP_PROT_VERSION "kprop5_01"
 
+/*
+ * Version 2 of the protocol adds a negotiation step after authentication.
+ * kprop sends a KRB-SAFE offer containing the dump size, the dump file's
+ * modification time and inode number (identifying the dump for resumption),
+ * and the transfer flags it supports.  kpropd replies with a KRB-SAFE message
+ * containing the byte offset at which to resume and the flags it accepts.
+ * The dump is then sent from that offset in KRB-PRIV blocks, deflated if
+ * KPROP_FLAG_DEFLATE was accepted.  kpropd acknowledges with the total size
+ * as in version 1.  All integers are big-endian.
+ */
+#define KPROP_PROT_VERSION_2 "kprop5_02"
+#define KPROP_FLAG_DEFLATE 0x1
+#define KPROP_OFFER_LEN 28
+#define KPROP_ACCEPT_LEN 12
+
+#ifdef HAVE_ZLIB
+#define KPROP_SUPPORTED_FLAGS KPROP_FLAG_DEFLATE
+#else
+#define KPROP_SUPPORTED_FLAGS 0
+#endif
+
 #define KPROP_BUFSIZ 32768
 #define KPROP_DBSIZE_MAX_BUFSIZ 12  /* max length of an encoded DB size */
 
@@ -78,6 +78,10 @@
 #include <kadm5/admin.h>
 #include <kdb_log.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifndef GETSOCKNAME_ARG3_TYPE
 #define GETSOCKNAME_ARG3_TYPE unsigned int
 #endif
@@ -112,6 +116,7 @@ typedef struct _kadm5_iprop_handle_t {
 } *kadm5_iprop_handle_t;
 
 static char *kprop_version = KPROP_PROT_VERSION;
+static char *kprop_version_2 = KPROP_PROT_VERSION_2;
 
 static kadm5_config_params params;
 
@@ -132,6 +137,7 @@ static char *realm = NULL;      /* Our realm */
 static char *def_realm = NULL;  /* Ref pointer for default realm */
 static char *file = KPROPD_DEFAULT_FILE;
 static char *temp_file_name;
+static char *resume_file_name;
 static char *kdb5_util = KPROPD_DEFAULT_KDB5_UTIL;
 static char *kerb_database = NULL;
 static char *acl_file_name = KPROPD_ACL_FILE;
@@ -142,20 +148,38 @@ static const char *port = KPROP_SERVICE;
 static char **db_args = NULL;
 static int db_args_size = 0;
 
+/*
+ * A kdb5_util load process reading the dump from a pipe while it is being
+ * received.  The loader does not make the new database live until it reads a
+ * byte from confirm_fd, which we only write once the whole dump has arrived
+ * intact; if we exit early, it sees EOF there and discards the load.
+ */
+struct stream_load {
+    pid_t pid;
+    int data_fd;
+    int confirm_fd;
+};
+
 static void parse_args(int argc, char **argv);
 static void do_standalone(void);
 static void doit(int fd);
 static krb5_error_code do_iprop(void);
 static void kerberos_authenticate(krb5_context context, int fd,
                                   krb5_principal *clientp, krb5_enctype *etype,
-                                  struct sockaddr_storage *my_sin);
+                                  struct sockaddr_storage *my_sin,
+                                  krb5_boolean *v2_out);
 static krb5_boolean authorized_principal(krb5_context context,
                                          krb5_principal p,
                                          krb5_enctype auth_etype);
 static void recv_database(krb5_context context, int fd, int database_fd,
                           krb5_data *confmsg);
+static void recv_database_v2(krb5_context context, int fd, int database_fd,
+                             struct stream_load *ld, krb5_data *confmsg);
 static void load_database(krb5_context context, char *kdb_util,
                           char *database_file_name);
+static void start_stream_load(krb5_context context, char *kdb_util,
+                              struct stream_load *ld);
+static void finish_stream_load(krb5_context context, struct stream_load *ld);
 static void send_error(krb5_context context, int fd, krb5_error_code err_code,
                        char *err_text);
 static void recv_error(krb5_context context, krb5_data *inbuf);
@@ -488,6 +512,8 @@ doit(int fd)
     krb5_enctype etype;
     int database_fd;
     char host[INET6_ADDRSTRLEN + 1];
+    krb5_boolean v2;
+    struct stream_load ld;
 
     signal_wrapper(SIGALRM, alarm_handler);
     alarm(params.iprop_resync_timeout);
@@ -522,7 +548,7 @@ doit(int fd)
     /*
      * Now do the authentication
      */
-    kerberos_authenticate(kpropd_context, fd, &client, &etype, &from);
+    kerberos_authenticate(kpropd_context, fd, &client, &etype, &from, &v2);
 
     if (!authorized_principal(kpropd_context, client, etype)) {
         char *name;
@@ -553,25 +579,48 @@ doit(int fd)
                 temp_file_name);
         exit(1);
     }
-    database_fd = open(temp_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (v2) {
+        /* Keep any partial dump from an interrupted transfer; the resume
+         * file tells recv_database_v2() whether it can be continued. */
+        database_fd = open(temp_file_name, O_RDWR | O_CREAT, 0600);
+    } else {
+        (void)unlink(resume_file_name);
+        database_fd = open(temp_file_name, O_WRONLY | O_CREAT | O_TRUNC,
+                           0600);
+    }
     if (database_fd < 0) {
         com_err(progname, errno, _("while opening database file, '%s'"),
                 temp_file_name);
         exit(1);
     }
-    recv_database(kpropd_context, fd, database_fd, &confmsg);
-    if (rename(temp_file_name, file)) {
-        com_err(progname, errno, _("while renaming %s to %s"),
-                temp_file_name, file);
-        exit(1);
-    }
-    retval = krb5_lock_file(kpropd_context, lock_fd, KRB5_LOCKMODE_SHARED);
-    if (retval) {
-        com_err(progname, retval, _("while downgrading lock on '%s'"),
-                temp_file_name);
-        exit(1);
+    if (v2) {
+        /* The dump is loaded as it arrives; the load is only made live
+         * after the transfer completes and the file is renamed. */
+        recv_database_v2(kpropd_context, fd, database_fd, &ld, &confmsg);
+        close(database_fd);
+        (void)unlink(resume_file_name);
+        if (rename(temp_file_name, file)) {
+            com_err(progname, errno, _("while renaming %s to %s"),
+                    temp_file_name, file);
+            exit(1);
+        }
+        finish_stream_load(kpropd_context, &ld);
+    } else {
+        recv_database(kpropd_context, fd, database_fd, &confmsg);
+        if (rename(temp_file_name, file)) {
+            com_err(progname, errno, _("while renaming %s to %s"),
+                    temp_file_name, file);
+            exit(1);
+        }
+        retval = krb5_lock_file(kpropd_context, lock_fd,
+                                KRB5_LOCKMODE_SHARED);
+        if (retval) {
+            com_err(progname, retval, _("while downgrading lock on '%s'"),
+                    temp_file_name);
+            exit(1);
+        }
+        load_database(kpropd_context, kdb5_util, file);
     }
-    load_database(kpropd_context, kdb5_util, file);
     retval = krb5_lock_file(kpropd_context, lock_fd, KRB5_LOCKMODE_UNLOCK);
     if (retval) {
         com_err(progname, retval, _("while unlocking '%s'"), temp_file_name);
@@ -606,7 +655,7 @@ static kdb_fullresync_result_t *
 full_resync(CLIENT *clnt)
 {
     static kdb_fullresync_result_t clnt_res;
-    uint32_t vers = IPROPX_VERSION_1; /* max version we support */
+    uint32_t vers = IPROPX_VERSION_2; /* max version we support */
     enum clnt_stat status;
 
     memset(&clnt_res, 0, sizeof(clnt_res));
@@ -623,6 +672,120 @@ full_resync(CLIENT *clnt)
     return (status == RPC_SUCCESS) ? &clnt_res : NULL;
 }
 
+/*
+ * Ask the primary KDC for the current state of each principal changed after
+ * *last, for when *last is too old for incremental updates.  If the primary
+ * does not support this, set *supported to false.
+ */
+static kdb_incr_result_t *
+get_delta(CLIENT *clnt, kdb_last_t *last, krb5_boolean *supported)
+{
+    static kdb_incr_result_t clnt_res;
+    enum clnt_stat status;
+
+    memset(&clnt_res, 0, sizeof(clnt_res));
+    status = clnt_call(clnt, IPROP_GET_DELTA, (xdrproc_t)xdr_kdb_last_t, last,
+                       (xdrproc_t)xdr_kdb_incr_result_t, &clnt_res,
+                       full_resync_timeout);
+    if (status == RPC_PROCUNAVAIL)
+        *supported = FALSE;
+    return (status == RPC_SUCCESS) ? &clnt_res : NULL;
+}
+
+/*
+ * Try to catch up using get_delta() instead of a full resync.  Return the
+ * result if the delta was applied, or NULL if a full resync is still needed.
+ */
+static kdb_incr_result_t *
+catch_up(CLIENT *clnt, kdb_last_t *last, krb5_boolean *supported)
+{
+    kdb_incr_result_t *delta_ret;
+    krb5_error_code retval;
+    const char *msg;
+
+    delta_ret = get_delta(clnt, last, supported);
+    if (delta_ret == NULL || delta_ret->ret != UPDATE_OK)
+        return NULL;
+
+    retval = ulog_replay_delta(kpropd_context, delta_ret, db_args);
+    if (retval) {
+        msg = krb5_get_error_message(kpropd_context, retval);
+        if (debug) {
+            fprintf(stderr, _("ulog_replay_delta failed (%s), full resync "
+                              "needed\n"), msg);
+        }
+        syslog(LOG_ERR, _("ulog_replay_delta failed (%s), full resync "
+                          "needed."), msg);
+        krb5_free_error_message(kpropd_context, msg);
+        return NULL;
+    }
+
+    if (debug) {
+        fprintf(stderr, _("Caught up from checkpoint (sno=%u sec=%u "
+                          "usec=%u)\n"),
+                (unsigned int)delta_ret->lastentry.last_sno,
+                (unsigned int)delta_ret->lastentry.last_time.seconds,
+                (unsigned int)delta_ret->lastentry.last_time.useconds);
+    }
+    syslog(LOG_INFO, _("Caught up from primary checkpoint to sno %u."),
+           (unsigned int)delta_ret->lastentry.last_sno);
+    return delta_ret;
+}
+
+/* Return the iprop_replica_wait setting for our realm, or 0 if unset. */
+static krb5_deltat
+get_replica_wait(void)
+{
+    char *value = NULL;
+    krb5_deltat wait = 0;
+
+    if (profile_get_string(kpropd_context->profile, KRB5_CONF_REALMS, realm,
+                           KRB5_CONF_IPROP_REPLICA_WAIT, NULL, &value) == 0 &&
+        value != NULL) {
+        if (krb5_string_to_deltat(value, &wait) != 0 || wait < 0)
+            wait = 0;
+        profile_release_string(value);
+    }
+    return wait;
+}
+
+/*
+ * Ask the primary KDC for updates after *last.  If *wait is nonzero, let it
+ * hold the request open for up to *wait seconds until new updates arrive.  If
+ * the primary does not support waiting, set *wait to 0 and fall back to an
+ * immediate request.
+ */
+static kdb_incr_result_t *
+get_updates(CLIENT *clnt, kdb_last_t *last, krb5_deltat *wait)
+{
+    static kdb_incr_result_t clnt_res;
+    kdb_wait_args_t args;
+    struct timeval timeout;
+    enum clnt_stat status;
+
+    if (*wait == 0)
+        return iprop_get_updates_1(last, clnt);
+
+    memset(&clnt_res, 0, sizeof(clnt_res));
+    args.last = *last;
+    args.wait_secs = *wait;
+    timeout.tv_sec = *wait + 25;
+    timeout.tv_usec = 0;
+    status = clnt_call(clnt, IPROP_WAIT_UPDATES,
+                       (xdrproc_t)xdr_kdb_wait_args_t, &args,
+                       (xdrproc_t)xdr_kdb_incr_result_t, &clnt_res, timeout);
+    if (status == RPC_PROCUNAVAIL) {
+        if (debug) {
+            fprintf(stderr, _("Primary cannot hold update requests; "
+                              "polling instead\n"));
+        }
+        *wait = 0;
+        return iprop_get_updates_1(last, clnt);
+    }
+
+    return (status == RPC_SUCCESS) ? &clnt_res : NULL;
+}
+
 /*
  * Beg for incrementals from the KDC.
  *
@@ -637,11 +800,13 @@ do_iprop()
     void *server_handle = NULL;
     char *iprop_svc_princstr = NULL, *primary_svc_princstr = NULL;
     unsigned int pollin, backoff_time;
+    krb5_deltat wait_time = 0;
     int backoff_cnt = 0, reinit_cnt = 0;
     struct timeval iprop_start, iprop_end;
     unsigned long usec;
     time_t frrequested = 0, now;
-    kdb_incr_result_t *incr_ret;
+    kdb_incr_result_t *incr_ret, *delta_ret;
+    krb5_boolean delta_supported = TRUE;
     kdb_last_t mylast;
     kdb_fullresync_result_t *full_ret;
     kadm5_iprop_handle_t handle;
@@ -653,6 +818,10 @@ do_iprop()
     if (pollin == 0)
         pollin = 10;
 
+    /* Waiting for updates only makes sense if we are going to keep asking. */
+    if (runonce != 1)
+        wait_time = get_replica_wait();
+
     retval = kadm5_get_kiprop_host_srv_name(kpropd_context, realm,
                                             &primary_svc_princstr);
     if (retval) {
@@ -772,7 +941,14 @@ reinit:
          * or (if needed) do a full resync of the krb5 db.
          */
 
-        if (debug) {
+        if (debug && wait_time > 0) {
+            fprintf(stderr, _("Calling iprop_wait_updates_1 "
+                              "(sno=%u sec=%u usec=%u wait=%u)\n"),
+                    (unsigned int)mylast.last_sno,
+                    (unsigned int)mylast.last_time.seconds,
+                    (unsigned int)mylast.last_time.useconds,
+                    (unsigned int)wait_time);
+        } else if (debug) {
             fprintf(stderr, _("Calling iprop_get_updates_1 "
                               "(sno=%u sec=%u usec=%u)\n"),
                     (unsigned int)mylast.last_sno,
@@ -780,7 +956,7 @@ reinit:
                     (unsigned int)mylast.last_time.useconds);
         }
         gettimeofday(&iprop_start, NULL);
-        incr_ret = iprop_get_updates_1(&mylast, handle->clnt);
+        incr_ret = get_updates(handle->clnt, &mylast, &wait_time);
         if (incr_ret == (kdb_incr_result_t *)NULL) {
             clnt_perror(handle->clnt,
                         _("iprop_get_updates call failed"));
@@ -798,6 +974,20 @@ reinit:
         switch (incr_ret->ret) {
 
         case UPDATE_FULL_RESYNC_NEEDED:
+            /*
+             * The primary may be able to bring us up to date by sending just
+             * the principals we missed, which is much cheaper than a full
+             * resync.
+             */
+            if (!frrequested && delta_supported) {
+                delta_ret = catch_up(handle->clnt, &mylast, &delta_supported);
+                if (delta_ret != NULL) {
+                    incr_ret = delta_ret;
+                    backoff_cnt = 0;
+                    break;
+                }
+            }
+
             /*
              * If we're already asked for a full resync and we still
              * need one and the last one hasn't timed out then just keep
@@ -960,6 +1150,14 @@ reinit:
         if (runonce == 1 && incr_ret->ret != UPDATE_FULL_RESYNC_NEEDED)
             goto done;
 
+        /*
+         * When the primary holds our requests open, it has already waited
+         * for us, so ask again right away.
+         */
+        if (wait_time > 0 && backoff_cnt == 0 && retval == 0 &&
+            (incr_ret->ret == UPDATE_OK || incr_ret->ret == UPDATE_NIL))
+            continue;
+
         /*
          * Sleep for the specified poll interval (Default is 2 mts),
          * or do a binary exponential backoff if we get an
@@ -1159,6 +1357,13 @@ parse_args(int argc, char **argv)
         exit(1);
     }
 
+    /* Construct the name of the file identifying a partial transfer. */
+    if (asprintf(&resume_file_name, "%s.resume", temp_file_name) < 0) {
+        com_err(progname, ENOMEM,
+                _("while allocating filename for resume file"));
+        exit(1);
+    }
+
     params.realm = realm;
     params.mask |= KADM5_CONFIG_REALM;
     retval = kadm5_get_config_params(kpropd_context, 1, &params, &params);
@@ -1182,9 +1387,11 @@ parse_args(int argc, char **argv)
  */
 static void
 kerberos_authenticate(krb5_context context, int fd, krb5_principal *clientp,
-                      krb5_enctype *etype, struct sockaddr_storage *my_sin)
+                      krb5_enctype *etype, struct sockaddr_storage *my_sin,
+                      krb5_boolean *v2_out)
 {
     krb5_error_code retval;
+    krb5_data version;
     krb5_ticket *ticket;
     struct sockaddr_storage r_sin;
     GETSOCKNAME_ARG3_TYPE sin_length;
@@ -1206,8 +1413,7 @@ kerberos_authenticate(krb5_context context, int fd, krb5_principal *clientp,
             com_err(progname, retval, _("while unparsing client name"));
             exit(1);
         }
-        fprintf(stderr, "krb5_recvauth(%d, %s, %s, ...)\n", fd, kprop_version,
-                name);
+        fprintf(stderr, "krb5_recvauth(%d, %s, ...)\n", fd, name);
         free(name);
     }
 
@@ -1248,8 +1454,9 @@ kerberos_authenticate(krb5_context context, int fd, krb5_principal *clientp,
         }
     }
 
-    retval = krb5_recvauth(context, &auth_context, &fd, kprop_version, server,
-                           0, keytab, &ticket);
+    /* Accept either protocol version; kprop tries version 2 first. */
+    retval = krb5_recvauth_version(context, &auth_context, &fd, server, 0,
+                                   keytab, &ticket, &version);
     if (retval) {
         syslog(LOG_ERR, _("Error in krb5_recvauth: %s"),
                error_message(retval));
@@ -1263,6 +1470,19 @@ kerberos_authenticate(krb5_context context, int fd, krb5_principal *clientp,
         exit(1);
     }
 
+    if (version.length == strlen(kprop_version_2) + 1 &&
+        memcmp(version.data, kprop_version_2, version.length) == 0) {
+        *v2_out = TRUE;
+    } else if (version.length == strlen(kprop_version) + 1 &&
+               memcmp(version.data, kprop_version, version.length) == 0) {
+        *v2_out = FALSE;
+    } else {
+        send_error(context, fd, KRB5_SENDAUTH_BADAPPLVERS, NULL);
+        syslog(LOG_ERR, _("Unsupported kprop protocol version"));
+        exit(1);
+    }
+    krb5_free_data_contents(context, &version);
+
     *etype = ticket->enc_part.enctype;
 
     if (debug) {
@@ -1463,6 +1683,309 @@ recv_database(krb5_context context, int fd, int database_fd,
 }
 
 
+/* Write all of len bytes of data to fd, or return false. */
+static krb5_boolean
+write_all(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        data += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* Append received dump data to the temp file and feed it to the loader. */
+static void
+store_dump_data(krb5_context context, int fd, int database_fd,
+                struct stream_load *ld, const char *data, size_t len,
+                uint64_t offset)
+{
+    char buf[1024];
+
+    if (!write_all(database_fd, data, len)) {
+        snprintf(buf, sizeof(buf),
+                 "while writing database block starting at offset %"PRIu64,
+                 offset);
+        com_err(progname, errno, "%s", buf);
+        send_error(context, fd, errno, buf);
+        exit(1);
+    }
+    if (!write_all(ld->data_fd, data, len)) {
+        snprintf(buf, sizeof(buf),
+                 "while passing database block starting at offset %"PRIu64
+                 " to %s", offset, kdb5_util);
+        com_err(progname, errno, "%s", buf);
+        send_error(context, fd, errno, buf);
+        exit(1);
+    }
+}
+
+/*
+ * Determine where a version 2 transfer of the dump described by offer should
+ * start.  If the resume file shows that the temp file holds a prefix of the
+ * same dump, continue after it; otherwise start over and record the dump's
+ * identity so that this transfer can be resumed if it is interrupted.
+ */
+static uint64_t
+get_resume_offset(int database_fd, const unsigned char *offer,
+                  uint64_t database_size)
+{
+    unsigned char ident[KPROP_OFFER_LEN - 4];
+    struct stat st;
+    uint64_t offset = 0;
+    int rfd;
+
+    rfd = open(resume_file_name, O_RDONLY);
+    if (rfd >= 0) {
+        if (read(rfd, ident, sizeof(ident)) == (ssize_t)sizeof(ident) &&
+            memcmp(ident, offer, sizeof(ident)) == 0 &&
+            fstat(database_fd, &st) == 0 &&
+            (uint64_t)st.st_size <= database_size)
+            offset = st.st_size;
+        close(rfd);
+    }
+    if (offset > 0)
+        return offset;
+
+    if (ftruncate(database_fd, 0) != 0) {
+        com_err(progname, errno, _("while truncating %s"), temp_file_name);
+        exit(1);
+    }
+    rfd = open(resume_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (rfd >= 0) {
+        if (!write_all(rfd, (const char *)offer, sizeof(ident)))
+            (void)unlink(resume_file_name);
+        close(rfd);
+    }
+    return 0;
+}
+
+/*
+ * Receive the database using protocol version 2 (see kprop.h), starting a
+ * kdb5_util load process which reads the dump as it arrives.  On return the
+ * whole dump has been written to database_fd and to the loader, which is
+ * waiting for finish_stream_load() to confirm the load.
+ */
+static void
+recv_database_v2(krb5_context context, int fd, int database_fd,
+                 struct stream_load *ld, krb5_data *confmsg)
+{
+    uint64_t database_size, offset, received_size;
+    uint32_t flags;
+    unsigned char offer[KPROP_OFFER_LEN], reply[KPROP_ACCEPT_LEN];
+    char buf[KPROP_BUFSIZ], dbsize_buf[KPROP_DBSIZE_MAX_BUFSIZ];
+    krb5_data inbuf, outbuf;
+    krb5_error_code retval;
+    krb5_boolean done;
+    ssize_t n;
+#ifdef HAVE_ZLIB
+    z_stream zs;
+    int zret = Z_OK;
+#endif
+
+    /* Receive and decode the transfer offer from the client. */
+    retval = krb5_read_message(context, &fd, &inbuf);
+    if (retval) {
+        send_error(context, fd, retval, "while reading transfer offer");
+        com_err(progname, retval, _("while reading transfer offer"));
+        exit(1);
+    }
+    if (krb5_is_krb_error(&inbuf))
+        recv_error(context, &inbuf);
+    retval = krb5_rd_safe(context, auth_context, &inbuf, &outbuf, NULL);
+    krb5_free_data_contents(context, &inbuf);
+    if (retval) {
+        send_error(context, fd, retval, "while decoding transfer offer");
+        com_err(progname, retval, _("while decoding transfer offer"));
+        exit(1);
+    }
+    if (outbuf.length != KPROP_OFFER_LEN) {
+        send_error(context, fd, KRB5KRB_ERR_GENERIC,
+                   "malformed transfer offer");
+        com_err(progname, KRB5KRB_ERR_GENERIC,
+                _("malformed transfer offer from client"));
+        exit(1);
+    }
+    memcpy(offer, outbuf.data, sizeof(offer));
+    krb5_free_data_contents(context, &outbuf);
+    database_size = load_64_be(offer);
+    flags = load_32_be(offer + 24) & KPROP_SUPPORTED_FLAGS;
+
+    /* Tell the client where to resume and which flags we accept. */
+    offset = get_resume_offset(database_fd, offer, database_size);
+    store_64_be(offset, reply);
+    store_32_be(flags, reply + 8);
+    inbuf = make_data(reply, sizeof(reply));
+    retval = krb5_mk_safe(context, auth_context, &inbuf, &outbuf, NULL);
+    if (retval) {
+        send_error(context, fd, retval, "while encoding transfer reply");
+        com_err(progname, retval, _("while encoding transfer reply"));
+        exit(1);
+    }
+    retval = krb5_write_message(context, &fd, &outbuf);
+    krb5_free_data_contents(context, &outbuf);
+    if (retval) {
+        com_err(progname, retval, _("while sending transfer reply"));
+        exit(1);
+    }
+
+    retval = krb5_auth_con_initivector(context, auth_context);
+    if (retval) {
+        send_error(context, fd, retval,
+                   "failed while initializing i_vector");
+        com_err(progname, retval, _("while initializing i_vector"));
+        exit(1);
+    }
+
+    if (debug) {
+        fprintf(stderr, _("Full propagation transfer started at offset "
+                          "%"PRIu64" of %"PRIu64"%s.\n"), offset,
+                database_size,
+                (flags & KPROP_FLAG_DEFLATE) ? _(", compressed") : "");
+    }
+
+    /* Start the loader and give it the part of the dump we already have. */
+    start_stream_load(context, kdb5_util, ld);
+    received_size = 0;
+    if (lseek(database_fd, 0, SEEK_SET) == (off_t)-1) {
+        com_err(progname, errno, _("while seeking in database file"));
+        exit(1);
+    }
+    while (received_size < offset) {
+        n = read(database_fd, buf, sizeof(buf));
+        if (n <= 0 || !write_all(ld->data_fd, buf, n)) {
+            snprintf(buf, sizeof(buf),
+                     "while resuming database transfer at offset %"PRIu64,
+                     offset);
+            com_err(progname, errno, "%s", buf);
+            send_error(context, fd, KRB5KRB_ERR_GENERIC, buf);
+            exit(1);
+        }
+        received_size += n;
+    }
+    if (lseek(database_fd, offset, SEEK_SET) == (off_t)-1) {
+        com_err(progname, errno, _("while seeking in database file"));
+        exit(1);
+    }
+
+#ifdef HAVE_ZLIB
+    memset(&zs, 0, sizeof(zs));
+    if ((flags & KPROP_FLAG_DEFLATE) && inflateInit(&zs) != Z_OK) {
+        send_error(context, fd, KRB5KRB_ERR_GENERIC,
+                   "while initializing decompression");
+        com_err(progname, ENOMEM, _("while initializing decompression"));
+        exit(1);
+    }
+#endif
+
+    /* Receive the rest of the dump.  A compressed transfer is complete when
+     * the deflate stream ends; otherwise when we have all of the bytes. */
+    done = (received_size == database_size && !(flags & KPROP_FLAG_DEFLATE));
+    while (!done) {
+        retval = krb5_read_message(context, &fd, &inbuf);
+        if (retval) {
+            snprintf(buf, sizeof(buf),
+                     "while reading database block starting at offset %"PRIu64,
+                     received_size);
+            com_err(progname, retval, "%s", buf);
+            send_error(context, fd, retval, buf);
+            exit(1);
+        }
+        if (krb5_is_krb_error(&inbuf))
+            recv_error(context, &inbuf);
+        retval = krb5_rd_priv(context, auth_context, &inbuf, &outbuf, NULL);
+        krb5_free_data_contents(context, &inbuf);
+        if (retval) {
+            snprintf(buf, sizeof(buf),
+                     "while decoding database block starting at offset %"
+                     PRIu64, received_size);
+            com_err(progname, retval, "%s", buf);
+            send_error(context, fd, retval, buf);
+            exit(1);
+        }
+
+#ifdef HAVE_ZLIB
+        if (flags & KPROP_FLAG_DEFLATE) {
+            zs.next_in = (Bytef *)outbuf.data;
+            zs.avail_in = outbuf.length;
+            do {
+                zs.next_out = (Bytef *)buf;
+                zs.avail_out = sizeof(buf);
+                zret = inflate(&zs, Z_NO_FLUSH);
+                if (zret != Z_OK && zret != Z_STREAM_END &&
+                    zret != Z_BUF_ERROR) {
+                    snprintf(buf, sizeof(buf),
+                             "while decompressing database block starting "
+                             "at offset %"PRIu64, received_size);
+                    com_err(progname, KRB5KRB_ERR_GENERIC, "%s", buf);
+                    send_error(context, fd, KRB5KRB_ERR_GENERIC, buf);
+                    exit(1);
+                }
+                n = sizeof(buf) - zs.avail_out;
+                if (received_size + n <= database_size) {
+                    store_dump_data(context, fd, database_fd, ld, buf, n,
+                                    received_size);
+                }
+                received_size += n;
+            } while (zs.avail_out == 0 && zret != Z_STREAM_END &&
+                     received_size <= database_size);
+            done = (zret == Z_STREAM_END);
+        } else
+#endif
+        {
+            n = outbuf.length;
+            if (received_size + n <= database_size) {
+                store_dump_data(context, fd, database_fd, ld, outbuf.data, n,
+                                received_size);
+            }
+            received_size += n;
+            done = (received_size >= database_size);
+        }
+        krb5_free_data_contents(context, &outbuf);
+
+        if (received_size > database_size || (done &&
+                                               received_size != database_size)) {
+            snprintf(buf, sizeof(buf),
+                     "Received %"PRIu64" bytes, expected %"PRIu64
+                     " bytes for database file",
+                     received_size, database_size);
+            com_err(progname, KRB5KRB_ERR_GENERIC, "%s", buf);
+            send_error(context, fd, KRB5KRB_ERR_GENERIC, buf);
+            exit(1);
+        }
+    }
+#ifdef HAVE_ZLIB
+    if (flags & KPROP_FLAG_DEFLATE)
+        inflateEnd(&zs);
+#endif
+
+    /* Let the loader see the end of the dump. */
+    close(ld->data_fd);
+    ld->data_fd = -1;
+
+    if (debug)
+        fprintf(stderr, _("Full propagation transfer finished.\n"));
+
+    /* Create message acknowledging number of bytes received, but
+     * don't send it until kdb5_util returns successfully. */
+    inbuf = make_data(dbsize_buf, sizeof(dbsize_buf));
+    encode_database_size(database_size, &inbuf);
+    retval = krb5_mk_safe(context,auth_context,&inbuf,confmsg,NULL);
+    if (retval) {
+        com_err(progname, retval, "while encoding # of received bytes");
+        send_error(context, fd, retval, "while encoding # of received bytes");
+        exit(1);
+    }
+}
+
+
 static void
 send_error(krb5_context context, int fd, krb5_error_code err_code,
            char *err_text)
@@ -1527,11 +2050,45 @@ recv_error(krb5_context context, krb5_data *inbuf)
     exit(1);
 }
 
+/*
+ * Fill in av, which must have room for twelve entries, with a kdb5_util
+ * command line to load the dump in database_file_name.  If confirm_arg is not
+ * NULL, pass it as the file descriptor from which kdb5_util must read a
+ * confirmation before making the loaded database live.
+ */
+static void
+make_load_args(krb5_context context, char *kdb_util, char *confirm_arg,
+               char *database_file_name, char **av)
+{
+    kdb_log_context *log_ctx = context->kdblog_context;
+    int count;
+
+    av[0] = kdb_util;
+    count = 1;
+    if (realm) {
+        av[count++] = "-r";
+        av[count++] = realm;
+    }
+    av[count++] = "load";
+    if (kerb_database) {
+        av[count++] = "-d";
+        av[count++] = kerb_database;
+    }
+    if (log_ctx && log_ctx->iproprole == IPROP_REPLICA)
+        av[count++] = "-i";
+    if (confirm_arg != NULL) {
+        av[count++] = "-confirm";
+        av[count++] = confirm_arg;
+    }
+    av[count++] = database_file_name;
+    av[count++] = NULL;
+}
+
 static void
 load_database(krb5_context context, char *kdb_util, char *database_file_name)
 {
-    static char *edit_av[10];
-    int error_ret, child_pid, count;
+    static char *edit_av[12];
+    int error_ret, child_pid;
 
     /* <sys/param.h> has been included, so BSD will be defined on
      * BSD systems. */
@@ -1543,28 +2100,11 @@ load_database(krb5_context context, char *kdb_util, char *database_file_name)
 #else
     int waitb;
 #endif
-    kdb_log_context *log_ctx;
 
     if (debug)
         fprintf(stderr, "calling kdb5_util to load database\n");
 
-    log_ctx = context->kdblog_context;
-
-    edit_av[0] = kdb_util;
-    count = 1;
-    if (realm) {
-        edit_av[count++] = "-r";
-        edit_av[count++] = realm;
-    }
-    edit_av[count++] = "load";
-    if (kerb_database) {
-        edit_av[count++] = "-d";
-        edit_av[count++] = kerb_database;
-    }
-    if (log_ctx && log_ctx->iproprole == IPROP_REPLICA)
-        edit_av[count++] = "-i";
-    edit_av[count++] = database_file_name;
-    edit_av[count++] = NULL;
+    make_load_args(context, kdb_util, NULL, database_file_name, edit_av);
 
     switch (child_pid = fork()) {
     case -1:
@@ -1598,6 +2138,88 @@ load_database(krb5_context context, char *kdb_util, char *database_file_name)
     return;
 }
 
+/*
+ * Start kdb5_util loading a dump from a pipe.  The database is not made live
+ * until finish_stream_load() confirms the load.
+ */
+static void
+start_stream_load(krb5_context context, char *kdb_util,
+                  struct stream_load *ld)
+{
+    static char *edit_av[12];
+    char confirm_arg[16];
+    int data_pipe[2], confirm_pipe[2];
+
+    if (debug)
+        fprintf(stderr, "calling kdb5_util to load database from a pipe\n");
+
+    if (pipe(data_pipe) == -1 || pipe(confirm_pipe) == -1) {
+        com_err(progname, errno, _("while creating pipes for %s"), kdb_util);
+        exit(1);
+    }
+    snprintf(confirm_arg, sizeof(confirm_arg), "%d", confirm_pipe[0]);
+    make_load_args(context, kdb_util, confirm_arg, "-", edit_av);
+
+    /* Report a loader which exits early as a write error, not a signal. */
+    signal_wrapper(SIGPIPE, SIG_IGN);
+
+    switch (ld->pid = fork()) {
+    case -1:
+        com_err(progname, errno, _("while trying to fork %s"), kdb_util);
+        exit(1);
+    case 0:
+        close(data_pipe[1]);
+        close(confirm_pipe[1]);
+        if (dup2(data_pipe[0], STDIN_FILENO) == -1) {
+            com_err(progname, errno, _("while trying to exec %s"), kdb_util);
+            _exit(1);
+        }
+        close(data_pipe[0]);
+        execv(kdb_util, edit_av);
+        com_err(progname, errno, _("while trying to exec %s"), kdb_util);
+        _exit(1);
+        /*NOTREACHED*/
+    default:
+        if (debug)
+            fprintf(stderr, "Load PID is %ld\n", (long)ld->pid);
+        close(data_pipe[0]);
+        close(confirm_pipe[0]);
+        ld->data_fd = data_pipe[1];
+        ld->confirm_fd = confirm_pipe[1];
+    }
+}
+
+/* Confirm a streaming load and wait for kdb5_util to finish it. */
+static void
+finish_stream_load(krb5_context context, struct stream_load *ld)
+{
+    int status;
+
+    if (ld->data_fd != -1)
+        close(ld->data_fd);
+    if (!write_all(ld->confirm_fd, "y", 1)) {
+        com_err(progname, errno, _("while confirming load by %s"), kdb5_util);
+        exit(1);
+    }
+    close(ld->confirm_fd);
+
+    while (waitpid(ld->pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            com_err(progname, errno, _("while waiting for %s"), kdb5_util);
+            exit(1);
+        }
+    }
+    if (!WIFEXITED(status)) {
+        com_err(progname, 0, _("%s load terminated"), kdb5_util);
+        exit(1);
+    }
+    if (WEXITSTATUS(status)) {
+        com_err(progname, 0, _("%s returned a bad exit status (%d)"),
+                kdb5_util, WEXITSTATUS(status));
+        exit(1);
+    }
+}
+
 /*
  * Get the host base service name for the kiprop principal. Returns
  * KADM5_OK on success. Caller must free the storage allocated
@@ -163,6 +163,7 @@ struct connection {
     /* RPC-specific fields */
     SVCXPRT *transp;
     int rpc_force_close;
+    int rpc_held;
 };
 
 #define SET(TYPE) struct { TYPE *data; size_t n, max; }
@@ -1118,6 +1119,8 @@ kill_lru_tcp_or_rpc_connection(void *handle, verto_ev *newev)
             continue;
         if (c->type != CONN_TCP && c->type != CONN_RPC)
             continue;
+        if (c->rpc_held)
+            continue;
         if (oldest_c == NULL
             || oldest_c->start_time > c->start_time) {
             oldest_ev = ev;
@@ -1425,18 +1428,24 @@ loop_free(verto_ctx *ctx)
     FREE_SET_DATA(events);
 }
 
-static int
-have_event_for_fd(int fd)
+static verto_ev *
+find_event_for_fd(int fd)
 {
     verto_ev *ev;
     int i;
 
     FOREACH_ELT(events, i, ev) {
         if (verto_get_fd(ev) == fd)
-            return 1;
+            return ev;
     }
 
-    return 0;
+    return NULL;
+}
+
+static int
+have_event_for_fd(int fd)
+{
+    return find_event_for_fd(fd) != NULL;
 }
 
 static void
@@ -1519,4 +1528,37 @@ process_rpc_connection(verto_ctx *ctx, verto_ev *ev)
         verto_del(ev);
 }
 
+krb5_error_code
+loop_hold_rpc_connection(int fd)
+{
+    struct connection *conn;
+    verto_ev *ev;
+
+    ev = find_event_for_fd(fd);
+    if (ev == NULL)
+        return ENOENT;
+    conn = verto_get_private(ev);
+    if (conn == NULL || conn->type != CONN_RPC || conn->rpc_held)
+        return EINVAL;
+    conn->rpc_held = 1;
+    verto_set_flags(ev, VERTO_EV_FLAG_PERSIST);
+    return 0;
+}
+
+void
+loop_release_rpc_connection(int fd)
+{
+    struct connection *conn;
+    verto_ev *ev;
+
+    ev = find_event_for_fd(fd);
+    if (ev == NULL)
+        return;
+    conn = verto_get_private(ev);
+    if (conn == NULL || !conn->rpc_held)
+        return;
+    conn->rpc_held = 0;
+    verto_set_flags(ev, VERTO_EV_FLAG_IO_READ | VERTO_EV_FLAG_PERSIST);
+}
+
 #endif /* INET */
@@ -287,6 +287,30 @@ typedef struct _kadm5_key_data {
     krb5_keysalt    salt;
 } kadm5_key_data;
 
+/*
+ * One entry in a batch passed to kadm5_create_principals() or
+ * kadm5_modify_principals().  n_ks_tuple, ks_tuple, and pass are used only
+ * when creating principals.
+ */
+typedef struct _kadm5_principal_op {
+    kadm5_principal_ent_rec rec;
+    long            mask;
+    int             n_ks_tuple;
+    krb5_key_salt_tuple *ks_tuple;
+    char            *pass;
+} kadm5_principal_op_rec, *kadm5_principal_op_t;
+
+/*
+ * The result for one principal of kadm5_randkey_principals().  If code is 0,
+ * key_data contains the new keys, which the caller frees with
+ * kadm5_free_kadm5_key_data().
+ */
+typedef struct _kadm5_principal_keys {
+    kadm5_ret_t     code;
+    kadm5_key_data  *key_data;
+    int             n_key_data;
+} kadm5_principal_keys_rec, *kadm5_principal_keys_t;
+
 /*
  * functions
  */
@@ -370,6 +394,20 @@ kadm5_ret_t    kadm5_delete_principal(void *server_handle,
 kadm5_ret_t    kadm5_modify_principal(void *server_handle,
                                       kadm5_principal_ent_t ent,
                                       long mask);
+
+/*
+ * Create or modify each principal in ops, as if by kadm5_create_principal_3()
+ * or kadm5_modify_principal(), placing the result of ops[i] in codes[i].  The
+ * operations are performed under one database lock and their update log
+ * entries are flushed together.  The return value is nonzero only if the
+ * batch as a whole could not be attempted, in which case codes is not set.
+ */
+kadm5_ret_t    kadm5_create_principals(void *server_handle,
+                                       kadm5_principal_op_t ops, int count,
+                                       kadm5_ret_t *codes);
+kadm5_ret_t    kadm5_modify_principals(void *server_handle,
+                                       kadm5_principal_op_t ops, int count,
+                                       kadm5_ret_t *codes);
 kadm5_ret_t    kadm5_rename_principal(void *server_handle,
                                       krb5_principal,krb5_principal);
 kadm5_ret_t    kadm5_get_principal(void *server_handle,
@@ -397,6 +435,21 @@ kadm5_ret_t    kadm5_randkey_principal_3(void *server_handle,
                                          krb5_keyblock **keyblocks,
                                          int *n_keys);
 
+/*
+ * Randomize the keys of each principal in princs, as if by
+ * kadm5_randkey_principal_3(), placing the result for princs[i] and its new
+ * keys (with their kvno) in results[i].  The operations are performed under
+ * one database lock, as with kadm5_create_principals().  The return value is
+ * nonzero only if the batch as a whole could not be attempted, in which case
+ * results is not set.
+ */
+kadm5_ret_t    kadm5_randkey_principals(void *server_handle,
+                                        krb5_principal *princs, int count,
+                                        krb5_boolean keepold,
+                                        int n_ks_tuple,
+                                        krb5_key_salt_tuple *ks_tuple,
+                                        kadm5_principal_keys_t results);
+
 kadm5_ret_t    kadm5_setkey_principal(void *server_handle,
                                       krb5_principal principal,
                                       krb5_keyblock *keyblocks,
@@ -453,6 +506,18 @@ kadm5_ret_t    kadm5_get_principals(void *server_handle,
                                     char *exp, char ***princs,
                                     int *count);
 
+/*
+ * List at most max principal names matching exp, in name order, beginning
+ * after cursor (or at the first name if cursor is NULL).  If more names may
+ * follow, set *next_cursor to an allocated string to pass as cursor for the
+ * next page; otherwise set it to NULL.  Free the names with
+ * kadm5_free_name_list() and the cursor with free().
+ */
+kadm5_ret_t    kadm5_get_principals_page(void *server_handle,
+                                         char *exp, char *cursor, int max,
+                                         char ***princs, int *count,
+                                         char **next_cursor);
+
 kadm5_ret_t    kadm5_get_policies(void *server_handle,
                                   char *exp, char ***pols,
                                   int *count);
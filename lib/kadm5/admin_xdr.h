@@ -71,3 +71,13 @@ bool_t      xdr_osa_pw_hist_ent(XDR *xdrs, osa_pw_hist_ent *objp);
 bool_t      xdr_kadm5_key_data(XDR *xdrs, kadm5_key_data *objp);
 bool_t      xdr_getpkeys_arg(XDR *xdrs, getpkeys_arg *objp);
 bool_t      xdr_getpkeys_ret(XDR *xdrs, getpkeys_ret *objp);
+bool_t      xdr_kadm5_principal_op_rec(XDR *xdrs,
+                                       kadm5_principal_op_rec *objp);
+bool_t      xdr_bprinc_arg(XDR *xdrs, bprinc_arg *objp);
+bool_t      xdr_bprinc_ret(XDR *xdrs, bprinc_ret *objp);
+bool_t      xdr_kadm5_principal_keys_rec(XDR *xdrs,
+                                         kadm5_principal_keys_rec *objp);
+bool_t      xdr_brandkey_arg(XDR *xdrs, brandkey_arg *objp);
+bool_t      xdr_brandkey_ret(XDR *xdrs, brandkey_ret *objp);
+bool_t      xdr_gprincs_page_arg(XDR *xdrs, gprincs_page_arg *objp);
+bool_t      xdr_gprincs_page_ret(XDR *xdrs, gprincs_page_ret *objp);
@@ -58,12 +58,10 @@ kadm5_ret_t _kadm5_chpass_principal_util(void *server_handle,
                                          char *msg_ret,
                                          unsigned int msg_len)
 {
-    int code, code2;
+    int code;
     unsigned int pwsize;
     static char buffer[255];
     char *new_password;
-    kadm5_principal_ent_rec princ_ent;
-    kadm5_policy_ent_rec policy_ent;
 
     _KADM5_CHECK_HANDLE(server_handle);
 
@@ -123,6 +121,24 @@ kadm5_ret_t _kadm5_chpass_principal_util(void *server_handle,
         memset(buffer, 0, sizeof(buffer)); /* in case we read a new password */
 #endif
 
+    return _kadm5_chpass_principal_message(lhandle, princ, code, msg_ret,
+                                           msg_len);
+}
+
+/*
+ * Place in msg_ret a message describing the result code of a password change
+ * for princ, looking up princ's policy via lhandle if necessary to explain a
+ * password quality failure.  Return code.
+ */
+kadm5_ret_t
+_kadm5_chpass_principal_message(void *lhandle, krb5_principal princ,
+                                kadm5_ret_t code, char *msg_ret,
+                                unsigned int msg_len)
+{
+    int code2;
+    kadm5_principal_ent_rec princ_ent;
+    kadm5_policy_ent_rec policy_ent;
+
     if (code == KADM5_OK) {
         strncpy(msg_ret, string_text(CHPASS_UTIL_PASSWORD_CHANGED), msg_len - 1);
         msg_ret[msg_len - 1] = '\0';
@@ -153,6 +153,122 @@ kadm5_modify_principal(void *server_handle,
     return r.code;
 }
 
+/* Copy ops into a newly allocated array, leaving out the fields which are not
+ * sent to the server, as for a single create or modify. */
+static kadm5_principal_op_t
+copy_ops(kadm5_principal_op_t ops, int count, krb5_boolean create)
+{
+    kadm5_principal_op_t copy;
+    kadm5_principal_ent_t rec;
+    int i;
+
+    copy = calloc(count > 0 ? count : 1, sizeof(*copy));
+    if (copy == NULL)
+        return NULL;
+    for (i = 0; i < count; i++) {
+        copy[i] = ops[i];
+        rec = &copy[i].rec;
+        rec->mod_name = NULL;
+        if (!(ops[i].mask & KADM5_POLICY))
+            rec->policy = NULL;
+        if (!(ops[i].mask & KADM5_KEY_DATA)) {
+            rec->n_key_data = 0;
+            rec->key_data = NULL;
+        }
+        if (!(ops[i].mask & KADM5_TL_DATA)) {
+            rec->n_tl_data = 0;
+            rec->tl_data = NULL;
+        }
+        if (!create) {
+            copy[i].n_ks_tuple = 0;
+            copy[i].ks_tuple = NULL;
+            copy[i].pass = NULL;
+        }
+    }
+    return copy;
+}
+
+/* Perform ops one at a time, for servers which do not support batches. */
+static kadm5_ret_t
+unbatched_ops(void *server_handle, kadm5_principal_op_t ops, int count,
+              krb5_boolean create, kadm5_ret_t *codes)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (create) {
+            codes[i] = kadm5_create_principal_3(server_handle, &ops[i].rec,
+                                                ops[i].mask,
+                                                ops[i].n_ks_tuple,
+                                                ops[i].ks_tuple, ops[i].pass);
+        } else {
+            codes[i] = kadm5_modify_principal(server_handle, &ops[i].rec,
+                                              ops[i].mask);
+        }
+        if (codes[i] == KADM5_RPC_ERROR)
+            return KADM5_RPC_ERROR;
+    }
+    return 0;
+}
+
+static kadm5_ret_t
+batch_ops(void *server_handle, kadm5_principal_op_t ops, int count,
+          krb5_boolean create, kadm5_ret_t *codes)
+{
+    bprinc_arg          arg;
+    bprinc_ret          r;
+    enum clnt_stat      st;
+    kadm5_ret_t         ret;
+    kadm5_server_handle_t handle = server_handle;
+
+    CHECK_HANDLE(server_handle);
+
+    if (count < 0 || (count > 0 && (ops == NULL || codes == NULL)))
+        return EINVAL;
+    if (count == 0)
+        return 0;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.api_version = handle->api_version;
+    arg.count = count;
+    arg.ops = copy_ops(ops, count, create);
+    if (arg.ops == NULL)
+        return ENOMEM;
+
+    memset(&r, 0, sizeof(r));
+    if (create)
+        st = create_principals_2(&arg, &r, handle->clnt);
+    else
+        st = modify_principals_2(&arg, &r, handle->clnt);
+    free(arg.ops);
+    if (st == RPC_PROCUNAVAIL)
+        return unbatched_ops(server_handle, ops, count, create, codes);
+    if (st != RPC_SUCCESS)
+        eret();
+
+    ret = r.code;
+    if (ret == 0 && r.count != count)
+        ret = KADM5_RPC_ERROR;
+    if (ret == 0)
+        memcpy(codes, r.codes, count * sizeof(*codes));
+    xdr_free(xdr_bprinc_ret, &r);
+    return ret;
+}
+
+kadm5_ret_t
+kadm5_create_principals(void *server_handle, kadm5_principal_op_t ops,
+                        int count, kadm5_ret_t *codes)
+{
+    return batch_ops(server_handle, ops, count, TRUE, codes);
+}
+
+kadm5_ret_t
+kadm5_modify_principals(void *server_handle, kadm5_principal_op_t ops,
+                        int count, kadm5_ret_t *codes)
+{
+    return batch_ops(server_handle, ops, count, FALSE, codes);
+}
+
 kadm5_ret_t
 kadm5_get_principal(void *server_handle,
                     krb5_principal princ, kadm5_principal_ent_t ent,
@@ -206,6 +322,44 @@ kadm5_get_principals(void *server_handle,
     return r.code;
 }
 
+kadm5_ret_t
+kadm5_get_principals_page(void *server_handle, char *exp, char *cursor,
+                          int max, char ***princs, int *count,
+                          char **next_cursor)
+{
+    gprincs_page_arg arg;
+    gprincs_page_ret r;
+    enum clnt_stat st;
+    kadm5_server_handle_t handle = server_handle;
+
+    CHECK_HANDLE(server_handle);
+
+    if (princs == NULL || count == NULL || next_cursor == NULL || max <= 0)
+        return EINVAL;
+    *princs = NULL;
+    *count = 0;
+    *next_cursor = NULL;
+
+    arg.api_version = handle->api_version;
+    arg.exp = exp;
+    arg.cursor = cursor;
+    arg.max = max;
+    memset(&r, 0, sizeof(r));
+    st = get_princs_page_2(&arg, &r, handle->clnt);
+    if (st == RPC_PROCUNAVAIL && cursor == NULL) {
+        /* The server cannot page; return the whole list as one page. */
+        return kadm5_get_principals(server_handle, exp, princs, count);
+    }
+    if (st != RPC_SUCCESS)
+        eret();
+    if (r.code == 0) {
+        *count = r.count;
+        *princs = r.princs;
+        *next_cursor = r.next_cursor;
+    }
+    return r.code;
+}
+
 kadm5_ret_t
 kadm5_rename_principal(void *server_handle,
                        krb5_principal source, krb5_principal dest)
@@ -389,6 +543,132 @@ kadm5_randkey_principal_3(void *server_handle,
     return r.code;
 }
 
+/*
+ * Randomize the keys of princ and return them with their kvno, for servers
+ * which do not support RANDKEY_PRINCIPALS.  Use the original randkey RPC if
+ * the server does not support CHRAND_PRINCIPAL3 and no new parameters are
+ * needed.  Only fall back when the server says the procedure is unavailable,
+ * so that keys are never randomized twice after a communication failure.
+ */
+static kadm5_ret_t
+unbatched_randkey(void *server_handle, krb5_principal princ,
+                  krb5_boolean keepold, int n_ks_tuple,
+                  krb5_key_salt_tuple *ks_tuple, kadm5_principal_keys_t res)
+{
+    kadm5_server_handle_t handle = server_handle;
+    kadm5_principal_ent_rec ent;
+    chrand3_arg arg3;
+    chrand_arg arg;
+    chrand_ret r;
+    enum clnt_stat st;
+    krb5_keyblock *keys = NULL;
+    krb5_kvno kvno;
+    kadm5_ret_t ret;
+    int i, nkeys = 0;
+
+    arg3.princ = princ;
+    arg3.api_version = handle->api_version;
+    arg3.keepold = keepold;
+    arg3.n_ks_tuple = n_ks_tuple;
+    arg3.ks_tuple = ks_tuple;
+    memset(&r, 0, sizeof(r));
+    st = chrand_principal3_2(&arg3, &r, handle->clnt);
+    if (st == RPC_PROCUNAVAIL && !keepold && ks_tuple == NULL) {
+        arg.princ = princ;
+        arg.api_version = handle->api_version;
+        memset(&r, 0, sizeof(r));
+        st = chrand_principal_2(&arg, &r, handle->clnt);
+    }
+    if (st != RPC_SUCCESS)
+        eret();
+    keys = r.keys;
+    nkeys = r.n_keys;
+    ret = r.code;
+    if (ret)
+        goto cleanup;
+    ret = kadm5_get_principal(server_handle, princ, &ent, KADM5_KVNO);
+    if (ret)
+        goto cleanup;
+    kvno = ent.kvno;
+    kadm5_free_principal_ent(server_handle, &ent);
+
+    if (nkeys > 0) {
+        res->key_data = calloc(nkeys, sizeof(*res->key_data));
+        if (res->key_data == NULL) {
+            ret = ENOMEM;
+            goto cleanup;
+        }
+    }
+    for (i = 0; i < nkeys; i++) {
+        res->key_data[i].kvno = kvno;
+        res->key_data[i].key = keys[i];
+    }
+    res->n_key_data = nkeys;
+    free(keys);
+    return 0;
+
+cleanup:
+    for (i = 0; i < nkeys; i++)
+        krb5_free_keyblock_contents(handle->context, &keys[i]);
+    free(keys);
+    return ret;
+}
+
+kadm5_ret_t
+kadm5_randkey_principals(void *server_handle, krb5_principal *princs,
+                         int count, krb5_boolean keepold, int n_ks_tuple,
+                         krb5_key_salt_tuple *ks_tuple,
+                         kadm5_principal_keys_t results)
+{
+    brandkey_arg        arg;
+    brandkey_ret        r;
+    enum clnt_stat      st;
+    kadm5_ret_t         ret;
+    kadm5_server_handle_t handle = server_handle;
+    int                 i;
+
+    CHECK_HANDLE(server_handle);
+
+    if (count < 0 || (count > 0 && (princs == NULL || results == NULL)))
+        return EINVAL;
+    if (count == 0)
+        return 0;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.api_version = handle->api_version;
+    arg.princs = princs;
+    arg.count = count;
+    arg.keepold = keepold;
+    arg.n_ks_tuple = n_ks_tuple;
+    arg.ks_tuple = ks_tuple;
+
+    memset(&r, 0, sizeof(r));
+    st = randkey_principals_2(&arg, &r, handle->clnt);
+    if (st == RPC_PROCUNAVAIL) {
+        for (i = 0; i < count; i++) {
+            memset(&results[i], 0, sizeof(results[i]));
+            results[i].code = unbatched_randkey(server_handle, princs[i],
+                                                keepold, n_ks_tuple, ks_tuple,
+                                                &results[i]);
+        }
+        return 0;
+    }
+    if (st != RPC_SUCCESS)
+        eret();
+
+    ret = r.code;
+    if (ret == 0 && r.count != count)
+        ret = KADM5_RPC_ERROR;
+    if (ret) {
+        xdr_free(xdr_brandkey_ret, &r);
+        return ret;
+    }
+    /* Take ownership of the decoded key data. */
+    memcpy(results, r.results, count * sizeof(*results));
+    free(r.results);
+    return 0;
+}
+
 kadm5_ret_t
 kadm5_randkey_principal(void *server_handle,
                         krb5_principal princ,
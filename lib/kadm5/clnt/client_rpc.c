@@ -211,3 +211,35 @@ get_principal_keys_2(getpkeys_arg *argp, getpkeys_ret *res, CLIENT *clnt)
 			 (xdrproc_t)xdr_getpkeys_arg, (caddr_t)argp,
 			 (xdrproc_t)xdr_getpkeys_ret, (caddr_t)res, TIMEOUT);
 }
+
+enum clnt_stat
+create_principals_2(bprinc_arg *argp, bprinc_ret *res, CLIENT *clnt)
+{
+	return clnt_call(clnt, CREATE_PRINCIPALS,
+			 (xdrproc_t)xdr_bprinc_arg, (caddr_t)argp,
+			 (xdrproc_t)xdr_bprinc_ret, (caddr_t)res, TIMEOUT);
+}
+
+enum clnt_stat
+modify_principals_2(bprinc_arg *argp, bprinc_ret *res, CLIENT *clnt)
+{
+	return clnt_call(clnt, MODIFY_PRINCIPALS,
+			 (xdrproc_t)xdr_bprinc_arg, (caddr_t)argp,
+			 (xdrproc_t)xdr_bprinc_ret, (caddr_t)res, TIMEOUT);
+}
+
+enum clnt_stat
+get_princs_page_2(gprincs_page_arg *argp, gprincs_page_ret *res, CLIENT *clnt)
+{
+	return clnt_call(clnt, GET_PRINCS_PAGE,
+			 (xdrproc_t)xdr_gprincs_page_arg, (caddr_t)argp,
+			 (xdrproc_t)xdr_gprincs_page_ret, (caddr_t)res, TIMEOUT);
+}
+
+enum clnt_stat
+randkey_principals_2(brandkey_arg *argp, brandkey_ret *res, CLIENT *clnt)
+{
+	return clnt_call(clnt, RANDKEY_PRINCIPALS,
+			 (xdrproc_t)xdr_brandkey_arg, (caddr_t)argp,
+			 (xdrproc_t)xdr_brandkey_ret, (caddr_t)res, TIMEOUT);
+}
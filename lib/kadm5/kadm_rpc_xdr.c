@@ -1204,3 +1204,163 @@ xdr_getpkeys_ret(XDR *xdrs, getpkeys_ret *objp)
 	}
 	return TRUE;
 }
+
+/* Batch entries always carry the current principal record format, as the
+ * batch procedures are newer than any earlier API version. */
+bool_t
+xdr_kadm5_principal_op_rec(XDR *xdrs, kadm5_principal_op_rec *objp)
+{
+	if (!_xdr_kadm5_principal_ent_rec(xdrs, &objp->rec,
+					  KADM5_API_VERSION_4)) {
+		return FALSE;
+	}
+	if (!xdr_long(xdrs, &objp->mask)) {
+		return FALSE;
+	}
+	if (!xdr_array(xdrs, (caddr_t *)&objp->ks_tuple,
+		       (unsigned int *)&objp->n_ks_tuple, ~0,
+		       sizeof(krb5_key_salt_tuple),
+		       xdr_krb5_key_salt_tuple)) {
+		return FALSE;
+	}
+	if (!xdr_nullstring(xdrs, &objp->pass)) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_bprinc_arg(XDR *xdrs, bprinc_arg *objp)
+{
+	if (!xdr_ui_4(xdrs, &objp->api_version)) {
+		return FALSE;
+	}
+	if (!xdr_array(xdrs, (caddr_t *)&objp->ops,
+		       (unsigned int *)&objp->count, ~0,
+		       sizeof(kadm5_principal_op_rec),
+		       xdr_kadm5_principal_op_rec)) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_bprinc_ret(XDR *xdrs, bprinc_ret *objp)
+{
+	if (!xdr_ui_4(xdrs, &objp->api_version)) {
+		return FALSE;
+	}
+	if (!xdr_kadm5_ret_t(xdrs, &objp->code)) {
+		return FALSE;
+	}
+	if (objp->code == KADM5_OK) {
+		if (!xdr_array(xdrs, (caddr_t *)&objp->codes,
+			       (unsigned int *)&objp->count, ~0,
+			       sizeof(kadm5_ret_t), xdr_kadm5_ret_t)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_kadm5_principal_keys_rec(XDR *xdrs, kadm5_principal_keys_rec *objp)
+{
+	if (!xdr_kadm5_ret_t(xdrs, &objp->code)) {
+		return FALSE;
+	}
+	if (objp->code == KADM5_OK) {
+		if (!xdr_array(xdrs, (caddr_t *)&objp->key_data,
+			       (unsigned int *)&objp->n_key_data, ~0,
+			       sizeof(kadm5_key_data), xdr_kadm5_key_data)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_brandkey_arg(XDR *xdrs, brandkey_arg *objp)
+{
+	if (!xdr_ui_4(xdrs, &objp->api_version)) {
+		return FALSE;
+	}
+	if (!xdr_array(xdrs, (caddr_t *)&objp->princs,
+		       (unsigned int *)&objp->count, ~0,
+		       sizeof(krb5_principal), xdr_krb5_principal)) {
+		return FALSE;
+	}
+	if (!xdr_krb5_boolean(xdrs, &objp->keepold)) {
+		return FALSE;
+	}
+	if (!xdr_array(xdrs, (caddr_t *)&objp->ks_tuple,
+		       (unsigned int *)&objp->n_ks_tuple, ~0,
+		       sizeof(krb5_key_salt_tuple),
+		       xdr_krb5_key_salt_tuple)) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_brandkey_ret(XDR *xdrs, brandkey_ret *objp)
+{
+	if (!xdr_ui_4(xdrs, &objp->api_version)) {
+		return FALSE;
+	}
+	if (!xdr_kadm5_ret_t(xdrs, &objp->code)) {
+		return FALSE;
+	}
+	if (objp->code == KADM5_OK) {
+		if (!xdr_array(xdrs, (caddr_t *)&objp->results,
+			       (unsigned int *)&objp->count, ~0,
+			       sizeof(kadm5_principal_keys_rec),
+			       xdr_kadm5_principal_keys_rec)) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+bool_t
+xdr_gprincs_page_arg(XDR *xdrs, gprincs_page_arg *objp)
+{
+     if (!xdr_ui_4(xdrs, &objp->api_version)) {
+	  return (FALSE);
+     }
+     if (!xdr_nullstring(xdrs, &objp->exp)) {
+	  return (FALSE);
+     }
+     if (!xdr_nullstring(xdrs, &objp->cursor)) {
+	  return (FALSE);
+     }
+     if (!xdr_int(xdrs, &objp->max)) {
+	  return (FALSE);
+     }
+     return (TRUE);
+}
+
+bool_t
+xdr_gprincs_page_ret(XDR *xdrs, gprincs_page_ret *objp)
+{
+     if (!xdr_ui_4(xdrs, &objp->api_version)) {
+	  return (FALSE);
+     }
+     if (!xdr_kadm5_ret_t(xdrs, &objp->code)) {
+	  return (FALSE);
+     }
+     if (objp->code == KADM5_OK) {
+	  if (!xdr_int(xdrs, &objp->count)) {
+	       return (FALSE);
+	  }
+	  if (!xdr_array(xdrs, (caddr_t *) &objp->princs,
+			 (unsigned int *) &objp->count, ~0,
+			 sizeof(char *), xdr_nullstring)) {
+	       return (FALSE);
+	  }
+	  if (!xdr_nullstring(xdrs, &objp->next_cursor)) {
+	       return (FALSE);
+	  }
+     }
+     return (TRUE);
+}
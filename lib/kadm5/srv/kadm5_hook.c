@@ -31,19 +31,538 @@
 #include <adm_proto.h>
 #include <syslog.h>
 
+/*
+ * If the kadm5_hook_async realm relation is set, each module gets a queue and
+ * a dispatcher thread.  There is one queue per module per process, shared by
+ * all server handles and released with the last of them, so postcommit calls
+ * for a principal are made in the order the changes were committed no matter
+ * which handle made them.  The queue has its own instance of the module,
+ * initialized with the dispatcher's krb5 context, so the module's methods
+ * must tolerate being called from two threads at once.  A failed postcommit
+ * call is retried up to kadm5_hook_retries times with exponential backoff.
+ * If the queue holds kadm5_hook_queue_size calls, the request thread waits
+ * for space.  The queue size and retry count are read by the first handle to
+ * load the module.  Precommit calls are always made synchronously.
+ */
+
+#define DEFAULT_QUEUE_SIZE 1000
+#define DEFAULT_RETRIES 3
+#define RETRY_DELAY_MAX 60
+
+enum hook_op { HOOK_CHPASS, HOOK_CREATE, HOOK_MODIFY, HOOK_REMOVE,
+               HOOK_RENAME };
+
+static const char *const op_names[] = {
+    "chpass", "create", "modify", "remove", "rename"
+};
+
+/* The arguments of one hook call.  In events passed to dispatch(), the fields
+ * alias the caller's arguments; queued events own copies, with entp pointing
+ * to ent. */
+struct hook_event {
+    struct hook_event *next;
+    enum hook_op op;
+    krb5_principal princ;
+    krb5_principal nprinc;
+    kadm5_principal_ent_t entp;
+    kadm5_principal_ent_rec ent;
+    long mask;
+    krb5_boolean keepold;
+    int n_ks_tuple;
+    krb5_key_salt_tuple *ks_tuple;
+    char *pass;
+};
+
+struct hook_queue;
+
 struct kadm5_hook_handle_st {
     kadm5_hook_vftable_1 vt;
     kadm5_hook_modinfo *data;
+    struct hook_queue *queue;   /* NULL unless in asynchronous mode */
+};
+
+static kadm5_ret_t
+call_hook(krb5_context context, kadm5_hook_handle h, int stage,
+          struct hook_event *ev)
+{
+    switch (ev->op) {
+    case HOOK_CHPASS:
+        if (h->vt.chpass == NULL)
+            return 0;
+        return h->vt.chpass(context, h->data, stage, ev->princ, ev->keepold,
+                            ev->n_ks_tuple, ev->ks_tuple, ev->pass);
+    case HOOK_CREATE:
+        if (h->vt.create == NULL)
+            return 0;
+        return h->vt.create(context, h->data, stage, ev->entp, ev->mask,
+                            ev->n_ks_tuple, ev->ks_tuple, ev->pass);
+    case HOOK_MODIFY:
+        if (h->vt.modify == NULL)
+            return 0;
+        return h->vt.modify(context, h->data, stage, ev->entp, ev->mask);
+    case HOOK_REMOVE:
+        if (h->vt.remove == NULL)
+            return 0;
+        return h->vt.remove(context, h->data, stage, ev->princ);
+    case HOOK_RENAME:
+        if (h->vt.rename == NULL)
+            return 0;
+        return h->vt.rename(context, h->data, stage, ev->princ, ev->nprinc);
+    }
+    return 0;
+}
+
+static krb5_boolean
+has_method(kadm5_hook_handle h, enum hook_op op)
+{
+    switch (op) {
+    case HOOK_CHPASS:
+        return h->vt.chpass != NULL;
+    case HOOK_CREATE:
+        return h->vt.create != NULL;
+    case HOOK_MODIFY:
+        return h->vt.modify != NULL;
+    case HOOK_REMOVE:
+        return h->vt.remove != NULL;
+    case HOOK_RENAME:
+        return h->vt.rename != NULL;
+    }
+    return FALSE;
+}
+
+static void
+log_failure(krb5_context context,
+            const char *name,
+            const char *function,
+            krb5_error_code ret)
+{
+    const char *e = krb5_get_error_message(context, ret);
+
+    krb5_klog_syslog(LOG_ERR, _("kadm5_hook %s failed postcommit %s: %s"),
+                     name, function, e);
+    krb5_free_error_message(context, e);
+}
+
+#if defined(ENABLE_THREADS) && defined(HAVE_PTHREAD)
+
+struct hook_queue {
+    struct hook_queue *next;
+    int refcount;
+    struct kadm5_hook_handle_st module;
+    krb5_context context;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    pthread_cond_t nonfull;
+    struct hook_event *head;
+    struct hook_event **tailp;
+    int len;
+    int max;
+    int retries;
+    krb5_boolean stopping;
 };
 
+/* The process-wide list of queues, protected by queues_lock. */
+static pthread_mutex_t queues_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hook_queue *queues;
+
+static void
+free_ent_contents(krb5_context context, kadm5_principal_ent_t ent)
+{
+    krb5_tl_data *tl, *next;
+    int i;
+
+    krb5_free_principal(context, ent->principal);
+    krb5_free_principal(context, ent->mod_name);
+    free(ent->policy);
+    for (i = 0; i < ent->n_key_data; i++)
+        krb5_free_key_data_contents(context, &ent->key_data[i]);
+    free(ent->key_data);
+    for (tl = ent->tl_data; tl != NULL; tl = next) {
+        next = tl->tl_data_next;
+        free(tl->tl_data_contents);
+        free(tl);
+    }
+}
+
+static krb5_error_code
+copy_ent(krb5_context context, const kadm5_principal_ent_rec *in,
+         kadm5_principal_ent_t out)
+{
+    krb5_error_code ret;
+    krb5_tl_data *tl, **tlp;
+    krb5_key_data *kd;
+    int i, j;
+
+    *out = *in;
+    out->principal = out->mod_name = NULL;
+    out->policy = NULL;
+    out->key_data = NULL;
+    out->n_key_data = 0;
+    out->tl_data = NULL;
+
+    if (in->principal != NULL) {
+        ret = krb5_copy_principal(context, in->principal, &out->principal);
+        if (ret)
+            goto fail;
+    }
+    if (in->mod_name != NULL) {
+        ret = krb5_copy_principal(context, in->mod_name, &out->mod_name);
+        if (ret)
+            goto fail;
+    }
+    if (in->policy != NULL) {
+        out->policy = k5memdup0(in->policy, strlen(in->policy), &ret);
+        if (out->policy == NULL)
+            goto fail;
+    }
+    if (in->n_key_data > 0) {
+        out->key_data = k5calloc(in->n_key_data, sizeof(*out->key_data),
+                                 &ret);
+        if (out->key_data == NULL)
+            goto fail;
+        for (i = 0; i < in->n_key_data; i++, out->n_key_data++) {
+            kd = &out->key_data[i];
+            *kd = in->key_data[i];
+            for (j = 0; j < 2; j++) {
+                kd->key_data_contents[j] = NULL;
+                if (in->key_data[i].key_data_length[j] == 0)
+                    continue;
+                kd->key_data_contents[j] =
+                    k5memdup(in->key_data[i].key_data_contents[j],
+                             in->key_data[i].key_data_length[j], &ret);
+                if (kd->key_data_contents[j] == NULL)
+                    goto fail;
+            }
+        }
+    }
+    tlp = &out->tl_data;
+    for (tl = in->tl_data; tl != NULL; tl = tl->tl_data_next) {
+        *tlp = k5alloc(sizeof(**tlp), &ret);
+        if (*tlp == NULL)
+            goto fail;
+        (*tlp)->tl_data_type = tl->tl_data_type;
+        (*tlp)->tl_data_length = tl->tl_data_length;
+        (*tlp)->tl_data_contents = k5memdup(tl->tl_data_contents,
+                                            tl->tl_data_length, &ret);
+        if ((*tlp)->tl_data_contents == NULL && tl->tl_data_length > 0)
+            goto fail;
+        tlp = &(*tlp)->tl_data_next;
+    }
+    return 0;
+
+fail:
+    free_ent_contents(context, out);
+    memset(out, 0, sizeof(*out));
+    return ret;
+}
+
+static void
+free_event(krb5_context context, struct hook_event *ev)
+{
+    if (ev == NULL)
+        return;
+    krb5_free_principal(context, ev->princ);
+    krb5_free_principal(context, ev->nprinc);
+    free_ent_contents(context, &ev->ent);
+    free(ev->ks_tuple);
+    if (ev->pass != NULL)
+        zapfree(ev->pass, strlen(ev->pass));
+    free(ev);
+}
+
+static krb5_error_code
+copy_event(krb5_context context, const struct hook_event *in,
+           struct hook_event **out)
+{
+    krb5_error_code ret;
+    struct hook_event *ev;
+
+    *out = NULL;
+    ev = k5alloc(sizeof(*ev), &ret);
+    if (ev == NULL)
+        return ret;
+    ev->op = in->op;
+    ev->mask = in->mask;
+    ev->keepold = in->keepold;
+    if (in->princ != NULL) {
+        ret = krb5_copy_principal(context, in->princ, &ev->princ);
+        if (ret)
+            goto fail;
+    }
+    if (in->nprinc != NULL) {
+        ret = krb5_copy_principal(context, in->nprinc, &ev->nprinc);
+        if (ret)
+            goto fail;
+    }
+    if (in->op == HOOK_CREATE || in->op == HOOK_MODIFY) {
+        ret = copy_ent(context, in->entp, &ev->ent);
+        if (ret)
+            goto fail;
+        ev->entp = &ev->ent;
+    }
+    if (in->n_ks_tuple > 0) {
+        ev->ks_tuple = k5memdup(in->ks_tuple,
+                                in->n_ks_tuple * sizeof(*in->ks_tuple), &ret);
+        if (ev->ks_tuple == NULL)
+            goto fail;
+        ev->n_ks_tuple = in->n_ks_tuple;
+    }
+    if (in->pass != NULL) {
+        ev->pass = k5memdup0(in->pass, strlen(in->pass), &ret);
+        if (ev->pass == NULL)
+            goto fail;
+    }
+    *out = ev;
+    return 0;
+
+fail:
+    free_event(context, ev);
+    return ret;
+}
+
+/* Add ev to q, waiting for space if the queue is full. */
+static void
+enqueue(struct hook_queue *q, struct hook_event *ev)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->len >= q->max && !q->stopping)
+        pthread_cond_wait(&q->nonfull, &q->lock);
+    ev->next = NULL;
+    *q->tailp = ev;
+    q->tailp = &ev->next;
+    q->len++;
+    pthread_cond_signal(&q->nonempty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Wait with q locked until delay seconds have passed or q is stopping. */
+static void
+wait_for_retry(struct hook_queue *q, int delay)
+{
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += delay;
+    while (!q->stopping) {
+        if (pthread_cond_timedwait(&q->nonempty, &q->lock,
+                                   &deadline) == ETIMEDOUT)
+            break;
+    }
+}
+
+/* Make the postcommit call for ev, retrying on failure.  Once the queue is
+ * stopping, make each remaining call once. */
+static void
+deliver(struct hook_queue *q, struct hook_event *ev)
+{
+    kadm5_hook_handle h = &q->module;
+    krb5_error_code ret;
+    int attempt, delay = 1;
+
+    for (attempt = 0; ; attempt++) {
+        ret = call_hook(q->context, h, KADM5_HOOK_STAGE_POSTCOMMIT, ev);
+        if (ret == 0)
+            return;
+        log_failure(q->context, h->vt.name, op_names[ev->op], ret);
+        pthread_mutex_lock(&q->lock);
+        if (attempt >= q->retries || q->stopping) {
+            pthread_mutex_unlock(&q->lock);
+            return;
+        }
+        wait_for_retry(q, delay);
+        pthread_mutex_unlock(&q->lock);
+        delay = (delay * 2 > RETRY_DELAY_MAX) ? RETRY_DELAY_MAX : delay * 2;
+    }
+}
+
+static void *
+dispatcher(void *arg)
+{
+    struct hook_queue *q = arg;
+    struct hook_event *ev;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (q->head == NULL && !q->stopping)
+            pthread_cond_wait(&q->nonempty, &q->lock);
+        if (q->head == NULL)
+            break;
+        ev = q->head;
+        q->head = ev->next;
+        if (q->head == NULL)
+            q->tailp = &q->head;
+        q->len--;
+        pthread_cond_signal(&q->nonfull);
+        pthread_mutex_unlock(&q->lock);
+
+        deliver(q, ev);
+        free_event(q->context, ev);
+
+        pthread_mutex_lock(&q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static void
+free_queue(struct hook_queue *q)
+{
+    if (q->module.vt.fini != NULL)
+        q->module.vt.fini(q->context, q->module.data);
+    pthread_cond_destroy(&q->nonfull);
+    pthread_cond_destroy(&q->nonempty);
+    pthread_mutex_destroy(&q->lock);
+    krb5_free_context(q->context);
+    free(q);
+}
+
+/* Create a queue and dispatcher for the module of h, with its own instance of
+ * the module. */
+static krb5_error_code
+new_queue(kadm5_hook_handle h, int max, int retries, struct hook_queue **out)
+{
+    krb5_error_code ret;
+    struct hook_queue *q;
+
+    *out = NULL;
+    q = k5alloc(sizeof(*q), &ret);
+    if (q == NULL)
+        return ret;
+    ret = kadm5_init_krb5_context(&q->context);
+    if (ret) {
+        free(q);
+        return ret;
+    }
+    q->module.vt = h->vt;
+    if (q->module.vt.init != NULL) {
+        ret = q->module.vt.init(q->context, &q->module.data);
+        if (ret) {
+            krb5_free_context(q->context);
+            free(q);
+            return ret;
+        }
+    }
+    q->refcount = 1;
+    q->tailp = &q->head;
+    q->max = max;
+    q->retries = retries;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->nonempty, NULL);
+    pthread_cond_init(&q->nonfull, NULL);
+    ret = pthread_create(&q->thread, NULL, dispatcher, q);
+    if (ret) {
+        free_queue(q);
+        return ret;
+    }
+    *out = q;
+    return 0;
+}
+
+/* Attach h to the process-wide queue for its module, creating it if this is
+ * the first handle for the module. */
+static krb5_error_code
+start_queue(kadm5_hook_handle h, int max, int retries)
+{
+    krb5_error_code ret = 0;
+    struct hook_queue *q;
+
+    pthread_mutex_lock(&queues_lock);
+    for (q = queues; q != NULL; q = q->next) {
+        if (strcmp(q->module.vt.name, h->vt.name) == 0)
+            break;
+    }
+    if (q != NULL) {
+        q->refcount++;
+    } else {
+        ret = new_queue(h, max, retries, &q);
+        if (!ret) {
+            q->next = queues;
+            queues = q;
+        }
+    }
+    pthread_mutex_unlock(&queues_lock);
+    if (!ret)
+        h->queue = q;
+    return ret;
+}
+
+/* Detach h from its queue.  If h was the last handle using the queue, deliver
+ * the calls remaining in it, then stop its dispatcher. */
+static void
+stop_queue(kadm5_hook_handle h)
+{
+    struct hook_queue *q = h->queue, **qp;
+
+    if (q == NULL)
+        return;
+    h->queue = NULL;
+    pthread_mutex_lock(&queues_lock);
+    if (--q->refcount > 0) {
+        pthread_mutex_unlock(&queues_lock);
+        return;
+    }
+    for (qp = &queues; *qp != q; qp = &(*qp)->next);
+    *qp = q->next;
+    pthread_mutex_unlock(&queues_lock);
+
+    pthread_mutex_lock(&q->lock);
+    q->stopping = TRUE;
+    pthread_cond_broadcast(&q->nonempty);
+    pthread_cond_broadcast(&q->nonfull);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+    free_queue(q);
+}
+
+/* Queue a copy of ev for h, or return an error if it could not be copied. */
+static krb5_error_code
+queue_event(krb5_context context, kadm5_hook_handle h,
+            const struct hook_event *ev)
+{
+    krb5_error_code ret;
+    struct hook_event *copy;
+
+    ret = copy_event(context, ev, &copy);
+    if (ret)
+        return ret;
+    enqueue(h->queue, copy);
+    return 0;
+}
+
+#else /* !(ENABLE_THREADS && HAVE_PTHREAD) */
+
+static krb5_error_code
+start_queue(kadm5_hook_handle h, int max, int retries)
+{
+    krb5_klog_syslog(LOG_WARNING, _("kadm5_hook_async is not supported "
+                                    "without thread support"));
+    return 0;
+}
+
+static void
+stop_queue(kadm5_hook_handle h)
+{
+}
+
+static krb5_error_code
+queue_event(krb5_context context, kadm5_hook_handle h,
+            const struct hook_event *ev)
+{
+    return ENOTSUP;
+}
+
+#endif /* !(ENABLE_THREADS && HAVE_PTHREAD) */
+
 krb5_error_code
-k5_kadm5_hook_load(krb5_context context,
+k5_kadm5_hook_load(krb5_context context, const char *realm,
                    kadm5_hook_handle **handles_out)
 {
     krb5_error_code ret;
     krb5_plugin_initvt_fn *modules = NULL, *mod;
     size_t count;
     kadm5_hook_handle *list = NULL, handle = NULL;
+    int async = 0, qsize = DEFAULT_QUEUE_SIZE, retries = DEFAULT_RETRIES;
 
     *handles_out = NULL;
 
@@ -51,6 +570,27 @@ k5_kadm5_hook_load(krb5_context context,
     if (ret != 0)
         goto cleanup;
 
+    if (realm != NULL) {
+        ret = profile_get_boolean(context->profile, KRB5_CONF_REALMS, realm,
+                                  KRB5_CONF_KADM5_HOOK_ASYNC, 0, &async);
+        if (!ret) {
+            ret = profile_get_integer(context->profile, KRB5_CONF_REALMS,
+                                      realm, KRB5_CONF_KADM5_HOOK_QUEUE_SIZE,
+                                      DEFAULT_QUEUE_SIZE, &qsize);
+        }
+        if (!ret) {
+            ret = profile_get_integer(context->profile, KRB5_CONF_REALMS,
+                                      realm, KRB5_CONF_KADM5_HOOK_RETRIES,
+                                      DEFAULT_RETRIES, &retries);
+        }
+        if (ret)
+            goto cleanup;
+        if (qsize < 1)
+            qsize = 1;
+        if (retries < 0)
+            retries = 0;
+    }
+
     /* Allocate a large enough list of handles. */
     for (count = 0; modules[count] != NULL; count++);
     list = k5calloc(count + 1, sizeof(*list), &ret);
@@ -79,6 +619,11 @@ k5_kadm5_hook_load(krb5_context context,
         list[count++] = handle;
         list[count] = NULL;
         handle = NULL;
+        if (async) {
+            ret = start_queue(list[count - 1], qsize, retries);
+            if (ret)
+                goto cleanup;
+        }
     }
     list[count] = NULL;
 
@@ -102,6 +647,7 @@ k5_kadm5_hook_free_handles(krb5_context context, kadm5_hook_handle *handles)
         return;
     for (hp = handles; *hp != NULL; hp++) {
         handle = *hp;
+        stop_queue(handle);
         if (handle->vt.fini != NULL)
             handle->vt.fini(context, handle->data);
         free(handle);
@@ -109,34 +655,32 @@ k5_kadm5_hook_free_handles(krb5_context context, kadm5_hook_handle *handles)
     free(handles);
 }
 
-static void
-log_failure(krb5_context context,
-            const char *name,
-            const char *function,
-            krb5_error_code ret)
+/* Make the call described by ev on each module, queueing postcommit calls for
+ * modules in asynchronous mode. */
+static kadm5_ret_t
+dispatch(krb5_context context, kadm5_hook_handle *handles, int stage,
+         struct hook_event *ev)
 {
-    const char *e = krb5_get_error_message(context, ret);
-
-    krb5_klog_syslog(LOG_ERR, _("kadm5_hook %s failed postcommit %s: %s"),
-                     name, function, e);
-    krb5_free_error_message(context, e);
-}
+    kadm5_hook_handle h;
+    krb5_error_code ret;
 
-#define ITERATE(operation, params)                                      \
-    for (; *handles; handles++) {                                       \
-        kadm5_hook_handle h = *handles;                                 \
-        krb5_error_code ret = 0;                                        \
-        if (h->vt.operation) {                                          \
-            ret = h->vt.operation params;                               \
-        }                                                               \
-        if (ret) {                                                      \
-            if (stage == KADM5_HOOK_STAGE_PRECOMMIT)                    \
-                return ret;                                             \
-            else                                                        \
-                log_failure(context, h->vt.name, #operation, ret);      \
-        }                                                               \
+    for (; *handles != NULL; handles++) {
+        h = *handles;
+        if (stage == KADM5_HOOK_STAGE_POSTCOMMIT && h->queue != NULL &&
+            has_method(h, ev->op)) {
+            /* If the call can't be queued, make it synchronously. */
+            if (queue_event(context, h, ev) == 0)
+                continue;
+        }
+        ret = call_hook(context, h, stage, ev);
+        if (ret) {
+            if (stage == KADM5_HOOK_STAGE_PRECOMMIT)
+                return ret;
+            log_failure(context, h->vt.name, op_names[ev->op], ret);
+        }
     }
-
+    return 0;
+}
 
 kadm5_ret_t
 k5_kadm5_hook_chpass(krb5_context context, kadm5_hook_handle *handles,
@@ -144,10 +688,15 @@ k5_kadm5_hook_chpass(krb5_context context, kadm5_hook_handle *handles,
                      int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
                      const char *newpass)
 {
-    ITERATE(chpass, (context, h->data,
-                     stage, princ, keepold,
-                     n_ks_tuple, ks_tuple, newpass));
-    return 0;
+    struct hook_event ev = { 0 };
+
+    ev.op = HOOK_CHPASS;
+    ev.princ = princ;
+    ev.keepold = keepold;
+    ev.n_ks_tuple = n_ks_tuple;
+    ev.ks_tuple = ks_tuple;
+    ev.pass = (char *)newpass;
+    return dispatch(context, handles, stage, &ev);
 }
 
 kadm5_ret_t
@@ -156,31 +705,48 @@ k5_kadm5_hook_create(krb5_context context, kadm5_hook_handle *handles,
                      int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
                      const char *newpass)
 {
-    ITERATE(create, (context, h->data,
-                     stage, princ, mask, n_ks_tuple, ks_tuple, newpass));
-    return 0;
+    struct hook_event ev = { 0 };
+
+    ev.op = HOOK_CREATE;
+    ev.entp = princ;
+    ev.mask = mask;
+    ev.n_ks_tuple = n_ks_tuple;
+    ev.ks_tuple = ks_tuple;
+    ev.pass = (char *)newpass;
+    return dispatch(context, handles, stage, &ev);
 }
 
 kadm5_ret_t
 k5_kadm5_hook_modify(krb5_context context, kadm5_hook_handle *handles,
                      int stage, kadm5_principal_ent_t princ, long mask)
 {
-    ITERATE(modify, (context, h->data, stage, princ, mask));
-    return 0;
+    struct hook_event ev = { 0 };
+
+    ev.op = HOOK_MODIFY;
+    ev.entp = princ;
+    ev.mask = mask;
+    return dispatch(context, handles, stage, &ev);
 }
 
 kadm5_ret_t
 k5_kadm5_hook_rename(krb5_context context, kadm5_hook_handle *handles,
                      int stage, krb5_principal oprinc, krb5_principal nprinc)
 {
-    ITERATE(rename, (context, h->data, stage, oprinc, nprinc));
-    return 0;
+    struct hook_event ev = { 0 };
+
+    ev.op = HOOK_RENAME;
+    ev.princ = oprinc;
+    ev.nprinc = nprinc;
+    return dispatch(context, handles, stage, &ev);
 }
 
 kadm5_ret_t
 k5_kadm5_hook_remove(krb5_context context, kadm5_hook_handle *handles,
                      int stage, krb5_principal princ)
 {
-    ITERATE(remove, (context, h->data, stage, princ));
-    return 0;
+    struct hook_event ev = { 0 };
+
+    ev.op = HOOK_REMOVE;
+    ev.princ = princ;
+    return dispatch(context, handles, stage, &ev);
 }
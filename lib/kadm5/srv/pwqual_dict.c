@@ -29,20 +29,50 @@
 
 /* Password quality module to look up passwords within the realm dictionary. */
 
-#include "k5-platform.h"
+#include "k5-int.h"
+#include "k5-hashtab.h"
 #include <krb5/pwqual_plugin.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <kadm5/admin.h>
 #include "adm_proto.h"
 #include <syslog.h>
 #include "server_internal.h"
 
+/*
+ * A compiled dictionary file, as written by k5_pwqual_dict_compile(), has a
+ * fixed-size header followed by a sorted table of 64-bit word fingerprints.
+ * All integers are big-endian.
+ *
+ *     magic        8 bytes   "K5PWDICT"
+ *     version      4 bytes   DICT_VERSION
+ *     flags        4 bytes   DICT_FLAG_FOLDED if words were case-folded
+ *     count        8 bytes   number of fingerprints
+ *     seed        16 bytes   siphash seed for the fingerprints
+ *     fingerprints count * 8 bytes, ascending, without duplicates
+ *
+ * The file is mapped read-only, so its pages are shared between all processes
+ * using it.  A fingerprint collision can cause a password to be rejected as a
+ * dictionary word, but with 64-bit fingerprints the chance is negligible.
+ */
+#define DICT_MAGIC "K5PWDICT"
+#define DICT_MAGIC_LEN 8
+#define DICT_VERSION 1
+#define DICT_FLAG_FOLDED 1
+#define DICT_HEADER_LEN (DICT_MAGIC_LEN + 4 + 4 + 8 + K5_HASH_SEED_LEN)
+
 typedef struct dict_moddata_st {
     char **word_list;        /* list of word pointers */
     char *word_block;        /* actual word data */
     unsigned int word_count; /* number of words */
+    void *map;               /* mapped compiled dictionary */
+    size_t map_len;          /* length of map */
+    const unsigned char *fingerprints; /* fingerprint table within map */
+    uint64_t fp_count;       /* number of fingerprints */
+    uint8_t seed[K5_HASH_SEED_LEN]; /* fingerprint seed */
+    krb5_boolean folded;     /* whether to case-fold before lookups */
 } *dict_moddata;
 
 
@@ -67,6 +97,91 @@ word_compare(const void *s1, const void *s2)
     return (strcasecmp(*(const char **)s1, *(const char **)s2));
 }
 
+/* Lowercase the ASCII letters of the len bytes at word. */
+static void
+fold_word(char *word, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (word[i] >= 'A' && word[i] <= 'Z')
+            word[i] += 'a' - 'A';
+    }
+}
+
+static int
+fingerprint_compare(const void *a, const void *b)
+{
+    uint64_t fa = *(const uint64_t *)a, fb = *(const uint64_t *)b;
+
+    return (fa > fb) - (fa < fb);
+}
+
+/* Map a compiled dictionary file open on fd with size len, which is at least
+ * DICT_HEADER_LEN. */
+static krb5_error_code
+map_dict(dict_moddata dict, int fd, size_t len, const char *dict_file)
+{
+    const unsigned char *p;
+    uint64_t count;
+    uint32_t version, flags;
+
+    dict->map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (dict->map == MAP_FAILED) {
+        dict->map = NULL;
+        return errno;
+    }
+    dict->map_len = len;
+
+    p = dict->map;
+    version = load_32_be(p + DICT_MAGIC_LEN);
+    flags = load_32_be(p + DICT_MAGIC_LEN + 4);
+    count = load_64_be(p + DICT_MAGIC_LEN + 8);
+    if (version != DICT_VERSION || (len - DICT_HEADER_LEN) % 8 != 0 ||
+        count != (len - DICT_HEADER_LEN) / 8) {
+        krb5_klog_syslog(LOG_ERR, _("Invalid compiled dictionary file %s"),
+                         dict_file);
+        return EINVAL;
+    }
+    memcpy(dict->seed, p + DICT_MAGIC_LEN + 16, K5_HASH_SEED_LEN);
+    dict->folded = (flags & DICT_FLAG_FOLDED) != 0;
+    dict->fingerprints = p + DICT_HEADER_LEN;
+    dict->fp_count = count;
+    return 0;
+}
+
+/* Return true if the compiled dictionary contains word. */
+static krb5_boolean
+lookup_fingerprint(dict_moddata dict, const char *word)
+{
+    uint64_t fp, val, lo = 0, hi = dict->fp_count, mid;
+    size_t len = strlen(word);
+    char *copy;
+    krb5_error_code ret;
+
+    if (dict->folded) {
+        copy = k5memdup0(word, len, &ret);
+        if (copy == NULL)
+            return FALSE;
+        fold_word(copy, len);
+        fp = k5_siphash24((uint8_t *)copy, len, dict->seed);
+        free(copy);
+    } else {
+        fp = k5_siphash24((const uint8_t *)word, len, dict->seed);
+    }
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        val = load_64_be(dict->fingerprints + mid * 8);
+        if (val == fp)
+            return TRUE;
+        else if (val < fp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return FALSE;
+}
+
 /*
  * Function: init-dict
  *
@@ -83,8 +198,8 @@ word_compare(const void *s1, const void *s2)
  *
  * Effects:
  *      If WORDFILE exists, it is read into memory sorted for future
- * use.  If it does not exist, it syslogs an error message and returns
- * success.
+ * use, or mapped if it is a compiled dictionary.  If it does not exist,
+ * it syslogs an error message and returns success.
  *
  * Modifies:
  *      word_list to point to a chunk of allocated memory containing
@@ -96,9 +211,10 @@ word_compare(const void *s1, const void *s2)
 static int
 init_dict(dict_moddata dict, const char *dict_file)
 {
-    int fd;
+    int fd, ret;
     size_t len, i;
     char *p, *t;
+    char magic[DICT_MAGIC_LEN];
     struct stat sb;
 
     if (dict_file == NULL) {
@@ -121,6 +237,17 @@ init_dict(dict_moddata dict, const char *dict_file)
         close(fd);
         return errno;
     }
+    if (sb.st_size >= DICT_HEADER_LEN &&
+        read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+        memcmp(magic, DICT_MAGIC, DICT_MAGIC_LEN) == 0) {
+        ret = map_dict(dict, fd, sb.st_size, dict_file);
+        (void)close(fd);
+        return ret;
+    }
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+        (void)close(fd);
+        return errno;
+    }
     dict->word_block = malloc(sb.st_size + 1);
     if (dict->word_block == NULL) {
         (void)close(fd);
@@ -178,6 +305,8 @@ destroy_dict(dict_moddata dict)
         return;
     free(dict->word_list);
     free(dict->word_block);
+    if (dict->map != NULL)
+        munmap(dict->map, dict->map_len);
     free(dict);
     return;
 }
@@ -199,6 +328,11 @@ dict_open(krb5_context context, const char *dict_file,
     dict->word_list = NULL;
     dict->word_block = NULL;
     dict->word_count = 0;
+    dict->map = NULL;
+    dict->map_len = 0;
+    dict->fingerprints = NULL;
+    dict->fp_count = 0;
+    dict->folded = FALSE;
 
     /* Fill in the dictionary structure with data from dict_file. */
     ret = init_dict(dict, dict_file);
@@ -229,6 +363,8 @@ dict_check(krb5_context context, krb5_pwqual_moddata data,
         bsearch(&password, dict->word_list, dict->word_count, sizeof(char *),
                 word_compare) != NULL)
         return KADM5_PASS_Q_DICT;
+    if (dict->map != NULL && lookup_fingerprint(dict, password))
+        return KADM5_PASS_Q_DICT;
 
     return 0;
 }
@@ -240,6 +376,168 @@ dict_close(krb5_context context, krb5_pwqual_moddata data)
     destroy_dict((dict_moddata)data);
 }
 
+/* Add the fingerprint of the len bytes at word to *fps. */
+static krb5_error_code
+add_fingerprint(uint64_t **fps, size_t *count, size_t *alloc, char *word,
+                size_t len, krb5_boolean folded,
+                const uint8_t seed[K5_HASH_SEED_LEN])
+{
+    uint64_t *newfps;
+    size_t newalloc;
+
+    if (len == 0)
+        return 0;
+    if (*count == *alloc) {
+        newalloc = (*alloc == 0) ? 1024 : *alloc * 2;
+        newfps = realloc(*fps, newalloc * sizeof(**fps));
+        if (newfps == NULL)
+            return ENOMEM;
+        *fps = newfps;
+        *alloc = newalloc;
+    }
+    if (folded)
+        fold_word(word, len);
+    (*fps)[(*count)++] = k5_siphash24((uint8_t *)word, len, seed);
+    return 0;
+}
+
+/* Write a compiled dictionary to fp. */
+static krb5_error_code
+write_dict(FILE *fp, const uint64_t *fps, size_t count, krb5_boolean folded,
+           const uint8_t seed[K5_HASH_SEED_LEN])
+{
+    unsigned char header[DICT_HEADER_LEN], block[8 * 1024];
+    size_t i, n;
+
+    memcpy(header, DICT_MAGIC, DICT_MAGIC_LEN);
+    store_32_be(DICT_VERSION, header + DICT_MAGIC_LEN);
+    store_32_be(folded ? DICT_FLAG_FOLDED : 0, header + DICT_MAGIC_LEN + 4);
+    store_64_be(count, header + DICT_MAGIC_LEN + 8);
+    memcpy(header + DICT_MAGIC_LEN + 16, seed, K5_HASH_SEED_LEN);
+    if (fwrite(header, sizeof(header), 1, fp) != 1)
+        return errno;
+
+    for (i = 0; i < count; i += n) {
+        for (n = 0; n < sizeof(block) / 8 && i + n < count; n++)
+            store_64_be(fps[i + n], block + n * 8);
+        if (fwrite(block, 8, n, fp) != n)
+            return errno;
+    }
+    return 0;
+}
+
+/*
+ * Compile the text dictionary infile (one word per line) into outfile in the
+ * format read by init_dict().  If folded is true, words are case-folded and
+ * lookups will be case-insensitive as with a text dictionary; otherwise
+ * lookups are case-sensitive.  outfile is replaced atomically, so a running
+ * kadmind with the old file mapped is not disturbed.
+ */
+krb5_error_code
+k5_pwqual_dict_compile(krb5_context context, const char *infile,
+                       const char *outfile, krb5_boolean folded)
+{
+    krb5_error_code ret;
+    FILE *in = NULL, *out = NULL;
+    struct k5buf buf;
+    char chunk[BUFSIZ], *start, *end, *nl, *tmpname = NULL;
+    uint64_t *fps = NULL;
+    size_t n, i, j, count = 0, alloc = 0;
+    uint8_t seed[K5_HASH_SEED_LEN];
+    krb5_data d = make_data(seed, sizeof(seed));
+
+    k5_buf_init_dynamic(&buf);
+
+    ret = krb5_c_random_make_octets(context, &d);
+    if (ret)
+        goto cleanup;
+
+    in = fopen(infile, "r");
+    if (in == NULL) {
+        ret = errno;
+        k5_setmsg(context, ret, _("Cannot open %s: %s"), infile,
+                  error_message(ret));
+        goto cleanup;
+    }
+
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        start = chunk;
+        end = chunk + n;
+        while ((nl = memchr(start, '\n', end - start)) != NULL) {
+            k5_buf_add_len(&buf, start, nl - start);
+            if (k5_buf_status(&buf) != 0) {
+                ret = ENOMEM;
+                goto cleanup;
+            }
+            ret = add_fingerprint(&fps, &count, &alloc, buf.data, buf.len,
+                                  folded, seed);
+            if (ret)
+                goto cleanup;
+            k5_buf_truncate(&buf, 0);
+            start = nl + 1;
+        }
+        k5_buf_add_len(&buf, start, end - start);
+    }
+    if (ferror(in)) {
+        ret = errno;
+        goto cleanup;
+    }
+    if (k5_buf_status(&buf) != 0) {
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    ret = add_fingerprint(&fps, &count, &alloc, buf.data, buf.len, folded,
+                          seed);
+    if (ret)
+        goto cleanup;
+
+    /* Sort the fingerprints and remove duplicates. */
+    if (count > 0) {
+        qsort(fps, count, sizeof(*fps), fingerprint_compare);
+        for (i = 1, j = 1; i < count; i++) {
+            if (fps[i] != fps[j - 1])
+                fps[j++] = fps[i];
+        }
+        count = j;
+    }
+
+    if (asprintf(&tmpname, "%s.tmp", outfile) < 0) {
+        tmpname = NULL;
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    out = fopen(tmpname, "w");
+    if (out == NULL) {
+        ret = errno;
+        k5_setmsg(context, ret, _("Cannot create %s: %s"), tmpname,
+                  error_message(ret));
+        goto cleanup;
+    }
+    ret = write_dict(out, fps, count, folded, seed);
+    if (fclose(out) != 0 && !ret)
+        ret = errno;
+    out = NULL;
+    if (ret) {
+        unlink(tmpname);
+        goto cleanup;
+    }
+    if (rename(tmpname, outfile) != 0) {
+        ret = errno;
+        unlink(tmpname);
+        k5_setmsg(context, ret, _("Cannot rename %s to %s: %s"), tmpname,
+                  outfile, error_message(ret));
+        goto cleanup;
+    }
+
+cleanup:
+    if (in != NULL)
+        fclose(in);
+    k5_buf_free(&buf);
+    free(fps);
+    free(tmpname);
+    return ret;
+}
+
 krb5_error_code
 pwqual_dict_initvt(krb5_context context, int maj_ver, int min_ver,
                    krb5_plugin_vtable vtable)
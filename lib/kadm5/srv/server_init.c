@@ -259,7 +259,8 @@ kadm5_ret_t kadm5_init(krb5_context context, char *client_name, char *pass,
     if (ret)
         goto cleanup;
 
-    ret = k5_kadm5_hook_load(context,&handle->hook_handles);
+    ret = k5_kadm5_hook_load(context, handle->params.realm,
+                             &handle->hook_handles);
     if (ret)
         goto cleanup;
 
@@ -29,6 +29,9 @@
 
 #include        "server_internal.h"
 
+/* Returned by a scan callback to end a name-ordered scan early. */
+#define SCAN_DONE -1
+
 struct iter_data {
     krb5_context context;
     char **names;
@@ -41,6 +44,12 @@ struct iter_data {
 #ifdef POSIX_REGEXPS
     regex_t preg;
 #endif
+    /* Fields used when listing principals in name order. */
+    char *prefix;               /* literal prefix of the glob */
+    size_t prefix_len;
+    const char *after;          /* list only names after this one */
+    int max;                    /* list at most this many names, if > 0 */
+    krb5_boolean more;          /* set if names were left out due to max */
 };
 
 /* XXX Duplicated in kdb5_util!  */
@@ -127,19 +136,39 @@ static kadm5_ret_t glob_to_regexp(char *glob, char *realm, char **regexp)
     return KADM5_OK;
 }
 
-static void get_either_iter(struct iter_data *data, char *name)
+/* Return the literal part of glob before its first wildcard, unquoted. */
+static char *glob_prefix(const char *glob)
+{
+    char *prefix, *p;
+
+    prefix = p = malloc(strlen(glob) + 1);
+    if (prefix == NULL)
+        return NULL;
+    while (*glob != '\0' && *glob != '*' && *glob != '?' && *glob != '[') {
+        if (*glob == '\\' && glob[1] != '\0')
+            glob++;
+        *p++ = *glob++;
+    }
+    *p = '\0';
+    return prefix;
+}
+
+static int name_matches(struct iter_data *data, char *name)
 {
-    int match;
 #ifdef SOLARIS_REGEXPS
-    match = (step(name, data->expbuf) != 0);
+    return (step(name, data->expbuf) != 0);
 #endif
 #ifdef POSIX_REGEXPS
-    match = (regexec(&data->preg, name, 0, NULL, 0) == 0);
+    return (regexec(&data->preg, name, 0, NULL, 0) == 0);
 #endif
 #ifdef BSD_REGEXPS
-    match = (re_exec(name) != 0);
+    return (re_exec(name) != 0);
 #endif
-    if (match) {
+}
+
+static void get_either_iter(struct iter_data *data, char *name)
+{
+    if (name_matches(data, name)) {
         if (data->n_names == data->sz_names) {
             int new_sz = data->sz_names * 2;
             char **new_names = realloc(data->names,
@@ -167,21 +196,123 @@ static void get_pols_iter(void *data, osa_policy_ent_t entry)
     get_either_iter(data, name);
 }
 
-static void get_princs_iter(void *data, krb5_principal princ)
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+/* Sort the names collected so far and discard any beyond the first max + 1,
+ * which is enough to tell whether a page is the last one. */
+static void trim_names(struct iter_data *data)
+{
+    int i;
+
+    qsort(data->names, data->n_names, sizeof(*data->names), compare_names);
+    for (i = data->max + 1; i < data->n_names; i++)
+        free(data->names[i]);
+    if (data->n_names > data->max + 1)
+        data->n_names = data->max + 1;
+}
+
+/* Callback for a scan in name order starting at or before the first name
+ * which can be listed. */
+static int get_princs_range_iter(krb5_pointer ptr, krb5_db_entry *entry)
+{
+    struct iter_data *data = ptr;
+    char *name;
+
+    if (krb5_unparse_name(data->context, entry->princ, &name) != 0)
+        return 0;
+    if (data->after != NULL && strcmp(name, data->after) <= 0) {
+        free(name);
+        return 0;
+    }
+    if (strncmp(name, data->prefix, data->prefix_len) != 0) {
+        /* We have passed the range of names which can match. */
+        free(name);
+        return SCAN_DONE;
+    }
+    if (data->max > 0 && data->n_names == data->max) {
+        if (name_matches(data, name)) {
+            data->more = TRUE;
+            free(name);
+            return SCAN_DONE;
+        }
+        free(name);
+        return 0;
+    }
+    get_either_iter(data, name);
+    return data->malloc_failed ? ENOMEM : 0;
+}
+
+/* Callback for a scan in database order, used if the module cannot scan in
+ * name order.  Keep only the first max + 1 matching names after data->after,
+ * so memory use stays proportional to the page size. */
+static void get_princs_unordered_iter(void *ptr, krb5_principal princ)
 {
-    struct iter_data *id = (struct iter_data *) data;
+    struct iter_data *data = ptr;
     char *name;
 
-    if (krb5_unparse_name(id->context, princ, &name) != 0)
+    if (krb5_unparse_name(data->context, princ, &name) != 0)
         return;
+    if (data->after != NULL && strcmp(name, data->after) <= 0) {
+        free(name);
+        return;
+    }
     get_either_iter(data, name);
+    if (data->max > 0 && data->n_names >= 2 * (data->max + 1))
+        trim_names(data);
+}
+
+/* List the principals in data, scanning only the names which can match the
+ * glob's literal prefix if the module supports name-ordered scans. */
+static kadm5_ret_t get_princs(kadm5_server_handle_t handle, char *exp,
+                              struct iter_data *data)
+{
+    kadm5_ret_t ret;
+    const char *start;
+
+    data->context = handle->context;
+    data->prefix = glob_prefix(exp);
+    if (data->prefix == NULL)
+        return ENOMEM;
+    data->prefix_len = strlen(data->prefix);
+
+    if (*data->prefix != '\0' || data->after != NULL || data->max > 0) {
+        start = data->prefix;
+        if (data->after != NULL && strcmp(data->after, start) > 0)
+            start = data->after;
+        ret = krb5_db_iterate_from(handle->context, start,
+                                   get_princs_range_iter, data, 0);
+        if (ret == SCAN_DONE)
+            ret = 0;
+        if (ret != KRB5_PLUGIN_OP_NOTSUPP)
+            goto cleanup;
+    }
+
+    ret = kdb_iter_entry(handle, exp, get_princs_unordered_iter, data);
+    if (ret || data->max <= 0)
+        goto cleanup;
+    trim_names(data);
+    if (data->n_names > data->max) {
+        free(data->names[--data->n_names]);
+        data->more = TRUE;
+    }
+
+cleanup:
+    free(data->prefix);
+    data->prefix = NULL;
+    return ret;
 }
 
 static kadm5_ret_t kadm5_get_either(int princ,
                                     void *server_handle,
                                     char *exp,
+                                    char *after,
+                                    int max,
                                     char ***princs,
-                                    int *count)
+                                    int *count,
+                                    krb5_boolean *more)
 {
     struct iter_data data;
 #ifdef BSD_REGEXPS
@@ -222,6 +353,9 @@ static kadm5_ret_t kadm5_get_either(int princ,
     data.n_names = 0;
     data.sz_names = 10;
     data.malloc_failed = 0;
+    data.after = after;
+    data.max = max;
+    data.more = FALSE;
     data.names = malloc(sizeof(char *) * data.sz_names);
     if (data.names == NULL) {
         free(regexp);
@@ -229,8 +363,7 @@ static kadm5_ret_t kadm5_get_either(int princ,
     }
 
     if (princ) {
-        data.context = handle->context;
-        ret = kdb_iter_entry(handle, exp, get_princs_iter, (void *) &data);
+        ret = get_princs(handle, exp, &data);
     } else {
         ret = krb5_db_iter_policy(handle->context, exp, get_pols_iter, (void *)&data);
     }
@@ -250,6 +383,8 @@ static kadm5_ret_t kadm5_get_either(int princ,
 
     *princs = data.names;
     *count = data.n_names;
+    if (more != NULL)
+        *more = data.more;
     return KADM5_OK;
 }
 
@@ -258,7 +393,37 @@ kadm5_ret_t kadm5_get_principals(void *server_handle,
                                  char ***princs,
                                  int *count)
 {
-    return kadm5_get_either(1, server_handle, exp, princs, count);
+    return kadm5_get_either(1, server_handle, exp, NULL, 0, princs, count,
+                            NULL);
+}
+
+kadm5_ret_t kadm5_get_principals_page(void *server_handle,
+                                      char *exp,
+                                      char *cursor,
+                                      int max,
+                                      char ***princs,
+                                      int *count,
+                                      char **next_cursor)
+{
+    kadm5_ret_t ret;
+    krb5_boolean more;
+
+    if (princs == NULL || count == NULL || next_cursor == NULL || max <= 0)
+        return EINVAL;
+    *next_cursor = NULL;
+    ret = kadm5_get_either(1, server_handle, exp, cursor, max, princs, count,
+                           &more);
+    if (ret || !more || *count == 0)
+        return ret;
+
+    *next_cursor = strdup((*princs)[*count - 1]);
+    if (*next_cursor == NULL) {
+        kadm5_free_name_list(server_handle, *princs, *count);
+        *princs = NULL;
+        *count = 0;
+        return ENOMEM;
+    }
+    return KADM5_OK;
 }
 
 kadm5_ret_t kadm5_get_policies(void *server_handle,
@@ -266,5 +431,6 @@ kadm5_ret_t kadm5_get_policies(void *server_handle,
                                char ***pols,
                                int *count)
 {
-    return kadm5_get_either(0, server_handle, exp, pols, count);
+    return kadm5_get_either(0, server_handle, exp, NULL, 0, pols, count,
+                            NULL);
 }
@@ -9,6 +9,7 @@
 #include        <kadm5/admin.h>
 #include        <kdb.h>
 #include        "server_internal.h"
+#include        <kdb_log.h>
 
 #include <krb5/kadm5_hook_plugin.h>
 
@@ -282,11 +283,26 @@ kadm5_create_principal(void *server_handle,
         kadm5_create_principal_3(server_handle, entry, mask,
                                  0, NULL, password);
 }
-kadm5_ret_t
-kadm5_create_principal_3(void *server_handle,
-                         kadm5_principal_ent_t entry, long mask,
-                         int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
-                         char *password)
+/* A new principal entry which has been prepared but not yet stored. */
+struct pending_create {
+    kadm5_principal_ent_t entry;
+    long mask;
+    char *password;
+    krb5_db_entry *kdb;
+    osa_princ_ent_rec adb;
+    krb5_key_salt_tuple *ks_tuple;
+    int n_ks_tuple;
+};
+
+/*
+ * Check a principal creation request, generate the new entry's keys, and run
+ * the precommit hooks, filling in *pc.  Nothing is stored in the database.  On
+ * success, the caller must store pc->kdb and then call finish_create().
+ */
+static kadm5_ret_t
+prepare_create(kadm5_server_handle_t handle, kadm5_principal_ent_t entry,
+               long mask, int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
+               char *password, struct pending_create *pc)
 {
     krb5_db_entry               *kdb;
     osa_princ_ent_rec           adb;
@@ -295,15 +311,12 @@ kadm5_create_principal_3(void *server_handle,
     krb5_timestamp              now;
     krb5_tl_data                *tl_data_tail;
     unsigned int                ret;
-    kadm5_server_handle_t handle = server_handle;
     krb5_keyblock               *act_mkey;
     krb5_kvno                   act_kvno;
     int                         new_n_ks_tuple = 0, i;
     krb5_key_salt_tuple         *new_ks_tuple = NULL;
 
-    CHECK_HANDLE(server_handle);
-
-    krb5_clear_error_message(handle->context);
+    memset(pc, 0, sizeof(*pc));
 
     check_1_6_dummy(entry, mask, n_ks_tuple, ks_tuple, &password);
 
@@ -502,12 +515,15 @@ kadm5_create_principal_3(void *server_handle,
         adb.policy = entry->policy;
     }
 
-    /* store the new db entry */
-    ret = kdb_put_entry(handle, kdb, &adb);
-
-    (void) k5_kadm5_hook_create(handle->context, handle->hook_handles,
-                                KADM5_HOOK_STAGE_POSTCOMMIT, entry, mask,
-                                new_n_ks_tuple, new_ks_tuple, password);
+    pc->entry = entry;
+    pc->mask = mask;
+    pc->password = password;
+    pc->kdb = kdb;
+    pc->adb = adb;
+    pc->ks_tuple = new_ks_tuple;
+    pc->n_ks_tuple = new_n_ks_tuple;
+    kdb = NULL;
+    new_ks_tuple = NULL;
 
 cleanup:
     free(new_ks_tuple);
@@ -517,6 +533,51 @@ cleanup:
     return ret;
 }
 
+/* Release the resources of a creation prepared by prepare_create().  If
+ * postcommit is true, run the postcommit hooks first. */
+static void
+finish_create(kadm5_server_handle_t handle, struct pending_create *pc,
+              krb5_boolean postcommit)
+{
+    if (pc->kdb == NULL)
+        return;
+    if (postcommit) {
+        (void) k5_kadm5_hook_create(handle->context, handle->hook_handles,
+                                    KADM5_HOOK_STAGE_POSTCOMMIT, pc->entry,
+                                    pc->mask, pc->n_ks_tuple, pc->ks_tuple,
+                                    pc->password);
+    }
+    free(pc->ks_tuple);
+    krb5_db_free_principal(handle->context, pc->kdb);
+    memset(pc, 0, sizeof(*pc));
+}
+
+kadm5_ret_t
+kadm5_create_principal_3(void *server_handle,
+                         kadm5_principal_ent_t entry, long mask,
+                         int n_ks_tuple, krb5_key_salt_tuple *ks_tuple,
+                         char *password)
+{
+    kadm5_server_handle_t handle = server_handle;
+    struct pending_create pc;
+    kadm5_ret_t ret;
+
+    CHECK_HANDLE(server_handle);
+
+    krb5_clear_error_message(handle->context);
+
+    ret = prepare_create(handle, entry, mask, n_ks_tuple, ks_tuple, password,
+                         &pc);
+    if (ret)
+        return ret;
+
+    /* store the new db entry */
+    ret = kdb_put_entry(handle, pc.kdb, &pc.adb);
+
+    finish_create(handle, &pc, TRUE);
+    return ret;
+}
+
 
 kadm5_ret_t
 kadm5_delete_principal(void *server_handle, krb5_principal principal)
@@ -558,21 +619,11 @@ kadm5_delete_principal(void *server_handle, krb5_principal principal)
     return ret;
 }
 
-kadm5_ret_t
-kadm5_modify_principal(void *server_handle,
-                       kadm5_principal_ent_t entry, long mask)
+/* Check the arguments of a principal modification request. */
+static kadm5_ret_t
+check_modify(kadm5_principal_ent_t entry, long mask)
 {
-    int                     ret, ret2, i;
-    kadm5_policy_ent_rec    pol;
-    krb5_boolean            have_pol = FALSE;
-    krb5_db_entry           *kdb;
     krb5_tl_data            *tl_data_orig;
-    osa_princ_ent_rec       adb;
-    kadm5_server_handle_t handle = server_handle;
-
-    CHECK_HANDLE(server_handle);
-
-    krb5_clear_error_message(handle->context);
 
     if(entry == NULL)
         return EINVAL;
@@ -596,6 +647,20 @@ kadm5_modify_principal(void *server_handle,
             tl_data_orig = tl_data_orig->tl_data_next;
         }
     }
+    return 0;
+}
+
+/* Apply a checked modification request to the principal's database entry.
+ * Run the precommit hooks before storing the entry if precommit is true. */
+static kadm5_ret_t
+modify_entry(kadm5_server_handle_t handle, kadm5_principal_ent_t entry,
+             long mask, krb5_boolean precommit)
+{
+    int                     ret, ret2, i;
+    kadm5_policy_ent_rec    pol;
+    krb5_boolean            have_pol = FALSE;
+    krb5_db_entry           *kdb;
+    osa_princ_ent_rec       adb;
 
     ret = kdb_get_entry(handle, entry->principal, &kdb, &adb);
     if (ret)
@@ -687,15 +752,15 @@ kadm5_modify_principal(void *server_handle,
         kdb->fail_auth_count = 0;
     }
 
-    ret = k5_kadm5_hook_modify(handle->context, handle->hook_handles,
-                               KADM5_HOOK_STAGE_PRECOMMIT, entry, mask);
-    if (ret)
-        goto done;
+    if (precommit) {
+        ret = k5_kadm5_hook_modify(handle->context, handle->hook_handles,
+                                   KADM5_HOOK_STAGE_PRECOMMIT, entry, mask);
+        if (ret)
+            goto done;
+    }
 
     ret = kdb_put_entry(handle, kdb, &adb);
     if (ret) goto done;
-    (void) k5_kadm5_hook_modify(handle->context, handle->hook_handles,
-                                KADM5_HOOK_STAGE_POSTCOMMIT, entry, mask);
 
     ret = KADM5_OK;
 done:
@@ -707,6 +772,480 @@ done:
     return ret;
 }
 
+kadm5_ret_t
+kadm5_modify_principal(void *server_handle,
+                       kadm5_principal_ent_t entry, long mask)
+{
+    kadm5_server_handle_t handle = server_handle;
+    kadm5_ret_t ret;
+
+    CHECK_HANDLE(server_handle);
+
+    krb5_clear_error_message(handle->context);
+
+    ret = check_modify(entry, mask);
+    if (ret)
+        return ret;
+    ret = modify_entry(handle, entry, mask, TRUE);
+    if (ret)
+        return ret;
+    (void) k5_kadm5_hook_modify(handle->context, handle->hook_handles,
+                                KADM5_HOOK_STAGE_POSTCOMMIT, entry, mask);
+    return KADM5_OK;
+}
+
+/* Store a prepared new entry, unless the principal was created after its
+ * preparation.  The database must be locked. */
+static kadm5_ret_t
+store_new_entry(kadm5_server_handle_t handle, struct pending_create *pc)
+{
+    krb5_db_entry *kdb;
+    osa_princ_ent_rec adb;
+    kadm5_ret_t ret;
+
+    ret = kdb_get_entry(handle, pc->entry->principal, &kdb, &adb);
+    if (ret == 0) {
+        kdb_free_entry(handle, kdb, &adb);
+        return KADM5_DUP;
+    }
+    if (ret != KADM5_UNK_PRINC)
+        return ret;
+    return kdb_put_entry(handle, pc->kdb, &pc->adb);
+}
+
+/*
+ * Apply a batch of creates or modifies, flushing the update log once for the
+ * whole batch.  Each item succeeds or fails independently; the result of item
+ * i is stored in codes[i].  Password quality checks, key generation, and hooks
+ * run before the database is locked, so that the exclusive lock is held only
+ * while the entries are stored and logged.
+ */
+static kadm5_ret_t
+batch_ops(void *server_handle, kadm5_principal_op_t ops, int count,
+          krb5_boolean create, kadm5_ret_t *codes)
+{
+    kadm5_server_handle_t handle = server_handle;
+    struct pending_create *pcs = NULL;
+    krb5_boolean locked = FALSE;
+    kadm5_ret_t ret;
+    int i;
+
+    CHECK_HANDLE(server_handle);
+
+    if (count < 0 || (count > 0 && (ops == NULL || codes == NULL)))
+        return EINVAL;
+    if (count == 0)
+        return 0;
+
+    krb5_clear_error_message(handle->context);
+
+    if (create) {
+        pcs = calloc(count, sizeof(*pcs));
+        if (pcs == NULL)
+            return ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (create) {
+            codes[i] = prepare_create(handle, &ops[i].rec, ops[i].mask,
+                                      ops[i].n_ks_tuple, ops[i].ks_tuple,
+                                      ops[i].pass, &pcs[i]);
+        } else {
+            codes[i] = check_modify(&ops[i].rec, ops[i].mask);
+            if (codes[i] == 0) {
+                codes[i] = k5_kadm5_hook_modify(handle->context,
+                                                handle->hook_handles,
+                                                KADM5_HOOK_STAGE_PRECOMMIT,
+                                                &ops[i].rec, ops[i].mask);
+            }
+        }
+    }
+
+    ret = krb5_db_lock(handle->context, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (ret && ret != KRB5_PLUGIN_OP_NOTSUPP)
+        goto cleanup;
+    locked = (ret == 0);
+    ret = 0;
+    (void)ulog_begin_batch(handle->context);
+
+    for (i = 0; i < count; i++) {
+        if (codes[i] != 0)
+            continue;
+        if (create) {
+            codes[i] = store_new_entry(handle, &pcs[i]);
+        } else {
+            codes[i] = modify_entry(handle, &ops[i].rec, ops[i].mask,
+                                    FALSE);
+        }
+    }
+
+    (void)ulog_end_batch(handle->context);
+    if (locked)
+        (void)krb5_db_unlock(handle->context);
+
+    if (!create) {
+        for (i = 0; i < count; i++) {
+            if (codes[i] != 0)
+                continue;
+            (void)k5_kadm5_hook_modify(handle->context, handle->hook_handles,
+                                       KADM5_HOOK_STAGE_POSTCOMMIT,
+                                       &ops[i].rec, ops[i].mask);
+        }
+    }
+
+cleanup:
+    /* Nothing was stored if the database could not be locked. */
+    for (i = 0; pcs != NULL && i < count; i++)
+        finish_create(handle, &pcs[i], ret == 0);
+    free(pcs);
+    return ret;
+}
+
+kadm5_ret_t
+kadm5_create_principals(void *server_handle, kadm5_principal_op_t ops,
+                        int count, kadm5_ret_t *codes)
+{
+    return batch_ops(server_handle, ops, count, TRUE, codes);
+}
+
+kadm5_ret_t
+kadm5_modify_principals(void *server_handle, kadm5_principal_op_t ops,
+                        int count, kadm5_ret_t *codes)
+{
+    return batch_ops(server_handle, ops, count, FALSE, codes);
+}
+
+/* A random key change for one principal, prepared without the database
+ * lock. */
+struct pending_randkey {
+    krb5_db_entry *orig;                /* entry as fetched, if batched */
+    krb5_db_entry *kdb;                 /* entry with new keys */
+    osa_princ_ent_rec adb;
+    krb5_key_salt_tuple *ks_tuple;
+    int n_ks_tuple;
+};
+
+static void
+free_pending_randkey(kadm5_server_handle_t handle, struct pending_randkey *pr)
+{
+    free(pr->ks_tuple);
+    kdb_free_entry(handle, pr->orig, NULL);
+    kdb_free_entry(handle, pr->kdb, &pr->adb);
+    memset(pr, 0, sizeof(*pr));
+}
+
+/* Fetch principal and give it new random keys in pr->kdb, without storing
+ * it.  If keep_orig is true, also keep an unmodified copy in pr->orig. */
+static kadm5_ret_t
+prepare_randkey(kadm5_server_handle_t handle, krb5_principal principal,
+                krb5_boolean keepold, int n_ks_tuple,
+                krb5_key_salt_tuple *ks_tuple, krb5_boolean keep_orig,
+                struct pending_randkey *pr)
+{
+    krb5_keyblock *act_mkey;
+    krb5_kvno act_kvno;
+    kadm5_ret_t ret;
+
+    memset(pr, 0, sizeof(*pr));
+    if (principal == NULL)
+        return EINVAL;
+
+    ret = kdb_get_entry(handle, principal, &pr->kdb, &pr->adb);
+    if (ret)
+        return ret;
+    if (keep_orig) {
+        ret = kdb_get_entry(handle, principal, &pr->orig, NULL);
+        if (ret)
+            goto cleanup;
+    }
+
+    ret = apply_keysalt_policy(handle, pr->adb.policy, n_ks_tuple, ks_tuple,
+                               &pr->n_ks_tuple, &pr->ks_tuple);
+    if (ret)
+        goto cleanup;
+
+    if (krb5_principal_compare(handle->context, principal, hist_princ)) {
+        /* If changing the history entry, the new entry must have exactly one
+         * key. */
+        if (keepold) {
+            ret = KADM5_PROTECT_PRINCIPAL;
+            goto cleanup;
+        }
+        pr->n_ks_tuple = 1;
+    }
+
+    ret = kdb_get_active_mkey(handle, &act_kvno, &act_mkey);
+    if (ret)
+        goto cleanup;
+    ret = krb5_dbe_crk(handle->context, act_mkey, pr->ks_tuple, pr->n_ks_tuple,
+                       keepold, pr->kdb);
+
+cleanup:
+    if (ret)
+        free_pending_randkey(handle, pr);
+    return ret;
+}
+
+/* Update the fields of kdb which change along with its keys, for a random key
+ * change. */
+static kadm5_ret_t
+finish_randkey_entry(kadm5_server_handle_t handle, krb5_db_entry *kdb,
+                     osa_princ_ent_rec *adb)
+{
+    kadm5_policy_ent_rec pol;
+    krb5_boolean have_pol = FALSE;
+    krb5_keyblock *act_mkey;
+    krb5_kvno act_kvno;
+    krb5_timestamp now;
+    kadm5_ret_t ret;
+
+    /* We will always be changing the key data, attributes, auth failure count,
+     * and password expiration time. */
+    kdb->mask = KADM5_KEY_DATA | KADM5_ATTRIBUTES | KADM5_FAIL_AUTH_COUNT |
+        KADM5_PW_EXPIRATION;
+
+    ret = kdb_get_active_mkey(handle, &act_kvno, &act_mkey);
+    if (ret)
+        return ret;
+    ret = krb5_dbe_update_mkvno(handle->context, kdb, act_kvno);
+    if (ret)
+        return ret;
+
+    kdb->attributes &= ~KRB5_KDB_REQUIRES_PWCHANGE;
+
+    ret = krb5_timeofday(handle->context, &now);
+    if (ret)
+        return ret;
+
+    if ((adb->aux_attributes & KADM5_POLICY)) {
+        ret = get_policy(handle, adb->policy, &pol, &have_pol);
+        if (ret)
+            return ret;
+    }
+
+    kdb->pw_expiration = 0;
+    if (have_pol && pol.pw_max_life)
+        kdb->pw_expiration = ts_incr(now, pol.pw_max_life);
+    if (have_pol)
+        kadm5_free_policy_ent(handle->lhandle, &pol);
+
+    ret = krb5_dbe_update_last_pwd_change(handle->context, kdb, now);
+    if (ret)
+        return ret;
+
+    /* unlock principal on this KDC */
+    kdb->fail_auth_count = 0;
+    return 0;
+}
+
+/* Return true if e1 and e2 have identical key data. */
+static krb5_boolean
+same_key_data(const krb5_db_entry *e1, const krb5_db_entry *e2)
+{
+    const krb5_key_data *kd1, *kd2;
+    int i, j;
+
+    if (e1->n_key_data != e2->n_key_data)
+        return FALSE;
+    for (i = 0; i < e1->n_key_data; i++) {
+        kd1 = &e1->key_data[i];
+        kd2 = &e2->key_data[i];
+        if (kd1->key_data_ver != kd2->key_data_ver ||
+            kd1->key_data_kvno != kd2->key_data_kvno)
+            return FALSE;
+        for (j = 0; j < kd1->key_data_ver; j++) {
+            if (kd1->key_data_type[j] != kd2->key_data_type[j] ||
+                kd1->key_data_length[j] != kd2->key_data_length[j] ||
+                (kd1->key_data_length[j] > 0 &&
+                 memcmp(kd1->key_data_contents[j], kd2->key_data_contents[j],
+                        kd1->key_data_length[j]) != 0))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Store a prepared random key change.  The database must be locked.  The
+ * entry is fetched again so that changes made since its preparation are not
+ * lost; the prepared keys are used if the entry's keys have not changed, and
+ * new keys are made otherwise.  On success, pr->kdb holds the stored entry.
+ */
+static kadm5_ret_t
+store_randkey(kadm5_server_handle_t handle, krb5_principal principal,
+              krb5_boolean keepold, struct pending_randkey *pr)
+{
+    krb5_db_entry *kdb;
+    osa_princ_ent_rec adb;
+    krb5_keyblock *act_mkey;
+    krb5_kvno act_kvno;
+    kadm5_ret_t ret;
+    int i;
+
+    ret = kdb_get_entry(handle, principal, &kdb, &adb);
+    if (ret)
+        return ret;
+
+    if (same_key_data(kdb, pr->orig)) {
+        for (i = 0; i < kdb->n_key_data; i++)
+            krb5_dbe_free_key_data_contents(handle->context,
+                                            &kdb->key_data[i]);
+        free(kdb->key_data);
+        kdb->key_data = pr->kdb->key_data;
+        kdb->n_key_data = pr->kdb->n_key_data;
+        pr->kdb->key_data = NULL;
+        pr->kdb->n_key_data = 0;
+    } else {
+        ret = kdb_get_active_mkey(handle, &act_kvno, &act_mkey);
+        if (!ret) {
+            ret = krb5_dbe_crk(handle->context, act_mkey, pr->ks_tuple,
+                               pr->n_ks_tuple, keepold, kdb);
+        }
+        if (ret)
+            goto cleanup;
+    }
+
+    ret = finish_randkey_entry(handle, kdb, &adb);
+    if (ret)
+        goto cleanup;
+    ret = kdb_put_entry(handle, kdb, &adb);
+    if (ret)
+        goto cleanup;
+
+    /* Keep the stored entry in place of the prepared one. */
+    kdb_free_entry(handle, pr->kdb, &pr->adb);
+    pr->kdb = kdb;
+    pr->adb = adb;
+    return 0;
+
+cleanup:
+    kdb_free_entry(handle, kdb, &adb);
+    return ret;
+}
+
+/* Return the decrypted keys of kdb's current kvno. */
+static kadm5_ret_t
+current_key_data(kadm5_server_handle_t handle, krb5_db_entry *kdb,
+                 kadm5_key_data **key_data_out, int *n_key_data_out)
+{
+    kadm5_key_data *key_data = NULL;
+    kadm5_ret_t ret = 0;
+    krb5_kvno kvno;
+    int i, nkeys = 0;
+
+    *key_data_out = NULL;
+    *n_key_data_out = 0;
+
+    key_data = calloc(kdb->n_key_data, sizeof(*key_data));
+    if (key_data == NULL && kdb->n_key_data > 0)
+        return ENOMEM;
+
+    /* Key data is sorted by descending kvno. */
+    kvno = (kdb->n_key_data > 0) ? kdb->key_data[0].key_data_kvno : 0;
+    for (i = 0; i < kdb->n_key_data; i++) {
+        if (kdb->key_data[i].key_data_kvno != kvno)
+            break;
+        key_data[nkeys].kvno = kvno;
+        ret = krb5_dbe_decrypt_key_data(handle->context, NULL,
+                                        &kdb->key_data[i],
+                                        &key_data[nkeys].key,
+                                        &key_data[nkeys].salt);
+        if (ret)
+            goto done;
+        nkeys++;
+    }
+
+    *key_data_out = key_data;
+    *n_key_data_out = nkeys;
+    key_data = NULL;
+    nkeys = 0;
+
+done:
+    kadm5_free_kadm5_key_data(handle->context, nkeys, key_data);
+    return ret;
+}
+
+/*
+ * Give each principal new random keys, flushing the update log once for the
+ * whole batch.  As with batch_ops(), key generation and the precommit hooks
+ * run before the database is locked, and the postcommit hooks and key
+ * decryption after it is unlocked.
+ */
+kadm5_ret_t
+kadm5_randkey_principals(void *server_handle, krb5_principal *princs,
+                         int count, krb5_boolean keepold, int n_ks_tuple,
+                         krb5_key_salt_tuple *ks_tuple,
+                         kadm5_principal_keys_t results)
+{
+    kadm5_server_handle_t handle = server_handle;
+    struct pending_randkey *prs;
+    krb5_boolean locked = FALSE;
+    kadm5_ret_t ret;
+    int i;
+
+    CHECK_HANDLE(server_handle);
+
+    if (count < 0 || (count > 0 && (princs == NULL || results == NULL)))
+        return EINVAL;
+    if (count == 0)
+        return 0;
+
+    krb5_clear_error_message(handle->context);
+
+    prs = calloc(count, sizeof(*prs));
+    if (prs == NULL)
+        return ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        memset(&results[i], 0, sizeof(results[i]));
+        results[i].code = prepare_randkey(handle, princs[i], keepold,
+                                          n_ks_tuple, ks_tuple, TRUE, &prs[i]);
+        if (results[i].code == 0) {
+            results[i].code = k5_kadm5_hook_chpass(handle->context,
+                                                   handle->hook_handles,
+                                                   KADM5_HOOK_STAGE_PRECOMMIT,
+                                                   princs[i], keepold,
+                                                   prs[i].n_ks_tuple,
+                                                   prs[i].ks_tuple, NULL);
+        }
+    }
+
+    ret = krb5_db_lock(handle->context, KRB5_DB_LOCKMODE_EXCLUSIVE);
+    if (ret && ret != KRB5_PLUGIN_OP_NOTSUPP)
+        goto cleanup;
+    locked = (ret == 0);
+    ret = 0;
+    (void)ulog_begin_batch(handle->context);
+
+    for (i = 0; i < count; i++) {
+        if (results[i].code == 0)
+            results[i].code = store_randkey(handle, princs[i], keepold,
+                                            &prs[i]);
+    }
+
+    (void)ulog_end_batch(handle->context);
+    if (locked)
+        (void)krb5_db_unlock(handle->context);
+
+    for (i = 0; i < count; i++) {
+        if (results[i].code != 0)
+            continue;
+        (void)k5_kadm5_hook_chpass(handle->context, handle->hook_handles,
+                                   KADM5_HOOK_STAGE_POSTCOMMIT, princs[i],
+                                   keepold, prs[i].n_ks_tuple,
+                                   prs[i].ks_tuple, NULL);
+        results[i].code = current_key_data(handle, prs[i].kdb,
+                                           &results[i].key_data,
+                                           &results[i].n_key_data);
+    }
+
+cleanup:
+    for (i = 0; i < count; i++)
+        free_pending_randkey(handle, &prs[i]);
+    free(prs);
+    return ret;
+}
+
 kadm5_ret_t
 kadm5_rename_principal(void *server_handle,
                        krb5_principal source, krb5_principal target)
@@ -1402,17 +1941,9 @@ kadm5_randkey_principal_3(void *server_handle,
                           krb5_keyblock **keyblocks,
                           int *n_keys)
 {
-    krb5_db_entry               *kdb;
-    osa_princ_ent_rec           adb;
-    krb5_timestamp              now;
-    kadm5_policy_ent_rec        pol;
+    struct pending_randkey      pr;
     int                         ret, n_new_keys;
-    krb5_boolean                have_pol = FALSE;
     kadm5_server_handle_t       handle = server_handle;
-    krb5_keyblock               *act_mkey;
-    krb5_kvno                   act_kvno;
-    int                         new_n_ks_tuple = 0;
-    krb5_key_salt_tuple         *new_ks_tuple = NULL;
 
     if (keyblocks)
         *keyblocks = NULL;
@@ -1421,72 +1952,19 @@ kadm5_randkey_principal_3(void *server_handle,
 
     krb5_clear_error_message(handle->context);
 
-    if (principal == NULL)
-        return EINVAL;
-
-    if ((ret = kdb_get_entry(handle, principal, &kdb, &adb)))
-        return(ret);
-
-    /* We will always be changing the key data, attributes, auth failure count,
-     * and password expiration time. */
-    kdb->mask = KADM5_KEY_DATA | KADM5_ATTRIBUTES | KADM5_FAIL_AUTH_COUNT |
-        KADM5_PW_EXPIRATION;
-
-    ret = apply_keysalt_policy(handle, adb.policy, n_ks_tuple, ks_tuple,
-                               &new_n_ks_tuple, &new_ks_tuple);
-    if (ret)
-        goto done;
-
-    if (krb5_principal_compare(handle->context, principal, hist_princ)) {
-        /* If changing the history entry, the new entry must have exactly one
-         * key. */
-        if (keepold) {
-            ret = KADM5_PROTECT_PRINCIPAL;
-            goto done;
-        }
-        new_n_ks_tuple = 1;
-    }
-
-    ret = kdb_get_active_mkey(handle, &act_kvno, &act_mkey);
+    ret = prepare_randkey(handle, principal, keepold, n_ks_tuple, ks_tuple,
+                          FALSE, &pr);
     if (ret)
-        goto done;
-
-    ret = krb5_dbe_crk(handle->context, act_mkey, new_ks_tuple, new_n_ks_tuple,
-                       keepold, kdb);
-    if (ret)
-        goto done;
-
-    ret = krb5_dbe_update_mkvno(handle->context, kdb, act_kvno);
-    if (ret)
-        goto done;
-
-    kdb->attributes &= ~KRB5_KDB_REQUIRES_PWCHANGE;
-
-    ret = krb5_timeofday(handle->context, &now);
-    if (ret)
-        goto done;
-
-    if ((adb.aux_attributes & KADM5_POLICY)) {
-        ret = get_policy(handle, adb.policy, &pol, &have_pol);
-        if (ret)
-            goto done;
-    }
-
-    kdb->pw_expiration = 0;
-    if (have_pol && pol.pw_max_life)
-        kdb->pw_expiration = ts_incr(now, pol.pw_max_life);
+        return ret;
 
-    ret = krb5_dbe_update_last_pwd_change(handle->context, kdb, now);
+    ret = finish_randkey_entry(handle, pr.kdb, &pr.adb);
     if (ret)
         goto done;
 
-    /* unlock principal on this KDC */
-    kdb->fail_auth_count = 0;
-
     if (keyblocks) {
         /* Return only the new keys added by krb5_dbe_crk. */
-        n_new_keys = count_new_keys(kdb->n_key_data, kdb->key_data);
-        ret = decrypt_key_data(handle->context, n_new_keys, kdb->key_data,
+        n_new_keys = count_new_keys(pr.kdb->n_key_data, pr.kdb->key_data);
+        ret = decrypt_key_data(handle->context, n_new_keys, pr.kdb->key_data,
                                keyblocks, n_keys);
         if (ret)
             goto done;
@@ -1494,22 +1972,18 @@ kadm5_randkey_principal_3(void *server_handle,
 
     ret = k5_kadm5_hook_chpass(handle->context, handle->hook_handles,
                                KADM5_HOOK_STAGE_PRECOMMIT, principal, keepold,
-                               new_n_ks_tuple, new_ks_tuple, NULL);
+                               pr.n_ks_tuple, pr.ks_tuple, NULL);
     if (ret)
         goto done;
-    if ((ret = kdb_put_entry(handle, kdb, &adb)))
+    if ((ret = kdb_put_entry(handle, pr.kdb, &pr.adb)))
         goto done;
 
     (void) k5_kadm5_hook_chpass(handle->context, handle->hook_handles,
                                 KADM5_HOOK_STAGE_POSTCOMMIT, principal,
-                                keepold, new_n_ks_tuple, new_ks_tuple, NULL);
+                                keepold, pr.n_ks_tuple, pr.ks_tuple, NULL);
     ret = KADM5_OK;
 done:
-    free(new_ks_tuple);
-    kdb_free_entry(handle, kdb, &adb);
-    if (have_pol)
-        kadm5_free_policy_ent(handle->lhandle, &pol);
-
+    free_pending_randkey(handle, &pr);
     return ret;
 }
 
@@ -742,6 +742,86 @@ test_get_principal()
     krb5_free_principal(context, admin_none_princ);
 }
 
+/* List principals matching exp in pages of size max, and check that the
+ * result is the expected list of names. */
+static void
+gprincs_page_test(char *user, char *exp, int max, const char *const *expected)
+{
+    void *handle = get_handle(user);
+    char **names, *cursor = NULL, *next, *name;
+    int i, count, n = 0;
+
+    do {
+        check(kadm5_get_principals_page(handle, exp, cursor, max, &names,
+                                        &count, &next));
+        free(cursor);
+        assert(count <= max);
+        assert(next == NULL || count == max);
+        for (i = 0; i < count; i++) {
+            assert(expected[n] != NULL);
+            if (asprintf(&name, "%s@KRBTEST.COM", expected[n++]) < 0)
+                abort();
+            assert(strcmp(names[i], name) == 0);
+            free(name);
+        }
+        check(kadm5_free_name_list(handle, names, count));
+        cursor = next;
+    } while (cursor != NULL);
+    assert(expected[n] == NULL);
+    free_handle(handle);
+}
+
+static void
+test_get_principals_page()
+{
+    static const char *const all[] = {
+        "page-test/0", "page-test/1", "page-test/2", "page-test/3",
+        "page-test/4", "page-test/5", "page-test/6", NULL
+    };
+    static const char *const odd[] = {
+        "page-test/1", "page-test/3", "page-test/5", NULL
+    };
+    static const char *const none[] = { NULL };
+    krb5_principal princs[7], other = parse_princ("page-tesu");
+    void *handle;
+    char **names, *next;
+    int i, count;
+
+    for (i = 0; i < 7; i++) {
+        princs[i] = parse_princ(all[i]);
+        create_simple_princ(princs[i], NULL);
+    }
+    create_simple_princ(other, NULL);
+
+    /* Prefix scans stop at the end of the prefix range, across pages. */
+    gprincs_page_test("admin/get", "page-test/*", 3, all);
+    gprincs_page_test("admin/get", "page-test/*", 7, all);
+    gprincs_page_test("admin/get", "page-test/*", 100, all);
+    gprincs_page_test("admin", "page-test/[135]", 2, odd);
+    gprincs_page_test("admin", "page-test/?@KRBTEST.COM", 1, all);
+    gprincs_page_test("admin", "nonexistent*", 3, none);
+
+    handle = get_handle("admin");
+    check_fail(kadm5_get_principals_page(handle, "*", NULL, 0, &names, &count,
+                                         &next), EINVAL);
+    free_handle(handle);
+
+    /* Fails over RPC without the "list" privilege. */
+    if (rpc) {
+        handle = get_handle("admin/none");
+        check_fail(kadm5_get_principals_page(handle, "*", NULL, 10, &names,
+                                             &count, &next), KADM5_AUTH_LIST);
+        free_handle(handle);
+    }
+
+    for (i = 0; i < 7; i++) {
+        delete_princ(princs[i]);
+        krb5_free_principal(context, princs[i]);
+    }
+    delete_princ(other);
+    krb5_free_principal(context, other);
+}
+
 static void
 test_init_destroy()
 {
@@ -1315,6 +1395,7 @@ main(int argc, char **argv)
     test_delete_principal();
     test_get_policy();
     test_get_principal();
+    test_get_principals_page();
     test_init_destroy();
     test_modify_policy();
     test_modify_principal();
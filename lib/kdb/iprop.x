@@ -210,6 +210,11 @@ struct kdb_fullresync_result_t {
 	update_status_t 	ret;
 };
 
+struct kdb_wait_args_t {
+	kdb_last_t		last;
+	uint32_t		wait_secs;
+};
+
 program KRB5_IPROP_PROG {
 	version KRB5_IPROP_VERS {
 		/*
@@ -239,5 +244,22 @@ program KRB5_IPROP_PROG {
 		 */
 		kdb_fullresync_result_t
 		IPROP_FULL_RESYNC_EXT(uint32_t) = 3;
+
+		/*
+		 * Like IPROP_GET_UPDATES, but if there are no new updates,
+		 * hold the call open for up to wait_secs seconds until
+		 * some arrive.
+		 */
+		kdb_incr_result_t
+		IPROP_WAIT_UPDATES(kdb_wait_args_t) = 4;
+
+		/*
+		 * Bring a replica which is too far behind for
+		 * IPROP_GET_UPDATES up to date without a full resync, by
+		 * returning the current state of each principal changed
+		 * since its last serial number.
+		 */
+		kdb_incr_result_t
+		IPROP_GET_DELTA(kdb_last_t) = 5;
 	} = 1;
 } = 100423;
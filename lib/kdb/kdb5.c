@@ -326,6 +326,10 @@ copy_vtable(const kdb_vftabl *in, kdb_vftabl *out)
     out->allowed_to_delegate_from = in->allowed_to_delegate_from;
     out->issue_pac = in->issue_pac;
 
+    /* Copy fields for minor version 1. */
+    if (in->min_ver >= 1)
+        out->iterate_from = in->iterate_from;
+
     /* Set defaults for optional fields. */
     if (out->fetch_master_key == NULL)
         out->fetch_master_key = krb5_db_def_fetch_mkey;
@@ -1092,6 +1096,27 @@ krb5_db_iterate(krb5_context kcontext, char *match_entry,
                       &proxy_args, iterflags);
 }
 
+krb5_error_code
+krb5_db_iterate_from(krb5_context kcontext, const char *start,
+                     int (*func)(krb5_pointer, krb5_db_entry *),
+                     krb5_pointer func_arg, krb5_flags iterflags)
+{
+    krb5_error_code status = 0;
+    kdb_vftabl *v;
+    struct callback_proxy_args proxy_args;
+
+    status = get_vftabl(kcontext, &v);
+    if (status)
+        return status;
+    if (v->iterate_from == NULL)
+        return KRB5_PLUGIN_OP_NOTSUPP;
+
+    proxy_args.func = func;
+    proxy_args.func_arg = func_arg;
+    return v->iterate_from(kcontext, start, sort_entry_callback_proxy,
+                           &proxy_args, iterflags);
+}
+
 /* Return a read only pointer alias to mkey list.  Do not free this! */
 krb5_keylist_node *
 krb5_db_mkey_list_alias(krb5_context kcontext)
@@ -37,4 +37,8 @@ krb5_error_code
 krb5int_delete_principal_no_log(krb5_context kcontext,
                                 krb5_principal search_for);
 
+krb5_error_code
+krb5int_conv_2logentry_full(krb5_context context, krb5_db_entry *entry,
+                            kdb_incr_update_t *update);
+
 #endif /* __KDB5INT_H__ */
@@ -18,6 +18,7 @@
 #include "iprop.h"
 #include <kdb.h>
 #include <kdb_log.h>
+#include "kdb5int.h"
 
 /* BEGIN CSTYLED */
 #define ULOG_ENTRY_TYPE(upd, i) ((kdb_incr_update_t *)upd)->kdb_update.kdbe_t_val[i]
@@ -292,11 +293,12 @@ error:
 /*
  * This routine converts a krb5 DB record into update log (ulog) entry format.
  * Space for the update log entry should be allocated prior to invocation of
- * this routine.
+ * this routine.  Unless full is set, only the attributes which differ from
+ * the current database entry are included.
  */
-krb5_error_code
-ulog_conv_2logentry(krb5_context context, krb5_db_entry *entry,
-                    kdb_incr_update_t *update)
+static krb5_error_code
+conv_2logentry(krb5_context context, krb5_db_entry *entry,
+               kdb_incr_update_t *update, krb5_boolean full)
 {
     int i, j, cnt, final, nattrs, tmpint;
     krb5_principal tmpprinc;
@@ -329,10 +331,14 @@ ulog_conv_2logentry(krb5_context context, krb5_db_entry *entry,
         return (ENOMEM);
     }
 
-    ret = krb5_db_get_principal(context, entry->princ, 0, &curr);
-    if (ret && ret != KRB5_KDB_NOENTRY) {
-        free(attr_types);
-        return (ret);
+    if (full) {
+        ret = KRB5_KDB_NOENTRY;
+    } else {
+        ret = krb5_db_get_principal(context, entry->princ, 0, &curr);
+        if (ret && ret != KRB5_KDB_NOENTRY) {
+            free(attr_types);
+            return (ret);
+        }
     }
 
     if (ret == KRB5_KDB_NOENTRY) {
@@ -545,6 +551,22 @@ ulog_conv_2logentry(krb5_context context, krb5_db_entry *entry,
     return (0);
 }
 
+krb5_error_code
+ulog_conv_2logentry(krb5_context context, krb5_db_entry *entry,
+                    kdb_incr_update_t *update)
+{
+    return conv_2logentry(context, entry, update, FALSE);
+}
+
+/* Convert entry into an update containing all of its attributes, suitable for
+ * replacing the entry on a replica whose copy may be of any age. */
+krb5_error_code
+krb5int_conv_2logentry_full(krb5_context context, krb5_db_entry *entry,
+                            kdb_incr_update_t *update)
+{
+    return conv_2logentry(context, entry, update, TRUE);
+}
+
 /* Convert an update log (ulog) entry into a kerberos record. */
 krb5_error_code
 ulog_conv_2dbentry(krb5_context context, krb5_db_entry **entry,
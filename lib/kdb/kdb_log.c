@@ -4,12 +4,12 @@
  * Use is subject to license terms.
  */
 
+#include <k5-int.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
-#include <k5-int.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <syslog.h>
@@ -57,6 +57,13 @@ time_equal(const kdbe_time_t *a, const kdbe_time_t *b)
     return a->seconds == b->seconds && a->useconds == b->useconds;
 }
 
+static inline krb5_boolean
+time_before(const kdbe_time_t *a, const kdbe_time_t *b)
+{
+    return a->seconds < b->seconds ||
+        (a->seconds == b->seconds && a->useconds < b->useconds);
+}
+
 static void
 time_current(kdbe_time_t *out)
 {
@@ -67,19 +74,18 @@ time_current(kdbe_time_t *out)
     out->useconds = timestamp.tv_usec;
 }
 
-/* Sync update entry to disk. */
+/* Sync the pages of the update log containing [startp, endp) to disk. */
 static void
-sync_update(kdb_hlog_t *ulog, kdb_ent_header_t *upd)
+sync_range(char *startp, char *endp)
 {
     unsigned long start, end, size;
 
     if (!pagesize)
         pagesize = getpagesize();
 
-    start = (unsigned long)upd & ~(pagesize - 1);
+    start = (unsigned long)startp & ~(pagesize - 1);
 
-    end = ((unsigned long)upd + ulog->kdb_block + (pagesize - 1)) &
-        ~(pagesize - 1);
+    end = ((unsigned long)endp + (pagesize - 1)) & ~(pagesize - 1);
 
     size = end - start;
     if (msync((caddr_t)start, size, MS_SYNC)) {
@@ -89,6 +95,13 @@ sync_update(kdb_hlog_t *ulog, kdb_ent_header_t *upd)
     }
 }
 
+/* Sync update entry to disk. */
+static void
+sync_update(kdb_hlog_t *ulog, kdb_ent_header_t *upd)
+{
+    sync_range((char *)upd, (char *)upd + ulog->kdb_block);
+}
+
 /* Sync memory to disk for the update log header. */
 static void
 sync_header(kdb_hlog_t *ulog)
@@ -103,6 +116,141 @@ sync_header(kdb_hlog_t *ulog)
     }
 }
 
+/* Return true if syncing a newly stored update should be left for later. */
+static inline krb5_boolean
+defer_sync(kdb_log_context *log_ctx)
+{
+    if (log_ctx->sync_mode == ULOG_SYNC_INTERVAL)
+        return TRUE;
+    return log_ctx->sync_mode == ULOG_SYNC_BATCH && log_ctx->batch_depth > 0;
+}
+
+/* Sync the deferred update entries.  The range wraps from the end of the
+ * entry array to its beginning if dirty_end <= dirty_start; sync it as two
+ * ranges in that case, so as not to flush the untouched middle of the log. */
+static void
+sync_dirty(kdb_log_context *log_ctx)
+{
+    kdb_hlog_t *ulog = log_ctx->ulog;
+
+    if (log_ctx->dirty_start == NULL)
+        return;
+    if (log_ctx->dirty_end > log_ctx->dirty_start) {
+        sync_range(log_ctx->dirty_start, log_ctx->dirty_end);
+    } else {
+        sync_range(log_ctx->dirty_start,
+                   (char *)INDEX(ulog, log_ctx->ulogentries));
+        sync_range((char *)INDEX(ulog, 0), log_ctx->dirty_end);
+    }
+    log_ctx->dirty_start = log_ctx->dirty_end = NULL;
+}
+
+/*
+ * Sync a newly stored update entry, or add it to the range of entries to be
+ * synced by flush_pending().  Deferred entries are still visible to other
+ * processes through the shared mapping; only their durability is delayed.
+ * Entries are stored in ring order, so the range is extended at its end,
+ * wrapping to the beginning of the entry array as needed.  An entry which
+ * does not follow the range (after a resize, for instance) causes the range
+ * to be synced first.
+ */
+static void
+commit_update(kdb_log_context *log_ctx, kdb_ent_header_t *upd)
+{
+    kdb_hlog_t *ulog = log_ctx->ulog;
+    char *start = (char *)upd, *end = start + ulog->kdb_block;
+    char *first = (char *)INDEX(ulog, 0);
+    char *last = (char *)INDEX(ulog, log_ctx->ulogentries);
+    krb5_boolean wrapped;
+
+    if (!defer_sync(log_ctx)) {
+        sync_update(ulog, upd);
+        return;
+    }
+    if (log_ctx->dirty_start != NULL && start != log_ctx->dirty_end &&
+        !(start == first && log_ctx->dirty_end == last))
+        sync_dirty(log_ctx);
+    if (log_ctx->dirty_start == NULL) {
+        log_ctx->dirty_start = start;
+    } else {
+        /* If the range has come around to its own beginning, the whole entry
+         * array is dirty. */
+        wrapped = start == first ||
+            log_ctx->dirty_end <= log_ctx->dirty_start;
+        if (wrapped && end > log_ctx->dirty_start) {
+            log_ctx->dirty_start = first;
+            end = last;
+        }
+    }
+    log_ctx->dirty_end = end;
+}
+
+/* Sync the ulog header after an update, or note that it needs syncing. */
+static void
+commit_header(kdb_log_context *log_ctx)
+{
+    if (defer_sync(log_ctx))
+        log_ctx->header_dirty = TRUE;
+    else
+        sync_header(log_ctx->ulog);
+}
+
+/* Sync any deferred update entries with one flush, followed by the header, so
+ * that the header never refers to entries which are not yet on disk. */
+static void
+flush_pending(kdb_log_context *log_ctx)
+{
+    sync_dirty(log_ctx);
+    if (log_ctx->header_dirty) {
+        sync_header(log_ctx->ulog);
+        log_ctx->header_dirty = FALSE;
+    }
+}
+
+/* Read the ulog sync mode and interval and the checkpoint setting from the
+ * default realm's profile configuration.  Set *checkpoint_out to true if a
+ * checkpoint should be kept alongside the ulog. */
+static void
+get_log_config(krb5_context context, kdb_log_context *log_ctx,
+               krb5_boolean *checkpoint_out)
+{
+    char *realm = NULL, *value = NULL;
+    krb5_deltat interval;
+    int checkpoint;
+
+    log_ctx->sync_mode = ULOG_SYNC_BATCH;
+    log_ctx->sync_interval = 1;
+    *checkpoint_out = TRUE;
+    if (context->profile == NULL ||
+        krb5_get_default_realm(context, &realm) != 0)
+        return;
+
+    if (profile_get_string(context->profile, KRB5_CONF_REALMS, realm,
+                           KRB5_CONF_IPROP_ULOG_SYNC, NULL, &value) == 0 &&
+        value != NULL) {
+        if (strcasecmp(value, "always") == 0)
+            log_ctx->sync_mode = ULOG_SYNC_ALWAYS;
+        else if (strcasecmp(value, "interval") == 0)
+            log_ctx->sync_mode = ULOG_SYNC_INTERVAL;
+        profile_release_string(value);
+    }
+
+    value = NULL;
+    if (profile_get_string(context->profile, KRB5_CONF_REALMS, realm,
+                           KRB5_CONF_IPROP_ULOG_SYNC_INTERVAL, NULL,
+                           &value) == 0 && value != NULL) {
+        if (krb5_string_to_deltat(value, &interval) == 0 && interval > 0)
+            log_ctx->sync_interval = interval;
+        profile_release_string(value);
+    }
+
+    if (profile_get_boolean(context->profile, KRB5_CONF_REALMS, realm,
+                            KRB5_CONF_IPROP_CHECKPOINT, TRUE,
+                            &checkpoint) == 0)
+        *checkpoint_out = checkpoint;
+    krb5_free_default_realm(context, realm);
+}
+
 /* Return true if the ulog entry for sno matches sno and timestamp. */
 static krb5_boolean
 check_sno(kdb_log_context *log_ctx, kdb_sno_t sno,
@@ -175,6 +323,311 @@ extend_file_to(int fd, unsigned int new_size)
     return 0;
 }
 
+/*
+ * A checkpoint lets a replica which has fallen behind the start of the ulog
+ * catch up without a full resync.  Once the ulog is full, each entry about to
+ * be overwritten is recorded in the checkpoint file as its serial number and
+ * principal name.  Together with the entries still in the ulog, the checkpoint
+ * names every principal changed since its base serial number, so
+ * ulog_get_delta() can send the current state of just those principals.  The
+ * file is compacted to one record per principal as it grows, so its size
+ * tracks the number of principals changed rather than the number of updates.
+ *
+ * The file holds a kdb_ckpt_hdr_t followed by kdb_ckpt_rec_t records, each
+ * followed by the principal name.  It is only read on the host which wrote it,
+ * so fields are in native byte order.
+ */
+
+#define KDB_CKPT_MAGIC  0x6663434b      /* 'fcCK' */
+
+typedef struct kdb_ckpt_hdr {
+    uint32_t        magic;
+    uint32_t        nrecords;       /* records in the file */
+    uint32_t        ncompacted;     /* records after the last compaction */
+    kdb_sno_t       base_sno;       /* first serial # recorded */
+    kdbe_time_t     base_time;      /* timestamp of base_sno */
+    kdb_sno_t       last_sno;       /* last serial # recorded */
+} kdb_ckpt_hdr_t;
+
+typedef struct kdb_ckpt_rec {
+    kdb_sno_t       sno;
+    uint32_t        namelen;        /* length of the name after the record */
+} kdb_ckpt_rec_t;
+
+/* A principal name changed by update sno.  name is not terminated. */
+struct ckpt_name {
+    kdb_sno_t sno;
+    const char *name;
+    uint32_t len;
+};
+
+/* Discard the checkpoint.  This must happen whenever the ulog is reset, since
+ * the checkpoint only describes the updates leading up to the current ulog
+ * contents. */
+static void
+reset_checkpoint(kdb_log_context *log_ctx)
+{
+    if (log_ctx->ckpt_name != NULL)
+        (void)unlink(log_ctx->ckpt_name);
+}
+
+/* Set *name_out and *len_out to the principal name of the update in ent,
+ * without decoding it.  The name is the first field of the XDR-encoded
+ * kdb_incr_update_t.  Dummy entries yield an empty name.  Return false if ent
+ * is malformed. */
+static krb5_boolean
+entry_princ_name(kdb_ent_header_t *ent, const char **name_out,
+                 uint32_t *len_out)
+{
+    uint32_t len;
+
+    *name_out = NULL;
+    *len_out = 0;
+    if (ent->kdb_umagic != KDB_ULOG_MAGIC)
+        return FALSE;
+    if (ent->kdb_entry_size == 0)
+        return TRUE;
+    if (ent->kdb_entry_size < 4)
+        return FALSE;
+    len = load_32_be(ent->entry_data);
+    if (len > ent->kdb_entry_size - 4)
+        return FALSE;
+    *name_out = (const char *)ent->entry_data + 4;
+    *len_out = len;
+    return TRUE;
+}
+
+/* Read the checkpoint header from fd into *hdr, and the records following it
+ * into an allocated buffer in *recs_out and *len_out.  Return false if fd does
+ * not contain a valid checkpoint. */
+static krb5_boolean
+read_checkpoint(int fd, kdb_ckpt_hdr_t *hdr, char **recs_out, size_t *len_out)
+{
+    struct stat st;
+    char *recs;
+    size_t len;
+
+    *recs_out = NULL;
+    *len_out = 0;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*hdr))
+        return FALSE;
+    if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+        hdr->magic != KDB_CKPT_MAGIC)
+        return FALSE;
+    len = st.st_size - sizeof(*hdr);
+    recs = malloc(len + 1);
+    if (recs == NULL)
+        return FALSE;
+    if (pread(fd, recs, len, sizeof(*hdr)) != (ssize_t)len) {
+        free(recs);
+        return FALSE;
+    }
+    *recs_out = recs;
+    *len_out = len;
+    return TRUE;
+}
+
+/* Parse len bytes of checkpoint records into a list of names pointing into
+ * recs. */
+static krb5_error_code
+parse_records(const char *recs, size_t len, struct ckpt_name **names_out,
+              size_t *count_out)
+{
+    kdb_ckpt_rec_t rec;
+    struct ckpt_name *names;
+    size_t off, count = 0;
+
+    *names_out = NULL;
+    *count_out = 0;
+    names = calloc(len / sizeof(rec) + 1, sizeof(*names));
+    if (names == NULL)
+        return ENOMEM;
+    for (off = 0; off < len; off += rec.namelen) {
+        if (len - off < sizeof(rec))
+            goto corrupt;
+        memcpy(&rec, recs + off, sizeof(rec));
+        off += sizeof(rec);
+        if (rec.namelen > len - off)
+            goto corrupt;
+        names[count].sno = rec.sno;
+        names[count].name = recs + off;
+        names[count].len = rec.namelen;
+        count++;
+    }
+    *names_out = names;
+    *count_out = count;
+    return 0;
+
+corrupt:
+    free(names);
+    return KRB5_LOG_CORRUPT;
+}
+
+/* Order names by principal name, newest update first. */
+static int
+cmp_names(const void *a, const void *b)
+{
+    const struct ckpt_name *n1 = a, *n2 = b;
+    int cmp;
+
+    cmp = memcmp(n1->name, n2->name, (n1->len < n2->len) ? n1->len : n2->len);
+    if (cmp != 0)
+        return cmp;
+    if (n1->len != n2->len)
+        return (n1->len < n2->len) ? -1 : 1;
+    if (n1->sno != n2->sno)
+        return (n1->sno > n2->sno) ? -1 : 1;
+    return 0;
+}
+
+/* Sort names and keep only the newest entry for each principal.  Return the
+ * new count. */
+static size_t
+dedup_names(struct ckpt_name *names, size_t count)
+{
+    size_t i, n = 0;
+
+    qsort(names, count, sizeof(*names), cmp_names);
+    for (i = 0; i < count; i++) {
+        if (n > 0 && names[i].len == names[n - 1].len &&
+            memcmp(names[i].name, names[n - 1].name, names[i].len) == 0)
+            continue;
+        names[n++] = names[i];
+    }
+    return n;
+}
+
+/* Rewrite the checkpoint open on fd with one record per principal, replacing
+ * the file so that readers never see it partially written. */
+static krb5_error_code
+compact_checkpoint(kdb_log_context *log_ctx, int fd, kdb_ckpt_hdr_t *hdr)
+{
+    krb5_error_code ret;
+    kdb_ckpt_hdr_t rhdr;
+    kdb_ckpt_rec_t rec;
+    struct ckpt_name *names = NULL;
+    struct k5buf buf;
+    char *recs = NULL, *tmpname = NULL;
+    size_t len, count, i;
+    int tfd = -1;
+
+    k5_buf_init_dynamic(&buf);
+    if (!read_checkpoint(fd, &rhdr, &recs, &len)) {
+        ret = KRB5_LOG_CORRUPT;
+        goto cleanup;
+    }
+    ret = parse_records(recs, len, &names, &count);
+    if (ret)
+        goto cleanup;
+    count = dedup_names(names, count);
+
+    hdr->nrecords = hdr->ncompacted = count;
+    k5_buf_add_len(&buf, hdr, sizeof(*hdr));
+    for (i = 0; i < count; i++) {
+        rec.sno = names[i].sno;
+        rec.namelen = names[i].len;
+        k5_buf_add_len(&buf, &rec, sizeof(rec));
+        k5_buf_add_len(&buf, names[i].name, names[i].len);
+    }
+    ret = k5_buf_status(&buf);
+    if (ret)
+        goto cleanup;
+
+    if (asprintf(&tmpname, "%s.tmp", log_ctx->ckpt_name) < 0) {
+        tmpname = NULL;
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    tfd = open(tmpname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (tfd == -1) {
+        ret = errno;
+        goto cleanup;
+    }
+    if (write(tfd, buf.data, buf.len) != (ssize_t)buf.len) {
+        ret = KRB5_LOG_ERROR;
+        goto cleanup;
+    }
+    if (rename(tmpname, log_ctx->ckpt_name) != 0) {
+        ret = errno;
+        goto cleanup;
+    }
+
+cleanup:
+    if (tfd != -1) {
+        close(tfd);
+        if (ret)
+            (void)unlink(tmpname);
+    }
+    k5_buf_free(&buf);
+    free(tmpname);
+    free(names);
+    free(recs);
+    return ret;
+}
+
+/* Record the ulog entry ent in the checkpoint before it is overwritten. */
+static void
+checkpoint_entry(kdb_log_context *log_ctx, kdb_ent_header_t *ent)
+{
+    kdb_ckpt_hdr_t hdr;
+    kdb_ckpt_rec_t rec;
+    const char *name;
+    struct stat st;
+    uint32_t len, limit;
+    off_t end;
+    int fd;
+
+    if (log_ctx->ckpt_name == NULL)
+        return;
+    fd = open(log_ctx->ckpt_name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return;
+    if (!entry_princ_name(ent, &name, &len))
+        goto fail;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != KDB_CKPT_MAGIC ||
+        hdr.last_sno + 1 != ent->kdb_entry_sno) {
+        /* There is no checkpoint which ends just before this entry, so start
+         * a new one from here. */
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = KDB_CKPT_MAGIC;
+        hdr.base_sno = ent->kdb_entry_sno;
+        hdr.base_time = ent->kdb_time;
+        if (ftruncate(fd, sizeof(hdr)) != 0)
+            goto fail;
+        end = sizeof(hdr);
+    } else {
+        if (fstat(fd, &st) != 0)
+            goto fail;
+        end = st.st_size;
+    }
+
+    if (len > 0) {
+        rec.sno = ent->kdb_entry_sno;
+        rec.namelen = len;
+        if (pwrite(fd, &rec, sizeof(rec), end) != sizeof(rec) ||
+            pwrite(fd, name, len, end + sizeof(rec)) != (ssize_t)len)
+            goto fail;
+        hdr.nrecords++;
+    }
+    hdr.last_sno = ent->kdb_entry_sno;
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        goto fail;
+
+    limit = (hdr.ncompacted > log_ctx->ulogentries) ? hdr.ncompacted :
+        log_ctx->ulogentries;
+    if (hdr.nrecords > 2 * limit && compact_checkpoint(log_ctx, fd, &hdr) != 0)
+        goto fail;
+    close(fd);
+    return;
+
+fail:
+    /* Never leave behind a checkpoint with a gap in it. */
+    close(fd);
+    reset_checkpoint(log_ctx);
+}
+
 /*
  * Resize the array elements.  We reinitialize the update log rather than
  * unrolling the the log and copying it over to a temporary log for obvious
@@ -218,6 +671,7 @@ set_dummy(kdb_log_context *log_ctx, kdb_sno_t sno, const kdbe_time_t *kdb_time)
     kdb_hlog_t *ulog = log_ctx->ulog;
     kdb_ent_header_t *ent = INDEX(ulog, (sno - 1) % log_ctx->ulogentries);
 
+    reset_checkpoint(log_ctx);
     memset(ent, 0, sizeof(*ent));
     ent->kdb_umagic = KDB_ULOG_MAGIC;
     ent->kdb_entry_sno = sno;
@@ -294,6 +748,7 @@ store_update(kdb_log_context *log_ctx, kdb_incr_update_t *upd)
         retval = resize(ulog, ulogentries, log_ctx->ulogfd, recsize);
         if (retval)
             return retval;
+        reset_checkpoint(log_ctx);
     }
 
     ulog->kdb_state = KDB_UNSTABLE;
@@ -301,6 +756,10 @@ store_update(kdb_log_context *log_ctx, kdb_incr_update_t *upd)
     i = (upd->kdb_entry_sno - 1) % ulogentries;
     indx_log = INDEX(ulog, i);
 
+    /* If the ulog is full, this slot holds the oldest entry. */
+    if (ulog->kdb_num == ulogentries)
+        checkpoint_entry(log_ctx, indx_log);
+
     memset(indx_log, 0, ulog->kdb_block);
     indx_log->kdb_umagic = KDB_ULOG_MAGIC;
     indx_log->kdb_entry_size = upd_size;
@@ -314,7 +773,7 @@ store_update(kdb_log_context *log_ctx, kdb_incr_update_t *upd)
         return KRB5_LOG_CONV;
 
     indx_log->kdb_commit = TRUE;
-    sync_update(ulog, indx_log);
+    commit_update(log_ctx, indx_log);
 
     /* Modify the ulog header to reflect the new update. */
     ulog->kdb_last_sno = upd->kdb_entry_sno;
@@ -335,7 +794,7 @@ store_update(kdb_log_context *log_ctx, kdb_incr_update_t *upd)
     }
 
     ulog->kdb_state = KDB_STABLE;
-    sync_header(ulog);
+    commit_header(log_ctx);
     return 0;
 }
 
@@ -364,16 +823,48 @@ ulog_add_update(krb5_context context, kdb_incr_update_t *upd)
     return ret;
 }
 
+/* Apply upd to the database without logging it. */
+static krb5_error_code
+replay_update(krb5_context context, kdb_incr_update_t *upd)
+{
+    krb5_db_entry *entry = NULL;
+    krb5_principal dbprinc;
+    char *dbprincstr;
+    krb5_error_code retval;
+
+    if (upd->kdb_deleted) {
+        dbprincstr = k5memdup0(upd->kdb_princ_name.utf8str_t_val,
+                               upd->kdb_princ_name.utf8str_t_len, &retval);
+        if (dbprincstr == NULL)
+            return retval;
+
+        retval = krb5_parse_name(context, dbprincstr, &dbprinc);
+        free(dbprincstr);
+        if (retval)
+            return retval;
+
+        retval = krb5int_delete_principal_no_log(context, dbprinc);
+        krb5_free_principal(context, dbprinc);
+        if (retval == KRB5_KDB_NOENTRY)
+            retval = 0;
+        return retval;
+    }
+
+    retval = ulog_conv_2dbentry(context, &entry, upd);
+    if (retval)
+        return retval;
+    retval = krb5int_put_principal_no_log(context, entry);
+    krb5_db_free_principal(context, entry);
+    return retval;
+}
+
 /* Used by the replica to update its hash db from the incr update log. */
 krb5_error_code
 ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args)
 {
-    krb5_db_entry *entry = NULL;
     kdb_incr_update_t *upd = NULL, *fupd;
     int i, no_of_updates;
     krb5_error_code retval;
-    krb5_principal dbprinc;
-    char *dbprincstr;
     kdb_log_context *log_ctx;
     kdb_hlog_t *ulog = NULL;
 
@@ -384,6 +875,9 @@ ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args)
     if (retval)
         return retval;
 
+    /* Flush the ulog once for the whole set of updates. */
+    (void)ulog_begin_batch(context);
+
     no_of_updates = incr_ret->updates.kdb_ulog_t_len;
     upd = incr_ret->updates.kdb_ulog_t_val;
     fupd = upd;
@@ -393,33 +887,9 @@ ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args)
             continue;
 
         /* Replay this update in the database. */
-        if (upd->kdb_deleted) {
-            dbprincstr = k5memdup0(upd->kdb_princ_name.utf8str_t_val,
-                                   upd->kdb_princ_name.utf8str_t_len, &retval);
-            if (dbprincstr == NULL)
-                goto cleanup;
-
-            retval = krb5_parse_name(context, dbprincstr, &dbprinc);
-            free(dbprincstr);
-            if (retval)
-                goto cleanup;
-
-            retval = krb5int_delete_principal_no_log(context, dbprinc);
-            krb5_free_principal(context, dbprinc);
-            if (retval == KRB5_KDB_NOENTRY)
-                retval = 0;
-            if (retval)
-                goto cleanup;
-        } else {
-            retval = ulog_conv_2dbentry(context, &entry, upd);
-            if (retval)
-                goto cleanup;
-
-            retval = krb5int_put_principal_no_log(context, entry);
-            krb5_db_free_principal(context, entry);
-            if (retval)
-                goto cleanup;
-        }
+        retval = replay_update(context, upd);
+        if (retval)
+            goto cleanup;
 
         retval = lock_ulog(context, KRB5_LOCKMODE_EXCLUSIVE);
         if (retval)
@@ -442,6 +912,7 @@ ulog_replay(krb5_context context, kdb_incr_result_t *incr_ret, char **db_args)
 cleanup:
     if (retval)
         (void)ulog_init_header(context);
+    (void)ulog_end_batch(context);
     if (fupd)
         ulog_free_entries(fupd, no_of_updates);
     return retval;
@@ -473,7 +944,7 @@ ulog_map(krb5_context context, const char *logname, uint32_t ulogentries)
     uint32_t filesize;
     kdb_log_context *log_ctx;
     kdb_hlog_t *ulog = NULL;
-    krb5_boolean locked = FALSE;
+    krb5_boolean locked = FALSE, checkpoint;
 
     log_ctx = create_log_context(context);
     if (log_ctx == NULL)
@@ -506,6 +977,12 @@ ulog_map(krb5_context context, const char *logname, uint32_t ulogentries)
     }
     log_ctx->ulog = ulog;
     log_ctx->ulogentries = ulogentries;
+    get_log_config(context, log_ctx, &checkpoint);
+    if (checkpoint && asprintf(&log_ctx->ckpt_name, "%s.ckpt", logname) < 0) {
+        log_ctx->ckpt_name = NULL;
+        retval = ENOMEM;
+        goto cleanup;
+    }
 
     retval = lock_ulog(context, KRB5_LOCKMODE_EXCLUSIVE);
     if (retval)
@@ -616,6 +1093,193 @@ cleanup:
     return retval;
 }
 
+/* Fill in upd, whose principal name is already set, with the full current
+ * database entry for that principal, or mark it as a deletion if the principal
+ * no longer exists. */
+static krb5_error_code
+fill_delta_update(krb5_context context, kdb_incr_update_t *upd)
+{
+    krb5_error_code ret;
+    krb5_principal princ;
+    krb5_db_entry *entry;
+
+    upd->kdb_commit = TRUE;
+    ret = krb5_parse_name(context, upd->kdb_princ_name.utf8str_t_val, &princ);
+    if (ret)
+        return ret;
+    ret = krb5_db_get_principal(context, princ, 0, &entry);
+    krb5_free_principal(context, princ);
+    if (ret == KRB5_KDB_NOENTRY) {
+        upd->kdb_deleted = TRUE;
+        return 0;
+    }
+    if (ret)
+        return ret;
+    ret = krb5int_conv_2logentry_full(context, entry, upd);
+    krb5_db_free_principal(context, entry);
+    return ret;
+}
+
+/*
+ * Get the updates needed to bring a replica at last up to date.  If last is
+ * still in the ulog, this is the same as ulog_get_entries().  If it has fallen
+ * off the start of the ulog but is covered by the checkpoint, the result holds
+ * the full current state (or deletion) of each principal changed after last,
+ * and lastentry is where the replica's ulog should be reset to once it has
+ * applied them with ulog_replay_delta().  Otherwise ulog_handle->ret is
+ * UPDATE_FULL_RESYNC_NEEDED.
+ */
+krb5_error_code
+ulog_get_delta(krb5_context context, const kdb_last_t *last,
+               kdb_incr_result_t *ulog_handle)
+{
+    krb5_error_code ret;
+    kdb_log_context *log_ctx;
+    kdb_hlog_t *ulog = NULL;
+    kdb_ckpt_hdr_t hdr;
+    kdb_ent_header_t *ent;
+    kdb_incr_update_t *upd = NULL;
+    kdb_last_t newlast;
+    update_status_t status;
+    struct ckpt_name *ckpt_names = NULL, *names = NULL;
+    char *recs = NULL;
+    size_t len, nckpt = 0, count = 0, i;
+    kdb_sno_t sno;
+    krb5_boolean locked = FALSE;
+    int fd = -1;
+
+    INIT_ULOG(context);
+    ulog_handle->ret = UPDATE_ERROR;
+
+    ret = lock_ulog(context, KRB5_LOCKMODE_SHARED);
+    if (ret)
+        return ret;
+    status = get_sno_status(log_ctx, last);
+    if (status != UPDATE_FULL_RESYNC_NEEDED) {
+        unlock_ulog(context);
+        return ulog_get_entries(context, last, ulog_handle);
+    }
+    locked = TRUE;
+
+    /* The checkpoint must end where the ulog begins, and last must fall
+     * within it. */
+    ulog_handle->ret = UPDATE_FULL_RESYNC_NEEDED;
+    if (log_ctx->ckpt_name == NULL || ulog->kdb_state != KDB_STABLE ||
+        ulog->kdb_num != log_ctx->ulogentries)
+        goto cleanup;
+    fd = open(log_ctx->ckpt_name, O_RDONLY);
+    if (fd == -1 || !read_checkpoint(fd, &hdr, &recs, &len))
+        goto cleanup;
+    if (hdr.last_sno + 1 != ulog->kdb_first_sno ||
+        last->last_sno < hdr.base_sno ||
+        last->last_sno >= ulog->kdb_first_sno ||
+        time_before(&last->last_time, &hdr.base_time) ||
+        time_before(&ulog->kdb_first_time, &last->last_time))
+        goto cleanup;
+
+    ulog_handle->ret = UPDATE_ERROR;
+    ret = parse_records(recs, len, &ckpt_names, &nckpt);
+    if (ret)
+        goto cleanup;
+    names = k5calloc(nckpt + ulog->kdb_num, sizeof(*names), &ret);
+    if (names == NULL)
+        goto cleanup;
+
+    /* Collect the principals changed after last in the checkpoint and the
+     * ulog. */
+    for (i = 0; i < nckpt; i++) {
+        if (ckpt_names[i].sno > last->last_sno)
+            names[count++] = ckpt_names[i];
+    }
+    for (sno = ulog->kdb_first_sno; ; sno++) {
+        ent = INDEX(ulog, (sno - 1) % log_ctx->ulogentries);
+        if (!entry_princ_name(ent, &names[count].name, &names[count].len)) {
+            ret = KRB5_LOG_CORRUPT;
+            goto cleanup;
+        }
+        if (names[count].len > 0)
+            names[count++].sno = sno;
+        if (sno == ulog->kdb_last_sno)
+            break;
+    }
+    count = dedup_names(names, count);
+
+    /* Copy the names out of the ulog before releasing it. */
+    upd = k5calloc(count ? count : 1, sizeof(*upd), &ret);
+    if (upd == NULL)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        upd[i].kdb_princ_name.utf8str_t_val =
+            k5memdup0(names[i].name, names[i].len, &ret);
+        if (upd[i].kdb_princ_name.utf8str_t_val == NULL)
+            goto cleanup;
+        upd[i].kdb_princ_name.utf8str_t_len = names[i].len;
+    }
+    newlast.last_sno = ulog->kdb_last_sno;
+    newlast.last_time = ulog->kdb_last_time;
+    unlock_ulog(context);
+    locked = FALSE;
+
+    for (i = 0; i < count; i++) {
+        ret = fill_delta_update(context, &upd[i]);
+        if (ret)
+            goto cleanup;
+    }
+
+    ulog_handle->updates.kdb_ulog_t_val = upd;
+    ulog_handle->updates.kdb_ulog_t_len = count;
+    ulog_handle->lastentry = newlast;
+    ulog_handle->ret = UPDATE_OK;
+    upd = NULL;
+
+cleanup:
+    if (locked)
+        unlock_ulog(context);
+    if (fd != -1)
+        close(fd);
+    if (upd != NULL)
+        ulog_free_entries(upd, count);
+    free(names);
+    free(ckpt_names);
+    free(recs);
+    return ret;
+}
+
+/* Used by the replica to apply the result of ulog_get_delta() from its
+ * primary.  Afterwards the ulog is reset to the primary's last serial number,
+ * as it is after loading a full dump. */
+krb5_error_code
+ulog_replay_delta(krb5_context context, kdb_incr_result_t *incr_ret,
+                  char **db_args)
+{
+    kdb_incr_update_t *upd = incr_ret->updates.kdb_ulog_t_val;
+    u_int i, count = incr_ret->updates.kdb_ulog_t_len;
+    krb5_error_code retval;
+
+    retval = krb5_db_open(context, db_args,
+                          KRB5_KDB_OPEN_RW | KRB5_KDB_SRV_TYPE_ADMIN);
+    if (retval)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        if (!upd[i].kdb_commit)
+            continue;
+        retval = replay_update(context, &upd[i]);
+        if (retval)
+            goto cleanup;
+    }
+    retval = ulog_set_last(context, &incr_ret->lastentry);
+
+cleanup:
+    if (retval)
+        (void)ulog_init_header(context);
+    if (upd != NULL)
+        ulog_free_entries(upd, count);
+    incr_ret->updates.kdb_ulog_t_val = NULL;
+    incr_ret->updates.kdb_ulog_t_len = 0;
+    return retval;
+}
+
 krb5_error_code
 ulog_set_role(krb5_context ctx, iprop_role role)
 {
@@ -672,6 +1336,63 @@ ulog_set_last(krb5_context context, const kdb_last_t *last)
     return 0;
 }
 
+/*
+ * Begin a batch of updates.  Until the matching ulog_end_batch() call, the
+ * updates are not individually synced to disk unless iprop_ulog_sync is set to
+ * "always".  Batches may be nested; only the outermost end flushes.
+ */
+krb5_error_code
+ulog_begin_batch(krb5_context context)
+{
+    kdb_log_context *log_ctx = context->kdblog_context;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL)
+        return 0;
+    log_ctx->batch_depth++;
+    return 0;
+}
+
+/* End a batch of updates, syncing the entries stored during the batch with one
+ * flush and then the header with another. */
+krb5_error_code
+ulog_end_batch(krb5_context context)
+{
+    kdb_log_context *log_ctx = context->kdblog_context;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL)
+        return 0;
+    if (log_ctx->batch_depth > 0 && --log_ctx->batch_depth > 0)
+        return 0;
+    flush_pending(log_ctx);
+    return 0;
+}
+
+/* Sync any updates whose flush was deferred.  Processes using the "interval"
+ * sync mode call this every ulog_get_sync_interval() seconds. */
+void
+ulog_sync(krb5_context context)
+{
+    kdb_log_context *log_ctx = context->kdblog_context;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL)
+        return;
+    flush_pending(log_ctx);
+}
+
+/* Return the interval at which ulog_sync() should be called, or 0 if updates
+ * are always synced by the time ulog_add_update() or ulog_end_batch()
+ * returns. */
+krb5_deltat
+ulog_get_sync_interval(krb5_context context)
+{
+    kdb_log_context *log_ctx = context->kdblog_context;
+
+    if (log_ctx == NULL || log_ctx->ulog == NULL ||
+        log_ctx->sync_mode != ULOG_SYNC_INTERVAL)
+        return 0;
+    return log_ctx->sync_interval;
+}
+
 void
 ulog_fini(krb5_context context)
 {
@@ -679,10 +1400,13 @@ ulog_fini(krb5_context context)
 
     if (log_ctx == NULL)
         return;
-    if (log_ctx->ulog != NULL)
+    if (log_ctx->ulog != NULL) {
+        flush_pending(log_ctx);
         munmap(log_ctx->ulog, MAXLOGLEN);
+    }
     if (log_ctx->ulogfd != -1)
         close(log_ctx->ulogfd);
+    free(log_ctx->ckpt_name);
     free(log_ctx);
     context->kdblog_context = NULL;
 }
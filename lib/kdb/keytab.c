@@ -58,6 +58,7 @@ krb5_kt_ops krb5_kt_kdb_ops = {
     NULL,                       /* end_get */
     NULL,                       /* add (extended) */
     NULL,                       /* remove (extended) */
+    NULL,                       /* add_entries (extended) */
 };
 
 typedef struct krb5_ktkdb_data {
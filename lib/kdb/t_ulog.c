@@ -32,9 +32,10 @@
 
 /*
  * This program performs unit tests for the update log functions in kdb_log.c.
- * Right now it contains only a test for issue #7839, checking that
- * ulog_add_update behaves appropriately when the last serial number is
- * reached.
+ * It contains a test for issue #7839, checking that ulog_add_update behaves
+ * appropriately when the last serial number is reached, and tests of the
+ * deferred syncing done for batches of updates, including deferred ranges
+ * which wrap around the end of the log.
  *
  * The test program accepts one argument, which it unlinks and then maps with
  * ulog_map().  This lets us test all of the update log functions except for
@@ -57,6 +58,7 @@ main(int argc, char **argv)
     kdb_hlog_t *ulog;
     kdb_incr_update_t upd;
     const char *filename;
+    int i;
 
     if (argc != 2) {
         fprintf(stderr, "Usage: %s filename\n", argv[0]);
@@ -84,5 +86,72 @@ main(int argc, char **argv)
     assert(ulog->kdb_num == 2);
     assert(ulog->kdb_first_sno == 1);
     assert(ulog->kdb_last_sno == 2);
+
+    /* Without a profile, updates are synced once per (outermost) batch.
+     * Updates within a batch must be stored immediately. */
+    assert(lctx->sync_mode == ULOG_SYNC_BATCH);
+    assert(ulog_get_sync_interval(context) == 0);
+    if (ulog_begin_batch(context) != 0 || ulog_begin_batch(context) != 0)
+        abort();
+    for (i = 0; i < 3; i++) {
+        memset(&upd, 0, sizeof(kdb_incr_update_t));
+        if (ulog_add_update(context, &upd) != 0)
+            abort();
+    }
+    assert(ulog->kdb_last_sno == 5);
+    assert(lctx->dirty_start != NULL && lctx->header_dirty);
+    assert(lctx->dirty_end - lctx->dirty_start == 3 * ulog->kdb_block);
+    if (ulog_end_batch(context) != 0)
+        abort();
+    assert(lctx->dirty_start != NULL && lctx->header_dirty);
+    if (ulog_end_batch(context) != 0)
+        abort();
+    assert(lctx->dirty_start == NULL && !lctx->header_dirty);
+
+    /* In "always" mode, batches do not defer syncing. */
+    lctx->sync_mode = ULOG_SYNC_ALWAYS;
+    if (ulog_begin_batch(context) != 0)
+        abort();
+    memset(&upd, 0, sizeof(kdb_incr_update_t));
+    if (ulog_add_update(context, &upd) != 0)
+        abort();
+    assert(lctx->dirty_start == NULL && !lctx->header_dirty);
+    if (ulog_end_batch(context) != 0)
+        abort();
+
+    /* In "interval" mode, updates are deferred until ulog_sync(). */
+    lctx->sync_mode = ULOG_SYNC_INTERVAL;
+    memset(&upd, 0, sizeof(kdb_incr_update_t));
+    if (ulog_add_update(context, &upd) != 0)
+        abort();
+    assert(lctx->dirty_start != NULL && lctx->header_dirty);
+    assert(ulog_get_sync_interval(context) == 1);
+    ulog_sync(context);
+    assert(lctx->dirty_start == NULL && !lctx->header_dirty);
+
+    /* A deferred range which wraps around the end of the entry array is kept
+     * as one range from the oldest entry to the newest. */
+    assert(lctx->ulogentries == 10 && ulog->kdb_last_sno == 7);
+    for (i = 0; i < 5; i++) {
+        memset(&upd, 0, sizeof(kdb_incr_update_t));
+        if (ulog_add_update(context, &upd) != 0)
+            abort();
+    }
+    assert(lctx->dirty_start == (char *)INDEX(ulog, 7));
+    assert(lctx->dirty_end == (char *)INDEX(ulog, 2));
+
+    /* Once the range comes around to its own beginning, it covers the whole
+     * entry array. */
+    for (i = 0; i < 6; i++) {
+        memset(&upd, 0, sizeof(kdb_incr_update_t));
+        if (ulog_add_update(context, &upd) != 0)
+            abort();
+    }
+    assert(lctx->dirty_start == (char *)INDEX(ulog, 0));
+    assert(lctx->dirty_end == (char *)INDEX(ulog, 10));
+    ulog_sync(context);
+    assert(lctx->dirty_start == NULL && !lctx->header_dirty);
+
+    ulog_fini(context);
     return 0;
 }
@@ -42,6 +42,18 @@ krb5_error_code
 k5_cc_retrieve_cred_default(krb5_context, krb5_ccache, krb5_flags,
                             krb5_creds *, krb5_creds *);
 
+/* Callback for k5_cc_retrieve_cred_iter() to yield the next candidate
+ * credential, returning nonzero when there are no more. */
+typedef krb5_error_code
+(*k5_cc_next_cred_fn)(krb5_context context, void *arg, krb5_creds *creds);
+
+/* Search the candidate credentials yielded by next_fn in the manner of
+ * k5_cc_retrieve_cred_default(). */
+krb5_error_code
+k5_cc_retrieve_cred_iter(krb5_context context, krb5_flags flags,
+                         krb5_creds *mcreds, k5_cc_next_cred_fn next_fn,
+                         void *arg, krb5_creds *creds);
+
 krb5_boolean
 krb5int_cc_creds_match_request(krb5_context, krb5_flags whichfields, krb5_creds *mcreds, krb5_creds *creds);
 
@@ -169,6 +181,12 @@ k5_marshal_princ(struct k5buf *buf, int version, krb5_principal princ);
 krb5_error_code
 k5_kcm_primary_name(krb5_context context, char **name_out);
 
+int
+krb5int_kcm_initialize(void);
+
+void
+krb5int_kcm_finalize(void);
+
 /*
  * Per-type ccache cursor.
  */
@@ -56,12 +56,28 @@
  * Each of the file ccache functions opens and closes the file whenever it
  * needs to access it.
  *
+ * If the ccache_index libdefaults variable is true, a cache handle keeps an
+ * index of the credentials in the file by server principal name (ignoring the
+ * realm), so that fcc_retrieve() only needs to read the credentials which
+ * might match.  The index holds file offsets; each candidate credential is
+ * re-read and matched in full, so an out-of-date index can cause a lookup to
+ * fall back to a sequential search but cannot cause a wrong result.  The index
+ * is trusted without reading the file if the file's identity, size, and
+ * modification time are unchanged.  Otherwise, if the last indexed credential
+ * is still present at the same offset, the file is assumed to have been
+ * appended to and only the new credentials are indexed; if not, the index is
+ * rebuilt.  An index built in the same second as the file was modified is
+ * always checked in this way, since a later change in that second might not
+ * alter the modification time.
+ *
  * This module depends on UNIX-like file descriptors, and UNIX-like behavior
  * from the functions: open, close, read, write, lseek.
  */
 
 #include "k5-int.h"
+#include "k5-hashtab.h"
 #include "cc-int.h"
+#include "../os/os-proto.h"
 
 #include <stdio.h>
 #include <errno.h>
@@ -94,11 +110,16 @@ static krb5_error_code interpret_errno(krb5_context, int);
 #endif
 #endif
 
+struct fcc_index;
+
 typedef struct fcc_data_st {
     k5_cc_mutex lock;
     char *filename;
+    struct fcc_index *index;    /* Index for retrieval, if built */
 } fcc_data;
 
+static void free_index(struct fcc_index *index);
+
 /* Iterator over file caches.  */
 struct krb5_fcc_ptcursor_data {
     krb5_boolean first;
@@ -478,6 +499,8 @@ fcc_initialize(krb5_context context, krb5_ccache id, krb5_principal princ)
 
     k5_cc_mutex_lock(context, &data->lock);
 
+    free_index(data->index);
+    data->index = NULL;
     unlink(data->filename);
     flags = O_CREAT | O_EXCL | O_RDWR | O_BINARY | O_CLOEXEC;
     fd = open(data->filename, flags, 0600);
@@ -534,6 +557,7 @@ static void
 free_fccdata(krb5_context context, fcc_data *data)
 {
     k5_cc_mutex_assert_unlocked(context, &data->lock);
+    free_index(data->index);
     free(data->filename);
     k5_cc_mutex_destroy(&data->lock);
     free(data);
@@ -674,6 +698,7 @@ fcc_resolve(krb5_context context, krb5_ccache *id, const char *residual)
         free(data);
         return KRB5_CC_NOMEM;
     }
+    data->index = NULL;
     ret = k5_cc_mutex_init(&data->lock);
     if (ret) {
         free(data->filename);
@@ -852,6 +877,7 @@ krb5int_fcc_new_unique(krb5_context context, char *template, krb5_ccache *id)
         unlink(template);
         return KRB5_CC_NOMEM;
     }
+    data->index = NULL;
 
     ret = k5_cc_mutex_init(&data->lock);
     if (ret) {
@@ -969,15 +995,389 @@ cleanup:
     return set_errmsg_filename(context, ret, data->filename);
 }
 
+/* A file offset of a credential in the cache file. */
+struct fcc_index_ent {
+    struct fcc_index_ent *next;
+    long offset;
+};
+
+/* The credentials for one server name, in file order. */
+struct fcc_index_name {
+    struct fcc_index_name *next;
+    struct k5buf key;
+    struct fcc_index_ent *ents;
+    struct fcc_index_ent **tailp;
+};
+
+struct fcc_index {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    krb5_boolean racy;
+    long start;                 /* Offset of the first credential */
+    long end;                   /* Offset after the last indexed credential */
+    long last_offset;           /* Offset of the last indexed credential */
+    uint64_t last_hash;         /* Hash of the last indexed credential */
+    uint8_t seed[K5_HASH_SEED_LEN];
+    struct k5_hashtab *ht;
+    struct fcc_index_name *names;
+};
+
+static void
+free_index(struct fcc_index *index)
+{
+    struct fcc_index_name *name, *next_name;
+    struct fcc_index_ent *ent, *next_ent;
+
+    if (index == NULL)
+        return;
+    for (name = index->names; name != NULL; name = next_name) {
+        next_name = name->next;
+        for (ent = name->ents; ent != NULL; ent = next_ent) {
+            next_ent = ent->next;
+            free(ent);
+        }
+        k5_buf_free(&name->key);
+        free(name);
+    }
+    k5_hashtab_free(index->ht);
+    free(index);
+}
+
+/* Marshal the components of princ (but not the realm) into buf, for use as a
+ * hash table key. */
+static void
+server_key(krb5_const_principal princ, struct k5buf *buf)
+{
+    int i;
+
+    k5_buf_add_uint32_be(buf, princ->length);
+    for (i = 0; i < princ->length; i++) {
+        k5_buf_add_uint32_be(buf, princ->data[i].length);
+        k5_buf_add_len(buf, princ->data[i].data, princ->data[i].length);
+    }
+}
+
+/* Record that the credential at offset has the server principal server. */
+static krb5_error_code
+index_add(struct fcc_index *index, krb5_const_principal server, long offset)
+{
+    krb5_error_code ret;
+    struct fcc_index_name *name;
+    struct fcc_index_ent *ent;
+    struct k5buf key;
+
+    k5_buf_init_dynamic(&key);
+    server_key(server, &key);
+    ret = k5_buf_status(&key);
+    if (ret)
+        return ret;
+
+    name = k5_hashtab_get(index->ht, key.data, key.len);
+    if (name == NULL) {
+        name = k5alloc(sizeof(*name), &ret);
+        if (name == NULL) {
+            k5_buf_free(&key);
+            return ret;
+        }
+        name->key = key;
+        name->tailp = &name->ents;
+        ret = k5_hashtab_add(index->ht, key.data, key.len, name);
+        if (ret) {
+            k5_buf_free(&key);
+            free(name);
+            return ret;
+        }
+        name->next = index->names;
+        index->names = name;
+    } else {
+        k5_buf_free(&key);
+    }
+
+    ent = k5alloc(sizeof(*ent), &ret);
+    if (ent == NULL)
+        return ret;
+    ent->offset = offset;
+    *name->tailp = ent;
+    name->tailp = &ent->next;
+    return 0;
+}
+
+/* Read a credential from fp at its current position into buf, without
+ * unmarshalling it.  Set *offset_out to its starting offset. */
+static krb5_error_code
+load_cred_at(krb5_context context, FILE *fp, int version, struct k5buf *buf,
+             long *offset_out)
+{
+    krb5_error_code ret;
+    size_t maxsize;
+
+    *offset_out = ftell(fp);
+    if (*offset_out == -1)
+        return interpret_errno(context, errno);
+    ret = get_size(context, fp, &maxsize);
+    if (ret)
+        return ret;
+    ret = load_cred(context, fp, version, maxsize, buf);
+    if (ret)
+        return ret;
+    return k5_buf_status(buf);
+}
+
+/* Index the credentials in fp from its current position to the end of the
+ * file. */
+static krb5_error_code
+index_creds(krb5_context context, FILE *fp, int version,
+            struct fcc_index *index)
+{
+    krb5_error_code ret;
+    struct k5buf buf;
+    krb5_creds creds;
+    long offset;
+
+    k5_buf_init_dynamic_zap(&buf);
+    for (;;) {
+        k5_buf_truncate(&buf, 0);
+        ret = load_cred_at(context, fp, version, &buf, &offset);
+        if (ret == KRB5_CC_END) {
+            ret = 0;
+            break;
+        }
+        if (ret)
+            break;
+        ret = k5_unmarshal_cred(buf.data, buf.len, version, &creds);
+        if (ret)
+            break;
+        if (!cred_removed(&creds))
+            ret = index_add(index, creds.server, offset);
+        krb5_free_cred_contents(context, &creds);
+        if (ret)
+            break;
+        index->last_offset = offset;
+        index->last_hash = k5_siphash24(buf.data, buf.len, index->seed);
+        index->end = offset + buf.len;
+    }
+    k5_buf_free(&buf);
+    return ret;
+}
+
+/* Return true if the last credential indexed by index is still present in
+ * fp, and nothing but whole credentials follow it. */
+static krb5_boolean
+index_continues(krb5_context context, FILE *fp, int version,
+                struct fcc_index *index, const struct stat *st)
+{
+    struct k5buf buf;
+    long offset;
+    krb5_boolean match;
+
+    if (index->dev != st->st_dev || index->ino != st->st_ino ||
+        st->st_size < index->end || index->last_offset == -1)
+        return FALSE;
+    if (fseek(fp, index->last_offset, SEEK_SET) != 0)
+        return FALSE;
+    k5_buf_init_dynamic_zap(&buf);
+    match = (load_cred_at(context, fp, version, &buf, &offset) == 0 &&
+             offset + (long)buf.len == index->end &&
+             k5_siphash24(buf.data, buf.len, index->seed) == index->last_hash);
+    k5_buf_free(&buf);
+    return match;
+}
+
+/* Make sure data has an index reflecting fp, whose credentials begin at
+ * start. */
+static krb5_error_code
+update_index(krb5_context context, fcc_data *data, FILE *fp, int version,
+             long start)
+{
+    krb5_error_code ret;
+    struct fcc_index *index = data->index;
+    struct stat st;
+    krb5_data d;
+
+    if (fstat(fileno(fp), &st) == -1)
+        return interpret_errno(context, errno);
+    if (index != NULL && !index->racy && index->start == start &&
+        index->dev == st.st_dev && index->ino == st.st_ino &&
+        index->size == st.st_size && index->mtime == st.st_mtime &&
+        index->mtime_nsec == k5_stat_mtime_nsec(&st))
+        return 0;
+
+    if (index != NULL && index->start == start &&
+        index_continues(context, fp, version, index, &st)) {
+        /* Index only the credentials appended since the last update. */
+        if (fseek(fp, index->end, SEEK_SET) != 0) {
+            ret = interpret_errno(context, errno);
+            goto cleanup;
+        }
+    } else {
+        free_index(index);
+        index = data->index = k5alloc(sizeof(*index), &ret);
+        if (index == NULL)
+            return ret;
+        index->start = index->end = start;
+        index->last_offset = -1;
+        d = make_data(index->seed, sizeof(index->seed));
+        ret = krb5_c_random_make_octets(context, &d);
+        if (ret)
+            goto cleanup;
+        ret = k5_hashtab_create(index->seed, 64, &index->ht);
+        if (ret)
+            goto cleanup;
+        if (fseek(fp, start, SEEK_SET) != 0) {
+            ret = interpret_errno(context, errno);
+            goto cleanup;
+        }
+    }
+    ret = index_creds(context, fp, version, index);
+    if (ret)
+        goto cleanup;
+
+    index->dev = st.st_dev;
+    index->ino = st.st_ino;
+    index->size = st.st_size;
+    index->mtime = st.st_mtime;
+    index->mtime_nsec = k5_stat_mtime_nsec(&st);
+    index->racy = (st.st_mtime >= time(NULL));
+
+cleanup:
+    if (ret) {
+        free_index(data->index);
+        data->index = NULL;
+    }
+    return ret;
+}
+
+/* State for yielding the indexed candidates for a retrieval. */
+struct index_iter {
+    FILE *fp;
+    int version;
+    struct fcc_index_ent *ent;
+    krb5_error_code err;
+};
+
+/* Read the next candidate credential which has not been removed.  Record any
+ * error reading a candidate in the iterator. */
+static krb5_error_code
+next_indexed_cred(krb5_context context, void *arg, krb5_creds *creds)
+{
+    struct index_iter *it = arg;
+    krb5_error_code ret;
+    struct k5buf buf;
+    long offset;
+
+    k5_buf_init_dynamic_zap(&buf);
+    for (;;) {
+        if (it->ent == NULL) {
+            ret = KRB5_CC_END;
+            break;
+        }
+        if (fseek(it->fp, it->ent->offset, SEEK_SET) != 0) {
+            ret = it->err = interpret_errno(context, errno);
+            break;
+        }
+        k5_buf_truncate(&buf, 0);
+        ret = load_cred_at(context, it->fp, it->version, &buf, &offset);
+        if (!ret)
+            ret = k5_unmarshal_cred(buf.data, buf.len, it->version, creds);
+        if (ret) {
+            it->err = ret;
+            break;
+        }
+        it->ent = it->ent->next;
+        if (!cred_removed(creds))
+            break;
+        krb5_free_cred_contents(context, creds);
+    }
+    k5_buf_free(&buf);
+    return ret;
+}
+
+/*
+ * Search for a credential using the index of the cache file.  Set *fallback
+ * to true if the index could not be used, in which case the caller should
+ * search the file sequentially.
+ */
+static krb5_error_code
+retrieve_indexed(krb5_context context, fcc_data *data, krb5_flags whichfields,
+                 krb5_creds *mcreds, krb5_creds *creds, krb5_boolean *fallback)
+{
+    krb5_error_code ret;
+    krb5_principal princ = NULL;
+    struct fcc_index_name *name;
+    struct index_iter it;
+    struct k5buf key = EMPTY_K5BUF;
+    FILE *fp = NULL;
+    int version;
+    long start;
+
+    *fallback = FALSE;
+    k5_cc_mutex_lock(context, &data->lock);
+
+    ret = open_cache_file(context, data->filename, FALSE, &fp);
+    if (ret)
+        goto cleanup;
+    ret = read_header(context, fp, &version);
+    if (ret)
+        goto cleanup;
+    ret = read_principal(context, fp, version, &princ);
+    if (ret)
+        goto cleanup;
+    start = ftell(fp);
+    if (start == -1 || update_index(context, data, fp, version, start) != 0) {
+        *fallback = TRUE;
+        goto cleanup;
+    }
+
+    k5_buf_init_dynamic(&key);
+    server_key(mcreds->server, &key);
+    ret = k5_buf_status(&key);
+    if (ret)
+        goto cleanup;
+    name = k5_hashtab_get(data->index->ht, key.data, key.len);
+
+    it.fp = fp;
+    it.version = version;
+    it.ent = (name != NULL) ? name->ents : NULL;
+    it.err = 0;
+    ret = k5_cc_retrieve_cred_iter(context, whichfields, mcreds,
+                                   next_indexed_cred, &it, creds);
+    if (it.err) {
+        /* The index doesn't match the file; discard it. */
+        if (ret == 0)
+            krb5_free_cred_contents(context, creds);
+        free_index(data->index);
+        data->index = NULL;
+        *fallback = TRUE;
+    }
+
+cleanup:
+    k5_buf_free(&key);
+    krb5_free_principal(context, princ);
+    (void)close_cache_file(context, fp);
+    k5_cc_mutex_unlock(context, &data->lock);
+    return ret;
+}
+
 /* Search for a credential within the cache file. */
 static krb5_error_code KRB5_CALLCONV
 fcc_retrieve(krb5_context context, krb5_ccache id, krb5_flags whichfields,
              krb5_creds *mcreds, krb5_creds *creds)
 {
     krb5_error_code ret;
+    fcc_data *data = id->data;
+    krb5_boolean fallback;
 
+    if (context->fcc_index && mcreds->server != NULL) {
+        ret = retrieve_indexed(context, data, whichfields, mcreds, creds,
+                               &fallback);
+        if (!fallback)
+            return set_errmsg_filename(context, ret, data->filename);
+    }
     ret = k5_cc_retrieve_cred_default(context, id, whichfields, mcreds, creds);
-    return set_errmsg_filename(context, ret, ((fcc_data *)id->data)->filename);
+    return set_errmsg_filename(context, ret, data->filename);
 }
 
 /* Store a credential in the cache file. */
@@ -35,6 +35,12 @@
  * KCM protocol.  On macOS, the preferred transport is Mach RPC; on other
  * Unix-like platforms or if the daemon is not available via RPC, Unix domain
  * sockets are used instead.
+ *
+ * All cache handles and cursors within a process share a single connection to
+ * the daemon, which stays open until the library is unloaded.  When a series
+ * of objects is fetched by UUID, the requests are pipelined over the Unix
+ * domain socket: a window of requests is written at once, and then the
+ * replies are read in order.
  */
 
 #ifndef _WIN32
@@ -53,6 +59,13 @@
 
 #define MAX_REPLY_SIZE (10 * 1024 * 1024)
 
+/*
+ * The maximum number of requests written to the daemon before reading any
+ * replies.  The pipelined requests are small, so a full window fits within
+ * the socket buffer and can be written before the daemon starts replying.
+ */
+#define KCM_PIPELINE_DEPTH 16
+
 const krb5_cc_ops krb5_kcm_ops;
 
 struct uuid_list {
@@ -72,21 +85,39 @@ struct kcm_cursor {
     struct cred_list *creds;
 };
 
+struct name_list {
+    char **names;
+    size_t count;
+    size_t pos;
+};
+
 struct kcmio {
     SOCKET fd;
 #ifdef __APPLE__
     mach_port_t mport;
 #endif
+    char *path;                 /* Unix domain socket path */
+    pid_t pid;                  /* process which made the connection */
+    uid_t euid;                 /* effective uid when the connection was made */
+    k5_mutex_t lock;            /* serializes use of the connection */
+    unsigned int refcount;      /* protected by shared_io_lock */
+    unsigned int unsupported;   /* optional operations the daemon rejected */
 };
 
+/* The connection shared by all handles in this process, if one has been made.
+ * The shared pointer holds a reference to it. */
+static k5_mutex_t shared_io_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct kcmio *shared_io;
+
 /* This structure bundles together a KCM request and reply, to minimize how
  * much we have to declare and clean up in each method. */
 struct kcmreq {
+    kcm_opcode opcode;
     struct k5buf reqbuf;
     struct k5input reply;
     void *reply_mem;
 };
-#define EMPTY_KCMREQ { EMPTY_K5BUF }
+#define EMPTY_KCMREQ { 0, EMPTY_K5BUF }
 
 struct kcm_cache_data {
     char *residual;             /* immutable; may be accessed without lock */
@@ -97,6 +128,7 @@ struct kcm_cache_data {
 struct kcm_ptcursor {
     char *residual;             /* primary or singleton subsidiary */
     struct uuid_list *uuids;    /* NULL for singleton subsidiary */
+    struct name_list *names;    /* names fetched for a window of uuids */
     struct kcmio *io;
     krb5_boolean first;
 };
@@ -158,6 +190,32 @@ unsupported_op_error(krb5_error_code code)
         code == KRB5_CC_NOSUPP;
 }
 
+/* Return true if code definitely means the daemon does not implement an
+ * operation.  KRB5_CC_IO is excluded because it can also indicate a transient
+ * failure, which should not stop us from trying the operation again. */
+static krb5_boolean
+remember_unsupported_error(krb5_error_code code)
+{
+    return code == KRB5_FCC_INTERNAL || code == KRB5_CC_NOSUPP;
+}
+
+/* Return a flag for opcode if it is an optional operation whose absence we
+ * remember for the life of a connection, or 0 if it is not. */
+static unsigned int
+optional_op_flag(kcm_opcode opcode)
+{
+    switch (opcode) {
+    case KCM_OP_RETRIEVE:
+        return 0x1;
+    case KCM_OP_GET_CRED_LIST:
+        return 0x2;
+    case KCM_OP_REPLACE:
+        return 0x4;
+    default:
+        return 0;
+    }
+}
+
 /* Begin a request for the given opcode.  If cache is non-null, supply the
  * cache name as a request parameter. */
 static void
@@ -167,6 +225,7 @@ kcmreq_init(struct kcmreq *req, kcm_opcode opcode, krb5_ccache cache)
     const char *name;
 
     memset(req, 0, sizeof(*req));
+    req->opcode = opcode;
 
     bytes[0] = KCM_PROTOCOL_VERSION_MAJOR;
     bytes[1] = KCM_PROTOCOL_VERSION_MINOR;
@@ -288,79 +347,115 @@ kcmio_mach_close(struct kcmio *io)
         mach_port_deallocate(mach_task_self(), io->mport);
 }
 
+/* Return true if io is using Mach RPC rather than a Unix domain socket. */
+static inline krb5_boolean
+kcmio_using_mach(struct kcmio *io)
+{
+    return io->mport != MACH_PORT_NULL;
+}
+
 #else /* __APPLE__ */
 
 #define kcmio_mach_connect(context, io) EINVAL
 #define kcmio_mach_call(context, io, data, len, reply_out, len_out) EINVAL
 #define kcmio_mach_close(io)
+#define kcmio_using_mach(io) FALSE
 
 #endif
 
-/* Connect to the KCM daemon via a Unix domain socket. */
+/* Connect to the KCM daemon via a Unix domain socket at io->path. */
 static krb5_error_code
 kcmio_unix_socket_connect(krb5_context context, struct kcmio *io)
 {
     krb5_error_code ret;
     SOCKET fd = INVALID_SOCKET;
     struct sockaddr_un addr;
-    char *path = NULL;
 
-    ret = profile_get_string(context->profile, KRB5_CONF_LIBDEFAULTS,
-                             KRB5_CONF_KCM_SOCKET, NULL,
-                             DEFAULT_KCM_SOCKET_PATH, &path);
-    if (ret)
-        goto cleanup;
-    if (strcmp(path, "-") == 0) {
-        ret = KRB5_KCM_NO_SERVER;
-        goto cleanup;
-    }
+    if (strcmp(io->path, "-") == 0)
+        return KRB5_KCM_NO_SERVER;
 
     fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (fd == INVALID_SOCKET) {
-        ret = SOCKET_ERRNO;
-        goto cleanup;
-    }
+    if (fd == INVALID_SOCKET)
+        return SOCKET_ERRNO;
 
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
-    strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+    strlcpy(addr.sun_path, io->path, sizeof(addr.sun_path));
     if (SOCKET_CONNECT(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
         ret = (SOCKET_ERRNO == ENOENT) ? KRB5_KCM_NO_SERVER : SOCKET_ERRNO;
-        goto cleanup;
+        closesocket(fd);
+        return ret;
     }
 
+    /* We might be talking to a different daemon than before. */
     io->fd = fd;
-    fd = INVALID_SOCKET;
+    io->unsupported = 0;
+    return 0;
+}
 
-cleanup:
-    if (fd != INVALID_SOCKET)
-        closesocket(fd);
-    profile_release_string(path);
-    return ret;
+/* Close io's socket after an I/O error, since we can no longer tell where the
+ * next reply begins.  The next call will reconnect. */
+static void
+kcmio_unix_socket_disconnect(struct kcmio *io)
+{
+    if (io->fd != INVALID_SOCKET)
+        closesocket(io->fd);
+    io->fd = INVALID_SOCKET;
+}
+
+/* Return true if req should not be sent because the daemon has already
+ * rejected its opcode on this connection. */
+static inline krb5_boolean
+kcmio_skip_req(struct kcmio *io, struct kcmreq *req)
+{
+    return (io->unsupported & optional_op_flag(req->opcode)) != 0;
 }
 
-/* Write a KCM request: 4-byte big-endian length, then the marshalled
- * request. */
+/* Write the requests in reqs whose skip flags are not set, each as a 4-byte
+ * big-endian length followed by the marshalled request.  The requests are
+ * written together so that the daemon can process them without waiting. */
 static krb5_error_code
-kcmio_unix_socket_write(krb5_context context, struct kcmio *io, void *request,
-                        size_t len)
+kcmio_unix_socket_write(krb5_context context, struct kcmio *io,
+                        struct kcmreq *reqs, const krb5_boolean *skip,
+                        size_t nreqs)
 {
-    char lenbytes[4];
-    sg_buf sg[2];
+    struct k5buf buf;
+    sg_buf sg;
+    size_t i;
     int ret;
     krb5_boolean reconnected = FALSE;
 
-    SG_SET(&sg[0], lenbytes, sizeof(lenbytes));
-    SG_SET(&sg[1], request, len);
-    store_32_be(len, lenbytes);
+    k5_buf_init_dynamic(&buf);
+    for (i = 0; i < nreqs; i++) {
+        if (skip[i])
+            continue;
+        k5_buf_add_uint32_be(&buf, reqs[i].reqbuf.len);
+        k5_buf_add_len(&buf, reqs[i].reqbuf.data, reqs[i].reqbuf.len);
+    }
+    if (k5_buf_status(&buf) != 0)
+        return ENOMEM;
+    if (buf.len == 0)
+        return 0;
+
+    /* Reconnect if a previous call failed. */
+    if (io->fd == INVALID_SOCKET) {
+        ret = kcmio_unix_socket_connect(context, io);
+        if (ret)
+            goto cleanup;
+        reconnected = TRUE;
+    }
 
     for (;;) {
-        ret = krb5int_net_writev(context, io->fd, sg, 2);
-        if (ret >= 0)
-            return 0;
+        SG_SET(&sg, buf.data, buf.len);
+        ret = krb5int_net_writev(context, io->fd, &sg, 1);
+        if (ret >= 0) {
+            ret = 0;
+            break;
+        }
         ret = errno;
+        kcmio_unix_socket_disconnect(io);
         if (ret != EPIPE || reconnected)
-            return ret;
+            break;
 
         /*
          * Try once to reconnect on an EPIPE, in case the server has an idle
@@ -370,123 +465,322 @@ kcmio_unix_socket_write(krb5_context context, struct kcmio *io, void *request,
          * always listen for connections on the socket during upgrades, or a
          * single reconnect attempt won't be robust.
          */
-        close(io->fd);
         ret = kcmio_unix_socket_connect(context, io);
         if (ret)
-            return ret;
+            break;
         reconnected = TRUE;
     }
+
+cleanup:
+    k5_buf_free(&buf);
+    return ret;
 }
 
 /* Read a KCM reply: 4-byte big-endian length, 4-byte big-endian status code,
- * then the marshalled reply. */
+ * then the marshalled reply.  Place the status code in *code_out.  Return an
+ * error only if the reply could not be read. */
 static krb5_error_code
 kcmio_unix_socket_read(krb5_context context, struct kcmio *io,
-                       void **reply_out, size_t *len_out)
+                       void **reply_out, size_t *len_out,
+                       krb5_error_code *code_out)
 {
-    krb5_error_code code;
-    char lenbytes[4], codebytes[4], *reply;
+    krb5_error_code ret;
+    char lenbytes[4], codebytes[4], *reply = NULL;
     size_t len;
     int st;
 
     *reply_out = NULL;
     *len_out = 0;
+    *code_out = 0;
 
     st = krb5_net_read(context, io->fd, lenbytes, 4);
-    if (st != 4)
-        return (st == -1) ? errno : KRB5_CC_IO;
+    if (st != 4) {
+        ret = (st == -1) ? errno : KRB5_CC_IO;
+        goto fail;
+    }
     len = load_32_be(lenbytes);
-    if (len > MAX_REPLY_SIZE)
-        return KRB5_KCM_REPLY_TOO_BIG;
+    if (len > MAX_REPLY_SIZE) {
+        ret = KRB5_KCM_REPLY_TOO_BIG;
+        goto fail;
+    }
 
     st = krb5_net_read(context, io->fd, codebytes, 4);
-    if (st != 4)
-        return (st == -1) ? errno : KRB5_CC_IO;
-    code = load_32_be(codebytes);
-    if (code != 0)
-        return code;
-
-    reply = malloc(len);
-    if (reply == NULL)
-        return ENOMEM;
+    if (st != 4) {
+        ret = (st == -1) ? errno : KRB5_CC_IO;
+        goto fail;
+    }
+
+    /* Read the reply even if the status is an error, so that the next reply
+     * on the connection can be found. */
+    reply = malloc(len ? len : 1);
+    if (reply == NULL) {
+        ret = ENOMEM;
+        goto fail;
+    }
     st = krb5_net_read(context, io->fd, reply, len);
     if (st == -1 || (size_t)st != len) {
-        free(reply);
-        return (st < 0) ? errno : KRB5_CC_IO;
+        ret = (st < 0) ? errno : KRB5_CC_IO;
+        goto fail;
     }
 
+    *code_out = load_32_be(codebytes);
+    if (*code_out != 0) {
+        free(reply);
+        return 0;
+    }
     *reply_out = reply;
     *len_out = len;
     return 0;
+
+fail:
+    free(reply);
+    kcmio_unix_socket_disconnect(io);
+    return ret;
 }
 
+/* Release a reference to io, closing the connection if it was the last. */
+static void
+kcmio_close(struct kcmio *io)
+{
+    krb5_boolean last;
+
+    if (io == NULL)
+        return;
+
+    k5_mutex_lock(&shared_io_lock);
+    last = (--io->refcount == 0);
+    k5_mutex_unlock(&shared_io_lock);
+    if (!last)
+        return;
+
+    kcmio_mach_close(io);
+    if (io->fd != INVALID_SOCKET)
+        closesocket(io->fd);
+    k5_mutex_destroy(&io->lock);
+    free(io->path);
+    free(io);
+}
+
+/* Return true if shared_io can be used by this process for the socket at path.
+ * shared_io_lock must be held. */
+static krb5_boolean
+shared_io_matches(const char *path)
+{
+    return shared_io != NULL && shared_io->pid == getpid() &&
+        shared_io->euid == geteuid() && strcmp(shared_io->path, path) == 0;
+}
+
+/* Take a reference to the shared connection if it matches path, making sure it
+ * is connected.  Set *io_out to NULL if there is no matching connection. */
+static krb5_error_code
+get_shared_io(krb5_context context, const char *path, struct kcmio **io_out)
+{
+    krb5_error_code ret = 0;
+    struct kcmio *io = NULL;
+
+    *io_out = NULL;
+
+    k5_mutex_lock(&shared_io_lock);
+    if (shared_io_matches(path)) {
+        io = shared_io;
+        io->refcount++;
+    }
+    k5_mutex_unlock(&shared_io_lock);
+    if (io == NULL)
+        return 0;
+
+    /* Reconnect now if a previous call failed, so that an absent daemon is
+     * reported when a cache is resolved. */
+    k5_mutex_lock(&io->lock);
+    if (!kcmio_using_mach(io) && io->fd == INVALID_SOCKET)
+        ret = kcmio_unix_socket_connect(context, io);
+    k5_mutex_unlock(&io->lock);
+    if (ret) {
+        kcmio_close(io);
+        return ret;
+    }
+
+    *io_out = io;
+    return 0;
+}
+
+/* Get a reference to a connection to the KCM daemon, sharing one connection
+ * across the process where possible. */
 static krb5_error_code
 kcmio_connect(krb5_context context, struct kcmio **io_out)
 {
     krb5_error_code ret;
-    struct kcmio *io;
+    struct kcmio *io = NULL, *old = NULL;
+    char *path = NULL;
 
     *io_out = NULL;
-    io = calloc(1, sizeof(*io));
+
+    ret = profile_get_string(context->profile, KRB5_CONF_LIBDEFAULTS,
+                             KRB5_CONF_KCM_SOCKET, NULL,
+                             DEFAULT_KCM_SOCKET_PATH, &path);
+    if (ret)
+        return ret;
+
+    ret = get_shared_io(context, path, io_out);
+    if (ret || *io_out != NULL)
+        goto cleanup;
+
+    io = k5alloc(sizeof(*io), &ret);
     if (io == NULL)
-        return ENOMEM;
+        goto cleanup;
     io->fd = INVALID_SOCKET;
+    io->pid = getpid();
+    io->euid = geteuid();
+    io->refcount = 1;
+    io->path = strdup(path);
+    if (io->path == NULL) {
+        free(io);
+        ret = ENOMEM;
+        goto cleanup;
+    }
+    ret = k5_mutex_init(&io->lock);
+    if (ret) {
+        free(io->path);
+        free(io);
+        goto cleanup;
+    }
 
     /* Try Mach RPC (macOS only), then fall back to Unix domain sockets */
     ret = kcmio_mach_connect(context, io);
     if (ret)
         ret = kcmio_unix_socket_connect(context, io);
     if (ret) {
-        free(io);
-        return ret;
+        kcmio_close(io);
+        goto cleanup;
+    }
+
+    /* Share the new connection, unless another thread has already made one.
+     * A connection inherited from a parent process, or made under a different
+     * effective uid, is never reused. */
+    k5_mutex_lock(&shared_io_lock);
+    if (shared_io_matches(path)) {
+        k5_mutex_unlock(&shared_io_lock);
+        kcmio_close(io);
+        ret = get_shared_io(context, path, io_out);
+        goto cleanup;
     }
+    old = shared_io;
+    shared_io = io;
+    io->refcount++;
+    k5_mutex_unlock(&shared_io_lock);
+    kcmio_close(old);
 
     *io_out = io;
-    return 0;
+
+cleanup:
+    profile_release_string(path);
+    return ret;
 }
 
-/* Check req->reqbuf for an error condition and return it.  Otherwise, send the
- * request to the KCM daemon and get a response. */
+/* Set up req->reply from the reply memory and return the status code at the
+ * start of the marshalled reply. */
 static krb5_error_code
-kcmio_call(krb5_context context, struct kcmio *io, struct kcmreq *req)
+kcmreq_start_reply(struct kcmreq *req, size_t reply_len)
 {
     krb5_error_code ret;
-    size_t reply_len = 0;
-
-    if (k5_buf_status(&req->reqbuf) != 0)
-        return ENOMEM;
-
-    if (io->fd != INVALID_SOCKET) {
-        ret = kcmio_unix_socket_write(context, io, req->reqbuf.data,
-                                      req->reqbuf.len);
-        if (ret)
-            return ret;
-        ret = kcmio_unix_socket_read(context, io, &req->reply_mem, &reply_len);
-        if (ret)
-            return ret;
-    } else {
-        /* We must be using Mach RPC. */
-        ret = kcmio_mach_call(context, io, req->reqbuf.data, req->reqbuf.len,
-                              &req->reply_mem, &reply_len);
-        if (ret)
-            return ret;
-    }
 
-    /* Read the status code from the marshalled reply. */
     k5_input_init(&req->reply, req->reply_mem, reply_len);
     ret = k5_input_get_uint32_be(&req->reply);
     return req->reply.status ? KRB5_KCM_MALFORMED_REPLY : ret;
 }
 
-static void
-kcmio_close(struct kcmio *io)
+/*
+ * Check each request in reqs for an error condition and return it.
+ * Otherwise, send the requests to the KCM daemon and get the responses,
+ * placing the result of each request in codes.  Over a Unix domain socket, all
+ * of the requests are written before any of the replies are read.  Requests
+ * for optional operations the daemon has already rejected are not sent, and
+ * yield KRB5_CC_NOSUPP.  Return an error if communication with the daemon
+ * fails.
+ */
+static krb5_error_code
+kcmio_call_batch(krb5_context context, struct kcmio *io, struct kcmreq *reqs,
+                 size_t nreqs, krb5_error_code *codes)
 {
-    if (io != NULL) {
-        kcmio_mach_close(io);
-        if (io->fd != INVALID_SOCKET)
-            closesocket(io->fd);
-        free(io);
+    krb5_error_code ret = 0;
+    krb5_boolean *skip;
+    size_t i, reply_len;
+
+    for (i = 0; i < nreqs; i++) {
+        if (k5_buf_status(&reqs[i].reqbuf) != 0)
+            return ENOMEM;
     }
+
+    skip = k5calloc(nreqs, sizeof(*skip), &ret);
+    if (skip == NULL)
+        return ret;
+
+    k5_mutex_lock(&io->lock);
+
+    /* Decide once which requests to send.  A reconnect during the write
+     * forgets io->unsupported, and the replies must be read for exactly the
+     * requests which were written. */
+    for (i = 0; i < nreqs; i++)
+        skip[i] = kcmio_skip_req(io, &reqs[i]);
+
+    if (!kcmio_using_mach(io)) {
+        ret = kcmio_unix_socket_write(context, io, reqs, skip, nreqs);
+        if (ret)
+            goto cleanup;
+    }
+
+    for (i = 0; i < nreqs; i++) {
+        if (skip[i]) {
+            codes[i] = KRB5_CC_NOSUPP;
+            continue;
+        }
+
+        reply_len = 0;
+        if (!kcmio_using_mach(io)) {
+            ret = kcmio_unix_socket_read(context, io, &reqs[i].reply_mem,
+                                         &reply_len, &codes[i]);
+            if (ret)
+                goto cleanup;
+        } else {
+            codes[i] = kcmio_mach_call(context, io, reqs[i].reqbuf.data,
+                                       reqs[i].reqbuf.len, &reqs[i].reply_mem,
+                                       &reply_len);
+        }
+        if (codes[i] == 0)
+            codes[i] = kcmreq_start_reply(&reqs[i], reply_len);
+
+        /* Don't ask again for an optional operation the daemon lacks. */
+        if (remember_unsupported_error(codes[i]))
+            io->unsupported |= optional_op_flag(reqs[i].opcode);
+    }
+
+cleanup:
+    k5_mutex_unlock(&io->lock);
+    free(skip);
+    return ret;
+}
+
+/* Check req->reqbuf for an error condition and return it.  Otherwise, send the
+ * request to the KCM daemon and get a response. */
+static krb5_error_code
+kcmio_call(krb5_context context, struct kcmio *io, struct kcmreq *req)
+{
+    krb5_error_code ret, code;
+
+    ret = kcmio_call_batch(context, io, req, 1, &code);
+    return ret ? ret : code;
+}
+
+/* Return true if the daemon on io has not rejected opcode. */
+static krb5_boolean
+kcmio_supports(struct kcmio *io, kcm_opcode opcode)
+{
+    krb5_boolean result;
+
+    k5_mutex_lock(&io->lock);
+    result = (io->unsupported & optional_op_flag(opcode)) == 0;
+    k5_mutex_unlock(&io->lock);
+    return result;
 }
 
 /* Fetch a zero-terminated name string from req->reply.  The returned pointer
@@ -548,6 +842,19 @@ free_uuid_list(struct uuid_list *uuids)
     free(uuids);
 }
 
+static void
+free_name_list(struct name_list *list)
+{
+    size_t i;
+
+    if (list == NULL)
+        return;
+    for (i = 0; i < list->count; i++)
+        free(list->names[i]);
+    free(list->names);
+    free(list);
+}
+
 static void
 free_cred_list(struct cred_list *list)
 {
@@ -618,8 +925,9 @@ kcmreq_free(struct kcmreq *req)
     free(req->reply_mem);
 }
 
-/* Create a krb5_ccache structure.  If io is NULL, make a new connection for
- * the cache.  Otherwise, always take ownership of io. */
+/* Create a krb5_ccache structure.  If io is NULL, get a reference to the
+ * shared connection for the cache.  Otherwise, always take ownership of the
+ * reference io. */
 static krb5_error_code
 make_cache(krb5_context context, const char *residual, struct kcmio *io,
            krb5_ccache *cache_out)
@@ -678,26 +986,35 @@ cache_call(krb5_context context, krb5_ccache cache, struct kcmreq *req)
     return ret;
 }
 
-/* Try to propagate the KDC time offset from the cache to the krb5 context. */
+/* Lock cache's I/O structure and use it to make a batch of calls to the KCM
+ * daemon. */
+static krb5_error_code
+cache_call_batch(krb5_context context, krb5_ccache cache, struct kcmreq *reqs,
+                 size_t nreqs, krb5_error_code *codes)
+{
+    krb5_error_code ret;
+    struct kcm_cache_data *data = cache->data;
+
+    k5_cc_mutex_lock(context, &data->lock);
+    ret = kcmio_call_batch(context, data->io, reqs, nreqs, codes);
+    k5_cc_mutex_unlock(context, &data->lock);
+    return ret;
+}
+
+/* Propagate the KDC time offset from the reply to a GET_KDC_OFFSET request to
+ * the krb5 context, if it is well-formed. */
 static void
-get_kdc_offset(krb5_context context, krb5_ccache cache)
+get_kdc_offset(krb5_context context, struct kcmreq *req)
 {
-    struct kcmreq req = EMPTY_KCMREQ;
     int32_t time_offset;
 
-    kcmreq_init(&req, KCM_OP_GET_KDC_OFFSET, cache);
-    if (cache_call(context, cache, &req) != 0)
-        goto cleanup;
-    time_offset = k5_input_get_uint32_be(&req.reply);
-    if (req.reply.status)
-        goto cleanup;
+    time_offset = k5_input_get_uint32_be(&req->reply);
+    if (req->reply.status)
+        return;
     context->os_context.time_offset = time_offset;
     context->os_context.usec_offset = 0;
     context->os_context.os_flags &= ~KRB5_OS_TOFFSET_TIME;
     context->os_context.os_flags |= KRB5_OS_TOFFSET_VALID;
-
-cleanup:
-    kcmreq_free(&req);
 }
 
 /* Try to propagate the KDC offset from the krb5 context to the cache. */
@@ -957,31 +1274,46 @@ static krb5_error_code KRB5_CALLCONV
 kcm_start_seq_get(krb5_context context, krb5_ccache cache,
                   krb5_cc_cursor *cursor_out)
 {
-    krb5_error_code ret;
-    struct kcmreq req = EMPTY_KCMREQ;
+    krb5_error_code ret, codes[2];
+    struct kcmreq reqs[2] = { EMPTY_KCMREQ, EMPTY_KCMREQ };
+    struct kcm_cache_data *data = cache->data;
     struct uuid_list *uuids = NULL;
     struct cred_list *creds = NULL;
     struct kcm_cursor *cursor;
+    kcm_opcode listop;
 
     *cursor_out = NULL;
 
-    get_kdc_offset(context, cache);
+    /* Fetch the KDC time offset along with the list of creds, using
+     * GET_CRED_LIST unless the daemon has already rejected it. */
+    listop = kcmio_supports(data->io, KCM_OP_GET_CRED_LIST) ?
+        KCM_OP_GET_CRED_LIST : KCM_OP_GET_CRED_UUID_LIST;
+    kcmreq_init(&reqs[0], KCM_OP_GET_KDC_OFFSET, cache);
+    kcmreq_init(&reqs[1], listop, cache);
+    ret = cache_call_batch(context, cache, reqs, 2, codes);
+    if (ret)
+        goto cleanup;
+    if (codes[0] == 0)
+        get_kdc_offset(context, &reqs[0]);
 
-    kcmreq_init(&req, KCM_OP_GET_CRED_LIST, cache);
-    ret = cache_call(context, cache, &req);
-    if (ret == 0) {
+    ret = codes[1];
+    if (ret == 0 && listop == KCM_OP_GET_CRED_LIST) {
         /* GET_CRED_LIST is available. */
-        ret = kcmreq_get_cred_list(&req, &creds);
+        ret = kcmreq_get_cred_list(&reqs[1], &creds);
         if (ret)
             goto cleanup;
-    } else if (unsupported_op_error(ret)) {
+    } else if (unsupported_op_error(ret) && listop == KCM_OP_GET_CRED_LIST) {
         /* Fall back to GET_CRED_UUID_LIST. */
-        kcmreq_free(&req);
-        kcmreq_init(&req, KCM_OP_GET_CRED_UUID_LIST, cache);
-        ret = cache_call(context, cache, &req);
+        kcmreq_free(&reqs[1]);
+        kcmreq_init(&reqs[1], KCM_OP_GET_CRED_UUID_LIST, cache);
+        ret = cache_call(context, cache, &reqs[1]);
         if (ret)
             goto cleanup;
-        ret = kcmreq_get_uuid_list(&req, &uuids);
+        ret = kcmreq_get_uuid_list(&reqs[1], &uuids);
+        if (ret)
+            goto cleanup;
+    } else if (ret == 0) {
+        ret = kcmreq_get_uuid_list(&reqs[1], &uuids);
         if (ret)
             goto cleanup;
     } else {
@@ -993,33 +1325,73 @@ kcm_start_seq_get(krb5_context context, krb5_ccache cache,
         goto cleanup;
     cursor->uuids = uuids;
     cursor->creds = creds;
+    uuids = NULL;
+    creds = NULL;
     *cursor_out = (krb5_cc_cursor)cursor;
 
 cleanup:
-    kcmreq_free(&req);
+    free_uuid_list(uuids);
+    free_cred_list(creds);
+    kcmreq_free(&reqs[0]);
+    kcmreq_free(&reqs[1]);
     return ret;
 }
 
+/*
+ * Fetch the creds for the next window of uuids into a new cred list,
+ * pipelining the requests.  Skip creds which have been removed since the UUID
+ * list was fetched.
+ */
 static krb5_error_code
-next_cred_by_uuid(krb5_context context, krb5_ccache cache,
-                  struct uuid_list *uuids, krb5_creds *cred_out)
+get_creds_by_uuid(krb5_context context, krb5_ccache cache,
+                  struct uuid_list *uuids, struct cred_list **creds_out)
 {
-    krb5_error_code ret;
-    struct kcmreq req;
+    krb5_error_code ret, codes[KCM_PIPELINE_DEPTH];
+    struct kcmreq reqs[KCM_PIPELINE_DEPTH];
+    struct cred_list *list = NULL;
+    size_t n, i;
 
-    memset(cred_out, 0, sizeof(*cred_out));
+    *creds_out = NULL;
 
-    if (uuids->pos >= uuids->count)
-        return KRB5_CC_END;
+    n = uuids->count - uuids->pos;
+    if (n > KCM_PIPELINE_DEPTH)
+        n = KCM_PIPELINE_DEPTH;
+    for (i = 0; i < n; i++) {
+        kcmreq_init(&reqs[i], KCM_OP_GET_CRED_BY_UUID, cache);
+        k5_buf_add_len(&reqs[i].reqbuf,
+                       uuids->uuidbytes + (uuids->pos++ * KCM_UUID_LEN),
+                       KCM_UUID_LEN);
+    }
+    ret = cache_call_batch(context, cache, reqs, n, codes);
+    if (ret)
+        goto cleanup;
 
-    kcmreq_init(&req, KCM_OP_GET_CRED_BY_UUID, cache);
-    k5_buf_add_len(&req.reqbuf, uuids->uuidbytes + (uuids->pos * KCM_UUID_LEN),
-                   KCM_UUID_LEN);
-    uuids->pos++;
-    ret = cache_call(context, cache, &req);
-    if (!ret)
-        ret = k5_unmarshal_cred(req.reply.ptr, req.reply.len, 4, cred_out);
-    kcmreq_free(&req);
+    list = k5alloc(sizeof(*list), &ret);
+    if (list == NULL)
+        goto cleanup;
+    list->creds = k5calloc(n, sizeof(*list->creds), &ret);
+    if (list->creds == NULL)
+        goto cleanup;
+    for (i = 0; i < n; i++) {
+        if (codes[i] == KRB5_CC_END)
+            continue;
+        ret = codes[i];
+        if (ret)
+            goto cleanup;
+        ret = k5_unmarshal_cred(reqs[i].reply.ptr, reqs[i].reply.len, 4,
+                                &list->creds[list->count]);
+        if (ret)
+            goto cleanup;
+        list->count++;
+    }
+
+    *creds_out = list;
+    list = NULL;
+
+cleanup:
+    for (i = 0; i < n; i++)
+        kcmreq_free(&reqs[i]);
+    free_cred_list(list);
     return map_invalid(ret);
 }
 
@@ -1027,15 +1399,26 @@ static krb5_error_code KRB5_CALLCONV
 kcm_next_cred(krb5_context context, krb5_ccache cache, krb5_cc_cursor *cursor,
               krb5_creds *cred_out)
 {
+    krb5_error_code ret;
     struct kcm_cursor *c = (struct kcm_cursor *)*cursor;
     struct cred_list *list;
 
-    if (c->uuids != NULL)
-        return next_cred_by_uuid(context, cache, c->uuids, cred_out);
+    memset(cred_out, 0, sizeof(*cred_out));
 
-    list = c->creds;
-    if (list->pos >= list->count)
-        return KRB5_CC_END;
+    for (;;) {
+        list = c->creds;
+        if (list != NULL && list->pos < list->count)
+            break;
+
+        /* Fetch the next window of creds if we are iterating by UUID. */
+        if (c->uuids == NULL || c->uuids->pos >= c->uuids->count)
+            return KRB5_CC_END;
+        free_cred_list(c->creds);
+        c->creds = NULL;
+        ret = get_creds_by_uuid(context, cache, c->uuids, &c->creds);
+        if (ret)
+            return ret;
+    }
 
     /* Transfer memory ownership of one cred to the caller. */
     *cred_out = list->creds[list->pos];
@@ -1115,6 +1498,7 @@ make_ptcursor(const char *residual, struct uuid_list *uuids, struct kcmio *io,
 
     data->residual = residual_copy;
     data->uuids = uuids;
+    data->names = NULL;
     data->io = io;
     data->first = TRUE;
     cursor->ops = &krb5_kcm_ops;
@@ -1134,8 +1518,8 @@ oom:
 static krb5_error_code KRB5_CALLCONV
 kcm_ptcursor_new(krb5_context context, krb5_cc_ptcursor *cursor_out)
 {
-    krb5_error_code ret;
-    struct kcmreq req = EMPTY_KCMREQ;
+    krb5_error_code ret, codes[2];
+    struct kcmreq reqs[2] = { EMPTY_KCMREQ, EMPTY_KCMREQ };
     struct kcmio *io = NULL;
     struct uuid_list *uuids = NULL;
     const char *defname, *primary;
@@ -1156,8 +1540,13 @@ kcm_ptcursor_new(krb5_context context, krb5_cc_ptcursor *cursor_out)
     if (strlen(defname) > 4)
         return make_ptcursor(defname + 4, NULL, io, cursor_out);
 
-    kcmreq_init(&req, KCM_OP_GET_CACHE_UUID_LIST, NULL);
-    ret = kcmio_call(context, io, &req);
+    /* Fetch the cache list and the primary name in one round trip. */
+    kcmreq_init(&reqs[0], KCM_OP_GET_CACHE_UUID_LIST, NULL);
+    kcmreq_init(&reqs[1], KCM_OP_GET_DEFAULT_CACHE, NULL);
+    ret = kcmio_call_batch(context, io, reqs, 2, codes);
+    if (ret)
+        goto cleanup;
+    ret = codes[0];
     if (ret == KRB5_FCC_NOFILE) {
         /* There are no accessible caches; return an empty cursor. */
         ret = make_ptcursor(NULL, NULL, NULL, cursor_out);
@@ -1165,16 +1554,14 @@ kcm_ptcursor_new(krb5_context context, krb5_cc_ptcursor *cursor_out)
     }
     if (ret)
         goto cleanup;
-    ret = kcmreq_get_uuid_list(&req, &uuids);
+    ret = kcmreq_get_uuid_list(&reqs[0], &uuids);
     if (ret)
         goto cleanup;
 
-    kcmreq_free(&req);
-    kcmreq_init(&req, KCM_OP_GET_DEFAULT_CACHE, NULL);
-    ret = kcmio_call(context, io, &req);
+    ret = codes[1];
     if (ret)
         goto cleanup;
-    ret = kcmreq_get_name(&req, &primary);
+    ret = kcmreq_get_name(&reqs[1], &primary);
     if (ret)
         goto cleanup;
 
@@ -1185,7 +1572,8 @@ kcm_ptcursor_new(krb5_context context, krb5_cc_ptcursor *cursor_out)
 cleanup:
     free_uuid_list(uuids);
     kcmio_close(io);
-    kcmreq_free(&req);
+    kcmreq_free(&reqs[0]);
+    kcmreq_free(&reqs[1]);
     return ret;
 }
 
@@ -1203,15 +1591,77 @@ name_exists(krb5_context context, struct kcmio *io, const char *name)
     return ret == 0;
 }
 
+/*
+ * Fetch the names of the caches for the next window of uuids into a new name
+ * list, pipelining the requests.  Skip caches which have been deleted since
+ * the UUID list was fetched.
+ */
+static krb5_error_code
+get_names_by_uuid(krb5_context context, struct kcmio *io,
+                  struct uuid_list *uuids, struct name_list **names_out)
+{
+    krb5_error_code ret, codes[KCM_PIPELINE_DEPTH];
+    struct kcmreq reqs[KCM_PIPELINE_DEPTH];
+    struct name_list *list = NULL;
+    const char *name;
+    size_t n, i;
+
+    *names_out = NULL;
+
+    n = uuids->count - uuids->pos;
+    if (n > KCM_PIPELINE_DEPTH)
+        n = KCM_PIPELINE_DEPTH;
+    for (i = 0; i < n; i++) {
+        kcmreq_init(&reqs[i], KCM_OP_GET_CACHE_BY_UUID, NULL);
+        k5_buf_add_len(&reqs[i].reqbuf,
+                       uuids->uuidbytes + (uuids->pos++ * KCM_UUID_LEN),
+                       KCM_UUID_LEN);
+    }
+    ret = kcmio_call_batch(context, io, reqs, n, codes);
+    if (ret)
+        goto cleanup;
+
+    list = k5alloc(sizeof(*list), &ret);
+    if (list == NULL)
+        goto cleanup;
+    list->names = k5calloc(n, sizeof(*list->names), &ret);
+    if (list->names == NULL)
+        goto cleanup;
+    for (i = 0; i < n; i++) {
+        if (codes[i] == KRB5_CC_END || codes[i] == KRB5_FCC_NOFILE)
+            continue;
+        ret = codes[i];
+        if (ret)
+            goto cleanup;
+        ret = kcmreq_get_name(&reqs[i], &name);
+        if (ret)
+            goto cleanup;
+        list->names[list->count] = strdup(name);
+        if (list->names[list->count] == NULL) {
+            ret = ENOMEM;
+            goto cleanup;
+        }
+        list->count++;
+    }
+
+    *names_out = list;
+    list = NULL;
+
+cleanup:
+    for (i = 0; i < n; i++)
+        kcmreq_free(&reqs[i]);
+    free_name_list(list);
+    return ret;
+}
+
 static krb5_error_code KRB5_CALLCONV
 kcm_ptcursor_next(krb5_context context, krb5_cc_ptcursor cursor,
                   krb5_ccache *cache_out)
 {
-    krb5_error_code ret = 0;
-    struct kcmreq req = EMPTY_KCMREQ;
+    krb5_error_code ret;
     struct kcm_ptcursor *data = cursor->data;
     struct uuid_list *uuids;
-    const unsigned char *id;
+    struct name_list *names;
     const char *name;
 
     *cache_out = NULL;
@@ -1227,35 +1677,25 @@ kcm_ptcursor_next(krb5_context context, krb5_cc_ptcursor cursor,
     if (uuids == NULL)
         return 0;
 
-    while (uuids->pos < uuids->count) {
-        /* Get the name of the next cache. */
-        id = &uuids->uuidbytes[KCM_UUID_LEN * uuids->pos++];
-        kcmreq_free(&req);
-        kcmreq_init(&req, KCM_OP_GET_CACHE_BY_UUID, NULL);
-        k5_buf_add_len(&req.reqbuf, id, KCM_UUID_LEN);
-        ret = kcmio_call(context, data->io, &req);
-        /* Continue if the cache has been deleted. */
-        if (ret == KRB5_CC_END || ret == KRB5_FCC_NOFILE) {
-            ret = 0;
-            continue;
+    for (;;) {
+        names = data->names;
+        if (names != NULL && names->pos < names->count) {
+            name = names->names[names->pos++];
+            /* Don't yield the primary cache twice. */
+            if (strcmp(name, data->residual) == 0)
+                continue;
+            return make_cache(context, name, NULL, cache_out);
         }
-        if (ret)
-            goto cleanup;
-        ret = kcmreq_get_name(&req, &name);
-        if (ret)
-            goto cleanup;
 
-        /* Don't yield the primary cache twice. */
-        if (strcmp(name, data->residual) == 0)
-            continue;
-
-        ret = make_cache(context, name, NULL, cache_out);
-        break;
+        /* Get the names of the next window of caches. */
+        if (uuids->pos >= uuids->count)
+            return 0;
+        free_name_list(data->names);
+        data->names = NULL;
+        ret = get_names_by_uuid(context, data->io, uuids, &data->names);
+        if (ret)
+            return ret;
     }
-
-cleanup:
-    kcmreq_free(&req);
-    return ret;
 }
 
 static krb5_error_code KRB5_CALLCONV
@@ -1265,6 +1705,7 @@ kcm_ptcursor_free(krb5_context context, krb5_cc_ptcursor *cursor)
 
     free(data->residual);
     free_uuid_list(data->uuids);
+    free_name_list(data->names);
     kcmio_close(data->io);
     free(data);
     free(*cursor);
@@ -1335,6 +1776,20 @@ kcm_switch_to(krb5_context context, krb5_ccache cache)
     return ret;
 }
 
+int
+krb5int_kcm_initialize(void)
+{
+    return k5_mutex_finish_init(&shared_io_lock);
+}
+
+void
+krb5int_kcm_finalize(void)
+{
+    kcmio_close(shared_io);
+    shared_io = NULL;
+    k5_mutex_destroy(&shared_io_lock);
+}
+
 const krb5_cc_ops krb5_kcm_ops = {
     0,
     "KCM",
@@ -193,15 +193,10 @@ krb5int_cc_creds_match_request(krb5_context context, krb5_flags whichfields,
 }
 
 static krb5_error_code
-krb5_cc_retrieve_cred_seq (krb5_context context, krb5_ccache id,
-                           krb5_flags whichfields, krb5_creds *mcreds,
-                           krb5_creds *creds, int nktypes, krb5_enctype *ktypes)
+retrieve_cred_seq(krb5_context context, krb5_flags whichfields,
+                  krb5_creds *mcreds, krb5_creds *creds, int nktypes,
+                  krb5_enctype *ktypes, k5_cc_next_cred_fn next_fn, void *arg)
 {
-    /* This function could be considerably faster if it kept indexing */
-    /* information.. sounds like a "next version" idea to me. :-) */
-
-    krb5_cc_cursor cursor;
-    krb5_error_code kret;
     krb5_error_code nomatch_err = KRB5_CC_NOTFOUND;
     struct {
         krb5_creds creds;
@@ -210,11 +205,7 @@ krb5_cc_retrieve_cred_seq (krb5_context context, krb5_ccache id,
     int have_creds = 0;
 #define fetchcreds (fetched.creds)
 
-    kret = krb5_cc_start_seq_get(context, id, &cursor);
-    if (kret != KRB5_OK)
-        return kret;
-
-    while (krb5_cc_next_cred(context, id, &cursor, &fetchcreds) == KRB5_OK) {
+    while ((*next_fn)(context, arg, &fetchcreds) == KRB5_OK) {
         if (krb5int_cc_creds_match_request(context, whichfields, mcreds, &fetchcreds))
         {
             if (ktypes) {
@@ -231,7 +222,6 @@ krb5_cc_retrieve_cred_seq (krb5_context context, krb5_ccache id,
                     continue;
                 }
             } else {
-                krb5_cc_end_seq_get(context, id, &cursor);
                 *creds = fetchcreds;
                 return KRB5_OK;
             }
@@ -242,7 +232,6 @@ krb5_cc_retrieve_cred_seq (krb5_context context, krb5_ccache id,
     }
 
     /* If we get here, a match wasn't found */
-    krb5_cc_end_seq_get(context, id, &cursor);
     if (have_creds) {
         *creds = best.creds;
         return KRB5_OK;
@@ -251,9 +240,9 @@ krb5_cc_retrieve_cred_seq (krb5_context context, krb5_ccache id,
 }
 
 krb5_error_code
-k5_cc_retrieve_cred_default(krb5_context context, krb5_ccache id,
-                            krb5_flags flags, krb5_creds *mcreds,
-                            krb5_creds *creds)
+k5_cc_retrieve_cred_iter(krb5_context context, krb5_flags flags,
+                         krb5_creds *mcreds, k5_cc_next_cred_fn next_fn,
+                         void *arg, krb5_creds *creds)
 {
     krb5_enctype *ktypes;
     int nktypes;
@@ -265,12 +254,43 @@ k5_cc_retrieve_cred_default(krb5_context context, krb5_ccache id,
             return ret;
         nktypes = k5_count_etypes (ktypes);
 
-        ret = krb5_cc_retrieve_cred_seq (context, id, flags, mcreds, creds,
-                                         nktypes, ktypes);
+        ret = retrieve_cred_seq (context, flags, mcreds, creds, nktypes,
+                                 ktypes, next_fn, arg);
         free (ktypes);
         return ret;
     } else {
-        return krb5_cc_retrieve_cred_seq (context, id, flags, mcreds, creds,
-                                          0, 0);
+        return retrieve_cred_seq (context, flags, mcreds, creds, 0, 0,
+                                  next_fn, arg);
     }
 }
+
+struct seq_state {
+    krb5_ccache id;
+    krb5_cc_cursor cursor;
+};
+
+static krb5_error_code
+next_seq_cred(krb5_context context, void *arg, krb5_creds *creds)
+{
+    struct seq_state *st = arg;
+
+    return krb5_cc_next_cred(context, st->id, &st->cursor, creds);
+}
+
+krb5_error_code
+k5_cc_retrieve_cred_default(krb5_context context, krb5_ccache id,
+                            krb5_flags flags, krb5_creds *mcreds,
+                            krb5_creds *creds)
+{
+    struct seq_state st;
+    krb5_error_code ret;
+
+    st.id = id;
+    ret = krb5_cc_start_seq_get(context, id, &st.cursor);
+    if (ret)
+        return ret;
+    ret = k5_cc_retrieve_cred_iter(context, flags, mcreds, next_seq_cred, &st,
+                                   creds);
+    krb5_cc_end_seq_get(context, id, &st.cursor);
+    return ret;
+}
@@ -127,6 +127,11 @@ krb5int_cc_initialize(void)
     err = k5_cc_mutex_finish_init(&krb5int_krcc_mutex);
     if (err)
         return err;
+#endif
+#ifndef _WIN32
+    err = krb5int_kcm_initialize();
+    if (err)
+        return err;
 #endif
     return 0;
 }
@@ -144,6 +149,9 @@ krb5int_cc_finalize(void)
     k5_cc_mutex_destroy(&krb5int_mcc_mutex);
 #ifdef USE_KEYRING_CCACHE
     k5_cc_mutex_destroy(&krb5int_krcc_mutex);
+#endif
+#ifndef _WIN32
+    krb5int_kcm_finalize();
 #endif
     for (t = cc_typehead; t != INITIAL_TYPEHEAD; t = t_next) {
         t_next = t->next;
@@ -32,6 +32,7 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#include <utime.h>
 #include "com_err.h"
 
 #define KRB5_OK 0
@@ -603,6 +604,138 @@ test_order(krb5_context context, const char *name)
     free_test_cred(context);
 }
 
+/* Store a copy of test_creds for the server svc<n>/host, using flags as the
+ * ticket flags so that the copy can be told apart from others. */
+static void
+store_svc_cred(krb5_context context, krb5_ccache id, int n, krb5_flags flags)
+{
+    krb5_error_code kret;
+    krb5_creds creds;
+    char pname[300];
+
+    creds = test_creds;
+    creds.is_skey = FALSE;
+    creds.ticket_flags = flags;
+    snprintf(pname, sizeof(pname), "svc%d/host@" REALM, n);
+    kret = krb5_parse_name(context, pname, &creds.server);
+    CHECK(kret, "parse_name");
+    kret = krb5_cc_store_cred(context, id, &creds);
+    CHECK(kret, "store_svc_cred");
+    krb5_free_principal(context, creds.server);
+}
+
+/*
+ * Retrieve the cred for svc<n>/host from id and check that it was stored with
+ * the ticket flags value flags, or that there is none if flags is 0.  If
+ * whichfields includes KRB5_TC_MATCH_SRV_NAMEONLY, ask for the server in a
+ * different realm.
+ */
+static void
+retrieve_svc_cred(krb5_context context, krb5_ccache id, int n,
+                  krb5_flags whichfields, krb5_flags flags)
+{
+    krb5_error_code kret;
+    krb5_creds mcreds, creds;
+    char pname[300];
+
+    memset(&mcreds, 0, sizeof(mcreds));
+    mcreds.client = test_creds.client;
+    snprintf(pname, sizeof(pname), "svc%d/host@%s", n,
+             (whichfields & KRB5_TC_MATCH_SRV_NAMEONLY) ? "OTHER" : REALM);
+    kret = krb5_parse_name(context, pname, &mcreds.server);
+    CHECK(kret, "parse_name");
+    kret = krb5_cc_retrieve_cred(context, id, whichfields, &mcreds, &creds);
+    if (flags == 0) {
+        CHECK_BOOL(kret != KRB5_CC_NOTFOUND, "cred should not be found",
+                   pname);
+    } else {
+        CHECK(kret, "retrieve_svc_cred");
+        CHECK_BOOL(creds.ticket_flags != flags, "wrong cred retrieved",
+                   pname);
+        krb5_free_cred_contents(context, &creds);
+    }
+    krb5_free_principal(context, mcreds.server);
+}
+
+/*
+ * Test retrieval from a FILE ccache with ccache_index enabled.  Changes are
+ * made through one handle and retrieved through another, whose index must
+ * notice them.
+ */
+static void
+test_fcc_index(krb5_context context)
+{
+    krb5_error_code kret;
+    krb5_ccache writer, reader;
+    krb5_creds rmcreds;
+    struct utimbuf times;
+    char path[300], name[310];
+    int n;
+
+    fprintf(stderr, "Testing FILE ccache index\n");
+
+    kret = init_test_cred(context);
+    CHECK(kret, "init_creds");
+    context->fcc_index = TRUE;
+
+    snprintf(path, sizeof(path), "/tmp/ccindex.%ld", (long) getpid());
+    snprintf(name, sizeof(name), "FILE:%s", path);
+    kret = krb5_cc_resolve(context, name, &writer);
+    CHECK(kret, "resolve writer");
+    kret = krb5_cc_resolve(context, name, &reader);
+    CHECK(kret, "resolve reader");
+
+    /* Store a hundred creds, then a second cred for svc20, which should not
+     * be retrieved in preference to the first. */
+    kret = krb5_cc_initialize(context, writer, test_creds.client);
+    CHECK(kret, "initialize");
+    for (n = 0; n < 100; n++)
+        store_svc_cred(context, writer, n, 1);
+    store_svc_cred(context, writer, 20, 2);
+
+    /* An index is only used without rereading the file if the file was last
+     * modified before the index was built, so move the mtime back. */
+    times.actime = times.modtime = time(NULL) - 60;
+    if (utime(path, &times) != 0) {
+        perror("utime");
+        exit(1);
+    }
+
+    for (n = 0; n < 100; n++)
+        retrieve_svc_cred(context, reader, n, 0, 1);
+    retrieve_svc_cred(context, reader, 100, 0, 0);
+    retrieve_svc_cred(context, reader, 50, KRB5_TC_MATCH_SRV_NAMEONLY, 1);
+
+    store_svc_cred(context, writer, 100, 3);
+    retrieve_svc_cred(context, reader, 100, 0, 3);
+    retrieve_svc_cred(context, reader, 99, 0, 1);
+
+    /* After the first svc20 cred is removed, the second should be found. */
+    rmcreds = test_creds;
+    rmcreds.is_skey = FALSE;
+    rmcreds.ticket_flags = 1;
+    kret = krb5_parse_name(context, "svc20/host@" REALM, &rmcreds.server);
+    CHECK(kret, "parse_name");
+    kret = krb5_cc_remove_cred(context, writer, KRB5_TC_MATCH_FLAGS_EXACT,
+                               &rmcreds);
+    CHECK(kret, "remove_cred");
+    krb5_free_principal(context, rmcreds.server);
+    retrieve_svc_cred(context, reader, 20, 0, 2);
+
+    kret = krb5_cc_initialize(context, writer, test_creds.client);
+    CHECK(kret, "initialize again");
+    store_svc_cred(context, writer, 5, 4);
+    retrieve_svc_cred(context, reader, 5, 0, 4);
+    retrieve_svc_cred(context, reader, 6, 0, 0);
+
+    kret = krb5_cc_destroy(context, writer);
+    CHECK(kret, "destroy");
+    kret = krb5_cc_close(context, reader);
+    CHECK(kret, "close");
+    context->fcc_index = FALSE;
+    free_test_cred(context);
+}
+
 extern const krb5_cc_ops krb5_mcc_ops;
 extern const krb5_cc_ops krb5_fcc_ops;
 
@@ -655,6 +788,8 @@ main(void)
 
     test_order(context, "MEMORY:order");
 
+    test_fcc_index(context);
+
     krb5_free_context(context);
     return 0;
 }
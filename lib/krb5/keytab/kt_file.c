@@ -54,8 +54,14 @@
 #ifndef LEAN_CLIENT
 
 #include "k5-int.h"
+#include "k5-hashtab.h"
+#include "k5-input.h"
+#include "kt-int.h"
 #include "../os/os-proto.h"
 #include <stdio.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 /*
  * Information needed by internal routines of the file-based ticket
@@ -75,6 +81,8 @@
 /*
  * Types
  */
+struct ktindex;
+
 typedef struct _krb5_ktfile_data {
     char *name;                 /* Name of the file */
     FILE *openf;                /* open file, if any. */
@@ -82,7 +90,8 @@ typedef struct _krb5_ktfile_data {
     int version;                /* Version number of keytab */
     unsigned int iter_count;    /* Number of active iterators */
     long start_offset;          /* Starting offset after version */
-    k5_mutex_t lock;            /* Protect openf, version */
+    struct ktindex *index;      /* Index for get_entry, if built */
+    k5_mutex_t lock;            /* Protect openf, version, index */
 } krb5_ktfile_data;
 
 /*
@@ -113,6 +122,7 @@ typedef struct _krb5_ktfile_data {
 #define KTVERSION(id) (((krb5_ktfile_data *)(id)->data)->version)
 #define KTITERS(id) (((krb5_ktfile_data *)(id)->data)->iter_count)
 #define KTSTARTOFF(id) (((krb5_ktfile_data *)(id)->data)->start_offset)
+#define KTINDEX(id) (((krb5_ktfile_data *)(id)->data)->index)
 #define KTLOCK(id) k5_mutex_lock(&((krb5_ktfile_data *)(id)->data)->lock)
 #define KTUNLOCK(id) k5_mutex_unlock(&((krb5_ktfile_data *)(id)->data)->lock)
 #define KTCHECKLOCK(id) k5_mutex_assert_locked(&((krb5_ktfile_data *)(id)->data)->lock)
@@ -150,6 +160,10 @@ krb5_ktfile_add(krb5_context, krb5_keytab, krb5_keytab_entry *);
 static krb5_error_code KRB5_CALLCONV
 krb5_ktfile_remove(krb5_context, krb5_keytab, krb5_keytab_entry *);
 
+static krb5_error_code KRB5_CALLCONV
+krb5_ktfile_add_entries(krb5_context, krb5_keytab, krb5_keytab_entry *,
+                        size_t);
+
 static krb5_error_code
 krb5_ktfileint_openr(krb5_context, krb5_keytab);
 
@@ -175,10 +189,20 @@ krb5_ktfileint_internal_read_entry(krb5_context, krb5_keytab,
 static krb5_error_code
 krb5_ktfileint_size_entry(krb5_context, krb5_keytab_entry *, krb5_int32 *);
 
+static krb5_error_code
+krb5_ktfileint_write_entries(krb5_context, krb5_keytab, krb5_keytab_entry *,
+                             size_t);
+
 static krb5_error_code
 krb5_ktfileint_find_slot(krb5_context, krb5_keytab, krb5_int32 *,
                          krb5_int32 *);
 
+static krb5_error_code
+krb5_ktfileint_find_end(krb5_context, krb5_keytab, krb5_int32 *);
+
+static void
+release_index(struct ktindex *index);
+
 
 /*
  * This is an implementation specific resolver.  It returns a keytab id
@@ -244,6 +268,7 @@ krb5_ktfile_close(krb5_context context, krb5_keytab id)
  * This routine should undo anything done by krb5_ktfile_resolve().
  */
 {
+    release_index(KTINDEX(id));
     free(KTFILENAME(id));
     zap(KTFILEBUFP(id), BUFSIZ);
     k5_mutex_destroy(&((krb5_ktfile_data *)id->data)->lock);
@@ -276,57 +301,706 @@ more_recent(const krb5_keytab_entry *k1, const krb5_keytab_entry *k2)
 }
 
 /*
- * This is the get_entry routine for the file based keytab implementation.
- * It opens the keytab file, and either retrieves the entry or returns
- * an error.
+ * Update *cur_entry and *found_wrong_kvno for new_entry, a candidate for a
+ * get_entry request for kvno and enctype whose principal matches.  Take
+ * ownership of new_entry's contents.  Return true if the search is over.
  */
+static krb5_boolean
+consider_entry(krb5_context context, krb5_kvno kvno, krb5_enctype enctype,
+               krb5_keytab_entry *new_entry, krb5_keytab_entry *cur_entry,
+               int *found_wrong_kvno)
+{
+    /* If the enctype is not ignored and doesn't match, free new_entry and
+       continue to the next. */
+    if (enctype != IGNORE_ENCTYPE && enctype != new_entry->key.enctype) {
+        krb5_kt_free_entry(context, new_entry);
+        return FALSE;
+    }
 
-static krb5_error_code KRB5_CALLCONV
-krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
-                      krb5_const_principal principal, krb5_kvno kvno,
-                      krb5_enctype enctype, krb5_keytab_entry *entry)
+    if (kvno == IGNORE_VNO || new_entry->vno == IGNORE_VNO) {
+        /* If this entry is more recent (or the first match), free the
+         * current and keep the new.  Otherwise, free the new. */
+        if (cur_entry->principal == NULL ||
+            more_recent(new_entry, cur_entry)) {
+            krb5_kt_free_entry(context, cur_entry);
+            *cur_entry = *new_entry;
+        } else {
+            krb5_kt_free_entry(context, new_entry);
+        }
+    } else {
+        /*
+         * If this kvno matches exactly, free the current, keep the new,
+         * and break out.  If it matches the low 8 bits of the desired
+         * kvno, remember the first match (because the recorded kvno may
+         * have been truncated due to pre-1.14 keytab format or kadmin
+         * protocol limitations) but keep looking for an exact match.
+         * Otherwise, remember that we were here so we can return the right
+         * error, and free the new.
+         */
+        if (new_entry->vno == kvno) {
+            krb5_kt_free_entry(context, cur_entry);
+            *cur_entry = *new_entry;
+            return TRUE;
+        } else if (new_entry->vno == (kvno & 0xff) &&
+                   cur_entry->principal == NULL) {
+            *cur_entry = *new_entry;
+        } else {
+            (*found_wrong_kvno)++;
+            krb5_kt_free_entry(context, new_entry);
+        }
+    }
+    return FALSE;
+}
+
+#ifndef _WIN32
+
+/*
+ * To avoid reading the whole file for every get_entry call, a file keytab
+ * handle uses an index of the file's entries by principal.  The index is
+ * built from a read-only mapping of the file the first time it is needed,
+ * and holds copies of the keys, so a lookup needs only an open() and fstat()
+ * of the file to check that the index is current.  Opening the file each time
+ * means that a cached index is used only by a caller which may still read the
+ * file, as with a sequential scan.  The index is rebuilt when the file's
+ * device, inode, size, or modification time changes, and released when the
+ * file is opened for writing through the handle.
+ *
+ * Modification times have limited granularity, so an index built in the same
+ * second as the file was last modified might miss a later change in that
+ * second.  Such an index is marked racy and is rebuilt on each use until the
+ * file is older than the index.
+ *
+ * Indexes are shared by all handles in the process, whichever krb5 context
+ * they belong to, through a cache of indexes keyed by file identity.  An
+ * index is never modified after it is built.  When a keytab file changes, the
+ * next lookup builds a new index and replaces the cached one; handles still
+ * using the old index keep it until they release their reference.  Racy
+ * indexes are not cached.
+ *
+ * If the file can't be indexed for any reason, get_entry reads it
+ * sequentially as before.
+ */
+
+struct ktindex_entry {
+    struct ktindex_entry *next;         /* Next entry for this principal */
+    krb5_timestamp timestamp;
+    krb5_kvno vno;
+    krb5_enctype enctype;
+    unsigned int keylen;
+    krb5_octet key[];
+};
+
+struct ktindex_princ {
+    struct ktindex_princ *next;         /* Next principal in the index */
+    krb5_principal princ;
+    struct k5buf hkey;                  /* Hash table key for princ */
+    struct ktindex_entry *entries;      /* Entries in file order */
+    struct ktindex_entry **tailp;
+};
+
+struct ktindex {
+    struct ktindex *next;               /* Next index in the cache */
+    char *name;                         /* File name, if cached */
+    unsigned int refcount;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+    krb5_boolean racy;
+    struct k5_hashtab *ht;
+    struct ktindex_princ *princs;
+};
+
+/* The cache list and index reference counts are protected by this lock. */
+static k5_mutex_t ktindex_cache_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct ktindex *ktindex_cache;
+
+static void
+free_index(struct ktindex *index)
 {
-    krb5_keytab_entry cur_entry, new_entry;
-    krb5_error_code kerror = 0;
-    int found_wrong_kvno = 0;
+    struct ktindex_princ *ip, *next_ip;
+    struct ktindex_entry *ie, *next_ie;
+
+    if (index == NULL)
+        return;
+    for (ip = index->princs; ip != NULL; ip = next_ip) {
+        next_ip = ip->next;
+        for (ie = ip->entries; ie != NULL; ie = next_ie) {
+            next_ie = ie->next;
+            zapfree(ie, sizeof(*ie) + ie->keylen);
+        }
+        krb5_free_principal(NULL, ip->princ);
+        k5_buf_free(&ip->hkey);
+        free(ip);
+    }
+    k5_hashtab_free(index->ht);
+    free(index->name);
+    free(index);
+}
+
+/* Release a reference to index, freeing it if it was the last one. */
+static void
+release_index(struct ktindex *index)
+{
+    krb5_boolean last;
+
+    if (index == NULL)
+        return;
+    k5_mutex_lock(&ktindex_cache_lock);
+    last = (--index->refcount == 0);
+    k5_mutex_unlock(&ktindex_cache_lock);
+    if (last)
+        free_index(index);
+}
+
+/* Return true if index is trustworthy and reflects the file described by
+ * st. */
+static krb5_boolean
+index_current(const struct ktindex *index, const struct stat *st)
+{
+    return index != NULL && !index->racy && index->dev == st->st_dev &&
+        index->ino == st->st_ino && index->size == st->st_size &&
+        index->mtime == st->st_mtime &&
+        index->mtime_nsec == k5_stat_mtime_nsec(st);
+}
+
+/* Return a new reference to a cached index reflecting the file described by
+ * st, or NULL if there is none. */
+static struct ktindex *
+cache_lookup(const struct stat *st)
+{
+    struct ktindex *index;
+
+    k5_mutex_lock(&ktindex_cache_lock);
+    for (index = ktindex_cache; index != NULL; index = index->next) {
+        if (index_current(index, st)) {
+            index->refcount++;
+            break;
+        }
+    }
+    k5_mutex_unlock(&ktindex_cache_lock);
+    return index;
+}
+
+/* Add index, built from the file name, to the cache.  Remove any cached
+ * indexes for the same file or from a file previously at the same name, so
+ * that the cache holds at most one index per file. */
+static void
+cache_store(const char *name, struct ktindex *index)
+{
+    struct ktindex **ixp, *ix, *stale = NULL;
+
+    index->name = strdup(name);
+    if (index->name == NULL)
+        return;
+    k5_mutex_lock(&ktindex_cache_lock);
+    ixp = &ktindex_cache;
+    while (*ixp != NULL) {
+        ix = *ixp;
+        if ((ix->dev == index->dev && ix->ino == index->ino) ||
+            strcmp(ix->name, name) == 0) {
+            *ixp = ix->next;
+            if (--ix->refcount == 0) {
+                ix->next = stale;
+                stale = ix;
+            }
+        } else {
+            ixp = &ix->next;
+        }
+    }
+    index->refcount++;
+    index->next = ktindex_cache;
+    ktindex_cache = index;
+    k5_mutex_unlock(&ktindex_cache_lock);
+
+    while (stale != NULL) {
+        ix = stale;
+        stale = ix->next;
+        free_index(ix);
+    }
+}
+
+int
+krb5int_ktfile_initialize(void)
+{
+    return k5_mutex_finish_init(&ktindex_cache_lock);
+}
+
+void
+krb5int_ktfile_finalize(void)
+{
+    struct ktindex *index, *next;
+
+    for (index = ktindex_cache; index != NULL; index = next) {
+        next = index->next;
+        if (--index->refcount == 0)
+            free_index(index);
+    }
+    ktindex_cache = NULL;
+    k5_mutex_destroy(&ktindex_cache_lock);
+}
+
+/* Marshal the realm and components of princ into buf, for use as a hash table
+ * key. */
+static void
+princ_hash_key(krb5_const_principal princ, struct k5buf *buf)
+{
+    int i;
+
+    k5_buf_add_uint32_be(buf, princ->realm.length);
+    k5_buf_add_len(buf, princ->realm.data, princ->realm.length);
+    for (i = 0; i < princ->length; i++) {
+        k5_buf_add_uint32_be(buf, princ->data[i].length);
+        k5_buf_add_len(buf, princ->data[i].data, princ->data[i].length);
+    }
+}
+
+/* Read a 16-bit or 32-bit integer in the byte order of keytab version vno. */
+static uint16_t
+get16(struct k5input *in, int vno)
+{
+    return (vno == KRB5_KT_VNO_1) ? k5_input_get_uint16_n(in) :
+        k5_input_get_uint16_be(in);
+}
+
+static uint32_t
+get32(struct k5input *in, int vno)
+{
+    return (vno == KRB5_KT_VNO_1) ? k5_input_get_uint32_n(in) :
+        k5_input_get_uint32_be(in);
+}
+
+/* Read a counted string for a principal realm or component into d. */
+static krb5_error_code
+get_princ_data(struct k5input *in, int vno, krb5_data *d)
+{
+    int16_t len = get16(in, vno);
+    const unsigned char *p;
+    krb5_error_code ret;
+
+    if (len <= 0)
+        return KRB5_KT_END;
+    p = k5_input_get_bytes(in, len);
+    if (p == NULL)
+        return KRB5_KT_END;
+    d->data = k5memdup0(p, len, &ret);
+    if (d->data == NULL)
+        return ret;
+    d->length = len;
+    return 0;
+}
+
+/*
+ * Parse a record body of length size from in, following the rules of
+ * krb5_ktfileint_internal_read_entry().  On success, set *princ_out to the
+ * record principal and *ie_out to an index entry for the rest.  Return
+ * KRB5_KT_END if the record is malformed.
+ */
+static krb5_error_code
+parse_record(struct k5input *in, int vno, int32_t size,
+             krb5_principal *princ_out, struct ktindex_entry **ie_out)
+{
+    krb5_error_code ret;
+    krb5_principal princ = NULL;
+    struct ktindex_entry *ie = NULL;
+    const unsigned char *key;
+    size_t start_len = in->len;
+    int16_t count, keylen;
+    krb5_timestamp timestamp;
+    krb5_kvno kvno;
+    krb5_enctype enctype;
+    uint32_t vno32;
+    int i;
+
+    *princ_out = NULL;
+    *ie_out = NULL;
+
+    count = get16(in, vno);
+    if (vno == KRB5_KT_VNO_1)
+        count -= 1;             /* V1 includes the realm in the count */
+    if (count <= 0 || in->status)
+        return KRB5_KT_END;
+
+    princ = k5alloc(sizeof(*princ), &ret);
+    if (princ == NULL)
+        return ret;
+    princ->magic = KV5M_PRINCIPAL;
+    princ->data = k5calloc(count, sizeof(*princ->data), &ret);
+    if (princ->data == NULL)
+        goto cleanup;
+    ret = get_princ_data(in, vno, &princ->realm);
+    if (ret)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        ret = get_princ_data(in, vno, &princ->data[i]);
+        if (ret)
+            goto cleanup;
+        princ->length++;
+    }
+    if (vno != KRB5_KT_VNO_1)
+        princ->type = (int32_t)get32(in, vno);
+
+    timestamp = get32(in, vno);
+    kvno = k5_input_get_byte(in);
+    enctype = (int16_t)get16(in, vno);
+    keylen = get16(in, vno);
+    key = (keylen > 0) ? k5_input_get_bytes(in, keylen) : NULL;
+    if (key == NULL || in->status) {
+        ret = KRB5_KT_END;
+        goto cleanup;
+    }
+
+    /* Check for a 32-bit kvno extension if four or more bytes remain. */
+    if ((start_len - in->len) + 4 <= (size_t)size) {
+        vno32 = get32(in, vno);
+        if (in->status) {
+            ret = KRB5_KT_END;
+            goto cleanup;
+        }
+        /* If the value is 0, the bytes are just zero-fill. */
+        if (vno32)
+            kvno = vno32;
+    }
+
+    ie = k5alloc(sizeof(*ie) + keylen, &ret);
+    if (ie == NULL)
+        goto cleanup;
+    ie->timestamp = timestamp;
+    ie->vno = kvno;
+    ie->enctype = enctype;
+    ie->keylen = keylen;
+    memcpy(ie->key, key, keylen);
+
+    *princ_out = princ;
+    *ie_out = ie;
+    princ = NULL;
+
+cleanup:
+    krb5_free_principal(NULL, princ);
+    return ret;
+}
+
+/* Add ie to index under princ, taking ownership of both. */
+static krb5_error_code
+index_add(struct ktindex *index, krb5_principal princ,
+          struct ktindex_entry *ie)
+{
+    krb5_error_code ret;
+    struct ktindex_princ *ip;
+    struct k5buf hkey;
+
+    k5_buf_init_dynamic(&hkey);
+    princ_hash_key(princ, &hkey);
+    ret = k5_buf_status(&hkey);
+    if (ret)
+        goto fail;
+
+    ip = k5_hashtab_get(index->ht, hkey.data, hkey.len);
+    if (ip != NULL) {
+        k5_buf_free(&hkey);
+        krb5_free_principal(NULL, princ);
+    } else {
+        ip = k5alloc(sizeof(*ip), &ret);
+        if (ip == NULL)
+            goto fail;
+        ip->princ = princ;
+        ip->hkey = hkey;
+        ip->tailp = &ip->entries;
+        ret = k5_hashtab_add(index->ht, ip->hkey.data, ip->hkey.len, ip);
+        if (ret) {
+            free(ip);
+            goto fail;
+        }
+        ip->next = index->princs;
+        index->princs = ip;
+    }
+    ie->next = NULL;
+    *ip->tailp = ie;
+    ip->tailp = &ie->next;
+    return 0;
+
+fail:
+    k5_buf_free(&hkey);
+    krb5_free_principal(NULL, princ);
+    zapfree(ie, sizeof(*ie) + ie->keylen);
+    return ret;
+}
+
+/* Index the keytab records in the len bytes at map. */
+static krb5_error_code
+parse_index(const unsigned char *map, size_t len, struct ktindex *index)
+{
+    krb5_error_code ret;
+    struct k5input in, rec;
+    krb5_principal princ;
+    struct ktindex_entry *ie;
+    int vno;
+    int32_t size;
+
+    k5_input_init(&in, map, len);
+    vno = k5_input_get_uint16_be(&in);
+    if (in.status || (vno != KRB5_KT_VNO && vno != KRB5_KT_VNO_1))
+        return KRB5_KEYTAB_BADVNO;
+
+    for (;;) {
+        /* Skip over holes left by removed entries. */
+        do {
+            size = get32(&in, vno);
+            if (in.status)
+                return 0;
+            if (size < 0) {
+                if (size == INT32_MIN)  /* INT32_MIN inverts to itself. */
+                    return KRB5_KT_FORMAT;
+                if (k5_input_get_bytes(&in, -size) == NULL)
+                    return 0;
+            }
+        } while (size < 0);
+        if (size == 0)
+            return 0;
+
+        /* As in sequential reading, a malformed record ends the keytab. */
+        rec = in;
+        ret = parse_record(&rec, vno, size, &princ, &ie);
+        if (ret)
+            return (ret == KRB5_KT_END) ? 0 : ret;
+        ret = index_add(index, princ, ie);
+        if (ret)
+            return ret;
+        if (k5_input_get_bytes(&in, size) == NULL)
+            return 0;
+    }
+}
+
+/* Build an index of the keytab file, which is open on fd and described by
+ * st. */
+static krb5_error_code
+build_index(krb5_context context, int fd, const struct stat *st,
+            struct ktindex **index_out)
+{
+    krb5_error_code ret;
+    struct ktindex *index;
+    uint8_t seed[K5_HASH_SEED_LEN];
+    krb5_data d = make_data(seed, sizeof(seed));
+    void *map;
+
+    *index_out = NULL;
+    if (st->st_size < 2 || (uintmax_t)st->st_size > SIZE_MAX)
+        return KRB5_KEYTAB_BADVNO;
+
+    index = k5alloc(sizeof(*index), &ret);
+    if (index == NULL)
+        return ret;
+    index->refcount = 1;
+    index->dev = st->st_dev;
+    index->ino = st->st_ino;
+    index->size = st->st_size;
+    index->mtime = st->st_mtime;
+    index->mtime_nsec = k5_stat_mtime_nsec(st);
+    index->racy = (st->st_mtime >= time(NULL));
+
+    ret = krb5_c_random_make_octets(context, &d);
+    if (ret)
+        goto cleanup;
+    ret = k5_hashtab_create(seed, 0, &index->ht);
+    if (ret)
+        goto cleanup;
+
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ret = errno;
+        goto cleanup;
+    }
+    ret = parse_index(map, st->st_size, index);
+    (void)munmap(map, st->st_size);
+    if (ret)
+        goto cleanup;
+
+    *index_out = index;
+    index = NULL;
+
+cleanup:
+    free_index(index);
+    return ret;
+}
+
+/* Make sure id has an index which reflects the current keytab file, using
+ * the cached index if there is a current one.  The file is always opened, so
+ * that a caller which can no longer read it does not get its keys from an
+ * index. */
+static krb5_error_code
+update_index(krb5_context context, krb5_keytab id)
+{
+    krb5_error_code ret;
+    struct stat st;
+    int fd;
+
+    KTCHECKLOCK(id);
+    fd = open(KTFILENAME(id), O_RDONLY);
+    if (fd == -1)
+        return errno;
+    set_cloexec_fd(fd);
+    if (fstat(fd, &st) != 0) {
+        ret = errno;
+        close(fd);
+        return ret;
+    }
+    if (index_current(KTINDEX(id), &st)) {
+        close(fd);
+        return 0;
+    }
+
+    release_index(KTINDEX(id));
+    KTINDEX(id) = cache_lookup(&st);
+    if (KTINDEX(id) != NULL) {
+        close(fd);
+        return 0;
+    }
+
+    ret = krb5_lock_file(context, fd, KRB5_LOCKMODE_SHARED);
+    if (ret) {
+        close(fd);
+        return ret;
+    }
+    /* The file may have been rewritten before we got the lock. */
+    if (fstat(fd, &st) == 0)
+        ret = build_index(context, fd, &st, &KTINDEX(id));
+    else
+        ret = errno;
+    (void)krb5_unlock_file(context, fd);
+    close(fd);
+    if (ret == 0 && !KTINDEX(id)->racy)
+        cache_store(KTFILENAME(id), KTINDEX(id));
+    return ret;
+}
+
+/* Look up principal in id's index, in the manner of scan_file(). */
+static krb5_error_code
+search_index(krb5_context context, krb5_keytab id,
+             krb5_const_principal principal, krb5_kvno kvno,
+             krb5_enctype enctype, krb5_keytab_entry *cur_entry,
+             int *found_wrong_kvno)
+{
+    krb5_error_code ret;
+    struct ktindex_princ *ip;
+    struct ktindex_entry *ie;
+    krb5_keytab_entry new_entry;
+    struct k5buf hkey;
+    char buf[256];
+
+    k5_buf_init_fixed(&hkey, buf, sizeof(buf));
+    princ_hash_key(principal, &hkey);
+    if (k5_buf_status(&hkey) != 0) {
+        k5_buf_init_dynamic(&hkey);
+        princ_hash_key(principal, &hkey);
+        ret = k5_buf_status(&hkey);
+        if (ret)
+            return ret;
+    }
+    ip = k5_hashtab_get(KTINDEX(id)->ht, hkey.data, hkey.len);
+    if (hkey.data != buf)
+        k5_buf_free(&hkey);
+    if (ip == NULL)
+        return KRB5_KT_END;
+
+    for (ie = ip->entries; ie != NULL; ie = ie->next) {
+        /* Check the enctype before making a copy of the entry. */
+        if (enctype != IGNORE_ENCTYPE && enctype != ie->enctype)
+            continue;
+        memset(&new_entry, 0, sizeof(new_entry));
+        new_entry.magic = KV5M_KEYTAB_ENTRY;
+        new_entry.timestamp = ie->timestamp;
+        new_entry.vno = ie->vno;
+        new_entry.key.magic = KV5M_KEYBLOCK;
+        new_entry.key.enctype = ie->enctype;
+        new_entry.key.length = ie->keylen;
+        new_entry.key.contents = k5memdup(ie->key, ie->keylen, &ret);
+        if (new_entry.key.contents == NULL)
+            return ret;
+        ret = krb5_copy_principal(context, ip->princ, &new_entry.principal);
+        if (ret) {
+            zapfree(new_entry.key.contents, new_entry.key.length);
+            return ret;
+        }
+        if (consider_entry(context, kvno, enctype, &new_entry, cur_entry,
+                           found_wrong_kvno))
+            return 0;
+    }
+    return KRB5_KT_END;
+}
+
+#else /* _WIN32 */
+
+struct ktindex;
+
+static void
+release_index(struct ktindex *index)
+{
+}
+
+int
+krb5int_ktfile_initialize(void)
+{
+    return 0;
+}
+
+void
+krb5int_ktfile_finalize(void)
+{
+}
+
+static krb5_error_code
+update_index(krb5_context context, krb5_keytab id)
+{
+    return ENOTSUP;
+}
+
+static krb5_error_code
+search_index(krb5_context context, krb5_keytab id,
+             krb5_const_principal principal, krb5_kvno kvno,
+             krb5_enctype enctype, krb5_keytab_entry *cur_entry,
+             int *found_wrong_kvno)
+{
+    return ENOTSUP;
+}
+
+#endif /* _WIN32 */
+
+/*
+ * Read the keytab file sequentially looking for the best match for
+ * principal, kvno, and enctype, placing it in *cur_entry.  Return
+ * KRB5_KT_END if the end of the file was reached, 0 if an exact kvno match
+ * was found, or another error.
+ */
+static krb5_error_code
+scan_file(krb5_context context, krb5_keytab id,
+          krb5_const_principal principal, krb5_kvno kvno,
+          krb5_enctype enctype, krb5_keytab_entry *cur_entry,
+          int *found_wrong_kvno)
+{
+    krb5_keytab_entry new_entry;
+    krb5_error_code kerror, kerror2;
     int was_open;
-    char *princname;
 
-    KTLOCK(id);
+    KTCHECKLOCK(id);
 
     if (KTFILEP(id) != NULL) {
         was_open = 1;
 
-        if (fseek(KTFILEP(id), KTSTARTOFF(id), SEEK_SET) == -1) {
-            KTUNLOCK(id);
+        if (fseek(KTFILEP(id), KTSTARTOFF(id), SEEK_SET) == -1)
             return errno;
-        }
     } else {
         was_open = 0;
 
         /* Open the keyfile for reading */
-        if ((kerror = krb5_ktfileint_openr(context, id))) {
-            KTUNLOCK(id);
+        if ((kerror = krb5_ktfileint_openr(context, id)))
             return(kerror);
-        }
     }
 
-    /*
-     * For efficiency and simplicity, we'll use a while true that
-     * is exited with a break statement.
-     */
-    cur_entry.principal = 0;
-    cur_entry.vno = 0;
-    cur_entry.key.contents = 0;
-
     while (TRUE) {
         if ((kerror = krb5_ktfileint_read_entry(context, id, &new_entry)))
             break;
 
-        /* by the time this loop exits, it must either free cur_entry,
-           and copy new_entry there, or free new_entry.  Otherwise, it
-           leaks. */
-
         /* if the principal isn't the one requested, free new_entry
            and continue to the next. */
 
@@ -335,47 +1009,46 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
             continue;
         }
 
-        /* If the enctype is not ignored and doesn't match, free new_entry and
-           continue to the next. */
-        if (enctype != IGNORE_ENCTYPE && enctype != new_entry.key.enctype) {
-            krb5_kt_free_entry(context, &new_entry);
-            continue;
-        }
+        if (consider_entry(context, kvno, enctype, &new_entry, cur_entry,
+                           found_wrong_kvno))
+            break;
+    }
 
-        if (kvno == IGNORE_VNO || new_entry.vno == IGNORE_VNO) {
-            /* If this entry is more recent (or the first match), free the
-             * current and keep the new.  Otherwise, free the new. */
-            if (cur_entry.principal == NULL ||
-                more_recent(&new_entry, &cur_entry)) {
-                krb5_kt_free_entry(context, &cur_entry);
-                cur_entry = new_entry;
-            } else {
-                krb5_kt_free_entry(context, &new_entry);
-            }
-        } else {
-            /*
-             * If this kvno matches exactly, free the current, keep the new,
-             * and break out.  If it matches the low 8 bits of the desired
-             * kvno, remember the first match (because the recorded kvno may
-             * have been truncated due to pre-1.14 keytab format or kadmin
-             * protocol limitations) but keep looking for an exact match.
-             * Otherwise, remember that we were here so we can return the right
-             * error, and free the new.
-             */
-            if (new_entry.vno == kvno) {
-                krb5_kt_free_entry(context, &cur_entry);
-                cur_entry = new_entry;
-                if (new_entry.vno == kvno)
-                    break;
-            } else if (new_entry.vno == (kvno & 0xff) &&
-                       cur_entry.principal == NULL) {
-                cur_entry = new_entry;
-            } else {
-                found_wrong_kvno++;
-                krb5_kt_free_entry(context, &new_entry);
-            }
-        }
+    if (was_open == 0) {
+        kerror2 = krb5_ktfileint_close(context, id);
+        if (kerror == 0 || (kerror == KRB5_KT_END && cur_entry->principal))
+            kerror = (kerror2 != 0) ? kerror2 : kerror;
+    }
+    return kerror;
+}
+
+/*
+ * This is the get_entry routine for the file based keytab implementation.
+ * It looks up the entry using the keytab's index if possible, or reads the
+ * keytab file otherwise, and either retrieves the entry or returns an error.
+ */
+
+static krb5_error_code KRB5_CALLCONV
+krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
+                      krb5_const_principal principal, krb5_kvno kvno,
+                      krb5_enctype enctype, krb5_keytab_entry *entry)
+{
+    krb5_keytab_entry cur_entry;
+    krb5_error_code kerror = 0;
+    int found_wrong_kvno = 0;
+    char *princname;
+
+    memset(&cur_entry, 0, sizeof(cur_entry));
+
+    KTLOCK(id);
+    if (update_index(context, id) == 0) {
+        kerror = search_index(context, id, principal, kvno, enctype,
+                              &cur_entry, &found_wrong_kvno);
+    } else {
+        kerror = scan_file(context, id, principal, kvno, enctype, &cur_entry,
+                           &found_wrong_kvno);
     }
+    KTUNLOCK(id);
 
     if (kerror == KRB5_KT_END) {
         if (cur_entry.principal)
@@ -392,18 +1065,9 @@ krb5_ktfile_get_entry(krb5_context context, krb5_keytab id,
         }
     }
     if (kerror) {
-        if (was_open == 0)
-            (void) krb5_ktfileint_close(context, id);
-        KTUNLOCK(id);
-        krb5_kt_free_entry(context, &cur_entry);
-        return kerror;
-    }
-    if (was_open == 0 && (kerror = krb5_ktfileint_close(context, id)) != 0) {
-        KTUNLOCK(id);
         krb5_kt_free_entry(context, &cur_entry);
         return kerror;
     }
-    KTUNLOCK(id);
     *entry = cur_entry;
     return 0;
 }
@@ -551,6 +1215,34 @@ krb5_ktfile_add(krb5_context context, krb5_keytab id, krb5_keytab_entry *entry)
     return retval;
 }
 
+/*
+ * krb5_ktfile_add_entries()
+ */
+
+static krb5_error_code KRB5_CALLCONV
+krb5_ktfile_add_entries(krb5_context context, krb5_keytab id,
+                        krb5_keytab_entry *entries, size_t count)
+{
+    krb5_error_code retval;
+
+    KTLOCK(id);
+    if (KTFILEP(id)) {
+        /* Iterator(s) active -- no changes.  */
+        KTUNLOCK(id);
+        k5_setmsg(context, KRB5_KT_IOERR,
+                  _("Cannot change keytab with keytab iterators active"));
+        return KRB5_KT_IOERR;   /* XXX */
+    }
+    if ((retval = krb5_ktfileint_openw(context, id))) {
+        KTUNLOCK(id);
+        return retval;
+    }
+    retval = krb5_ktfileint_write_entries(context, id, entries, count);
+    krb5_ktfileint_close(context, id);
+    KTUNLOCK(id);
+    return retval;
+}
+
 /*
  * krb5_ktfile_remove()
  */
@@ -631,7 +1323,8 @@ const struct _krb5_kt_ops krb5_ktf_ops = {
     krb5_ktfile_get_next,
     krb5_ktfile_end_get,
     krb5_ktfile_add,
-    krb5_ktfile_remove
+    krb5_ktfile_remove,
+    krb5_ktfile_add_entries
 };
 
 /*
@@ -651,7 +1344,8 @@ const struct _krb5_kt_ops krb5_ktf_writable_ops = {
     krb5_ktfile_get_next,
     krb5_ktfile_end_get,
     krb5_ktfile_add,
-    krb5_ktfile_remove
+    krb5_ktfile_remove,
+    krb5_ktfile_add_entries
 };
 
 /*
@@ -669,6 +1363,7 @@ const krb5_kt_ops krb5_kt_dfl_ops = {
     krb5_ktfile_get_next,
     krb5_ktfile_end_get,
     0,
+    0,
     0
 };
 
@@ -815,6 +1510,9 @@ krb5_ktfileint_openr(krb5_context context, krb5_keytab id)
 static krb5_error_code
 krb5_ktfileint_openw(krb5_context context, krb5_keytab id)
 {
+    /* The file may be about to change, so release the index. */
+    release_index(KTINDEX(id));
+    KTINDEX(id) = NULL;
     return krb5_ktfileint_open(context, id, KRB5_LOCKMODE_EXCLUSIVE);
 }
 
@@ -1122,35 +1820,22 @@ krb5_ktfileint_read_entry(krb5_context context, krb5_keytab id, krb5_keytab_entr
     return krb5_ktfileint_internal_read_entry(context, id, entryp, &delete_point);
 }
 
+/*
+ * Write the body of a keytab record for entry at the current file position.
+ * The caller is responsible for the record length and for flushing.
+ */
 static krb5_error_code
-krb5_ktfileint_write_entry(krb5_context context, krb5_keytab id, krb5_keytab_entry *entry)
+krb5_ktfileint_write_record(krb5_context context, krb5_keytab id,
+                            krb5_keytab_entry *entry)
 {
     krb5_octet vno;
     krb5_data *princ;
     krb5_int16 count, size, enctype;
-    krb5_error_code retval = 0;
     krb5_timestamp timestamp;
     krb5_int32  princ_type;
-    krb5_int32  size_needed;
-    krb5_int32  commit_point = -1;
     uint32_t    vno32;
     int         i;
 
-    KTCHECKLOCK(id);
-    retval = krb5_ktfileint_size_entry(context, entry, &size_needed);
-    if (retval)
-        return retval;
-    retval = krb5_ktfileint_find_slot(context, id, &size_needed, &commit_point);
-    if (retval)
-        return retval;
-
-    /* fseek to synchronise buffered I/O on the key table. */
-    /* XXX Without the weird setbuf crock, can we get rid of this now?  */
-    if (fseek(KTFILEP(id), 0L, SEEK_CUR) < 0)
-    {
-        return errno;
-    }
-
     if (KTVERSION(id) == KRB5_KT_VNO_1) {
         count = (krb5_int16)entry->principal->length + 1;
     } else {
@@ -1243,28 +1928,109 @@ krb5_ktfileint_write_entry(krb5_context context, krb5_keytab id, krb5_keytab_ent
     if (!fwrite(&vno32, sizeof(vno32), 1, KTFILEP(id)))
         goto abend;
 
-    if (fflush(KTFILEP(id)))
-        goto abend;
+    return 0;
+}
+
+/*
+ * Flush and sync the record data, then commit it by writing its length at
+ * commit_point.
+ */
+static krb5_error_code
+krb5_ktfileint_commit(krb5_context context, krb5_keytab id,
+                      krb5_int32 commit_point, krb5_int32 size)
+{
+    krb5_error_code retval;
 
+    if (fflush(KTFILEP(id)))
+        return KRB5_KT_IOERR;
     retval = k5_sync_disk_file(context, KTFILEP(id));
+    if (retval)
+        return retval;
+
+    if (fseek(KTFILEP(id), commit_point, SEEK_SET))
+        return errno;
+    if (KTVERSION(id) != KRB5_KT_VNO_1)
+        size = htonl(size);
+    if (!fwrite(&size, sizeof(size), 1, KTFILEP(id)))
+        return KRB5_KT_IOERR;
+    if (fflush(KTFILEP(id)))
+        return KRB5_KT_IOERR;
+    return k5_sync_disk_file(context, KTFILEP(id));
+}
 
-    if (retval) {
+static krb5_error_code
+krb5_ktfileint_write_entry(krb5_context context, krb5_keytab id, krb5_keytab_entry *entry)
+{
+    krb5_error_code retval = 0;
+    krb5_int32  size_needed;
+    krb5_int32  commit_point = -1;
+
+    KTCHECKLOCK(id);
+    retval = krb5_ktfileint_size_entry(context, entry, &size_needed);
+    if (retval)
+        return retval;
+    retval = krb5_ktfileint_find_slot(context, id, &size_needed, &commit_point);
+    if (retval)
         return retval;
-    }
 
-    if (fseek(KTFILEP(id), commit_point, SEEK_SET)) {
+    /* fseek to synchronise buffered I/O on the key table. */
+    /* XXX Without the weird setbuf crock, can we get rid of this now?  */
+    if (fseek(KTFILEP(id), 0L, SEEK_CUR) < 0)
+    {
         return errno;
     }
-    if (KTVERSION(id) != KRB5_KT_VNO_1)
-        size_needed = htonl(size_needed);
-    if (!fwrite(&size_needed, sizeof(size_needed), 1, KTFILEP(id))) {
-        goto abend;
+
+    retval = krb5_ktfileint_write_record(context, id, entry);
+    if (retval)
+        return retval;
+
+    return krb5_ktfileint_commit(context, id, commit_point, size_needed);
+}
+
+/*
+ * Append count entries to the end of the keytab as consecutive records,
+ * ignoring any holes left by deleted entries.  Only the length of the first
+ * record is written after the data is synced, so a partial write leaves the
+ * keytab unchanged.
+ */
+static krb5_error_code
+krb5_ktfileint_write_entries(krb5_context context, krb5_keytab id,
+                             krb5_keytab_entry *entries, size_t count)
+{
+    krb5_error_code retval;
+    krb5_int32 size, first_size = 0, commit_point;
+    size_t i;
+
+    KTCHECKLOCK(id);
+    retval = krb5_ktfileint_find_end(context, id, &commit_point);
+    if (retval)
+        return retval;
+    if (fseek(KTFILEP(id), 0L, SEEK_CUR) < 0)
+        return errno;
+
+    for (i = 0; i < count; i++) {
+        retval = krb5_ktfileint_size_entry(context, &entries[i], &size);
+        if (retval)
+            return retval;
+        if (i == 0) {
+            first_size = size;
+        } else {
+            if (KTVERSION(id) != KRB5_KT_VNO_1)
+                size = htonl(size);
+            if (!fwrite(&size, sizeof(size), 1, KTFILEP(id)))
+                return KRB5_KT_IOERR;
+        }
+        retval = krb5_ktfileint_write_record(context, id, &entries[i]);
+        if (retval)
+            return retval;
     }
-    if (fflush(KTFILEP(id)))
-        goto abend;
-    retval = k5_sync_disk_file(context, KTFILEP(id));
 
-    return retval;
+    /* Terminate the file with an empty record, as find_slot would. */
+    size = 0;
+    if (!fwrite(&size, sizeof(size), 1, KTFILEP(id)))
+        return KRB5_KT_IOERR;
+
+    return krb5_ktfileint_commit(context, id, commit_point, first_size);
 }
 
 /*
@@ -1379,4 +2145,51 @@ krb5_ktfileint_find_slot(krb5_context context, krb5_keytab id, krb5_int32 *size_
     *commit_point_ptr = commit_point;
     return 0;
 }
+
+/*
+ * Find the end of the records in the file and reserve it, without reusing
+ * holes.  The commit point is set as in krb5_ktfileint_find_slot(), and the
+ * file is left positioned just after it.
+ */
+static krb5_error_code
+krb5_ktfileint_find_end(krb5_context context, krb5_keytab id,
+                        krb5_int32 *commit_point_ptr)
+{
+    FILE *fp;
+    krb5_int32 size, commit_point;
+    krb5_kt_vno kt_vno;
+
+    KTCHECKLOCK(id);
+    fp = KTFILEP(id);
+    if (fseek(fp, 0, SEEK_SET))
+        return errno;
+    if (!fread(&kt_vno, sizeof(kt_vno), 1, fp))
+        return errno;
+
+    for (;;) {
+        commit_point = ftell(fp);
+        if (commit_point == -1)
+            return errno;
+        if (!fread(&size, sizeof(size), 1, fp)) {
+            /* Hit the end of file; reserve this slot with a zero length. */
+            if (fseek(fp, 0, SEEK_CUR))
+                return errno;
+            size = 0;
+            if (!fwrite(&size, sizeof(size), 1, fp))
+                return errno;
+            break;
+        }
+        if (size == 0)
+            break;
+        if (KTVERSION(id) != KRB5_KT_VNO_1)
+            size = ntohl(size);
+        if (size == INT32_MIN)
+            return KRB5_KT_FORMAT;
+        if (fseek(fp, (size > 0) ? size : -size, SEEK_CUR))
+            return errno;
+    }
+
+    *commit_point_ptr = commit_point;
+    return 0;
+}
 #endif /* LEAN_CLIENT */
@@ -631,7 +631,8 @@ const struct _krb5_kt_ops krb5_mkt_ops = {
     krb5_mkt_get_next,
     krb5_mkt_end_get,
     krb5_mkt_add,
-    krb5_mkt_remove
+    krb5_mkt_remove,
+    NULL
 };
 
 #endif /* LEAN_CLIENT */
@@ -36,4 +36,25 @@ krb5_kt_add_entry (krb5_context context, krb5_keytab id, krb5_keytab_entry *entr
     else
         return KRB5_KT_NOWRITE;
 }
+
+krb5_error_code
+k5_kt_add_entries(krb5_context context, krb5_keytab id,
+                  krb5_keytab_entry *entries, size_t count)
+{
+    krb5_error_code ret;
+    size_t i;
+
+    if (count == 0)
+        return 0;
+    if (id->ops->add_entries != NULL)
+        return id->ops->add_entries(context, id, entries, count);
+    if (id->ops->add == NULL)
+        return KRB5_KT_NOWRITE;
+    for (i = 0; i < count; i++) {
+        ret = id->ops->add(context, id, &entries[i]);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
 #endif /* LEAN_CLIENT */
@@ -32,6 +32,7 @@
 #include <unistd.h>
 #endif
 #include <string.h>
+#include <utime.h>
 
 
 int debug=0;
@@ -92,10 +93,10 @@ kt_test(krb5_context context, const char *name)
     const char *type;
     char buf[BUFSIZ];
     char *p;
-    krb5_keytab_entry kent, kent2;
-    krb5_principal princ;
+    krb5_keytab_entry kent, kent2, ents[3];
+    krb5_principal princ, princ2;
     krb5_kt_cursor cursor, cursor2;
-    int cnt;
+    int cnt, i;
     krb5_enctype e1 = ENCTYPE_AES128_CTS_HMAC_SHA256_128,
         e2 = ENCTYPE_AES256_CTS_HMAC_SHA384_192;
 
@@ -385,6 +386,53 @@ kt_test(krb5_context context, const char *name)
     }
     krb5_free_keytab_entry_contents(context, &kent);
 
+    /* =========================   k5_kt_add_entries ============== */
+    /* Add kvno 3 for both enctypes plus an entry for a second principal
+       in one call, and make sure all of them can be found. */
+    kret = krb5_parse_name(context, "test/test3@TEST.MIT.EDU", &princ2);
+    CHECK(kret, "parsing principal");
+
+    memset(ents, 0, sizeof(ents));
+    for (i = 0; i < 3; i++) {
+        ents[i].magic = KV5M_KEYTAB_ENTRY;
+        ents[i].principal = (i < 2) ? princ : princ2;
+        ents[i].vno = 3;
+        ents[i].key.magic = KV5M_KEYBLOCK;
+        ents[i].key.enctype = (i == 1) ? e2 : e1;
+        ents[i].key.length = 1;
+        ents[i].key.contents = (krb5_octet *) "3";
+    }
+    kret = k5_kt_add_entries(context, kt, ents, 3);
+    CHECK(kret, "Adding entries");
+
+    kret = krb5_kt_get_entry(context, kt, princ, 0, e2, &kent);
+    CHECK(kret, "looking up batch entry");
+    if (kent.vno != 3 || kent.key.contents[0] != '3') {
+        fprintf(stderr, "Batch entry check failed\n");
+        exit(1);
+    }
+    krb5_free_keytab_entry_contents(context, &kent);
+
+    kret = krb5_kt_get_entry(context, kt, princ2, 3, e1, &kent);
+    CHECK(kret, "looking up second batch principal");
+    krb5_free_keytab_entry_contents(context, &kent);
+
+    kret = krb5_kt_start_seq_get(context, kt, &cursor);
+    CHECK(kret, "Start sequence get");
+    cnt = 0;
+    while ((kret = krb5_kt_next_entry(context, kt, &kent, &cursor)) == 0) {
+        krb5_free_keytab_entry_contents(context, &kent);
+        cnt++;
+    }
+    CHECK_ERR(kret, KRB5_KT_END, "getting next entry");
+    kret = krb5_kt_end_seq_get(context, kt, &cursor);
+    CHECK(kret, "End sequence get");
+    if (cnt != 5) {
+        fprintf(stderr, "Mismatch in keytab count after batch add\n");
+        exit(1);
+    }
+
+    krb5_free_principal(context, princ2);
     krb5_free_principal(context, princ);
 
     /* =======================  Finally close =======================  */
@@ -394,6 +442,155 @@ kt_test(krb5_context context, const char *name)
 
 }
 
+/* Look up name and kvno in kt and check the resulting kvno, or the error if
+ * expected_vno is 0. */
+static void
+check_lookup(krb5_context context, krb5_keytab kt, const char *name,
+             krb5_kvno kvno, krb5_kvno expected_vno, krb5_error_code err)
+{
+    krb5_error_code kret;
+    krb5_principal princ;
+    krb5_keytab_entry kent;
+
+    kret = krb5_parse_name(context, name, &princ);
+    CHECK(kret, "parsing principal");
+    kret = krb5_kt_get_entry(context, kt, princ, kvno, 0, &kent);
+    CHECK_ERR(kret, err, "looking up indexed entry");
+    if (kret == 0) {
+        if (kent.vno != expected_vno ||
+            !krb5_principal_compare(context, princ, kent.principal) ||
+            kent.key.length != 1 || kent.key.contents[0] != kent.vno + '0') {
+            fprintf(stderr, "Indexed lookup of %s returned wrong entry\n",
+                    name);
+            exit(1);
+        }
+        krb5_free_keytab_entry_contents(context, &kent);
+    }
+    krb5_free_principal(context, princ);
+}
+
+/* File keytabs use a process-wide index for lookups; make sure lookups
+ * through one handle see changes made through another, including handles in
+ * other contexts. */
+static void
+test_file_index(krb5_context context)
+{
+    krb5_error_code kret;
+    krb5_context ctx2;
+    krb5_keytab kt1, kt2, kt3, ktnew;
+    krb5_keytab_entry kent;
+    struct utimbuf ut;
+    char *filename, *name, *newname, pname[64];
+    int i, vno;
+
+    printf("Testing file keytab index\n");
+    if (asprintf(&filename, "/tmp/ktindex.%ld", (long) getpid()) < 0 ||
+        asprintf(&name, "FILE:%s", filename) < 0 ||
+        asprintf(&newname, "%s.new", filename) < 0) {
+        perror("asprintf");
+        exit(1);
+    }
+    kret = krb5_kt_resolve(context, name, &kt1);
+    CHECK(kret, "resolve");
+    kret = krb5_kt_resolve(context, name, &kt2);
+    CHECK(kret, "resolve");
+
+    memset(&kent, 0, sizeof(kent));
+    kent.magic = KV5M_KEYTAB_ENTRY;
+    kent.key.magic = KV5M_KEYBLOCK;
+    kent.key.enctype = ENCTYPE_AES128_CTS_HMAC_SHA256_128;
+    kent.key.length = 1;
+    for (i = 0; i < 100; i++) {
+        snprintf(pname, sizeof(pname), "svc%d/host@TEST.MIT.EDU", i);
+        kret = krb5_parse_name(context, pname, &kent.principal);
+        CHECK(kret, "parsing principal");
+        for (vno = 1; vno <= 2; vno++) {
+            kent.vno = vno;
+            kent.key.contents = (krb5_octet *)(vno == 1 ? "1" : "2");
+            kret = krb5_kt_add_entry(context, kt1, &kent);
+            CHECK(kret, "adding entry");
+        }
+        krb5_free_principal(context, kent.principal);
+    }
+
+    /* Backdate the file so that the index built from it is trusted. */
+    ut.actime = ut.modtime = time(NULL) - 60;
+    if (utime(filename, &ut) != 0) {
+        perror("utime");
+        exit(1);
+    }
+    check_lookup(context, kt2, "svc50/host@TEST.MIT.EDU", 0, 2, 0);
+    check_lookup(context, kt2, "svc99/host@TEST.MIT.EDU", 1, 1, 0);
+    check_lookup(context, kt2, "svc0/host@TEST.MIT.EDU", 3, 0,
+                 KRB5_KT_KVNONOTFOUND);
+    check_lookup(context, kt2, "svc100/host@TEST.MIT.EDU", 0, 0,
+                 KRB5_KT_NOTFOUND);
+    check_lookup(context, kt2, "svc50/host@TEST.MIT.EDU", 0, 2, 0);
+
+    /* Look up through a handle in another context. */
+    kret = krb5_init_context(&ctx2);
+    CHECK(kret, "init_context");
+    kret = krb5_kt_resolve(ctx2, name, &kt3);
+    CHECK(kret, "resolve");
+    check_lookup(ctx2, kt3, "svc50/host@TEST.MIT.EDU", 0, 2, 0);
+    check_lookup(ctx2, kt3, "svc7/host@TEST.MIT.EDU", 1, 1, 0);
+
+    /* Remove an entry in place through the other handle. */
+    kret = krb5_parse_name(context, "svc50/host@TEST.MIT.EDU",
+                           &kent.principal);
+    CHECK(kret, "parsing principal");
+    kent.vno = 2;
+    kret = krb5_kt_remove_entry(context, kt1, &kent);
+    CHECK(kret, "removing entry");
+    check_lookup(context, kt2, "svc50/host@TEST.MIT.EDU", 0, 1, 0);
+
+    /* Add an entry in the same second as the last change. */
+    kent.vno = 3;
+    kent.key.contents = (krb5_octet *)"3";
+    kret = krb5_kt_add_entry(context, kt1, &kent);
+    CHECK(kret, "adding entry");
+    krb5_free_principal(context, kent.principal);
+    check_lookup(context, kt2, "svc50/host@TEST.MIT.EDU", 0, 3, 0);
+    check_lookup(context, kt1, "svc50/host@TEST.MIT.EDU", 2, 0,
+                 KRB5_KT_KVNONOTFOUND);
+    check_lookup(ctx2, kt3, "svc50/host@TEST.MIT.EDU", 0, 3, 0);
+
+    /* Replace the file with a new one containing a single entry. */
+    kret = krb5_kt_resolve(context, newname, &ktnew);
+    CHECK(kret, "resolve");
+    kret = krb5_parse_name(context, "svc0/host@TEST.MIT.EDU",
+                           &kent.principal);
+    CHECK(kret, "parsing principal");
+    kent.vno = 4;
+    kent.key.contents = (krb5_octet *)"4";
+    kret = krb5_kt_add_entry(context, ktnew, &kent);
+    CHECK(kret, "adding entry");
+    krb5_free_principal(context, kent.principal);
+    kret = krb5_kt_close(context, ktnew);
+    CHECK(kret, "close");
+    if (utime(newname, &ut) != 0 || rename(newname, filename) != 0) {
+        perror("replacing keytab");
+        exit(1);
+    }
+    check_lookup(ctx2, kt3, "svc0/host@TEST.MIT.EDU", 0, 4, 0);
+    check_lookup(context, kt2, "svc50/host@TEST.MIT.EDU", 0, 0,
+                 KRB5_KT_NOTFOUND);
+    check_lookup(context, kt1, "svc0/host@TEST.MIT.EDU", 4, 4, 0);
+
+    kret = krb5_kt_close(context, kt1);
+    CHECK(kret, "close");
+    kret = krb5_kt_close(context, kt2);
+    CHECK(kret, "close");
+    kret = krb5_kt_close(ctx2, kt3);
+    CHECK(kret, "close");
+    krb5_free_context(ctx2);
+    unlink(filename);
+    free(filename);
+    free(name);
+    free(newname);
+    printf("File keytab index test passed\n");
+}
+
 static void
 do_test(krb5_context context, const char *prefix, krb5_boolean delete)
 {
@@ -438,6 +635,7 @@ main(void)
     test_misc(context);
     do_test(context, "WRFILE:", FALSE);
     do_test(context, "MEMORY:", TRUE);
+    test_file_index(context);
 
     krb5_free_context(context);
     return 0;
@@ -132,7 +132,8 @@ k5_privsafe_check_replay(krb5_context context, krb5_auth_context authcon,
     }
 
     if (authcon->memrcache == NULL) {
-        ret = k5_memrcache_create(context, &authcon->memrcache);
+        ret = k5_memrcache_create(context, 0, K5_MEMRCACHE_REJECT,
+                                  &authcon->memrcache);
         if (ret)
             return ret;
     }
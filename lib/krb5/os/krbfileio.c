@@ -97,3 +97,17 @@ k5_sync_disk_file(krb5_context context, FILE *fp)
 
     return 0;
 }
+
+long
+k5_stat_mtime_nsec(const struct stat *st)
+{
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+    return st->st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+    return st->st_mtimespec.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMENSEC)
+    return st->st_mtimensec;
+#else
+    return 0;
+#endif
+}
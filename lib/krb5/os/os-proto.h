@@ -204,6 +204,11 @@ krb5_error_code k5_expand_path_tokens_extra(krb5_context context,
 
 krb5_error_code k5_create_secure_file(krb5_context, const char * pathname);
 krb5_error_code k5_sync_disk_file(krb5_context, FILE *fp);
+
+/* Return the nanoseconds part of st's modification time, or 0 if the
+ * platform does not provide it. */
+long k5_stat_mtime_nsec(const struct stat *st);
+
 krb5_error_code k5_os_init_context(krb5_context context, profile_t profile,
                                    krb5_flags flags);
 void k5_os_free_context(krb5_context);
@@ -224,6 +229,9 @@ void k5_init_trace(krb5_context context);
 #include "k5-thread.h"
 extern k5_mutex_t krb5int_us_time_mutex;
 
+int k5_sendto_kdc_initialize(void);
+void k5_sendto_kdc_finalize(void);
+
 extern unsigned int krb5_max_skdc_timeout;
 extern unsigned int krb5_skdc_timeout_shift;
 extern unsigned int krb5_skdc_timeout_1;
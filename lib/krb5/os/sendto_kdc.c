@@ -63,6 +63,10 @@
 #include <poll.h>
 #define USE_POLL
 #define MAX_POLLFDS 1024
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
 #elif defined(HAVE_SYS_SELECT_H)
 #include <sys/select.h>
 #endif
@@ -96,6 +100,7 @@ struct select_state {
     fd_set rfds, wfds, xfds;
 #endif
     int nfds;
+    int epfd;                   /* epoll set mirroring the fds, or -1 */
 };
 
 /* connection states */
@@ -135,7 +140,11 @@ struct conn_state {
     size_t server_index;
     struct conn_state *next;
     time_ms endtime;
+    time_ms sendtime;           /* 0 if we have not contacted this address */
     krb5_boolean defer;
+    krb5_boolean rejected;      /* true if msg_handler rejected a reply */
+    krb5_boolean pool;          /* true if the connection may be pooled */
+    krb5_boolean reused;        /* true if the connection came from the pool */
     struct {
         const char *uri_path;
         const char *servername;
@@ -195,6 +204,326 @@ free_http_tls_data(krb5_context context, struct conn_state *state)
     state->http.https_request = NULL;
 }
 
+/*
+ * KDC health tracking.  We remember, process-wide, the smoothed round-trip
+ * time and the number of consecutive failures observed for each server we
+ * contact, and use them to decide the order in which servers are tried.
+ * Servers which have failed are demoted to the end of the order for a period
+ * which grows with each consecutive failure, so that a dead KDC does not cost
+ * every request a timeout.
+ */
+
+#define HEALTH_SLOTS            64
+#define HEALTH_FAILURE_WAIT  1000 /* ms without a reply counted as a failure */
+#define HEALTH_DEMOTE_BASE  10000 /* ms demotion after the first failure */
+#define HEALTH_DEMOTE_MAX  600000 /* ms maximum demotion */
+
+struct server_health {
+    k5_transport transport;
+    int port;
+    char *hostname;             /* NULL if addr is used */
+    size_t addrlen;
+    struct sockaddr_storage addr;
+    time_ms srtt;               /* -1 if we have never had a reply */
+    unsigned int failures;      /* consecutive failures */
+    time_ms demoted_until;
+    time_ms last_used;          /* 0 if this slot is unused */
+};
+
+static k5_mutex_t health_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct server_health health_table[HEALTH_SLOTS];
+
+/*
+ * Idle TCP connections kept for reuse when kdc_connection_reuse is set, shared
+ * by all contexts in the process.  Connections are keyed by realm and address,
+ * and are discarded after kdc_idle_timeout seconds or when found to be closed
+ * by the server.  HTTPS connections are never pooled, as their TLS state
+ * belongs to the context which loaded the TLS module and was made with that
+ * context's TLS configuration.
+ */
+
+#define MAX_POOLED_CONNS           32
+#define DEFAULT_KDC_IDLE_TIMEOUT   30 /* seconds */
+
+struct pooled_conn {
+    struct pooled_conn *next;
+    krb5_data realm;
+    struct remote_address addr;
+    SOCKET fd;
+    long pid;                   /* process which made the connection */
+    time_ms expires;
+};
+
+static k5_mutex_t pool_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct pooled_conn *conn_pool; /* most recently used first */
+static size_t conn_pool_len;
+
+/* Release pc along with its connection, if it still has one. */
+static void
+free_pooled_conn(struct pooled_conn *pc)
+{
+    if (pc->fd != INVALID_SOCKET)
+        closesocket(pc->fd);
+    free(pc->realm.data);
+    free(pc);
+}
+
+int
+k5_sendto_kdc_initialize(void)
+{
+    int err;
+
+    err = k5_mutex_finish_init(&health_lock);
+    if (err)
+        return err;
+    return k5_mutex_finish_init(&pool_lock);
+}
+
+void
+k5_sendto_kdc_finalize(void)
+{
+    struct pooled_conn *pc, *next;
+    size_t i;
+
+    for (i = 0; i < HEALTH_SLOTS; i++)
+        free(health_table[i].hostname);
+    memset(health_table, 0, sizeof(health_table));
+    k5_mutex_destroy(&health_lock);
+
+    for (pc = conn_pool; pc != NULL; pc = next) {
+        next = pc->next;
+        free_pooled_conn(pc);
+    }
+    conn_pool = NULL;
+    conn_pool_len = 0;
+    k5_mutex_destroy(&pool_lock);
+}
+
+static krb5_boolean
+health_matches(const struct server_health *h, const struct server_entry *ent)
+{
+    if (h->last_used == 0 || h->transport != ent->transport)
+        return FALSE;
+    if (ent->hostname != NULL) {
+        return h->hostname != NULL && h->port == ent->port &&
+            strcmp(h->hostname, ent->hostname) == 0;
+    }
+    return h->hostname == NULL && h->addrlen == ent->addrlen &&
+        memcmp(&h->addr, &ent->addr, ent->addrlen) == 0;
+}
+
+/* Return the health table entry for ent, or NULL if there is none.  If create
+ * is true, replace the least recently used entry if necessary.  The caller
+ * must hold health_lock. */
+static struct server_health *
+find_health(const struct server_entry *ent, krb5_boolean create)
+{
+    struct server_health *h, *oldest = &health_table[0];
+    char *hostname = NULL;
+    size_t i;
+
+    for (i = 0; i < HEALTH_SLOTS; i++) {
+        h = &health_table[i];
+        if (health_matches(h, ent))
+            return h;
+        if (h->last_used < oldest->last_used)
+            oldest = h;
+    }
+    if (!create)
+        return NULL;
+
+    if (ent->hostname != NULL) {
+        hostname = strdup(ent->hostname);
+        if (hostname == NULL)
+            return NULL;
+    }
+    h = oldest;
+    free(h->hostname);
+    memset(h, 0, sizeof(*h));
+    h->transport = ent->transport;
+    h->port = ent->port;
+    h->hostname = hostname;
+    if (hostname == NULL) {
+        h->addrlen = ent->addrlen;
+        memcpy(&h->addr, &ent->addr, ent->addrlen);
+    }
+    h->srtt = -1;
+    return h;
+}
+
+/* Record a reply from ent after rtt milliseconds. */
+static void
+health_success(const struct server_entry *ent, time_ms now, time_ms rtt)
+{
+    struct server_health *h = find_health(ent, TRUE);
+
+    if (h == NULL)
+        return;
+    h->srtt = (h->srtt < 0) ? rtt : h->srtt + (rtt - h->srtt) / 8;
+    h->failures = 0;
+    h->demoted_until = 0;
+    h->last_used = now;
+}
+
+/* Record a failure to get a usable reply from ent, and demote it. */
+static void
+health_failure(const struct server_entry *ent, time_ms now)
+{
+    struct server_health *h = find_health(ent, TRUE);
+    time_ms delay = HEALTH_DEMOTE_BASE;
+    unsigned int i;
+
+    if (h == NULL)
+        return;
+    if (h->failures < UINT_MAX)
+        h->failures++;
+    for (i = 1; i < h->failures && delay < HEALTH_DEMOTE_MAX; i++)
+        delay *= 2;
+    h->demoted_until = now + ((delay < HEALTH_DEMOTE_MAX) ? delay :
+                              HEALTH_DEMOTE_MAX);
+    h->last_used = now;
+}
+
+struct server_rank {
+    size_t index;
+    time_ms srtt;
+    unsigned int failures;
+    time_ms demoted_until;      /* 0 if not currently demoted */
+    int rtt_class;
+};
+
+/* Return true if a should be tried before b.  Servers with a known round-trip
+ * time come first, grouped by powers of two so that servers with similar
+ * latencies keep their configured order; then servers we know nothing about;
+ * then demoted servers, soonest to be reinstated first. */
+static krb5_boolean
+rank_before(const struct server_rank *a, const struct server_rank *b)
+{
+    if (a->demoted_until != 0 || b->demoted_until != 0) {
+        if (b->demoted_until == 0)
+            return FALSE;
+        return a->demoted_until == 0 || a->demoted_until < b->demoted_until;
+    }
+    return a->rtt_class < b->rtt_class;
+}
+
+/* Fill in order with the indices of servers in the order they should be
+ * contacted, according to the health table. */
+static void
+rank_servers(krb5_context context, const struct serverlist *servers,
+             size_t *order)
+{
+    struct server_rank *ranks, tmp;
+    struct server_health *h;
+    struct server_entry *ent;
+    time_ms now, v;
+    krb5_boolean known = FALSE;
+    char rttbuf[32];
+    size_t i, j;
+
+    for (i = 0; i < servers->nservers; i++)
+        order[i] = i;
+    if (servers->nservers < 2 || get_curtime_ms(&now) != 0)
+        return;
+    ranks = calloc(servers->nservers, sizeof(*ranks));
+    if (ranks == NULL)
+        return;
+
+    k5_mutex_lock(&health_lock);
+    for (i = 0; i < servers->nservers; i++) {
+        ranks[i].index = i;
+        ranks[i].srtt = -1;
+        ranks[i].rtt_class = INT_MAX;
+        h = find_health(&servers->servers[i], FALSE);
+        if (h == NULL)
+            continue;
+        known = TRUE;
+        ranks[i].srtt = h->srtt;
+        ranks[i].failures = h->failures;
+        if (h->demoted_until > now)
+            ranks[i].demoted_until = h->demoted_until;
+        if (h->srtt >= 0) {
+            for (ranks[i].rtt_class = 0, v = h->srtt + 1; v > 1; v >>= 1)
+                ranks[i].rtt_class++;
+        }
+    }
+    k5_mutex_unlock(&health_lock);
+
+    if (!known) {
+        free(ranks);
+        return;
+    }
+
+    /* Insertion sort, which is stable and fine for short server lists. */
+    for (i = 1; i < servers->nservers; i++) {
+        tmp = ranks[i];
+        for (j = i; j > 0 && rank_before(&tmp, &ranks[j - 1]); j--)
+            ranks[j] = ranks[j - 1];
+        ranks[j] = tmp;
+    }
+
+    for (i = 0; i < servers->nservers; i++) {
+        order[i] = ranks[i].index;
+        ent = &servers->servers[order[i]];
+        if (ranks[i].srtt >= 0)
+            snprintf(rttbuf, sizeof(rttbuf), "%ldms", (long)ranks[i].srtt);
+        else
+            strlcpy(rttbuf, "unknown", sizeof(rttbuf));
+        if (ent->hostname != NULL) {
+            TRACE_SENDTO_KDC_RANK_HOST(context, (int)i + 1, ent->hostname,
+                                       ent->port, rttbuf, ranks[i].failures,
+                                       ranks[i].demoted_until != 0);
+        } else {
+            struct remote_address ra;
+
+            ra.transport = ent->transport;
+            ra.family = ent->family;
+            ra.len = ent->addrlen;
+            memcpy(&ra.saddr, &ent->addr, ent->addrlen);
+            TRACE_SENDTO_KDC_RANK_ADDR(context, (int)i + 1, &ra, rttbuf,
+                                       ranks[i].failures,
+                                       ranks[i].demoted_until != 0);
+        }
+    }
+    free(ranks);
+}
+
+/* Update the health table with the outcome of an exchange.  The server which
+ * sent the winning reply succeeded; any other server we contacted failed if
+ * none of its connections is still usable after HEALTH_FAILURE_WAIT. */
+static void
+record_health(const struct serverlist *servers, struct conn_state *conns,
+              struct conn_state *winner)
+{
+    struct conn_state *state;
+    krb5_boolean contacted, pending;
+    time_ms now;
+    size_t s;
+
+    if (get_curtime_ms(&now) != 0)
+        return;
+
+    k5_mutex_lock(&health_lock);
+    for (s = 0; s < servers->nservers; s++) {
+        if (winner != NULL && winner->server_index == s) {
+            health_success(&servers->servers[s], now, now - winner->sendtime);
+            continue;
+        }
+        contacted = pending = FALSE;
+        for (state = conns; state != NULL; state = state->next) {
+            if (state->server_index != s || state->sendtime == 0)
+                continue;
+            contacted = TRUE;
+            if (state->state != FAILED && !state->rejected &&
+                now - state->sendtime < HEALTH_FAILURE_WAIT)
+                pending = TRUE;
+        }
+        if (contacted && !pending)
+            health_failure(&servers->servers[s], now);
+    }
+    k5_mutex_unlock(&health_lock);
+}
+
 #ifdef USE_POLL
 
 /* Find a pollfd in selstate by fd, or abort if we can't find it. */
@@ -210,10 +539,35 @@ find_pollfd(struct select_state *selstate, int fd)
     abort();
 }
 
+#ifdef USE_EPOLL
+
+/* Apply op to fd in the epoll set of selstate, if it has one, with the
+ * interest given by the poll events mask events.  Return false on failure. */
+static krb5_boolean
+cm_sync_epoll(struct select_state *selstate, int op, int fd, short events)
+{
+    struct epoll_event ev;
+
+    if (selstate->epfd == -1)
+        return TRUE;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((events & POLLIN) ? EPOLLIN : 0) |
+        ((events & POLLOUT) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    return epoll_ctl(selstate->epfd, op, fd, &ev) == 0;
+}
+
+#else /* not USE_EPOLL */
+
+#define cm_sync_epoll(selstate, op, fd, events) TRUE
+
+#endif /* not USE_EPOLL */
+
 static void
 cm_init_selstate(struct select_state *selstate)
 {
     selstate->nfds = 0;
+    selstate->epfd = -1;
 }
 
 static krb5_boolean
@@ -221,6 +575,8 @@ cm_add_fd(struct select_state *selstate, int fd)
 {
     if (selstate->nfds >= MAX_POLLFDS)
         return FALSE;
+    if (!cm_sync_epoll(selstate, EPOLL_CTL_ADD, fd, 0))
+        return FALSE;
     selstate->fds[selstate->nfds].fd = fd;
     selstate->fds[selstate->nfds].events = 0;
     selstate->nfds++;
@@ -232,6 +588,7 @@ cm_remove_fd(struct select_state *selstate, int fd)
 {
     struct pollfd *pfd = find_pollfd(selstate, fd);
 
+    (void)cm_sync_epoll(selstate, EPOLL_CTL_DEL, fd, 0);
     *pfd = selstate->fds[selstate->nfds - 1];
     selstate->nfds--;
 }
@@ -241,6 +598,7 @@ static void
 cm_read(struct select_state *selstate, int fd)
 {
     find_pollfd(selstate, fd)->events = POLLIN;
+    (void)cm_sync_epoll(selstate, EPOLL_CTL_MOD, fd, POLLIN);
 }
 
 /* Poll for writing (and not reading) on fd the next time we poll. */
@@ -248,6 +606,7 @@ static void
 cm_write(struct select_state *selstate, int fd)
 {
     find_pollfd(selstate, fd)->events = POLLOUT;
+    (void)cm_sync_epoll(selstate, EPOLL_CTL_MOD, fd, POLLOUT);
 }
 
 /* Get the output events for fd in the form of ssflags. */
@@ -276,6 +635,7 @@ static void
 cm_init_selstate(struct select_state *selstate)
 {
     selstate->nfds = 0;
+    selstate->epfd = -1;
     selstate->max = 0;
     FD_ZERO(&selstate->rfds);
     FD_ZERO(&selstate->wfds);
@@ -369,6 +729,27 @@ cm_select_or_poll(const struct select_state *in, time_ms endtime,
     return (*sret < 0) ? SOCKET_ERRNO : 0;
 }
 
+/* Check which fds in the selstate in are ready, without waiting. */
+static krb5_error_code
+cm_check_ready(const struct select_state *in, struct select_state *out,
+               int *sret)
+{
+#ifndef USE_POLL
+    struct timeval tv;
+#endif
+
+    *out = *in;
+#ifdef USE_POLL
+    *sret = poll(out->fds, out->nfds, 0);
+#else
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    *sret = select(out->max, &out->rfds, &out->wfds, &out->xfds, &tv);
+#endif
+
+    return (*sret < 0) ? SOCKET_ERRNO : 0;
+}
+
 static int
 socktype_for_transport(k5_transport transport)
 {
@@ -434,16 +815,104 @@ krb5_set_kdc_recv_hook(krb5_context context, krb5_post_recv_fn recv_hook,
  * when finished.
  */
 
+/* Choose the transport strategy for sending message to a KDC. */
+static krb5_error_code
+get_strategy(krb5_context context, const krb5_data *message, int no_udp,
+             k5_transport_strategy *strategy_out)
+{
+    krb5_error_code retval;
+
+    if (!no_udp && context->udp_pref_limit < 0) {
+        int tmp;
+        retval = profile_get_integer(context->profile,
+                                     KRB5_CONF_LIBDEFAULTS, KRB5_CONF_UDP_PREFERENCE_LIMIT, 0,
+                                     DEFAULT_UDP_PREF_LIMIT, &tmp);
+        if (retval)
+            return retval;
+        if (tmp < 0)
+            tmp = DEFAULT_UDP_PREF_LIMIT;
+        else if (tmp > HARD_UDP_LIMIT)
+            /* In the unlikely case that a *really* big value is
+               given, let 'em use as big as we think we can
+               support.  */
+            tmp = HARD_UDP_LIMIT;
+        context->udp_pref_limit = tmp;
+    }
+
+    if (no_udp)
+        *strategy_out = NO_UDP;
+    else if (message->length <= (unsigned int) context->udp_pref_limit)
+        *strategy_out = UDP_FIRST;
+    else
+        *strategy_out = UDP_LAST;
+    return 0;
+}
+
+/*
+ * Translate the result retval of sending message to the KDCs for realm (with
+ * err set by check_for_svc_unavailable()), and run the KDC receive hook if
+ * one is set.  On success, *reply holds the reply to return to the caller.
+ * Set *hook_replied if the hook synthesized a reply in place of an error.
+ */
+static krb5_error_code
+finish_kdc_reply(krb5_context context, krb5_error_code retval,
+                 krb5_error_code err, const krb5_data *realm,
+                 const krb5_data *message, krb5_data *reply,
+                 krb5_boolean *hook_replied)
+{
+    krb5_error_code oldret;
+    krb5_data *hook_reply = NULL;
+
+    *hook_replied = FALSE;
+
+    if (retval == KRB5_KDC_UNREACH) {
+        if (err == KDC_ERR_SVC_UNAVAILABLE) {
+            retval = KRB5KDC_ERR_SVC_UNAVAILABLE;
+        } else {
+            k5_setmsg(context, retval,
+                      _("Cannot contact any KDC for realm '%.*s'"),
+                      realm->length, realm->data);
+        }
+    }
+
+    if (context->kdc_recv_hook != NULL) {
+        oldret = retval;
+        retval = context->kdc_recv_hook(context, context->kdc_recv_hook_data,
+                                        retval, realm, message, reply,
+                                        &hook_reply);
+        if (oldret && !retval) {
+            /*
+             * The hook must set a reply if it overrides an error from
+             * k5_sendto().
+             */
+            assert(hook_reply != NULL);
+            *hook_replied = TRUE;
+        }
+    }
+    if (retval) {
+        krb5_free_data(context, hook_reply);
+        return retval;
+    }
+
+    if (hook_reply != NULL) {
+        krb5_free_data_contents(context, reply);
+        *reply = *hook_reply;
+        free(hook_reply);
+    }
+    return 0;
+}
+
 krb5_error_code
 krb5_sendto_kdc(krb5_context context, const krb5_data *message,
                 const krb5_data *realm, krb5_data *reply_out, int *use_primary,
                 int no_udp)
 {
-    krb5_error_code retval, oldret, err;
+    krb5_error_code retval, err;
     struct serverlist servers;
     int server_used;
     k5_transport_strategy strategy;
     krb5_data reply = empty_data(), *hook_message = NULL, *hook_reply = NULL;
+    krb5_boolean hook_replied;
 
     *reply_out = empty_data();
 
@@ -462,29 +931,9 @@ krb5_sendto_kdc(krb5_context context, const krb5_data *message,
 
     TRACE_SENDTO_KDC(context, message->length, realm, *use_primary, no_udp);
 
-    if (!no_udp && context->udp_pref_limit < 0) {
-        int tmp;
-        retval = profile_get_integer(context->profile,
-                                     KRB5_CONF_LIBDEFAULTS, KRB5_CONF_UDP_PREFERENCE_LIMIT, 0,
-                                     DEFAULT_UDP_PREF_LIMIT, &tmp);
-        if (retval)
-            return retval;
-        if (tmp < 0)
-            tmp = DEFAULT_UDP_PREF_LIMIT;
-        else if (tmp > HARD_UDP_LIMIT)
-            /* In the unlikely case that a *really* big value is
-               given, let 'em use as big as we think we can
-               support.  */
-            tmp = HARD_UDP_LIMIT;
-        context->udp_pref_limit = tmp;
-    }
-
-    if (no_udp)
-        strategy = NO_UDP;
-    else if (message->length <= (unsigned int) context->udp_pref_limit)
-        strategy = UDP_FIRST;
-    else
-        strategy = UDP_LAST;
+    retval = get_strategy(context, message, no_udp, &strategy);
+    if (retval)
+        return retval;
 
     retval = k5_locate_kdc(context, realm, &servers, *use_primary, no_udp);
     if (retval)
@@ -511,41 +960,17 @@ krb5_sendto_kdc(krb5_context context, const krb5_data *message,
     retval = k5_sendto(context, message, realm, &servers, strategy, NULL,
                        &reply, NULL, NULL, &server_used,
                        check_for_svc_unavailable, &err);
-    if (retval == KRB5_KDC_UNREACH) {
-        if (err == KDC_ERR_SVC_UNAVAILABLE) {
-            retval = KRB5KDC_ERR_SVC_UNAVAILABLE;
-        } else {
-            k5_setmsg(context, retval,
-                      _("Cannot contact any KDC for realm '%.*s'"),
-                      realm->length, realm->data);
-        }
-    }
-
-    if (context->kdc_recv_hook != NULL) {
-        oldret = retval;
-        retval = context->kdc_recv_hook(context, context->kdc_recv_hook_data,
-                                        retval, realm, message, &reply,
-                                        &hook_reply);
-        if (oldret && !retval) {
-            /*
-             * The hook must set a reply if it overrides an error from
-             * k5_sendto().  Treat this reply as coming from the primary
-             * KDC.
-             */
-            assert(hook_reply != NULL);
-            *use_primary = 1;
-        }
-    }
+    retval = finish_kdc_reply(context, retval, err, realm, message, &reply,
+                              &hook_replied);
+    /* Treat a reply synthesized in place of an error as coming from the
+     * primary KDC. */
+    if (hook_replied)
+        *use_primary = 1;
     if (retval)
         goto cleanup;
 
-    if (hook_reply != NULL) {
-        *reply_out = *hook_reply;
-        free(hook_reply);
-    } else {
-        *reply_out = reply;
-        reply = empty_data();
-    }
+    *reply_out = reply;
+    reply = empty_data();
 
     /* Set use_primary to 1 if we ended up talking to a primary when we didn't
      * explicitly request to. */
@@ -885,12 +1310,15 @@ start_connection(krb5_context context, struct conn_state *state,
     if (fd == INVALID_SOCKET)
         return -1;              /* try other hosts */
     set_cloexec_fd(fd);
+    (void)get_curtime_ms(&state->sendtime);
     /* Make it non-blocking.  */
     ioctlsocket(fd, FIONBIO, (const void *) &one);
     if (state->addr.transport == TCP) {
         setsockopt(fd, SOL_SOCKET, SO_LINGER, &lopt, sizeof(lopt));
         TRACE_SENDTO_KDC_TCP_CONNECT(context, &state->addr);
     }
+    if (state->pool)
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
 
     /* Start connecting to KDC.  */
     e = SOCKET_CONNECT(fd, (struct sockaddr *)&state->addr.saddr,
@@ -978,6 +1406,145 @@ start_connection(krb5_context context, struct conn_state *state,
     return 0;
 }
 
+/* Return true if pc can carry a request for realm to the address of conn. */
+static krb5_boolean
+pooled_conn_matches(const struct pooled_conn *pc, const krb5_data *realm,
+                    const struct conn_state *conn)
+{
+    return data_eq(pc->realm, *realm) &&
+        pc->addr.transport == conn->addr.transport &&
+        pc->addr.len == conn->addr.len &&
+        memcmp(&pc->addr.saddr, &conn->addr.saddr, conn->addr.len) == 0;
+}
+
+/* Remove and return a pooled connection which matches realm and conn, or
+ * return NULL if there is none.  Discard expired connections and those made
+ * by a parent process along the way. */
+static struct pooled_conn *
+take_pooled_conn(const krb5_data *realm, const struct conn_state *conn)
+{
+    struct pooled_conn **pp, *pc, *found = NULL, *dead = NULL;
+    long pid = (long)getpid();
+    time_ms now;
+
+    if (get_curtime_ms(&now) != 0)
+        return NULL;
+
+    k5_mutex_lock(&pool_lock);
+    pp = &conn_pool;
+    while ((pc = *pp) != NULL) {
+        if (pc->expires <= now || pc->pid != pid) {
+            *pp = pc->next;
+            conn_pool_len--;
+            pc->next = dead;
+            dead = pc;
+        } else if (found == NULL && pooled_conn_matches(pc, realm, conn)) {
+            *pp = pc->next;
+            conn_pool_len--;
+            found = pc;
+        } else {
+            pp = &pc->next;
+        }
+    }
+    k5_mutex_unlock(&pool_lock);
+
+    for (; dead != NULL; dead = pc) {
+        pc = dead->next;
+        free_pooled_conn(dead);
+    }
+    return found;
+}
+
+/* Move the connection of conn, which has just completed an exchange, into the
+ * pool for up to idle_timeout seconds. */
+static void
+put_pooled_conn(krb5_context context, const krb5_data *realm,
+                struct conn_state *conn, int idle_timeout)
+{
+    krb5_error_code ret;
+    struct pooled_conn *pc, **pp, *evict = NULL;
+    time_ms now;
+
+    if (get_curtime_ms(&now) != 0)
+        return;
+    pc = calloc(1, sizeof(*pc));
+    if (pc == NULL)
+        return;
+    pc->fd = INVALID_SOCKET;
+    pc->realm.data = k5memdup0(realm->data, realm->length, &ret);
+    pc->realm.length = realm->length;
+    if (pc->realm.data == NULL) {
+        free_pooled_conn(pc);
+        return;
+    }
+    pc->addr = conn->addr;
+    pc->fd = conn->fd;
+    pc->pid = (long)getpid();
+    pc->expires = now + (time_ms)idle_timeout * 1000;
+    TRACE_SENDTO_KDC_CONN_SAVE(context, &conn->addr);
+
+    /* The connection now belongs to the pool. */
+    conn->fd = INVALID_SOCKET;
+
+    k5_mutex_lock(&pool_lock);
+    pc->next = conn_pool;
+    conn_pool = pc;
+    if (++conn_pool_len > MAX_POOLED_CONNS) {
+        /* Evict the least recently used connection. */
+        for (pp = &conn_pool; (*pp)->next != NULL; pp = &(*pp)->next);
+        evict = *pp;
+        *pp = NULL;
+        conn_pool_len--;
+    }
+    k5_mutex_unlock(&pool_lock);
+
+    if (evict != NULL)
+        free_pooled_conn(evict);
+}
+
+/* Try to start sending the message for conn over a pooled connection.  Return
+ * true if the message is under way, false if conn needs a new connection. */
+static krb5_boolean
+reuse_connection(krb5_context context, struct conn_state *conn,
+                 const krb5_data *message, struct select_state *selstate,
+                 const krb5_data *realm)
+{
+    struct pooled_conn *pc;
+    ssize_t nread;
+    char c;
+
+    /* An idle connection should have nothing to read.  If it does, the server
+     * has most likely closed it. */
+    while ((pc = take_pooled_conn(realm, conn)) != NULL) {
+        nread = recv(pc->fd, &c, 1, MSG_PEEK);
+        if (nread < 0 && SOCKET_ERRNO == EWOULDBLOCK)
+            break;
+        TRACE_SENDTO_KDC_CONN_CLOSED(context, &pc->addr);
+        free_pooled_conn(pc);
+    }
+    if (pc == NULL)
+        return FALSE;
+
+    conn->fd = pc->fd;
+    pc->fd = INVALID_SOCKET;
+    free_pooled_conn(pc);
+    TRACE_SENDTO_KDC_CONN_REUSE(context, &conn->addr);
+
+    if (set_transport_message(conn, realm, message) != 0 ||
+        !cm_add_fd(selstate, conn->fd)) {
+        closesocket(conn->fd);
+        conn->fd = INVALID_SOCKET;
+        conn->pool = FALSE;
+        return FALSE;
+    }
+    conn->reused = TRUE;
+    conn->state = WRITING;
+    cm_write(selstate, conn->fd);
+    if (get_curtime_ms(&conn->sendtime) == 0)
+        conn->endtime = conn->sendtime + 10000;
+    return TRUE;
+}
+
 /* Return 0 if we sent something, non-0 otherwise.
    If 0 is returned, the caller should delay waiting for a response.
    Otherwise, the caller should immediately move on to process the
@@ -992,6 +1559,9 @@ maybe_send(krb5_context context, struct conn_state *conn,
     ssize_t ret;
 
     if (conn->state == INITIALIZING) {
+        if (conn->pool && reuse_connection(context, conn, message, selstate,
+                                           realm))
+            return 0;
         return start_connection(context, conn, message, selstate,
                                 realm, callback_info);
     }
@@ -1037,6 +1607,17 @@ kill_conn(krb5_context context, struct conn_state *conn,
     closesocket(conn->fd);
     conn->fd = INVALID_SOCKET;
     conn->state = FAILED;
+
+    if (conn->reused) {
+        /* The server may have closed the pooled connection while it was
+         * idle.  Make a new connection on the next pass. */
+        conn->state = INITIALIZING;
+        conn->reused = conn->pool = FALSE;
+        conn->sendtime = 0;
+        conn->out.sgp = conn->out.sgbuf;
+        free(conn->in.buf);
+        memset(&conn->in, 0, sizeof(conn->in));
+    }
 }
 
 /* Check socket for error.  */
@@ -1393,66 +1974,83 @@ get_endtime(time_ms endtime, struct conn_state *conns)
     return endtime;
 }
 
-static krb5_boolean
-service_fds(krb5_context context, struct select_state *selstate,
-            time_ms interval, struct conn_state *conns,
-            struct select_state *seltemp, const krb5_data *realm,
-            int (*msg_handler)(krb5_context, const krb5_data *, void *),
-            void *msg_handler_data, struct conn_state **winner_out)
-{
-    int e, selret = 0;
-    time_ms endtime;
-    struct conn_state *state;
+/* The progress of an exchange through the schedule described below. */
+enum sendto_phase {
+    PHASE_FIRST,                /* contacting preferred-transport addresses */
+    PHASE_DEFERRED,             /* contacting deferred addresses */
+    PHASE_FIRST_WAIT,           /* waiting at the end of the first pass */
+    PHASE_PASS,                 /* resending in a later pass */
+    PHASE_PASS_WAIT             /* waiting at the end of a later pass */
+};
 
-    *winner_out = NULL;
+struct sendto_state {
+    const krb5_data *message;
+    const krb5_data *realm;
+    const struct serverlist *servers;
+    k5_transport_strategy strategy;
+    struct sendto_callback_info *callback_info;
+    int (*msg_handler)(krb5_context, const krb5_data *, void *);
+    void *msg_handler_data;
+    int reuse;
+    int idle_timeout;
+
+    struct select_state *sel_state, *seltemp;
+    struct conn_state *conns;
+    char *udpbuf;
+    size_t *order;              /* server indices in order of preference */
+    size_t next_server;         /* next index into order to resolve */
+    struct conn_state *next_conn; /* next connection to contact this pass */
+    enum sendto_phase phase;
+    int pass;
+    time_ms delay;
+    time_ms waituntil;          /* end of the current wait */
+    krb5_boolean done;
+    struct conn_state *winner;
+};
 
-    e = get_curtime_ms(&endtime);
-    if (e)
-        return TRUE;
-    endtime += interval;
+/* Process the descriptors of ss which were found to be ready in ss->seltemp.
+ * Set ss->winner and ss->done if a connection produces an acceptable
+ * reply. */
+static void
+service_fds(krb5_context context, struct sendto_state *ss)
+{
+    struct conn_state *state;
+    int ssflags, stop;
+    krb5_data reply;
 
-    e = 0;
-    while (selstate->nfds > 0) {
-        e = cm_select_or_poll(selstate, get_endtime(endtime, conns),
-                              seltemp, &selret);
-        if (e == EINTR)
+    for (state = ss->conns; state != NULL; state = state->next) {
+        if (state->fd == INVALID_SOCKET)
+            continue;
+        ssflags = cm_get_ssflags(ss->seltemp, state->fd);
+        if (!ssflags)
             continue;
-        if (e != 0)
-            break;
-
-        if (selret == 0)
-            /* Timeout, return to caller.  */
-            return FALSE;
-
-        /* Got something on a socket, process it.  */
-        for (state = conns; state != NULL; state = state->next) {
-            int ssflags;
-
-            if (state->fd == INVALID_SOCKET)
-                continue;
-            ssflags = cm_get_ssflags(seltemp, state->fd);
-            if (!ssflags)
-                continue;
-
-            if (service_dispatch(context, realm, state, selstate, ssflags)) {
-                int stop = 1;
-
-                if (msg_handler != NULL) {
-                    krb5_data reply = make_data(state->in.buf, state->in.pos);
 
-                    stop = (msg_handler(context, &reply, msg_handler_data) != 0);
-                }
+        if (service_dispatch(context, ss->realm, state, ss->sel_state,
+                             ssflags)) {
+            stop = 1;
+            if (ss->msg_handler != NULL) {
+                reply = make_data(state->in.buf, state->in.pos);
+                stop = (ss->msg_handler(context, &reply,
+                                        ss->msg_handler_data) != 0);
+            }
 
-                if (stop) {
-                    *winner_out = state;
-                    return TRUE;
-                }
+            if (stop) {
+                ss->winner = state;
+                ss->done = TRUE;
+                return;
             }
+            state->rejected = TRUE;
         }
     }
-    if (e != 0)
-        return TRUE;
-    return FALSE;
+}
+
+/* Begin waiting interval milliseconds for an answer. */
+static void
+start_wait(struct sendto_state *ss, time_ms interval)
+{
+    if (get_curtime_ms(&ss->waituntil) != 0)
+        ss->done = TRUE;
+    ss->waituntil += interval;
 }
 
 /*
@@ -1480,116 +2078,250 @@ service_fds(krb5_context context, struct select_state *selstate,
  * moving on.  This reduces network traffic significantly in a TCP environment.
  */
 
-krb5_error_code
-k5_sendto(krb5_context context, const krb5_data *message,
-          const krb5_data *realm, const struct serverlist *servers,
-          k5_transport_strategy strategy,
-          struct sendto_callback_info* callback_info, krb5_data *reply,
-          struct sockaddr *remoteaddr, socklen_t *remoteaddrlen,
-          int *server_used,
-          /* return 0 -> keep going, 1 -> quit */
-          int (*msg_handler)(krb5_context, const krb5_data *, void *),
-          void *msg_handler_data)
+/* Move ss on once its current wait has ended (or it has no descriptors left to
+ * wait on): send the next message and start a new wait, or set ss->done if
+ * there is nothing left to try. */
+static krb5_error_code
+advance_sendto(krb5_context context, struct sendto_state *ss)
 {
-    int pass;
-    time_ms delay;
-    krb5_error_code retval;
-    struct conn_state *conns = NULL, *state, **tailptr, *next, *winner;
-    size_t s;
-    struct select_state *sel_state = NULL, *seltemp;
-    char *udpbuf = NULL;
-    krb5_boolean done = FALSE;
-
-    *reply = empty_data();
-
-    /* One for use here, listing all our fds in use, and one for
-     * temporary use in service_fds, for the fds of interest.  */
-    sel_state = malloc(2 * sizeof(*sel_state));
-    if (sel_state == NULL) {
-        retval = ENOMEM;
-        goto cleanup;
-    }
-    seltemp = &sel_state[1];
-    cm_init_selstate(sel_state);
+    krb5_error_code ret;
+    struct conn_state *state, **tailptr;
 
-    /* First pass: resolve server hosts, communicate with resulting addresses
-     * of the preferred transport, and wait 1s for an answer from each. */
-    for (s = 0; s < servers->nservers && !done; s++) {
-        /* Find the current tail pointer. */
-        for (tailptr = &conns; *tailptr != NULL; tailptr = &(*tailptr)->next);
-        retval = resolve_server(context, realm, servers, s, strategy, message,
-                                &udpbuf, &conns);
-        if (retval)
-            goto cleanup;
-        for (state = *tailptr; state != NULL && !done; state = state->next) {
+    /* A pass ends early if every connection has failed. */
+    if (ss->phase == PHASE_PASS && ss->sel_state->nfds == 0)
+        ss->next_conn = NULL;
+
+    while (!ss->done) {
+        switch (ss->phase) {
+        case PHASE_FIRST:
+            /* First pass: resolve server hosts in order of observed health,
+             * communicate with resulting addresses of the preferred
+             * transport, and wait 1s for an answer from each. */
+            if (ss->next_conn == NULL) {
+                if (ss->next_server == ss->servers->nservers) {
+                    ss->phase = PHASE_DEFERRED;
+                    ss->next_conn = ss->conns;
+                    continue;
+                }
+                for (tailptr = &ss->conns; *tailptr != NULL;
+                     tailptr = &(*tailptr)->next);
+                ret = resolve_server(context, ss->realm, ss->servers,
+                                     ss->order[ss->next_server++],
+                                     ss->strategy, ss->message, &ss->udpbuf,
+                                     &ss->conns);
+                if (ret)
+                    return ret;
+                for (state = *tailptr; state != NULL; state = state->next)
+                    state->pool = ss->reuse && state->addr.transport == TCP;
+                ss->next_conn = *tailptr;
+                continue;
+            }
             /* Contact each new connection, deferring those which use the
              * non-preferred RFC 4120 transport. */
+            state = ss->next_conn;
+            ss->next_conn = state->next;
             if (state->defer)
                 continue;
-            if (maybe_send(context, state, message, sel_state, realm,
-                           callback_info))
+            break;
+
+        case PHASE_DEFERRED:
+            /* Complete the first pass by contacting servers of the
+             * non-preferred RFC 4120 transport (if given), waiting 1s for an
+             * answer from each, and then wait for two seconds. */
+            if (ss->next_conn == NULL) {
+                ss->phase = PHASE_FIRST_WAIT;
+                start_wait(ss, 2000);
+                return 0;
+            }
+            state = ss->next_conn;
+            ss->next_conn = state->next;
+            if (!state->defer)
                 continue;
-            done = service_fds(context, sel_state, 1000, conns, seltemp,
-                               realm, msg_handler, msg_handler_data, &winner);
-        }
-    }
+            break;
 
-    /* Complete the first pass by contacting servers of the non-preferred RFC
-     * 4120 transport (if given), waiting 1s for an answer from each. */
-    for (state = conns; state != NULL && !done; state = state->next) {
-        if (!state->defer)
+        case PHASE_FIRST_WAIT:
+            /* Make remaining passes over all of the connections. */
+            ss->phase = PHASE_PASS;
+            ss->pass = 1;
+            ss->delay = 4000;
+            ss->next_conn = ss->conns;
             continue;
-        if (maybe_send(context, state, message, sel_state, realm,
-                       callback_info))
+
+        case PHASE_PASS:
+            /* Wait for the delay backoff at the end of this pass. */
+            if (ss->next_conn == NULL) {
+                ss->phase = PHASE_PASS_WAIT;
+                start_wait(ss, ss->delay);
+                return 0;
+            }
+            state = ss->next_conn;
+            ss->next_conn = state->next;
+            break;
+
+        case PHASE_PASS_WAIT:
+            ss->delay *= 2;
+            if (ss->sel_state->nfds == 0 || ++ss->pass >= MAX_PASS) {
+                ss->done = TRUE;
+                return 0;
+            }
+            ss->phase = PHASE_PASS;
+            ss->next_conn = ss->conns;
             continue;
-        done = service_fds(context, sel_state, 1000, conns, seltemp,
-                           realm, msg_handler, msg_handler_data, &winner);
+        }
+
+        if (maybe_send(context, state, ss->message, ss->sel_state, ss->realm,
+                       ss->callback_info))
+            continue;
+        start_wait(ss, 1000);
+        return 0;
     }
+    return 0;
+}
 
-    /* Wait for two seconds at the end of the first pass. */
-    if (!done) {
-        done = service_fds(context, sel_state, 2000, conns, seltemp,
-                           realm, msg_handler, msg_handler_data, &winner);
+/* Begin an exchange of message with servers, as described for k5_sendto().  If
+ * epfd is not -1, register the descriptors of the exchange with it. */
+static krb5_error_code
+start_sendto(krb5_context context, const krb5_data *message,
+             const krb5_data *realm, const struct serverlist *servers,
+             k5_transport_strategy strategy,
+             struct sendto_callback_info *callback_info,
+             int (*msg_handler)(krb5_context, const krb5_data *, void *),
+             void *msg_handler_data, int epfd, struct sendto_state **ss_out)
+{
+    krb5_error_code ret;
+    struct sendto_state *ss;
+
+    *ss_out = NULL;
+
+    ss = k5alloc(sizeof(*ss), &ret);
+    if (ss == NULL)
+        return ret;
+    ss->message = message;
+    ss->realm = realm;
+    ss->servers = servers;
+    ss->strategy = strategy;
+    ss->callback_info = callback_info;
+    ss->msg_handler = msg_handler;
+    ss->msg_handler_data = msg_handler_data;
+    ss->phase = PHASE_FIRST;
+    ss->idle_timeout = DEFAULT_KDC_IDLE_TIMEOUT;
+
+    /* Connections used with a callback are specific to the caller, so are
+     * never pooled. */
+    if (callback_info == NULL) {
+        if (profile_get_boolean(context->profile, KRB5_CONF_LIBDEFAULTS,
+                                KRB5_CONF_KDC_CONNECTION_REUSE, NULL, 0,
+                                &ss->reuse) != 0)
+            ss->reuse = 0;
+        if (profile_get_integer(context->profile, KRB5_CONF_LIBDEFAULTS,
+                                KRB5_CONF_KDC_IDLE_TIMEOUT, NULL,
+                                DEFAULT_KDC_IDLE_TIMEOUT,
+                                &ss->idle_timeout) != 0 ||
+            ss->idle_timeout <= 0)
+            ss->reuse = 0;
     }
 
-    /* Make remaining passes over all of the connections. */
-    delay = 4000;
-    for (pass = 1; pass < MAX_PASS && !done; pass++) {
-        for (state = conns; state != NULL && !done; state = state->next) {
-            if (maybe_send(context, state, message, sel_state, realm,
-                           callback_info))
-                continue;
-            done = service_fds(context, sel_state, 1000, conns, seltemp,
-                               realm, msg_handler, msg_handler_data, &winner);
-            if (sel_state->nfds == 0)
-                break;
+    /* One for use here, listing all our fds in use, and one for
+     * temporary use in service_fds, for the fds of interest.  */
+    ss->sel_state = k5alloc(2 * sizeof(*ss->sel_state), &ret);
+    if (ss->sel_state == NULL)
+        goto error;
+    ss->seltemp = &ss->sel_state[1];
+    cm_init_selstate(ss->sel_state);
+    ss->sel_state->epfd = epfd;
+
+    ss->order = k5calloc(servers->nservers + 1, sizeof(*ss->order), &ret);
+    if (ss->order == NULL)
+        goto error;
+    rank_servers(context, servers, ss->order);
+
+    *ss_out = ss;
+    return 0;
+
+error:
+    free(ss->sel_state);
+    free(ss);
+    return ret;
+}
+
+/* Without blocking, process any ready descriptors of ss and move it on if its
+ * current wait has ended. */
+static krb5_error_code
+step_sendto(krb5_context context, struct sendto_state *ss)
+{
+    int e, selret = 0;
+    time_ms now;
+
+    if (ss->sel_state->nfds > 0) {
+        e = cm_check_ready(ss->sel_state, ss->seltemp, &selret);
+        if (e != 0 && e != EINTR) {
+            ss->done = TRUE;
+            return 0;
         }
-        /* Wait for the delay backoff at the end of this pass. */
-        if (!done) {
-            done = service_fds(context, sel_state, delay, conns, seltemp,
-                               realm, msg_handler, msg_handler_data, &winner);
+        if (selret > 0)
+            service_fds(context, ss);
+    }
+
+    while (!ss->done) {
+        if (ss->sel_state->nfds > 0) {
+            if (get_curtime_ms(&now) != 0)
+                ss->done = TRUE;
+            else if (now < get_endtime(ss->waituntil, ss->conns))
+                break;
         }
-        if (sel_state->nfds == 0)
-            break;
-        delay *= 2;
+        e = advance_sendto(context, ss);
+        if (e)
+            return e;
     }
+    return 0;
+}
+
+/* Return the number of milliseconds until ss must next be stepped if none of
+ * its descriptors become ready. */
+static time_ms
+sendto_timeout(struct sendto_state *ss)
+{
+    time_ms now, endtime;
+
+    if (ss->done || ss->sel_state->nfds == 0 || get_curtime_ms(&now) != 0)
+        return 0;
+    endtime = get_endtime(ss->waituntil, ss->conns);
+    return (endtime > now) ? endtime - now : 0;
+}
 
-    if (sel_state->nfds == 0 || !done || winner == NULL) {
+/* Finish the exchange ss after it has ended with retval, returning the winning
+ * reply (if there is one and retval is 0) in *reply, and free ss. */
+static krb5_error_code
+end_sendto(krb5_context context, struct sendto_state *ss,
+           krb5_error_code retval, krb5_data *reply,
+           struct sockaddr *remoteaddr, socklen_t *remoteaddrlen,
+           int *server_used)
+{
+    struct conn_state *state, *next, *winner = ss->winner;
+
+    *reply = empty_data();
+    if (retval == 0 && (ss->sel_state->nfds == 0 || winner == NULL))
         retval = KRB5_KDC_UNREACH;
+    if (retval)
         goto cleanup;
-    }
+
     /* Success!  */
     *reply = make_data(winner->in.buf, winner->in.pos);
-    retval = 0;
     winner->in.buf = NULL;
     if (server_used != NULL)
         *server_used = winner->server_index;
     if (remoteaddr != NULL && remoteaddrlen != 0 && *remoteaddrlen > 0)
         (void)getpeername(winner->fd, remoteaddr, remoteaddrlen);
     TRACE_SENDTO_KDC_RESPONSE(context, reply->length, &winner->addr);
+    if (winner->pool) {
+        cm_remove_fd(ss->sel_state, winner->fd);
+        put_pooled_conn(context, ss->realm, winner, ss->idle_timeout);
+    }
 
 cleanup:
-    for (state = conns; state != NULL; state = next) {
+    if (ss->conns != NULL)
+        record_health(ss->servers, ss->conns, (retval == 0) ? winner : NULL);
+    for (state = ss->conns; state != NULL; state = next) {
         next = state->next;
         if (state->fd != INVALID_SOCKET) {
             if (socktype_for_transport(state->addr.transport) == SOCK_STREAM)
@@ -1597,17 +2329,251 @@ cleanup:
             closesocket(state->fd);
             free_http_tls_data(context, state);
         }
-        if (state->in.buf != udpbuf)
+        if (state->in.buf != ss->udpbuf)
             free(state->in.buf);
-        if (callback_info) {
-            callback_info->pfn_cleanup(callback_info->data,
-                                       &state->callback_buffer);
+        if (ss->callback_info) {
+            ss->callback_info->pfn_cleanup(ss->callback_info->data,
+                                           &state->callback_buffer);
         }
         free(state);
     }
 
-    if (reply->data != udpbuf)
-        free(udpbuf);
-    free(sel_state);
+    if (reply->data != ss->udpbuf)
+        free(ss->udpbuf);
+    free(ss->sel_state);
+    free(ss->order);
+    free(ss);
     return retval;
 }
+
+krb5_error_code
+k5_sendto(krb5_context context, const krb5_data *message,
+          const krb5_data *realm, const struct serverlist *servers,
+          k5_transport_strategy strategy,
+          struct sendto_callback_info* callback_info, krb5_data *reply,
+          struct sockaddr *remoteaddr, socklen_t *remoteaddrlen,
+          int *server_used,
+          /* return 0 -> keep going, 1 -> quit */
+          int (*msg_handler)(krb5_context, const krb5_data *, void *),
+          void *msg_handler_data)
+{
+    krb5_error_code retval;
+    struct sendto_state *ss;
+    int e, selret = 0;
+
+    *reply = empty_data();
+
+    retval = start_sendto(context, message, realm, servers, strategy,
+                          callback_info, msg_handler, msg_handler_data, -1,
+                          &ss);
+    if (retval)
+        return retval;
+
+    while (!ss->done) {
+        /* Move on when there is nothing to wait for. */
+        if (ss->sel_state->nfds == 0) {
+            retval = advance_sendto(context, ss);
+            if (retval)
+                break;
+            continue;
+        }
+
+        e = cm_select_or_poll(ss->sel_state,
+                              get_endtime(ss->waituntil, ss->conns),
+                              ss->seltemp, &selret);
+        if (e == EINTR)
+            continue;
+        if (e != 0)
+            break;
+
+        if (selret == 0) {
+            /* Timeout; move on to the next step. */
+            retval = advance_sendto(context, ss);
+            if (retval)
+                break;
+        } else {
+            /* Got something on a socket, process it. */
+            service_fds(context, ss);
+        }
+    }
+
+    return end_sendto(context, ss, retval, reply, remoteaddr, remoteaddrlen,
+                      server_used);
+}
+
+struct _krb5_kdc_exchange {
+    krb5_data realm;
+    krb5_data message;
+    struct serverlist servers;
+    struct sendto_state *ss;    /* NULL once the exchange has ended */
+    krb5_error_code result;     /* outcome of the exchange once ended */
+    krb5_error_code err;        /* set by check_for_svc_unavailable */
+    krb5_boolean hooked;        /* true if the send hook supplied the reply */
+    krb5_boolean finished;      /* true once the result has been returned */
+    krb5_data reply;
+    int epfd;
+};
+
+krb5_error_code KRB5_CALLCONV
+krb5_kdc_exchange_start(krb5_context context, const krb5_data *realm,
+                        const krb5_data *message, int flags,
+                        krb5_kdc_exchange *exchange_out)
+{
+    krb5_error_code ret;
+    krb5_kdc_exchange ex;
+    k5_transport_strategy strategy;
+    krb5_data *hook_message = NULL, *hook_reply = NULL;
+    int use_primary = !!(flags & KRB5_KDC_EXCHANGE_PRIMARY);
+    int no_udp = !!(flags & KRB5_KDC_EXCHANGE_TCP);
+
+    *exchange_out = NULL;
+
+    TRACE_SENDTO_KDC(context, message->length, realm, use_primary, no_udp);
+
+    ex = k5alloc(sizeof(*ex), &ret);
+    if (ex == NULL)
+        return ret;
+    ex->epfd = -1;
+
+    ret = krb5int_copy_data_contents(context, realm, &ex->realm);
+    if (ret)
+        goto error;
+
+    ret = get_strategy(context, message, no_udp, &strategy);
+    if (ret)
+        goto error;
+
+    ret = k5_locate_kdc(context, realm, &ex->servers, use_primary, no_udp);
+    if (ret)
+        goto error;
+
+    if (context->kdc_send_hook != NULL) {
+        ret = context->kdc_send_hook(context, context->kdc_send_hook_data,
+                                     realm, message, &hook_message,
+                                     &hook_reply);
+        if (ret)
+            goto error;
+
+        if (hook_reply != NULL) {
+            ex->reply = *hook_reply;
+            free(hook_reply);
+            ex->hooked = TRUE;
+            *exchange_out = ex;
+            return 0;
+        }
+
+        if (hook_message != NULL)
+            message = hook_message;
+    }
+
+    ret = krb5int_copy_data_contents(context, message, &ex->message);
+    if (ret)
+        goto error;
+
+#ifdef USE_EPOLL
+    ex->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ex->epfd == -1) {
+        ret = errno;
+        goto error;
+    }
+#endif
+
+    ret = start_sendto(context, &ex->message, &ex->realm, &ex->servers,
+                       strategy, NULL, check_for_svc_unavailable, &ex->err,
+                       ex->epfd, &ex->ss);
+    if (ret)
+        goto error;
+
+    /* Send the first message so that the caller has something to wait on. */
+    ret = step_sendto(context, ex->ss);
+    if (ret || ex->ss->done) {
+        ex->result = end_sendto(context, ex->ss, ret, &ex->reply, NULL, NULL,
+                                NULL);
+        ex->ss = NULL;
+    }
+
+    krb5_free_data(context, hook_message);
+    *exchange_out = ex;
+    return 0;
+
+error:
+    krb5_free_data(context, hook_message);
+    krb5_kdc_exchange_free(context, ex);
+    return ret;
+}
+
+int KRB5_CALLCONV
+krb5_kdc_exchange_get_fd(krb5_kdc_exchange exchange)
+{
+    return exchange->epfd;
+}
+
+int KRB5_CALLCONV
+krb5_kdc_exchange_get_timeout(krb5_kdc_exchange exchange)
+{
+    time_ms timeout;
+
+    if (exchange->ss == NULL)
+        return 0;
+    timeout = sendto_timeout(exchange->ss);
+    return (timeout > INT_MAX) ? INT_MAX : timeout;
+}
+
+krb5_error_code KRB5_CALLCONV
+krb5_kdc_exchange_step(krb5_context context, krb5_kdc_exchange exchange,
+                       krb5_data *reply_out, krb5_boolean *done_out)
+{
+    krb5_error_code ret;
+    krb5_boolean hook_replied;
+
+    *reply_out = empty_data();
+    *done_out = FALSE;
+
+    if (exchange->finished)
+        return EINVAL;
+
+    if (exchange->ss != NULL) {
+        ret = step_sendto(context, exchange->ss);
+        if (!ret && !exchange->ss->done)
+            return 0;
+        exchange->result = end_sendto(context, exchange->ss, ret,
+                                      &exchange->reply, NULL, NULL, NULL);
+        exchange->ss = NULL;
+    }
+
+    exchange->finished = TRUE;
+    if (!exchange->hooked) {
+        ret = finish_kdc_reply(context, exchange->result, exchange->err,
+                               &exchange->realm, &exchange->message,
+                               &exchange->reply, &hook_replied);
+        if (ret)
+            return ret;
+    }
+
+    *reply_out = exchange->reply;
+    exchange->reply = empty_data();
+    *done_out = TRUE;
+    return 0;
+}
+
+void KRB5_CALLCONV
+krb5_kdc_exchange_free(krb5_context context, krb5_kdc_exchange exchange)
+{
+    krb5_data empty = empty_data();
+
+    if (exchange == NULL)
+        return;
+    if (exchange->ss != NULL) {
+        (void)end_sendto(context, exchange->ss, KRB5_KDC_UNREACH, &empty,
+                         NULL, NULL, NULL);
+    }
+#ifdef USE_EPOLL
+    if (exchange->epfd != -1)
+        close(exchange->epfd);
+#endif
+    krb5_free_data_contents(context, &exchange->reply);
+    krb5_free_data_contents(context, &exchange->message);
+    krb5_free_data_contents(context, &exchange->realm);
+    k5_free_serverlist(&exchange->servers);
+    free(exchange);
+}
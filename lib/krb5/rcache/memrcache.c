@@ -35,74 +35,163 @@
 #include "k5-hashtab.h"
 #include "memrcache.h"
 
+/* The timer wheel has one slot per second of expiration time.  Entries which
+ * expire more than WHEEL_SLOTS seconds ahead share a slot with entries from
+ * earlier laps of the wheel, and are skipped until their time comes. */
+#define WHEEL_SLOTS 512
+
+/* Approximate memory used by the hash table for each entry. */
+#define HASHTAB_OVERHEAD (5 * sizeof(void *))
+
 struct entry {
-    K5_TAILQ_ENTRY(entry) links;
-    krb5_timestamp timestamp;
-    krb5_data tag;
+    K5_LIST_ENTRY(entry) links;
+    krb5_timestamp expiry;
+    size_t size;
+    krb5_data tag;              /* contents follow the structure */
 };
 
 K5_LIST_HEAD(entry_list, entry);
-K5_TAILQ_HEAD(entry_queue, entry);
 
 struct k5_memrcache_st {
     struct k5_hashtab *hash_table;
-    struct entry_queue expiration_queue;
+    struct entry_list wheel[WHEEL_SLOTS];
+    krb5_timestamp wheel_time;  /* slots before this time are processed */
+    enum k5_memrcache_overflow overflow;
+    struct k5_memrcache_stats stats;
 };
 
+static inline struct entry_list *
+wheel_slot(k5_memrcache mrc, krb5_timestamp t)
+{
+    return &mrc->wheel[(uint32_t)t % WHEEL_SLOTS];
+}
+
+/* Remove entry from its hash bucket and wheel slot, and free it. */
+static void
+discard_entry(k5_memrcache mrc, struct entry *entry)
+{
+    k5_hashtab_remove(mrc->hash_table, entry->tag.data, entry->tag.length);
+    K5_LIST_REMOVE(entry, links);
+    mrc->stats.entries--;
+    mrc->stats.size -= entry->size;
+    free(entry);
+}
+
+/* Discard entries which expired before now, by processing each wheel slot
+ * from the last time we did so up to now. */
+static void
+expire_entries(k5_memrcache mrc, krb5_timestamp now)
+{
+    struct entry_list *slot;
+    struct entry *e, *next;
+    uint32_t i, nslots;
+
+    if (!ts_after(now, mrc->wheel_time))
+        return;
+    nslots = (uint32_t)ts_delta(now, mrc->wheel_time);
+    if (nslots > WHEEL_SLOTS)
+        nslots = WHEEL_SLOTS;
+
+    for (i = 0; i < nslots && mrc->stats.entries > 0; i++) {
+        slot = wheel_slot(mrc, ts_incr(mrc->wheel_time, i));
+        K5_LIST_FOREACH_SAFE(e, slot, links, next) {
+            if (ts_after(now, e->expiry)) {
+                discard_entry(mrc, e);
+                mrc->stats.expired++;
+            }
+        }
+    }
+    mrc->wheel_time = now;
+}
+
+/* Discard the first entry found in wheel order starting from the current
+ * time, which is at or near the soonest to expire. */
+static void
+evict_entry(k5_memrcache mrc)
+{
+    struct entry *e;
+    uint32_t i;
+
+    for (i = 0; i < WHEEL_SLOTS; i++) {
+        e = K5_LIST_FIRST(wheel_slot(mrc, ts_incr(mrc->wheel_time, i)));
+        if (e != NULL) {
+            discard_entry(mrc, e);
+            mrc->stats.evicted++;
+            return;
+        }
+    }
+}
+
+/* Make room for an entry of size bytes, or fail if the overflow policy
+ * doesn't allow it. */
+static krb5_error_code
+make_room(krb5_context context, k5_memrcache mrc, size_t size)
+{
+    if (size > mrc->stats.max_size ||
+        (mrc->overflow == K5_MEMRCACHE_REJECT &&
+         mrc->stats.size + size > mrc->stats.max_size)) {
+        mrc->stats.rejected++;
+        k5_setmsg(context, KRB5_RC_IO_SPACE,
+                  _("Replay cache is full (%lu entries)"),
+                  (unsigned long)mrc->stats.entries);
+        return KRB5_RC_IO_SPACE;
+    }
+    while (mrc->stats.size + size > mrc->stats.max_size)
+        evict_entry(mrc);
+    return 0;
+}
+
 static krb5_error_code
 insert_entry(krb5_context context, k5_memrcache mrc, const krb5_data *tag,
              krb5_timestamp now)
 {
     krb5_error_code ret;
-    struct entry *entry = NULL;
+    struct entry *entry;
+    size_t size = sizeof(*entry) + tag->length + HASHTAB_OVERHEAD;
+
+    ret = make_room(context, mrc, size);
+    if (ret)
+        return ret;
 
-    entry = calloc(1, sizeof(*entry));
+    entry = malloc(sizeof(*entry) + tag->length);
     if (entry == NULL)
         return ENOMEM;
-    entry->timestamp = now;
-
-    ret = krb5int_copy_data_contents(context, tag, &entry->tag);
-    if (ret)
-        goto error;
+    entry->expiry = ts_incr(now, context->clockskew);
+    entry->size = size;
+    entry->tag = make_data(entry + 1, tag->length);
+    if (tag->length > 0)
+        memcpy(entry->tag.data, tag->data, tag->length);
 
     ret = k5_hashtab_add(mrc->hash_table, entry->tag.data, entry->tag.length,
                          entry);
-    if (ret)
-        goto error;
-    K5_TAILQ_INSERT_TAIL(&mrc->expiration_queue, entry, links);
-
-    return 0;
-
-error:
-    if (entry != NULL) {
-        krb5_free_data_contents(context, &entry->tag);
+    if (ret) {
         free(entry);
+        return ret;
     }
-    return ret;
-}
-
-
-/* Remove entry from its hash bucket and the expiration queue, and free it. */
-static void
-discard_entry(krb5_context context, k5_memrcache mrc, struct entry *entry)
-{
-    k5_hashtab_remove(mrc->hash_table, entry->tag.data, entry->tag.length);
-    K5_TAILQ_REMOVE(&mrc->expiration_queue, entry, links);
-    krb5_free_data_contents(context, &entry->tag);
-    free(entry);
+    K5_LIST_INSERT_HEAD(wheel_slot(mrc, entry->expiry), entry, links);
+    mrc->stats.entries++;
+    mrc->stats.size += size;
+    mrc->stats.stores++;
+    return 0;
 }
 
-/* Initialize the lookaside cache structures and randomize the hash seed. */
+/* Initialize the replay cache structures and randomize the hash seed. */
 krb5_error_code
-k5_memrcache_create(krb5_context context, k5_memrcache *mrc_out)
+k5_memrcache_create(krb5_context context, size_t max_size,
+                    enum k5_memrcache_overflow overflow, k5_memrcache *mrc_out)
 {
     krb5_error_code ret;
     k5_memrcache mrc;
     uint8_t seed[K5_HASH_SEED_LEN];
     krb5_data seed_data = make_data(seed, sizeof(seed));
+    krb5_timestamp now;
+    size_t i;
 
     *mrc_out = NULL;
 
+    ret = krb5_timeofday(context, &now);
+    if (ret)
+        return ret;
     ret = krb5_c_random_make_octets(context, &seed_data);
     if (ret)
         return ret;
@@ -115,7 +204,12 @@ k5_memrcache_create(krb5_context context, k5_memrcache *mrc_out)
         free(mrc);
         return ret;
     }
-    K5_TAILQ_INIT(&mrc->expiration_queue);
+    for (i = 0; i < WHEEL_SLOTS; i++)
+        K5_LIST_INIT(&mrc->wheel[i]);
+    mrc->wheel_time = now;
+    mrc->overflow = overflow;
+    mrc->stats.max_size = (max_size != 0) ? max_size :
+        K5_MEMRCACHE_DEFAULT_SIZE;
 
     *mrc_out = mrc;
     return 0;
@@ -127,38 +221,41 @@ k5_memrcache_store(krb5_context context, k5_memrcache mrc,
 {
     krb5_error_code ret;
     krb5_timestamp now;
-    struct entry *e, *next;
 
     ret = krb5_timeofday(context, &now);
     if (ret)
         return ret;
 
+    expire_entries(mrc, now);
+
     /* Check if we already have a matching entry. */
-    e = k5_hashtab_get(mrc->hash_table, tag->data, tag->length);
-    if (e != NULL)
+    if (k5_hashtab_get(mrc->hash_table, tag->data, tag->length) != NULL) {
+        mrc->stats.replays++;
         return KRB5KRB_AP_ERR_REPEAT;
-
-    /* Discard stale entries. */
-    K5_TAILQ_FOREACH_SAFE(e, &mrc->expiration_queue, links, next) {
-        if (!ts_after(now, ts_incr(e->timestamp, context->clockskew)))
-            break;
-        discard_entry(context, mrc, e);
     }
 
     /* Add the new entry. */
     return insert_entry(context, mrc, tag, now);
 }
 
-/* Free all entries in the lookaside cache. */
+void
+k5_memrcache_get_stats(k5_memrcache mrc, struct k5_memrcache_stats *stats_out)
+{
+    *stats_out = mrc->stats;
+}
+
+/* Free all entries in the replay cache. */
 void
 k5_memrcache_free(krb5_context context, k5_memrcache mrc)
 {
     struct entry *e, *next;
+    size_t i;
 
     if (mrc == NULL)
         return;
-    K5_TAILQ_FOREACH_SAFE(e, &mrc->expiration_queue, links, next) {
-        discard_entry(context, mrc, e);
+    for (i = 0; i < WHEEL_SLOTS; i++) {
+        K5_LIST_FOREACH_SAFE(e, &mrc->wheel[i], links, next)
+            discard_entry(mrc, e);
     }
     k5_hashtab_free(mrc->hash_table);
     free(mrc);
@@ -33,14 +33,53 @@
 #ifndef MEMRCACHE_H
 #define MEMRCACHE_H
 
+/*
+ * An in-memory replay cache.  Entries are indexed by tag in a hash table and
+ * filed by expiration time in a timer wheel, so expiring entries costs time
+ * proportional to the number of entries expired.  The memory used by entries
+ * is limited to a fixed size.  A memrcache is not internally locked; callers
+ * sharing one between threads must serialize access to it.
+ */
+
 typedef struct k5_memrcache_st *k5_memrcache;
 
-krb5_error_code k5_memrcache_create(krb5_context context,
+/* Size limit used when a size of 0 is given to k5_memrcache_create(). */
+#define K5_MEMRCACHE_DEFAULT_SIZE (10 * 1024 * 1024)
+
+/* What to do when storing a tag would exceed the size limit. */
+enum k5_memrcache_overflow {
+    /* Fail the store with KRB5_RC_IO_SPACE, so that the message is not
+     * accepted without replay protection. */
+    K5_MEMRCACHE_REJECT,
+    /* Discard the unexpired entries closest to expiring to make room,
+     * accepting that replays of those messages will not be detected. */
+    K5_MEMRCACHE_EVICT
+};
+
+struct k5_memrcache_stats {
+    uint64_t stores;            /* tags stored */
+    uint64_t replays;           /* stores failed as replays */
+    uint64_t expired;           /* entries discarded after expiring */
+    uint64_t evicted;           /* entries discarded to make room */
+    uint64_t rejected;          /* stores failed for lack of room */
+    size_t entries;             /* current number of entries */
+    size_t size;                /* current memory used by entries */
+    size_t max_size;            /* size limit */
+};
+
+/* Create a replay cache using up to max_size bytes of memory for entries (or
+ * K5_MEMRCACHE_DEFAULT_SIZE if max_size is 0), handling overflow as given by
+ * overflow. */
+krb5_error_code k5_memrcache_create(krb5_context context, size_t max_size,
+                                    enum k5_memrcache_overflow overflow,
                                     k5_memrcache *mrc_out);
 
 krb5_error_code k5_memrcache_store(krb5_context context, k5_memrcache mrc,
                                    const krb5_data *tag);
 
+void k5_memrcache_get_stats(k5_memrcache mrc,
+                            struct k5_memrcache_stats *stats_out);
+
 void k5_memrcache_free(krb5_context context, k5_memrcache mrc);
 
 #endif /* MEMRCACHE_H */
@@ -45,13 +45,63 @@ struct krb5_rc_st {
     void *data;
 };
 
+/* The shm type requires shared file mappings and atomic builtins. */
+#if !defined(_WIN32) && defined(__ATOMIC_ACQUIRE)
+#define USE_SHM_RCACHE
+#endif
+
 extern const krb5_rc_ops k5_rc_dfl_ops;
 extern const krb5_rc_ops k5_rc_file2_ops;
+extern const krb5_rc_ops k5_rc_mem_ops;
 extern const krb5_rc_ops k5_rc_none_ops;
+#ifdef USE_SHM_RCACHE
+extern const krb5_rc_ops k5_rc_shm_ops;
+#endif
 
 /* Check and store a replay record in an open (but not locked) file descriptor,
  * using the file2 format.  fd is assumed to be at offset 0. */
 krb5_error_code k5_rcfile2_store(krb5_context context, int fd,
                                  const krb5_data *tag_data);
 
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* A file2 replay cache file kept open between stores, along with a mapping of
+ * its contents where the platform supports it.  The file is only used by the
+ * process which opened it, since a child process would share the open file
+ * description, and with it any lock on the file. */
+struct k5_rcfile2_file {
+    int fd;                     /* -1 if not open */
+    long pid;                   /* process which opened fd */
+    void *map;
+    size_t maplen;
+};
+
+#define K5_RCFILE2_FILE_INIT { -1, 0, NULL, 0 }
+
+/* Check and store a replay record in file, which must be open (but not
+ * locked), reading records through the mapping when possible. */
+krb5_error_code k5_rcfile2_store_file(krb5_context context,
+                                      struct k5_rcfile2_file *file,
+                                      const krb5_data *tag_data);
+
+/* Close file if the file it refers to has been removed or was opened by
+ * another process, so that the caller will reopen it by name. */
+void k5_rcfile2_check_file(struct k5_rcfile2_file *file);
+
+/* Set fd as the open descriptor for file, owned by the current process. */
+void k5_rcfile2_set_fd(struct k5_rcfile2_file *file, int fd);
+
+/* Release the mapping and descriptor of file, if it is open. */
+void k5_rcfile2_close_file(struct k5_rcfile2_file *file);
+
+int krb5int_rc_initialize(void);
+void krb5int_rc_finalize(void);
+
+#ifdef USE_SHM_RCACHE
+int k5_rcshm_initialize(void);
+void k5_rcshm_finalize(void);
+#endif
+
 #endif /* RC_INT_H */
@@ -20,10 +20,58 @@ struct typelist {
     struct typelist *next;
 };
 static struct typelist none = { &k5_rc_none_ops, 0 };
-static struct typelist file2 = { &k5_rc_file2_ops, &none };
+static struct typelist mem = { &k5_rc_mem_ops, &none };
+#ifdef USE_SHM_RCACHE
+static struct typelist shm = { &k5_rc_shm_ops, &mem };
+static struct typelist file2 = { &k5_rc_file2_ops, &shm };
+#else
+static struct typelist file2 = { &k5_rc_file2_ops, &mem };
+#endif
 static struct typelist dfl = { &k5_rc_dfl_ops, &file2 };
 static struct typelist *typehead = &dfl;
 
+int
+krb5int_rc_initialize(void)
+{
+#ifdef USE_SHM_RCACHE
+    return k5_rcshm_initialize();
+#else
+    return 0;
+#endif
+}
+
+void
+krb5int_rc_finalize(void)
+{
+#ifdef USE_SHM_RCACHE
+    k5_rcshm_finalize();
+#endif
+}
+
+/*
+ * Resolve name as the default replay cache.  A default replay cache is opened
+ * separately for each authentication context or acceptor credential, so
+ * refuse the mem type, which would detect almost no replays that way.
+ */
+static krb5_error_code
+resolve_default(krb5_context context, const char *name, krb5_rcache *rc_out)
+{
+    krb5_error_code ret;
+
+    ret = k5_rc_resolve(context, name, rc_out);
+    if (ret)
+        return ret;
+    if ((*rc_out)->ops == &k5_rc_mem_ops) {
+        k5_rc_close(context, *rc_out);
+        *rc_out = NULL;
+        k5_setmsg(context, KRB5_RC_TYPE_NOTFOUND,
+                  _("The mem replay cache type cannot be the default replay "
+                    "cache"));
+        return KRB5_RC_TYPE_NOTFOUND;
+    }
+    return 0;
+}
+
 krb5_error_code
 k5_rc_default(krb5_context context, krb5_rcache *rc_out)
 {
@@ -36,7 +84,7 @@ k5_rc_default(krb5_context context, krb5_rcache *rc_out)
     /* If KRB5RCACHENAME is set in the environment, resolve it. */
     val = secure_getenv("KRB5RCACHENAME");
     if (val != NULL)
-        return k5_rc_resolve(context, val, rc_out);
+        return resolve_default(context, val, rc_out);
 
     /* If KRB5RCACHETYPE is set in the environment, resolve it with an empty
      * residual (primarily to support KRB5RCACHETYPE=none). */
@@ -44,7 +92,7 @@ k5_rc_default(krb5_context context, krb5_rcache *rc_out)
     if (val != NULL) {
         if (asprintf(&rcname, "%s:", val) < 0)
             return ENOMEM;
-        ret = k5_rc_resolve(context, rcname, rc_out);
+        ret = resolve_default(context, rcname, rc_out);
         free(rcname);
         return ret;
     }
@@ -58,7 +106,7 @@ k5_rc_default(krb5_context context, krb5_rcache *rc_out)
         profile_release_string(profstr);
         if (ret)
             return ret;
-        ret = k5_rc_resolve(context, rcname, rc_out);
+        ret = resolve_default(context, rcname, rc_out);
         free(rcname);
         return ret;
     }
@@ -67,7 +67,7 @@ open_file(krb5_context context, int *fd_out)
             return ret;
     }
 
-    *fd_out = open(fname, O_CREAT | O_RDWR | O_BINARY, 0600);
+    *fd_out = open(fname, O_CREAT | O_RDWR | O_BINARY | O_CLOEXEC, 0600);
     ret = (*fd_out < 0) ? errno : 0;
     if (ret) {
         k5_setmsg(context, ret, "%s (filename: %s)",
@@ -100,7 +100,7 @@ open_file(krb5_context context, int *fd_out)
     if (asprintf(&fname, "%s/krb5_%lu.rcache2", dir, (unsigned long)euid) < 0)
         return ENOMEM;
 
-    fd = open(fname, O_CREAT | O_RDWR | O_NOFOLLOW, 0600);
+    fd = open(fname, O_CREAT | O_RDWR | O_NOFOLLOW | O_CLOEXEC, 0600);
     if (fd < 0) {
         ret = errno;
         k5_setmsg(context, ret, "%s (filename: %s)",
@@ -131,28 +131,42 @@ cleanup:
 static krb5_error_code
 dfl_resolve(krb5_context context, const char *residual, void **rcdata_out)
 {
+    krb5_error_code ret;
+    struct k5_rcfile2_file *file, init = K5_RCFILE2_FILE_INIT;
+
     *rcdata_out = NULL;
+    file = k5alloc(sizeof(*file), &ret);
+    if (file == NULL)
+        return ret;
+    *file = init;
+    *rcdata_out = file;
     return 0;
 }
 
 static void
 dfl_close(krb5_context context, void *rcdata)
 {
+    k5_rcfile2_close_file(rcdata);
+    free(rcdata);
 }
 
 static krb5_error_code
 dfl_store(krb5_context context, void *rcdata, const krb5_data *tag)
 {
     krb5_error_code ret;
+    struct k5_rcfile2_file *file = rcdata;
     int fd;
 
-    ret = open_file(context, &fd);
-    if (ret)
-        return ret;
-
-    ret = k5_rcfile2_store(context, fd, tag);
-    close(fd);
-    return ret;
+    /* Open the file on the first store, or again if it has been removed or
+     * this is a child of the process which opened it. */
+    k5_rcfile2_check_file(file);
+    if (file->fd == -1) {
+        ret = open_file(context, &fd);
+        if (ret)
+            return ret;
+        k5_rcfile2_set_fd(file, fd);
+    }
+    return k5_rcfile2_store_file(context, file, tag);
 }
 
 const krb5_rc_ops k5_rc_dfl_ops =
@@ -36,12 +36,22 @@
 #ifndef _WIN32
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 #define MAX_SIZE INT32_MAX
 #define TAG_LEN 12
 #define RECORD_LEN (TAG_LEN + 4)
 #define FIRST_TABLE_RECORDS 1023
+#define MIN_MAP_LEN 65536
+
+/* A replay cache file open and locked for a store.  If map is not NULL, it
+ * contains the first size bytes of the file. */
+struct view {
+    int fd;
+    const uint8_t *map;
+    off_t size;
+};
 
 /* Return the offset and number of records in the next table.  *offset should
  * initially be -1. */
@@ -68,33 +78,39 @@ next_table(off_t *offset, off_t *nrecords)
     return 0;
 }
 
-/* Read up to two records from fd at offset, and parse them out into tags and
- * timestamps.  Place the number of records read in *nread. */
+/* Read up to two records from the file at offset, and parse them out into tags
+ * and timestamps.  Place the number of records read in *nread. */
 static krb5_error_code
-read_records(int fd, off_t offset, uint8_t tag1_out[TAG_LEN],
+read_records(const struct view *v, off_t offset, uint8_t tag1_out[TAG_LEN],
              uint32_t *timestamp1_out, uint8_t tag2_out[TAG_LEN],
              uint32_t *timestamp2_out, int *nread)
 {
     uint8_t buf[RECORD_LEN * 2];
+    const uint8_t *p = buf;
     ssize_t st;
 
     *nread = 0;
 
-    st = lseek(fd, offset, SEEK_SET);
-    if (st == -1)
-        return errno;
-    st = read(fd, buf, RECORD_LEN * 2);
-    if (st == -1)
-        return errno;
+    if (v->map != NULL) {
+        p = v->map + offset;
+        st = (offset < v->size) ? v->size - offset : 0;
+    } else {
+        st = lseek(v->fd, offset, SEEK_SET);
+        if (st == -1)
+            return errno;
+        st = read(v->fd, buf, RECORD_LEN * 2);
+        if (st == -1)
+            return errno;
+    }
 
     if (st >= RECORD_LEN) {
-        memcpy(tag1_out, buf, TAG_LEN);
-        *timestamp1_out = load_32_be(buf + TAG_LEN);
+        memcpy(tag1_out, p, TAG_LEN);
+        *timestamp1_out = load_32_be(p + TAG_LEN);
         *nread = 1;
     }
-    if (st == RECORD_LEN * 2) {
-        memcpy(tag2_out, buf + RECORD_LEN, TAG_LEN);
-        *timestamp2_out = load_32_be(buf + RECORD_LEN + TAG_LEN);
+    if (st >= RECORD_LEN * 2) {
+        memcpy(tag2_out, p + RECORD_LEN, TAG_LEN);
+        *timestamp2_out = load_32_be(p + RECORD_LEN + TAG_LEN);
         *nread = 2;
     }
     return 0;
@@ -131,11 +147,10 @@ expired(uint32_t timestamp, uint32_t now, uint32_t skew)
     return ts_after(now, ts_incr(timestamp, skew));
 }
 
-/* Check and store a record into an open and locked file.  fd is assumed to be
- * at offset 0. */
+/* Check and store a record into an open and locked file. */
 static krb5_error_code
-store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
-      uint32_t skew)
+store(krb5_context context, const struct view *v, const uint8_t tag[TAG_LEN],
+      uint32_t now, uint32_t skew)
 {
     krb5_error_code ret;
     krb5_data d;
@@ -146,15 +161,26 @@ store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
     uint32_t r1stamp, r2stamp;
 
     /* Read or generate the hash seed. */
-    st = read(fd, seed, sizeof(seed));
-    if (st < 0)
-        return errno;
+    if (v->map != NULL && v->size >= (off_t)sizeof(seed)) {
+        memcpy(seed, v->map, sizeof(seed));
+        st = sizeof(seed);
+    } else {
+        st = lseek(v->fd, 0, SEEK_SET);
+        if (st == -1)
+            return errno;
+        st = read(v->fd, seed, sizeof(seed));
+        if (st < 0)
+            return errno;
+    }
     if ((size_t)st < sizeof(seed)) {
         d = make_data(seed, sizeof(seed));
         ret = krb5_c_random_make_octets(context, &d);
         if (ret)
             return ret;
-        st = write(fd, seed, sizeof(seed));
+        st = lseek(v->fd, 0, SEEK_SET);
+        if (st == -1)
+            return errno;
+        st = write(v->fd, seed, sizeof(seed));
         if (st < 0)
             return errno;
         if ((size_t)st != sizeof(seed))
@@ -169,7 +195,7 @@ store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
         ind = k5_siphash24(tag, TAG_LEN, seed) % nrecords;
         record_offset = table_offset + ind * RECORD_LEN;
 
-        ret = read_records(fd, record_offset, r1tag, &r1stamp, r2tag, &r2stamp,
+        ret = read_records(v, record_offset, r1tag, &r1stamp, r2tag, &r2stamp,
                            &nread);
         if (ret)
             return ret;
@@ -190,71 +216,216 @@ store(krb5_context context, int fd, const uint8_t tag[TAG_LEN], uint32_t now,
         /* Stop searching if we encountered an empty record or one beyond the
          * end of the file, as tag would have been written there previously. */
         if (nread < 2 || !r1stamp || !r2stamp)
-            return write_record(fd, avail_offset, tag, now);
+            return write_record(v->fd, avail_offset, tag, now);
 
         /* Use a different hash seed for the next table we search. */
         seed[0]++;
     }
 }
 
+/* Extract a tag from the authenticator checksum in tag_data. */
+static const uint8_t *
+get_tag(const krb5_data *tag_data, uint8_t tagbuf[TAG_LEN])
+{
+    if (tag_data->length >= TAG_LEN)
+        return (uint8_t *)tag_data->data;
+    memcpy(tagbuf, tag_data->data, tag_data->length);
+    memset(tagbuf + tag_data->length, 0, TAG_LEN - tag_data->length);
+    return tagbuf;
+}
+
 krb5_error_code
 k5_rcfile2_store(krb5_context context, int fd, const krb5_data *tag_data)
 {
     krb5_error_code ret;
     krb5_timestamp now;
-    uint8_t tagbuf[TAG_LEN], *tag;
+    struct view v = { fd, NULL, 0 };
+    uint8_t tagbuf[TAG_LEN];
+    const uint8_t *tag;
 
     ret = krb5_timeofday(context, &now);
     if (ret)
         return ret;
-
-    /* Extract a tag from the authenticator checksum. */
-    if (tag_data->length >= TAG_LEN) {
-        tag = (uint8_t *)tag_data->data;
-    } else {
-        memcpy(tagbuf, tag_data->data, tag_data->length);
-        memset(tagbuf + tag_data->length, 0, TAG_LEN - tag_data->length);
-        tag = tagbuf;
-    }
+    tag = get_tag(tag_data, tagbuf);
 
     ret = krb5_lock_file(context, fd, KRB5_LOCKMODE_EXCLUSIVE);
     if (ret)
         return ret;
-    ret = store(context, fd, tag, now, context->clockskew);
+    ret = store(context, &v, tag, now, context->clockskew);
     (void)krb5_unlock_file(NULL, fd);
     return ret;
 }
 
+#ifndef _WIN32
+
+static void
+unmap_file(struct k5_rcfile2_file *file)
+{
+    if (file->map != NULL)
+        (void)munmap(file->map, file->maplen);
+    file->map = NULL;
+    file->maplen = 0;
+}
+
+/* Make sure file's mapping covers size bytes.  The mapping is extended beyond
+ * the end of the file, so that it rarely needs to be replaced as new tables
+ * are added; only the first size bytes are ever accessed.  If the file cannot
+ * be mapped, leave file->map NULL and let the caller read records instead. */
+static void
+update_map(struct k5_rcfile2_file *file, off_t size)
+{
+    size_t len;
+    void *addr;
+
+    if (file->map != NULL && (uint64_t)size <= file->maplen)
+        return;
+    unmap_file(file);
+    if (size <= 0 || (uint64_t)size > SIZE_MAX / 2)
+        return;
+
+    for (len = MIN_MAP_LEN; len < (size_t)size; len *= 2);
+    addr = mmap(NULL, len, PROT_READ, MAP_SHARED, file->fd, 0);
+    if (addr == MAP_FAILED)
+        return;
+    file->map = addr;
+    file->maplen = len;
+}
+
+#else /* _WIN32 */
+
+static void
+unmap_file(struct k5_rcfile2_file *file)
+{
+}
+
+static void
+update_map(struct k5_rcfile2_file *file, off_t size)
+{
+}
+
+#endif /* _WIN32 */
+
+krb5_error_code
+k5_rcfile2_store_file(krb5_context context, struct k5_rcfile2_file *file,
+                      const krb5_data *tag_data)
+{
+    krb5_error_code ret;
+    krb5_timestamp now;
+    struct stat statbuf;
+    struct view v = { file->fd, NULL, 0 };
+    uint8_t tagbuf[TAG_LEN];
+    const uint8_t *tag;
+
+    ret = krb5_timeofday(context, &now);
+    if (ret)
+        return ret;
+    tag = get_tag(tag_data, tagbuf);
+
+    ret = krb5_lock_file(context, file->fd, KRB5_LOCKMODE_EXCLUSIVE);
+    if (ret)
+        return ret;
+
+    /* Other processes only extend the file while holding the lock, so its
+     * size cannot change until we release it. */
+    if (fstat(file->fd, &statbuf) == 0) {
+        update_map(file, statbuf.st_size);
+        v.map = file->map;
+        v.size = statbuf.st_size;
+    }
+
+    ret = store(context, &v, tag, now, context->clockskew);
+    (void)krb5_unlock_file(NULL, file->fd);
+    return ret;
+}
+
+void
+k5_rcfile2_check_file(struct k5_rcfile2_file *file)
+{
+    struct stat statbuf;
+
+    if (file->fd == -1)
+        return;
+    if (file->pid != (long)getpid() ||
+        (fstat(file->fd, &statbuf) == 0 && statbuf.st_nlink == 0))
+        k5_rcfile2_close_file(file);
+}
+
+void
+k5_rcfile2_set_fd(struct k5_rcfile2_file *file, int fd)
+{
+    set_cloexec_fd(fd);
+    file->fd = fd;
+    file->pid = getpid();
+}
+
+void
+k5_rcfile2_close_file(struct k5_rcfile2_file *file)
+{
+    unmap_file(file);
+    if (file->fd != -1)
+        close(file->fd);
+    file->fd = -1;
+}
+
+struct file2_data {
+    char *filename;
+    struct k5_rcfile2_file file;
+};
+
 static krb5_error_code
 file2_resolve(krb5_context context, const char *residual, void **rcdata_out)
 {
-    *rcdata_out = strdup(residual);
-    return (*rcdata_out == NULL) ? ENOMEM : 0;
+    krb5_error_code ret;
+    struct file2_data *data;
+    struct k5_rcfile2_file init = K5_RCFILE2_FILE_INIT;
+
+    *rcdata_out = NULL;
+
+    data = k5alloc(sizeof(*data), &ret);
+    if (data == NULL)
+        return ret;
+    data->filename = strdup(residual);
+    if (data->filename == NULL) {
+        free(data);
+        return ENOMEM;
+    }
+    data->file = init;
+    *rcdata_out = data;
+    return 0;
 }
 
 static void
 file2_close(krb5_context context, void *rcdata)
 {
-    free(rcdata);
+    struct file2_data *data = rcdata;
+
+    k5_rcfile2_close_file(&data->file);
+    free(data->filename);
+    free(data);
 }
 
 static krb5_error_code
 file2_store(krb5_context context, void *rcdata, const krb5_data *tag)
 {
     krb5_error_code ret;
-    const char *filename = rcdata;
+    struct file2_data *data = rcdata;
     int fd;
 
-    fd = open(filename, O_CREAT | O_RDWR | O_BINARY, 0600);
-    if (fd < 0) {
-        ret = errno;
-        k5_setmsg(context, ret, "%s (filename: %s)", error_message(ret),
-                  filename);
-        return ret;
+    /* Keep the file open between stores, but start over with a new file if
+     * it has been removed. */
+    k5_rcfile2_check_file(&data->file);
+    if (data->file.fd == -1) {
+        fd = open(data->filename, O_CREAT | O_RDWR | O_BINARY | O_CLOEXEC,
+                  0600);
+        if (fd < 0) {
+            ret = errno;
+            k5_setmsg(context, ret, "%s (filename: %s)", error_message(ret),
+                      data->filename);
+            return ret;
+        }
+        k5_rcfile2_set_fd(&data->file, fd);
     }
-    ret = k5_rcfile2_store(context, fd, tag);
-    close(fd);
-    return ret;
+    return k5_rcfile2_store_file(context, &data->file, tag);
 }
 
 const krb5_rc_ops k5_rc_file2_ops =
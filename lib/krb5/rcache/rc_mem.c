@@ -0,0 +1,89 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/rcache/rc_mem.c - in-memory replay cache type */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The mem replay cache type keeps records in a memrcache owned by the handle,
+ * for single-process acceptors which hold a handle for their lifetime (such as
+ * a GSS acceptor credential).  The residual is empty or gives the memory limit
+ * in bytes.  Stores fail with KRB5_RC_IO_SPACE rather than discarding live
+ * records when the limit is reached.
+ */
+
+#include "k5-int.h"
+#include "rc-int.h"
+#include "memrcache.h"
+#include <ctype.h>
+
+static krb5_error_code
+mem_resolve(krb5_context context, const char *residual, void **rcdata_out)
+{
+    unsigned long max_size = 0;
+    char *end;
+
+    *rcdata_out = NULL;
+
+    if (*residual != '\0') {
+        errno = 0;
+        max_size = strtoul(residual, &end, 10);
+        if (errno != 0 || *end != '\0' || !isdigit((unsigned char)*residual)) {
+            k5_setmsg(context, KRB5_RC_PARSE,
+                      _("Invalid memory replay cache size: %s"), residual);
+            return KRB5_RC_PARSE;
+        }
+    }
+
+    return k5_memrcache_create(context, max_size, K5_MEMRCACHE_REJECT,
+                               (k5_memrcache *)rcdata_out);
+}
+
+static void
+mem_close(krb5_context context, void *rcdata)
+{
+    struct k5_memrcache_stats stats;
+
+    k5_memrcache_get_stats(rcdata, &stats);
+    TRACE_RC_MEM_STATS(context, &stats);
+    k5_memrcache_free(context, rcdata);
+}
+
+static krb5_error_code
+mem_store(krb5_context context, void *rcdata, const krb5_data *tag)
+{
+    return k5_memrcache_store(context, rcdata, tag);
+}
+
+const krb5_rc_ops k5_rc_mem_ops = {
+    "mem",
+    mem_resolve,
+    mem_close,
+    mem_store
+};
@@ -0,0 +1,570 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/rcache/rc_shm.c - shared-memory replay cache */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * The shm replay cache type keeps records in a fixed-size hash table within a
+ * file which every process using the cache maps into memory, so that the
+ * worker processes of a multi-process acceptor can detect replays without
+ * reading or writing the file.  The residual is the name of the
+ * file, which should reside on a local (preferably memory-backed) filesystem.
+ * With an empty residual, a per-user file is used in the same directory as the
+ * dfl replay cache.
+ *
+ * The table is divided into stripes, each protected by a record lock on a byte
+ * of the file, along with a mutex for the threads of this process.  A record
+ * is stored within a small window of slots in the stripe
+ * selected by its hash, reusing the first slot which is empty or holds an
+ * expired record.  If the window is full of live records, the record is
+ * instead stored in a file2 replay cache named after the table file with
+ * ".file2" appended, and the stripe sends all of its records there until the
+ * last of them expires.
+ *
+ * Stripe locks are held only briefly.  If a process dies while holding one,
+ * the operating system releases it.  A record interrupted by a crash can at
+ * worst fail to match a replay of its authenticator.
+ *
+ * Record locks belong to a process, and closing any descriptor for the file
+ * releases all of the process's locks on it.  So each process keeps a single
+ * descriptor open for each table file it maps, and finds existing mappings by
+ * file identity rather than by name.
+ */
+
+#include "k5-int.h"
+#include "k5-hashtab.h"
+#include "rc-int.h"
+
+#ifdef USE_SHM_RCACHE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define TAG_LEN 12
+#define SHM_MAGIC 0x52435348    /* "RCSH" */
+#define SHM_VERSION 2
+#define NSTRIPES 256
+#define STRIPE_SLOTS 512
+#define WINDOW_SLOTS 32
+
+struct shm_header {
+    uint32_t magic;             /* SHM_MAGIC once initialized */
+    uint32_t version;
+    uint32_t nstripes;
+    uint32_t stripe_slots;
+    uint8_t seed[K5_HASH_SEED_LEN];
+    uint8_t pad[32];
+};
+
+/* Each stripe header occupies its own cache line.  The stripe lock is a
+ * record lock on the first byte of its header. */
+struct shm_stripe {
+    uint32_t overflow;          /* time of the last overflow record, or 0 */
+    uint8_t pad[60];
+};
+
+struct shm_slot {
+    uint8_t tag[TAG_LEN];
+    uint32_t stamp;             /* 0 if the slot has never been used */
+};
+
+#define MAP_LEN (sizeof(struct shm_header) +                            \
+                 NSTRIPES * sizeof(struct shm_stripe) +                 \
+                 NSTRIPES * STRIPE_SLOTS * sizeof(struct shm_slot))
+
+/* A mapping of a table file, shared by all handles in the process which
+ * resolve to the same file. */
+struct shm_map {
+    struct shm_map *next;
+    char *path;
+    char *overflow_path;
+    krb5_boolean safe;          /* apply open() safety to the overflow file */
+    int fd;                     /* -1 if not open */
+    dev_t dev;
+    ino_t ino;
+    unsigned int refcount;      /* protected by shm_maps_lock */
+    struct shm_header *hdr;
+    struct shm_stripe *stripes;
+    struct shm_slot *slots;
+    int nlocks;                 /* number of initialized stripe mutexes */
+    k5_mutex_t locks[NSTRIPES];
+};
+
+/* The list of mappings holds a reference to each, so that a process which
+ * resolves and closes a cache per authentication doesn't remap the table each
+ * time. */
+static k5_mutex_t shm_maps_lock = K5_MUTEX_PARTIAL_INITIALIZER;
+static struct shm_map *shm_maps;
+
+/* Return true if timestamp is expired, for the current timestamp (now) and
+ * allowable clock skew. */
+static inline krb5_boolean
+expired(uint32_t timestamp, uint32_t now, uint32_t skew)
+{
+    return ts_after(now, ts_incr(timestamp, skew));
+}
+
+static void
+free_map(struct shm_map *map)
+{
+    int i;
+
+    if (map == NULL)
+        return;
+    if (map->hdr != NULL)
+        munmap(map->hdr, MAP_LEN);
+    if (map->fd != -1)
+        close(map->fd);
+    for (i = 0; i < map->nlocks; i++)
+        k5_mutex_destroy(&map->locks[i]);
+    free(map->path);
+    free(map->overflow_path);
+    free(map);
+}
+
+static void
+release_map(struct shm_map *map)
+{
+    krb5_boolean last;
+
+    if (map == NULL)
+        return;
+    k5_mutex_lock(&shm_maps_lock);
+    last = (--map->refcount == 0);
+    k5_mutex_unlock(&shm_maps_lock);
+    if (last)
+        free_map(map);
+}
+
+/* Choose the table filename for an empty residual, in the manner of the dfl
+ * type. */
+static krb5_error_code
+default_path(char **path_out)
+{
+    const char *dir;
+
+    *path_out = NULL;
+    dir = secure_getenv("KRB5RCACHEDIR");
+    if (dir == NULL) {
+        dir = secure_getenv("TMPDIR");
+        if (dir == NULL)
+            dir = RCTMPDIR;
+    }
+    if (asprintf(path_out, "%s/krb5_%lu.rcshm", dir,
+                 (unsigned long)geteuid()) < 0) {
+        *path_out = NULL;
+        return ENOMEM;
+    }
+    return 0;
+}
+
+/* Initialize the header of a newly created or incompletely initialized table.
+ * The table file is locked. */
+static krb5_error_code
+init_header(krb5_context context, struct shm_header *hdr)
+{
+    krb5_error_code ret;
+    krb5_data d;
+
+    hdr->version = SHM_VERSION;
+    hdr->nstripes = NSTRIPES;
+    hdr->stripe_slots = STRIPE_SLOTS;
+    d = make_data(hdr->seed, sizeof(hdr->seed));
+    ret = krb5_c_random_make_octets(context, &d);
+    if (ret)
+        return ret;
+
+    /* Set the magic number last, so that the header is reinitialized if we
+     * crash before completing it. */
+    __atomic_store_n(&hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Open, lock, and map the table file at path, creating or initializing it if
+ * necessary.  If safe is true, require that the file be owned by the effective
+ * uid and not be a symbolic link. */
+static krb5_error_code
+open_map(krb5_context context, const char *path, krb5_boolean safe,
+         struct shm_map **map_out)
+{
+    krb5_error_code ret;
+    struct shm_map *map = NULL;
+    struct stat st;
+    void *addr;
+    int fd, flags = O_CREAT | O_RDWR | O_BINARY | O_CLOEXEC;
+    krb5_boolean locked = FALSE;
+
+    *map_out = NULL;
+
+    if (safe)
+        flags |= O_NOFOLLOW;
+    fd = open(path, flags, 0600);
+    if (fd < 0) {
+        ret = errno;
+        k5_setmsg(context, ret, "%s (filename: %s)", error_message(ret),
+                  path);
+        return ret;
+    }
+    set_cloexec_fd(fd);
+
+    ret = krb5_lock_file(context, fd, KRB5_LOCKMODE_EXCLUSIVE);
+    if (ret)
+        goto cleanup;
+    locked = TRUE;
+
+    if (fstat(fd, &st) != 0) {
+        ret = errno;
+        goto cleanup;
+    }
+    if (safe && st.st_uid != geteuid()) {
+        ret = EIO;
+        k5_setmsg(context, ret, "Replay cache file %s is not owned by uid %lu",
+                  path, (unsigned long)geteuid());
+        goto cleanup;
+    }
+
+    /* Extending the file fills the table with empty slots. */
+    if (st.st_size < (off_t)MAP_LEN && ftruncate(fd, MAP_LEN) != 0) {
+        ret = errno;
+        goto cleanup;
+    }
+
+    map = k5alloc(sizeof(*map), &ret);
+    if (map == NULL)
+        goto cleanup;
+    map->refcount = 1;
+    map->fd = -1;
+    map->safe = safe;
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+    map->path = strdup(path);
+    if (map->path == NULL ||
+        asprintf(&map->overflow_path, "%s.file2", path) < 0) {
+        map->overflow_path = NULL;
+        ret = ENOMEM;
+        goto cleanup;
+    }
+
+    addr = mmap(NULL, MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ret = errno;
+        goto cleanup;
+    }
+    map->hdr = addr;
+    map->stripes = (struct shm_stripe *)(map->hdr + 1);
+    map->slots = (struct shm_slot *)(map->stripes + NSTRIPES);
+
+    for (; map->nlocks < NSTRIPES; map->nlocks++) {
+        ret = k5_mutex_init(&map->locks[map->nlocks]);
+        if (ret)
+            goto cleanup;
+    }
+
+    if (map->hdr->magic == 0) {
+        ret = init_header(context, map->hdr);
+        if (ret)
+            goto cleanup;
+    } else if (map->hdr->magic != SHM_MAGIC ||
+               map->hdr->version != SHM_VERSION ||
+               map->hdr->nstripes != NSTRIPES ||
+               map->hdr->stripe_slots != STRIPE_SLOTS) {
+        ret = KRB5_RC_IO_UNKNOWN;
+        k5_setmsg(context, ret, _("Replay cache file %s has an unrecognized "
+                                  "format"), path);
+        goto cleanup;
+    }
+
+cleanup:
+    if (locked)
+        (void)krb5_unlock_file(context, fd);
+    if (ret) {
+        close(fd);
+        free_map(map);
+        return ret;
+    }
+
+    /* The stripe locks of this process are only held while the descriptor
+     * stays open. */
+    map->fd = fd;
+    *map_out = map;
+    return 0;
+}
+
+static krb5_error_code
+shm_resolve(krb5_context context, const char *residual, void **rcdata_out)
+{
+    krb5_error_code ret;
+    struct shm_map *map, *old = NULL, **mpp;
+    struct stat st;
+    char *path = NULL;
+    krb5_boolean safe = FALSE;
+
+    *rcdata_out = NULL;
+
+    if (*residual == '\0') {
+        ret = default_path(&path);
+        if (ret)
+            return ret;
+        residual = path;
+        safe = TRUE;
+    }
+
+    /*
+     * Reuse this process's mapping of the file, whatever name it was mapped
+     * under.  Keep shm_maps_lock while mapping a new file, so that no other
+     * thread opens (and later closes) a second descriptor for it.
+     */
+    k5_mutex_lock(&shm_maps_lock);
+    if (stat(residual, &st) == 0) {
+        for (map = shm_maps; map != NULL; map = map->next) {
+            if (st.st_dev == map->dev && st.st_ino == map->ino)
+                break;
+        }
+        if (map != NULL) {
+            map->refcount++;
+            k5_mutex_unlock(&shm_maps_lock);
+            *rcdata_out = map;
+            free(path);
+            return 0;
+        }
+    }
+
+    ret = open_map(context, residual, safe, &map);
+    if (ret) {
+        k5_mutex_unlock(&shm_maps_lock);
+        goto cleanup;
+    }
+
+    /* Replace any stale mapping of the same name in the list. */
+    for (mpp = &shm_maps; *mpp != NULL; mpp = &(*mpp)->next) {
+        if (strcmp((*mpp)->path, residual) == 0) {
+            old = *mpp;
+            *mpp = old->next;
+            break;
+        }
+    }
+    map->next = shm_maps;
+    shm_maps = map;
+    map->refcount++;
+    k5_mutex_unlock(&shm_maps_lock);
+    release_map(old);
+
+    *rcdata_out = map;
+
+cleanup:
+    free(path);
+    return ret;
+}
+
+static void
+shm_close(krb5_context context, void *rcdata)
+{
+    release_map(rcdata);
+}
+
+/* Set or release the record lock for stripe ind of map. */
+static krb5_error_code
+stripe_record_lock(struct shm_map *map, size_t ind, int type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = sizeof(struct shm_header) + ind * sizeof(struct shm_stripe);
+    fl.l_len = 1;
+    while (fcntl(map->fd, F_SETLKW, &fl) == -1) {
+        if (errno != EINTR)
+            return errno;
+    }
+    return 0;
+}
+
+/* Lock stripe ind of map against other threads and processes. */
+static krb5_error_code
+lock_stripe(struct shm_map *map, size_t ind)
+{
+    krb5_error_code ret;
+
+    k5_mutex_lock(&map->locks[ind]);
+    ret = stripe_record_lock(map, ind, F_WRLCK);
+    if (ret)
+        k5_mutex_unlock(&map->locks[ind]);
+    return ret;
+}
+
+static void
+unlock_stripe(struct shm_map *map, size_t ind)
+{
+    (void)stripe_record_lock(map, ind, F_UNLCK);
+    k5_mutex_unlock(&map->locks[ind]);
+}
+
+/* Store a record in the overflow file2 cache for map, applying the same
+ * open() safety as for the table file. */
+static krb5_error_code
+store_overflow(krb5_context context, struct shm_map *map,
+               const krb5_data *tag_data)
+{
+    krb5_error_code ret;
+    struct stat st;
+    int fd, flags = O_CREAT | O_RDWR | O_BINARY | O_CLOEXEC;
+
+    if (map->safe)
+        flags |= O_NOFOLLOW;
+    fd = open(map->overflow_path, flags, 0600);
+    if (fd < 0) {
+        ret = errno;
+        k5_setmsg(context, ret, "%s (filename: %s)", error_message(ret),
+                  map->overflow_path);
+        return ret;
+    }
+    set_cloexec_fd(fd);
+    if (map->safe && (fstat(fd, &st) != 0 || st.st_uid != geteuid())) {
+        close(fd);
+        ret = EIO;
+        k5_setmsg(context, ret, "Replay cache file %s is not owned by uid %lu",
+                  map->overflow_path, (unsigned long)geteuid());
+        return ret;
+    }
+    ret = k5_rcfile2_store(context, fd, tag_data);
+    close(fd);
+    return ret;
+}
+
+/* Check and store a record in a locked stripe. */
+static krb5_error_code
+store(krb5_context context, struct shm_map *map, struct shm_stripe *stripe,
+      struct shm_slot *slots, size_t home, const uint8_t tag[TAG_LEN],
+      const krb5_data *tag_data, uint32_t now, uint32_t skew)
+{
+    krb5_error_code ret;
+    struct shm_slot *slot, *avail = NULL;
+    size_t i;
+
+    for (i = 0; i < WINDOW_SLOTS; i++) {
+        slot = &slots[(home + i) % STRIPE_SLOTS];
+
+        /* Records are always stored in the first available slot and slots
+         * are never emptied, so tag cannot appear beyond an empty slot. */
+        if (slot->stamp == 0) {
+            if (avail == NULL)
+                avail = slot;
+            break;
+        }
+        if (memcmp(slot->tag, tag, TAG_LEN) == 0)
+            return KRB5KRB_AP_ERR_REPEAT;
+        if (avail == NULL && expired(slot->stamp, now, skew))
+            avail = slot;
+    }
+
+    /* Use the overflow cache if the window is full, or if it may hold live
+     * records for this stripe. */
+    if (stripe->overflow != 0 && expired(stripe->overflow, now, skew))
+        stripe->overflow = 0;
+    if (avail == NULL || stripe->overflow != 0) {
+        ret = store_overflow(context, map, tag_data);
+        if (!ret)
+            stripe->overflow = now;
+        return ret;
+    }
+
+    memcpy(avail->tag, tag, TAG_LEN);
+    avail->stamp = now;
+    return 0;
+}
+
+static krb5_error_code
+shm_store(krb5_context context, void *rcdata, const krb5_data *tag_data)
+{
+    krb5_error_code ret;
+    struct shm_map *map = rcdata;
+    struct shm_stripe *stripe;
+    krb5_timestamp now;
+    uint8_t tagbuf[TAG_LEN], *tag;
+    uint64_t hashval;
+    size_t ind;
+
+    ret = krb5_timeofday(context, &now);
+    if (ret)
+        return ret;
+
+    /* Extract a tag from the authenticator checksum. */
+    if (tag_data->length >= TAG_LEN) {
+        tag = (uint8_t *)tag_data->data;
+    } else {
+        memcpy(tagbuf, tag_data->data, tag_data->length);
+        memset(tagbuf + tag_data->length, 0, TAG_LEN - tag_data->length);
+        tag = tagbuf;
+    }
+
+    hashval = k5_siphash24(tag, TAG_LEN, map->hdr->seed);
+    ind = hashval % NSTRIPES;
+    stripe = &map->stripes[ind];
+
+    ret = lock_stripe(map, ind);
+    if (ret)
+        return ret;
+    ret = store(context, map, stripe, map->slots + ind * STRIPE_SLOTS,
+                (hashval / NSTRIPES) % STRIPE_SLOTS, tag, tag_data, now,
+                context->clockskew);
+    unlock_stripe(map, ind);
+    return ret;
+}
+
+int
+k5_rcshm_initialize(void)
+{
+    return k5_mutex_finish_init(&shm_maps_lock);
+}
+
+void
+k5_rcshm_finalize(void)
+{
+    struct shm_map *map, *next;
+
+    for (map = shm_maps; map != NULL; map = next) {
+        next = map->next;
+        release_map(map);
+    }
+    shm_maps = NULL;
+    k5_mutex_destroy(&shm_maps_lock);
+}
+
+const krb5_rc_ops k5_rc_shm_ops =
+{
+    "shm",
+    shm_resolve,
+    shm_close,
+    shm_store
+};
+
+#endif /* USE_SHM_RCACHE */
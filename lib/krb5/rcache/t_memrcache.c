@@ -32,49 +32,109 @@
 
 #include "memrcache.c"
 
+static krb5_context context;
+
+static krb5_error_code
+store(k5_memrcache mrc, uint32_t id, krb5_timestamp now)
+{
+    uint8_t tag[4];
+    krb5_data tag_data = make_data(tag, 4);
+
+    store_32_be(id, tag);
+    krb5_set_debugging_time(context, now, 0);
+    return k5_memrcache_store(context, mrc, &tag_data);
+}
+
+/* Create a replay cache with room for nentries four-byte tags. */
+static k5_memrcache
+create(size_t nentries, enum k5_memrcache_overflow overflow)
+{
+    krb5_error_code ret;
+    k5_memrcache mrc;
+    size_t size = sizeof(struct entry) + 4 + HASHTAB_OVERHEAD;
+
+    krb5_set_debugging_time(context, 1000, 0);
+    ret = k5_memrcache_create(context, nentries * size, overflow, &mrc);
+    assert(ret == 0);
+    return mrc;
+}
+
 int
 main()
 {
     krb5_error_code ret;
-    krb5_context context;
     k5_memrcache mrc;
-    int i;
-    uint8_t tag[4];
-    krb5_data tag_data = make_data(tag, 4);
-    struct entry *e;
+    struct k5_memrcache_stats stats;
+    uint32_t i;
 
     ret = krb5_init_context(&context);
     assert(ret == 0);
+    context->clockskew = 100;
 
     /* Store a thousand unique tags, then verify that they all appear as
      * replays. */
-    ret = k5_memrcache_create(context, &mrc);
-    assert(ret == 0);
-    for (i = 0; i < 1000; i++) {
-        store_32_be(i, tag);
-        ret = k5_memrcache_store(context, mrc, &tag_data);
-        assert(ret == 0);
-    }
-    for (i = 0; i < 1000; i++) {
-        store_32_be(i, tag);
-        ret = k5_memrcache_store(context, mrc, &tag_data);
-        assert(ret == KRB5KRB_AP_ERR_REPEAT);
-    }
+    mrc = create(1000, K5_MEMRCACHE_REJECT);
+    for (i = 0; i < 1000; i++)
+        assert(store(mrc, i, 1000) == 0);
+    for (i = 0; i < 1000; i++)
+        assert(store(mrc, i, 1000) == KRB5KRB_AP_ERR_REPEAT);
+    k5_memrcache_get_stats(mrc, &stats);
+    assert(stats.stores == 1000 && stats.replays == 1000);
+    assert(stats.entries == 1000 && stats.size == stats.max_size);
     k5_memrcache_free(context, mrc);
 
     /* Store a thousand unique tags, each spaced out so that previous entries
-     * appear as expired.  Verify that the expiration queue has one entry. */
-    ret = k5_memrcache_create(context, &mrc);
-    assert(ret == 0);
+     * appear as expired.  Verify that only one entry remains. */
+    mrc = create(1000, K5_MEMRCACHE_REJECT);
+    for (i = 1; i < 1000; i++)
+        assert(store(mrc, i, i * 200) == 0);
+    k5_memrcache_get_stats(mrc, &stats);
+    assert(stats.entries == 1 && stats.expired == 998);
+    k5_memrcache_free(context, mrc);
+
+    /* Entries which expire more than a lap of the timer wheel ahead must
+     * survive the wheel passing their slot. */
+    context->clockskew = WHEEL_SLOTS * 3;
+    mrc = create(10, K5_MEMRCACHE_REJECT);
+    assert(store(mrc, 0, 1000) == 0);
+    for (i = 1; i <= 3; i++)
+        assert(store(mrc, 0, 1000 + i * WHEEL_SLOTS) == KRB5KRB_AP_ERR_REPEAT);
+    assert(store(mrc, 0, 1001 + 3 * WHEEL_SLOTS) == 0);
+    k5_memrcache_free(context, mrc);
     context->clockskew = 100;
-    for (i = 1; i < 1000; i++) {
-        krb5_set_debugging_time(context, i * 200, 0);
-        store_32_be(i, tag);
-        ret = k5_memrcache_store(context, mrc, &tag_data);
-        assert(ret == 0);
-    }
-    e = K5_TAILQ_FIRST(&mrc->expiration_queue);
-    assert(e != NULL && K5_TAILQ_NEXT(e, links) == NULL);
+
+    /* A clock which steps backwards doesn't lose entries. */
+    mrc = create(10, K5_MEMRCACHE_REJECT);
+    assert(store(mrc, 0, 5000) == 0);
+    assert(store(mrc, 1, 4000) == 0);
+    assert(store(mrc, 0, 5050) == KRB5KRB_AP_ERR_REPEAT);
+    assert(store(mrc, 1, 4050) == KRB5KRB_AP_ERR_REPEAT);
+    k5_memrcache_free(context, mrc);
+
+    /* When full, the reject policy fails stores until entries expire. */
+    mrc = create(10, K5_MEMRCACHE_REJECT);
+    for (i = 0; i < 10; i++)
+        assert(store(mrc, i, 1000 + i) == 0);
+    assert(store(mrc, 10, 1010) == KRB5_RC_IO_SPACE);
+    for (i = 0; i < 10; i++)
+        assert(store(mrc, i, 1010) == KRB5KRB_AP_ERR_REPEAT);
+    assert(store(mrc, 10, 1101) == 0);
+    k5_memrcache_get_stats(mrc, &stats);
+    assert(stats.rejected == 1 && stats.expired == 1 && stats.entries == 10);
+    k5_memrcache_free(context, mrc);
+
+    /* When full, the evict policy discards the entries closest to
+     * expiring. */
+    mrc = create(10, K5_MEMRCACHE_EVICT);
+    for (i = 0; i < 20; i++)
+        assert(store(mrc, i, 1000 + i) == 0);
+    for (i = 10; i < 20; i++)
+        assert(store(mrc, i, 1020) == KRB5KRB_AP_ERR_REPEAT);
+    k5_memrcache_get_stats(mrc, &stats);
+    assert(stats.evicted == 10 && stats.entries == 10);
+    assert(stats.rejected == 0 && stats.expired == 0);
+    assert(store(mrc, 0, 1020) == 0);
+    assert(store(mrc, 10, 1020) == 0);
     k5_memrcache_free(context, mrc);
 
     krb5_free_context(context);
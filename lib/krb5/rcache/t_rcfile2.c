@@ -46,6 +46,25 @@
  *     spawn <nprocesses> subprocesses, each of which tries to store the same
  *     tag and reports success or failure.  The master process verifies that
  *     exactly one subprocess succeeds.  Repeat <reps> times.
+ *
+ *   t_rcfile2 <filename> fork <nreps>
+ *     open a replay cache handle, then fork a subprocess which stores a tag
+ *     through the inherited handle at the same time as the master process
+ *     stores it.  Verify that exactly one store succeeds and that the
+ *     subprocess opened the file for itself.  Repeat <nreps> times.
+ *
+ *   t_rcfile2 <filename> remove
+ *     verify that a replay cache handle starts a new file if its file is
+ *     removed between stores.
+ *
+ *   t_rcfile2 <filename> speed <nreps>
+ *     store <nreps> unique tags by opening the file for each store, and then
+ *     again through a replay cache handle, and display the store rates.
+ *
+ * Except in speed mode, tests store records through a replay cache handle
+ * which keeps the file open.  Subprocesses of the concurrent test alternate
+ * between their own handle and opening the file for each store, to check
+ * that the two methods can share a file.
  */
 
 #include "rc_file2.c"
@@ -54,15 +73,53 @@
 
 krb5_context ctx;
 
+/* The replay cache handle for this process, or NULL to open the file for each
+ * store. */
+static struct file2_data *handle;
+static krb5_boolean oneshot;
+
+/* Store a record by opening the file, as done prior to replay cache handles
+ * keeping it open. */
+static krb5_error_code
+oneshot_store(const char *filename, const krb5_data *tag_data)
+{
+    krb5_error_code ret;
+    int fd;
+
+    fd = open(filename, O_CREAT | O_RDWR | O_BINARY, 0600);
+    if (fd < 0)
+        return errno;
+    ret = k5_rcfile2_store(ctx, fd, tag_data);
+    close(fd);
+    return ret;
+}
+
 static krb5_error_code
 test_store(const char *filename, uint8_t *tag, krb5_timestamp timestamp,
            const uint32_t clockskew)
 {
     krb5_data tag_data = make_data(tag, TAG_LEN);
+    void *rcdata;
 
     ctx->clockskew = clockskew;
     (void)krb5_set_debugging_time(ctx, timestamp, 0);
-    return file2_store(ctx, (void *)filename, &tag_data);
+    if (oneshot)
+        return oneshot_store(filename, &tag_data);
+    if (handle == NULL) {
+        if (file2_resolve(ctx, filename, &rcdata) != 0)
+            abort();
+        handle = rcdata;
+    }
+    return file2_store(ctx, handle, &tag_data);
+}
+
+/* Discard the replay cache handle inherited from the parent process. */
+static void
+reset_handle(void)
+{
+    if (handle != NULL)
+        file2_close(ctx, handle);
+    handle = NULL;
 }
 
 /* Store a sequence of unique tags, with timestamps far enough apart that all
@@ -130,6 +187,8 @@ concurrency_test(const char *filename, int nchildren, int reps)
         pids[i] = fork();
         assert(pids[i] != -1);
         if (pids[i] == 0) {
+            reset_handle();
+            oneshot = (i % 2 == 1);
             store_records(filename, i, reps, 0);
             _exit(0);
         }
@@ -159,8 +218,10 @@ race_test(const char *filename, int nchildren, int reps)
         for (j = 0; j < nchildren; j++) {
             pid = fork();
             assert(pid != -1);
-            if (pid == 0)
+            if (pid == 0) {
+                reset_handle();
                 _exit(test_store(filename, tag, 1000, 100) != 0);
+            }
         }
 
         nsuccess = 0;
@@ -174,6 +235,94 @@ race_test(const char *filename, int nchildren, int reps)
     }
 }
 
+/* Fork a child process which keeps the parent's replay cache handle, and have
+ * both processes store the same tag at once.  Verify that only one of them
+ * succeeds, and that the child did not use the parent's open file (which
+ * would share the parent's lock on it).  Repeat reps times. */
+static void
+fork_test(const char *filename, int reps)
+{
+    uint8_t tag[TAG_LEN] = { 0 };
+    char c;
+    int i, nsuccess, status, go[2];
+    pid_t pid;
+
+    /* Open the file in this process. */
+    store_32_be(UINT32_MAX, tag);
+    assert(test_store(filename, tag, 1000, 100) == 0);
+
+    for (i = 0; i < reps; i++) {
+        store_32_be(i, tag);
+        assert(pipe(go) == 0);
+        pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            close(go[1]);
+            assert(read(go[0], &c, 1) == 0);
+            status = (test_store(filename, tag, 1000, 100) != 0);
+            if (handle->file.pid != (long)getpid())
+                status = 2;
+            _exit(status);
+        }
+
+        /* Release the child and store the tag at the same time. */
+        close(go[0]);
+        close(go[1]);
+        nsuccess = (test_store(filename, tag, 1000, 100) == 0);
+        assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status));
+        assert(WEXITSTATUS(status) != 2);
+        if (WEXITSTATUS(status) == 0)
+            nsuccess++;
+        assert(nsuccess == 1);
+    }
+}
+
+/* Verify that a handle starts over with a new file if its file is removed. */
+static void
+remove_test(const char *filename)
+{
+    uint8_t tag[TAG_LEN] = { 0 };
+
+    assert(test_store(filename, tag, 1000, 100) == 0);
+    assert(test_store(filename, tag, 1000, 100) == KRB5KRB_AP_ERR_REPEAT);
+    assert(unlink(filename) == 0);
+    assert(test_store(filename, tag, 1000, 100) == 0);
+    assert(test_store(filename, tag, 1000, 100) == KRB5KRB_AP_ERR_REPEAT);
+    assert(access(filename, F_OK) == 0);
+}
+
+/* Store reps unique tags and return the rate in stores per second. */
+static double
+time_stores(const char *filename, int reps)
+{
+    struct timeval start, end;
+    double elapsed;
+
+    unlink(filename);
+    gettimeofday(&start, NULL);
+    store_records(filename, 0, reps, 0);
+    gettimeofday(&end, NULL);
+    elapsed = (end.tv_sec - start.tv_sec) +
+        (end.tv_usec - start.tv_usec) / 1000000.0;
+    return (elapsed > 0) ? reps / elapsed : 0;
+}
+
+/* Compare the store rates of opening the file for each store and of keeping
+ * it open in a replay cache handle. */
+static void
+speed_test(const char *filename, int reps)
+{
+    double oneshot_rate, handle_rate;
+
+    oneshot = TRUE;
+    oneshot_rate = time_stores(filename, reps);
+    oneshot = FALSE;
+    handle_rate = time_stores(filename, reps);
+    reset_handle();
+    printf("%d stores: %.0f/s opening file, %.0f/s with handle\n", reps,
+           oneshot_rate, handle_rate);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -200,10 +349,19 @@ main(int argc, char **argv)
     } else if (strcmp(cmd, "race") == 0) {
         assert(argv[0] != NULL && argv[1] != NULL);
         race_test(filename, atoi(argv[0]), atoi(argv[1]));
+    } else if (strcmp(cmd, "fork") == 0) {
+        assert(argv[0] != NULL);
+        fork_test(filename, atoi(argv[0]));
+    } else if (strcmp(cmd, "remove") == 0) {
+        remove_test(filename);
+    } else if (strcmp(cmd, "speed") == 0) {
+        assert(argv[0] != NULL);
+        speed_test(filename, atoi(argv[0]));
     } else {
         abort();
     }
 
+    reset_handle();
     krb5_free_context(ctx);
     return 0;
 }
@@ -0,0 +1,329 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* lib/krb5/rcache/t_rcshm.c - shared-memory replay cache tests */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Usage:
+ *
+ *   t_rcshm <filename> expiry <nreps>
+ *     store <nreps> records spaced far enough apart that all records appear
+ *     expired; verify that no record overflows the table.
+ *
+ *   t_rcshm <filename> concurrent <nprocesses> <nreps>
+ *     spawn <nprocesses> subprocesses, each of which stores <nreps> unique
+ *     tags.  As each process completes, the master process tests that the
+ *     records stored by the subprocess appears as replays.
+ *
+ *   t_rcshm <filename> race <nprocesses> <nreps>
+ *     spawn <nprocesses> subprocesses, each of which tries to store the same
+ *     tag and reports success or failure.  The master process verifies that
+ *     exactly one subprocess succeeds.  Repeat <reps> times.
+ *
+ *   t_rcshm <filename> overflow <nreps>
+ *     store <nreps> unique tags with the same timestamp, more than the table
+ *     can hold, and verify that each appears as a replay afterwards.
+ *
+ *   t_rcshm <filename> recovery
+ *     verify that stripe locks held by a dead process are released, that an
+ *     incompletely initialized table is reinitialized, and that mappings are
+ *     shared within a process until the file is replaced.
+ */
+
+#include "rc_shm.c"
+#include <sys/wait.h>
+
+krb5_context ctx;
+
+static struct shm_map *
+resolve(const char *filename)
+{
+    void *rcdata;
+
+    if (shm_resolve(ctx, filename, &rcdata) != 0)
+        abort();
+    return rcdata;
+}
+
+static krb5_error_code
+test_store(const char *filename, uint8_t *tag, krb5_timestamp timestamp,
+           const uint32_t clockskew)
+{
+    krb5_error_code ret;
+    krb5_data tag_data = make_data(tag, TAG_LEN);
+    struct shm_map *map = resolve(filename);
+
+    ctx->clockskew = clockskew;
+    (void)krb5_set_debugging_time(ctx, timestamp, 0);
+    ret = shm_store(ctx, map, &tag_data);
+    shm_close(ctx, map);
+    return ret;
+}
+
+/* Return true if the overflow cache for filename exists. */
+static krb5_boolean
+overflow_exists(const char *filename)
+{
+    struct stat statbuf;
+    char *name;
+    int st;
+
+    if (asprintf(&name, "%s.file2", filename) < 0)
+        abort();
+    st = stat(name, &statbuf);
+    free(name);
+    return st == 0;
+}
+
+/* Store a sequence of unique tags, with timestamps far enough apart that all
+ * previous records appear expired.  Verify that nothing overflows. */
+static void
+expiry_test(const char *filename, int reps)
+{
+    krb5_error_code ret;
+    uint8_t tag[TAG_LEN] = { 0 };
+    uint32_t timestamp;
+    const uint32_t clockskew = 5, start = 1000;
+    int i;
+
+    assert((uint32_t)reps < (UINT32_MAX - start) / clockskew / 2);
+    for (i = 0, timestamp = start; i < reps; i++, timestamp += clockskew * 2) {
+        store_32_be(i, tag);
+        ret = test_store(filename, tag, timestamp, clockskew);
+        assert(ret == 0);
+    }
+    assert(!overflow_exists(filename));
+}
+
+/* Store a sequence of unique tags with the same timestamp.  Exit with failure
+ * if any store operation doesn't succeed or fail as given by expect_fail. */
+static void
+store_records(const char *filename, int id, int reps, int expect_fail)
+{
+    krb5_error_code ret;
+    uint8_t tag[TAG_LEN] = { 0 };
+    int i;
+
+    store_32_be(id, tag);
+    for (i = 0; i < reps; i++) {
+        store_32_be(i, tag + 4);
+        ret = test_store(filename, tag, 1000, 100);
+        if (ret != (expect_fail ? KRB5KRB_AP_ERR_REPEAT : 0)) {
+            fprintf(stderr, "store %d %d %sfail\n", id, i,
+                    expect_fail ? "didn't " : "");
+            _exit(1);
+        }
+    }
+}
+
+/* Spawn multiple child processes, each storing a sequence of unique tags.
+ * After each process completes, verify that its tags appear as replays. */
+static void
+concurrency_test(const char *filename, int nchildren, int reps)
+{
+    pid_t *pids, pid;
+    int i, nprocs, status;
+
+    pids = calloc(nchildren, sizeof(*pids));
+    assert(pids != NULL);
+    for (i = 0; i < nchildren; i++) {
+        pids[i] = fork();
+        assert(pids[i] != -1);
+        if (pids[i] == 0) {
+            store_records(filename, i, reps, 0);
+            _exit(0);
+        }
+    }
+    for (nprocs = nchildren; nprocs > 0; nprocs--) {
+        pid = wait(&status);
+        assert(pid != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        for (i = 0; i < nchildren; i++) {
+            if (pids[i] == pid)
+                store_records(filename, i, reps, 1);
+        }
+    }
+    free(pids);
+}
+
+/* Spawn multiple child processes, all trying to store the same tag.  Verify
+ * that only one of the processes succeeded.  Repeat reps times. */
+static void
+race_test(const char *filename, int nchildren, int reps)
+{
+    int i, j, status, nsuccess;
+    uint8_t tag[TAG_LEN] = { 0 };
+    pid_t pid;
+
+    for (i = 0; i < reps; i++) {
+        store_32_be(i, tag);
+        for (j = 0; j < nchildren; j++) {
+            pid = fork();
+            assert(pid != -1);
+            if (pid == 0)
+                _exit(test_store(filename, tag, 1000, 100) != 0);
+        }
+
+        nsuccess = 0;
+        for (j = 0; j < nchildren; j++) {
+            pid = wait(&status);
+            assert(pid != -1);
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                nsuccess++;
+        }
+        assert(nsuccess == 1);
+    }
+}
+
+/* Store more live records than the table can hold, and verify that they are
+ * all detected as replays. */
+static void
+overflow_test(const char *filename, int reps)
+{
+    assert((size_t)reps > NSTRIPES * STRIPE_SLOTS);
+    store_records(filename, 0, reps, 0);
+    assert(overflow_exists(filename));
+    store_records(filename, 0, reps, 1);
+}
+
+static void
+recovery_test(const char *filename)
+{
+    struct shm_map *map1, *map2;
+    uint8_t tag[TAG_LEN] = { 0 };
+    char *alias;
+    pid_t pid;
+    int i, status;
+
+    /* Mappings are shared within the process, including under another name
+     * for the same file. */
+    map1 = resolve(filename);
+    map2 = resolve(filename);
+    assert(map1 == map2);
+    if (asprintf(&alias, "%s.alias", filename) < 0)
+        abort();
+    unlink(alias);
+    assert(link(filename, alias) == 0);
+    map2 = resolve(alias);
+    assert(map1 == map2);
+    shm_close(ctx, map2);
+    unlink(alias);
+    free(alias);
+
+    /* Exit from a child process while it holds every stripe lock, and verify
+     * that stores still complete. */
+    pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        for (i = 0; i < NSTRIPES; i++)
+            assert(lock_stripe(map1, i) == 0);
+        _exit(0);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    for (i = 0; i < 100; i++) {
+        store_32_be(i, tag);
+        assert(test_store(filename, tag, 1000, 100) == 0);
+        assert(test_store(filename, tag, 1000, 100) == KRB5KRB_AP_ERR_REPEAT);
+    }
+
+    /* Simulate a crash during initialization.  The next process to open the
+     * table should reinitialize its header. */
+    map1->hdr->magic = 0;
+    memset(map1->hdr->seed, 0, sizeof(map1->hdr->seed));
+    pid = fork();
+    assert(pid != -1);
+    if (pid == 0) {
+        /* Forget the inherited mapping, as a new process would not have it. */
+        shm_maps = NULL;
+        map2 = resolve(filename);
+        assert(map2 != map1);
+        _exit(0);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(map1->hdr->magic == SHM_MAGIC);
+    shm_close(ctx, map1);
+    shm_close(ctx, map1);
+
+    /* Replacing the file results in a new mapping. */
+    assert(unlink(filename) == 0);
+    map2 = resolve(filename);
+    assert(map2 != map1);
+    store_32_be(0, tag);
+    assert(test_store(filename, tag, 1000, 100) == 0);
+    shm_close(ctx, map2);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *filename, *cmd;
+    char *overflow_name;
+
+    argv++;
+    assert(*argv != NULL);
+
+    if (krb5_init_context(&ctx) != 0 || k5_rcshm_initialize() != 0)
+        abort();
+
+    assert(*argv != NULL);
+    filename = *argv++;
+    unlink(filename);
+    if (asprintf(&overflow_name, "%s.file2", filename) < 0)
+        abort();
+    unlink(overflow_name);
+
+    assert(*argv != NULL);
+    cmd = *argv++;
+    if (strcmp(cmd, "expiry") == 0) {
+        assert(argv[0] != NULL);
+        expiry_test(filename, atoi(argv[0]));
+    } else if (strcmp(cmd, "concurrent") == 0) {
+        assert(argv[0] != NULL && argv[1] != NULL);
+        concurrency_test(filename, atoi(argv[0]), atoi(argv[1]));
+    } else if (strcmp(cmd, "race") == 0) {
+        assert(argv[0] != NULL && argv[1] != NULL);
+        race_test(filename, atoi(argv[0]), atoi(argv[1]));
+    } else if (strcmp(cmd, "overflow") == 0) {
+        assert(argv[0] != NULL);
+        overflow_test(filename, atoi(argv[0]));
+    } else if (strcmp(cmd, "recovery") == 0) {
+        recovery_test(filename);
+    } else {
+        abort();
+    }
+
+    unlink(filename);
+    unlink(overflow_name);
+    free(overflow_name);
+    k5_rcshm_finalize();
+    krb5_free_context(ctx);
+    return 0;
+}
@@ -28,12 +28,16 @@
  * @file plugins/kadm5_hook/test/main.c
  *
  * This is a test kadm5_hook plugin. If enabled, it will print when kadm5_hook
- * calls are made.
+ * calls are made.  To exercise asynchronous delivery, postcommit create calls
+ * are slow for principals whose names begin with "slow", and the first
+ * postcommit create call for the principal "retry" fails.
  */
 
 #include <krb5/krb5.h>
 #include <krb5/kadm5_hook_plugin.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 static void
@@ -77,7 +81,18 @@ create(krb5_context context,
        krb5_key_salt_tuple *ks_tuple,
        const char *newpass)
 {
+    static int retry_failed = 0;
+    krb5_data *name = &princ->principal->data[0];
+
+    if (stage == KADM5_HOOK_STAGE_POSTCOMMIT && name->length >= 4 &&
+        memcmp(name->data, "slow", 4) == 0)
+        usleep(200000);
     log_call(context, "create", stage, princ->principal);
+    if (stage == KADM5_HOOK_STAGE_POSTCOMMIT && !retry_failed &&
+        name->length == 5 && memcmp(name->data, "retry", 5) == 0) {
+        retry_failed = 1;
+        return KRB5_PLUGIN_NO_HANDLE;
+    }
     return 0;
 }
 
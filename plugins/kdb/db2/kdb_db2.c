@@ -963,11 +963,13 @@ curs_unlock(iter_curs *curs)
     curs->islocked = FALSE;
 }
 
-/* Set up curs and lock DB. */
+/* Set up curs and lock DB.  If start is not NULL, position the cursor at the
+ * first key at or after start. */
 static krb5_error_code
 curs_init(iter_curs *curs, krb5_context ctx, krb5_db2_context *dbc,
-          krb5_flags iterflags)
+          const char *start, krb5_flags iterflags)
 {
+    krb5_error_code retval;
     int isrecurse = iterflags & KRB5_DB_ITER_RECURSE;
     unsigned int prevflag = R_PREV;
     unsigned int nextflag = R_NEXT;
@@ -1005,7 +1007,21 @@ curs_init(iter_curs *curs, krb5_context ctx, krb5_db2_context *dbc,
         curs->startflag = R_FIRST;
         curs->stepflag = nextflag;
     }
-    return curs_lock(curs);
+    retval = curs_lock(curs);
+    if (retval || start == NULL)
+        return retval;
+
+    /* Only a btree can be positioned at a key it does not contain. */
+    if (dbc->hashfirst || (iterflags & KRB5_DB_ITER_REV)) {
+        curs_unlock(curs);
+        return KRB5_PLUGIN_OP_NOTSUPP;
+    }
+    if (*start != '\0') {
+        curs->key.data = (char *)start;
+        curs->key.size = strlen(start);
+        curs->startflag = R_CURSOR;
+    }
+    return 0;
 }
 
 /* Get initial entry. */
@@ -1106,14 +1122,14 @@ curs_fini(iter_curs *curs)
 }
 
 static krb5_error_code
-ctx_iterate(krb5_context context, krb5_db2_context *dbc,
+ctx_iterate(krb5_context context, krb5_db2_context *dbc, const char *start,
             ctx_iterate_cb func, krb5_pointer func_arg, krb5_flags iterflags)
 {
     krb5_error_code retval;
     int dbret;
     iter_curs curs;
 
-    retval = curs_init(&curs, context, dbc, iterflags);
+    retval = curs_init(&curs, context, dbc, start, iterflags);
     if (retval)
         return retval;
     dbret = curs_start(&curs);
@@ -1142,7 +1158,18 @@ krb5_db2_iterate(krb5_context context, char *match_expr, ctx_iterate_cb func,
 {
     if (!inited(context))
         return KRB5_KDB_DBNOTINITED;
-    return ctx_iterate(context, context->dal_handle->db_context, func,
+    return ctx_iterate(context, context->dal_handle->db_context, NULL, func,
+                       func_arg, iterflags);
+}
+
+krb5_error_code
+krb5_db2_iterate_from(krb5_context context, const char *start,
+                      ctx_iterate_cb func, krb5_pointer func_arg,
+                      krb5_flags iterflags)
+{
+    if (!inited(context))
+        return KRB5_KDB_DBNOTINITED;
+    return ctx_iterate(context, context->dal_handle->db_context, start, func,
                        func_arg, iterflags);
 }
 
@@ -1408,7 +1435,8 @@ ctx_merge_nra(krb5_context context, krb5_db2_context *dbc_temp,
 
     nra.kcontext = context;
     nra.db_context = dbc_real;
-    return ctx_iterate(context, dbc_temp, krb5_db2_merge_nra_iterator, &nra, 0);
+    return ctx_iterate(context, dbc_temp, NULL, krb5_db2_merge_nra_iterator,
+                       &nra, 0);
 }
 
 /*
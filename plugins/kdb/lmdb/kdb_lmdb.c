@@ -69,6 +69,12 @@
  * the KDC; this isn't ideal if the load is aborted, but it shouldn't cause any
  * practical issues.
  *
+ * Because the principal database is empty at the start of a load, we can keep
+ * track of the greatest principal key stored within the load transaction and
+ * use MDB_APPEND for any key which sorts after it.  kdb5_util stores entries
+ * in sorted batches and dumps from LMDB and DB2 btree databases are already
+ * sorted, so most load puts skip the B-tree search and fill pages densely.
+ *
  * For iprop loads, kdb5_util also includes the "merge_nra" db_arg, signifying
  * that the lockout attributes from existing principal entries should be
  * preserved.  This attribute is noted in the LMDB context, and put_principal
@@ -118,6 +124,10 @@ typedef struct {
     /* Write transaction for load operations (create() with the "temporary"
      * db_arg).  */
     MDB_txn *load_txn;
+
+    /* Greatest principal key stored within load_txn. */
+    char *load_maxkey;
+    size_t load_maxkey_len;
 } klmdb_context;
 
 static krb5_error_code
@@ -342,6 +352,36 @@ fetch_lockout(krb5_context context, MDB_val *key, krb5_db_entry *entry)
     mdb_txn_abort(txn);
 }
 
+/* Return true if key sorts after the greatest principal key stored so far in
+ * the load transaction, using the LMDB default key comparison. */
+static krb5_boolean
+load_key_is_greatest(klmdb_context *dbc, MDB_val *key)
+{
+    size_t len = dbc->load_maxkey_len;
+    int cmp;
+
+    if (dbc->load_maxkey == NULL)
+        return TRUE;
+    cmp = memcmp(key->mv_data, dbc->load_maxkey,
+                 (key->mv_size < len) ? key->mv_size : len);
+    return cmp > 0 || (cmp == 0 && key->mv_size > len);
+}
+
+/* Record key as the greatest principal key stored in the load transaction. */
+static krb5_error_code
+set_load_maxkey(klmdb_context *dbc, MDB_val *key)
+{
+    char *copy;
+
+    copy = realloc(dbc->load_maxkey, key->mv_size ? key->mv_size : 1);
+    if (copy == NULL)
+        return ENOMEM;
+    memcpy(copy, key->mv_data, key->mv_size);
+    dbc->load_maxkey = copy;
+    dbc->load_maxkey_len = key->mv_size;
+    return 0;
+}
+
 /*
  * Store a value for key in the specified database within the primary
  * environment.  Use the saved load transaction if one is present, or a
@@ -361,6 +401,12 @@ put(krb5_context context, MDB_dbi db, char *keystr, uint8_t *bytes, size_t len,
 
     if (dbc->load_txn != NULL) {
         txn = dbc->load_txn;
+        if (db == dbc->princ_db && !must_overwrite &&
+            load_key_is_greatest(dbc, &key)) {
+            if (set_load_maxkey(dbc, &key) != 0)
+                return ENOMEM;
+            putflags |= MDB_APPEND;
+        }
     } else {
         err = mdb_txn_begin(dbc->env, NULL, 0, &temp_txn);
         if (err)
@@ -493,6 +539,7 @@ klmdb_fini(krb5_context context)
     mdb_env_close(dbc->lockout_env);
     free(dbc->path);
     free(dbc->lockout_path);
+    free(dbc->load_maxkey);
     free(dbc);
     context->dal_handle->db_context = NULL;
     return 0;
@@ -836,10 +883,12 @@ klmdb_delete_principal(krb5_context context, krb5_const_principal searchfor)
     return ret;
 }
 
+/* Iterate over principal entries, beginning at the first key at or after
+ * start if it is not NULL. */
 static krb5_error_code
-klmdb_iterate(krb5_context context, char *match_expr,
-              krb5_error_code (*func)(void *, krb5_db_entry *), void *arg,
-              krb5_flags iterflags)
+iterate(krb5_context context, const char *start,
+        krb5_error_code (*func)(void *, krb5_db_entry *), void *arg,
+        krb5_flags iterflags)
 {
     krb5_error_code ret;
     klmdb_context *dbc = context->dal_handle->db_context;
@@ -848,10 +897,20 @@ klmdb_iterate(krb5_context context, char *match_expr,
     MDB_cursor *cursor = NULL;
     MDB_val key, val;
     MDB_cursor_op op = (iterflags & KRB5_DB_ITER_REV) ? MDB_PREV : MDB_NEXT;
+    MDB_cursor_op firstop = op;
     int err;
 
     if (dbc == NULL)
         return KRB5_KDB_DBNOTINITED;
+    if (start != NULL) {
+        if (iterflags & KRB5_DB_ITER_REV)
+            return KRB5_PLUGIN_OP_NOTSUPP;
+        if (*start != '\0') {
+            key.mv_data = (char *)start;
+            key.mv_size = strlen(start);
+            firstop = MDB_SET_RANGE;
+        }
+    }
 
     err = mdb_txn_begin(dbc->env, NULL, MDB_RDONLY, &txn);
     if (err)
@@ -860,7 +919,8 @@ klmdb_iterate(krb5_context context, char *match_expr,
     if (err)
         goto lmdb_error;
     for (;;) {
-        err = mdb_cursor_get(cursor, &key, &val, op);
+        err = mdb_cursor_get(cursor, &key, &val, firstop);
+        firstop = op;
         if (err == MDB_NOTFOUND)
             break;
         if (err)
@@ -886,6 +946,22 @@ cleanup:
     return ret;
 }
 
+static krb5_error_code
+klmdb_iterate(krb5_context context, char *match_expr,
+              krb5_error_code (*func)(void *, krb5_db_entry *), void *arg,
+              krb5_flags iterflags)
+{
+    return iterate(context, NULL, func, arg, iterflags);
+}
+
+static krb5_error_code
+klmdb_iterate_from(krb5_context context, const char *start,
+                   krb5_error_code (*func)(void *, krb5_db_entry *), void *arg,
+                   krb5_flags iterflags)
+{
+    return iterate(context, start, func, arg, iterflags);
+}
+
 krb5_error_code
 klmdb_get_policy(krb5_context context, char *name, osa_policy_ent_t *policy)
 {
@@ -1121,7 +1197,7 @@ cleanup:
 
 kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_lmdb, kdb_function_table) = {
     .maj_ver = KRB5_KDB_DAL_MAJOR_VERSION,
-    .min_ver = 0,
+    .min_ver = 1,
     .init_library = klmdb_lib_init,
     .fini_library = klmdb_lib_cleanup,
     .init_module = klmdb_open,
@@ -1132,6 +1208,7 @@ kdb_vftabl PLUGIN_SYMBOL_NAME(krb5_lmdb, kdb_function_table) = {
     .put_principal = klmdb_put_principal,
     .delete_principal = klmdb_delete_principal,
     .iterate = klmdb_iterate,
+    .iterate_from = klmdb_iterate_from,
     .create_policy = klmdb_create_policy,
     .get_policy = klmdb_get_policy,
     .put_policy = klmdb_put_policy,
@@ -0,0 +1,166 @@
+/* -*- mode: c; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/* tests/asyncsend.c - test harness for asynchronous KDC exchanges */
+/*
+ * Copyright (C) 2026 by the Massachusetts Institute of Technology.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * * Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in
+ *   the documentation and/or other materials provided with the
+ *   distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * This test harness performs multiple initial creds operations concurrently
+ * using krb5_init_creds_step() and krb5_kdc_exchange_step(), driving all of
+ * the KDC exchanges from a single poll() loop.  All exchanges use the same
+ * client principal and password.
+ */
+
+#include "k5-int.h"
+#include <poll.h>
+
+static krb5_context ctx;
+
+static void
+check(krb5_error_code code)
+{
+    const char *errmsg;
+
+    if (code) {
+        errmsg = krb5_get_error_message(ctx, code);
+        fprintf(stderr, "%s\n", errmsg);
+        krb5_free_error_message(ctx, errmsg);
+        exit(1);
+    }
+}
+
+struct client {
+    krb5_init_creds_context icc;
+    krb5_kdc_exchange ex;
+    krb5_data reply;
+};
+
+/* Advance c's initial creds operation with its latest reply, starting a new
+ * exchange if another message must be sent.  Return true if it has
+ * finished. */
+static krb5_boolean
+step_client(struct client *c)
+{
+    krb5_data req = empty_data(), realm = empty_data();
+    unsigned int flags;
+
+    check(krb5_init_creds_step(ctx, c->icc, &c->reply, &req, &realm,
+                               &flags));
+    krb5_free_data_contents(ctx, &c->reply);
+    if (!(flags & KRB5_INIT_CREDS_STEP_FLAG_CONTINUE)) {
+        krb5_init_creds_free(ctx, c->icc);
+        c->icc = NULL;
+        return TRUE;
+    }
+    check(krb5_kdc_exchange_start(ctx, &realm, &req, 0, &c->ex));
+    krb5_free_data_contents(ctx, &req);
+    krb5_free_data_contents(ctx, &realm);
+    return FALSE;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *password;
+    krb5_principal client;
+    struct client *clients;
+    struct pollfd *fds;
+    krb5_boolean done;
+    int i, n, nclients, nleft, inflight, maxinflight = 0, timeout, nfds;
+
+    if (argc != 4) {
+        fprintf(stderr, "Usage: asyncsend princ password nclients\n");
+        exit(1);
+    }
+    password = argv[2];
+    nclients = atoi(argv[3]);
+    assert(nclients > 0);
+
+    check(krb5_init_context(&ctx));
+    check(krb5_parse_name(ctx, argv[1], &client));
+
+    clients = calloc(nclients, sizeof(*clients));
+    fds = calloc(nclients, sizeof(*fds));
+    assert(clients != NULL && fds != NULL);
+    for (i = 0; i < nclients; i++) {
+        check(krb5_init_creds_init(ctx, client, NULL, NULL, 0, NULL,
+                                   &clients[i].icc));
+        check(krb5_init_creds_set_password(ctx, clients[i].icc, password));
+        (void)step_client(&clients[i]);
+    }
+
+    nleft = nclients;
+    while (nleft > 0) {
+        /* Wait for any exchange's descriptor or earliest timeout. */
+        inflight = 0;
+        timeout = -1;
+        for (i = 0; i < nclients; i++) {
+            fds[i].fd = -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            if (clients[i].ex == NULL)
+                continue;
+            inflight++;
+            fds[i].fd = krb5_kdc_exchange_get_fd(clients[i].ex);
+            n = krb5_kdc_exchange_get_timeout(clients[i].ex);
+            if (timeout == -1 || n < timeout)
+                timeout = n;
+        }
+        if (inflight > maxinflight)
+            maxinflight = inflight;
+        nfds = poll(fds, nclients, timeout);
+        assert(nfds >= 0);
+
+        /* Step each exchange which is ready or due. */
+        for (i = 0; i < nclients; i++) {
+            if (clients[i].ex == NULL)
+                continue;
+            if (fds[i].revents == 0 &&
+                krb5_kdc_exchange_get_timeout(clients[i].ex) > 0)
+                continue;
+            check(krb5_kdc_exchange_step(ctx, clients[i].ex,
+                                         &clients[i].reply, &done));
+            if (!done)
+                continue;
+            krb5_kdc_exchange_free(ctx, clients[i].ex);
+            clients[i].ex = NULL;
+            if (step_client(&clients[i]))
+                nleft--;
+        }
+    }
+
+    printf("%d clients finished, at most %d exchanges in flight\n", nclients,
+           maxinflight);
+
+    free(fds);
+    free(clients);
+    krb5_free_principal(ctx, client);
+    krb5_free_context(ctx);
+    return 0;
+}
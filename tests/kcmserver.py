@@ -34,6 +34,7 @@ cache_uuidmap = {}
 defname = b'default'
 next_unique = 1
 next_uuid = 1
+logfile = None
 
 class KCMOpcodes(object):
     GEN_NEW = 3
@@ -55,6 +56,10 @@ class KCMOpcodes(object):
     REPLACE = 13002
 
 
+opnames = dict((v, k) for k, v in vars(KCMOpcodes).items()
+               if not k.startswith('_'))
+
+
 class KRB5Errors(object):
     KRB5_CC_NOTFOUND = -1765328243
     KRB5_CC_END = -1765328242
@@ -277,6 +282,13 @@ ophandlers = {
     KCMOpcodes.REPLACE : op_replace
 }
 
+# If a log file was requested, append a line to it describing an event
+# on the client socket s.
+def log(s, msg):
+    if logfile is not None:
+        with open(logfile, 'a') as f:
+            f.write('%d %s\n' % (s.fileno(), msg))
+
 # Read and respond to a request from the socket s.
 def service_request(s):
     lenbytes = b''
@@ -293,6 +305,11 @@ def service_request(s):
     majver, minver, op = struct.unpack('>BBH', req[:4])
     argbytes = req[4:]
 
+    # Note whether the client sent another request without waiting for
+    # the reply to this one.
+    pending, w, x = select.select([s], [], [], 0)
+    log(s, opnames.get(op, str(op)) + (' pipelined' if pending else ''))
+
     if op in ophandlers:
         code, payload = ophandlers[op](argbytes)
     else:
@@ -311,7 +328,10 @@ parser = optparse.OptionParser()
 parser.add_option('-f', '--fallback', action='store_true', dest='fallback',
                   default=False,
                   help='Do not support RETRIEVE/GET_CRED_LIST/REPLACE')
+parser.add_option('-l', '--log', dest='logfile',
+                  help='Log connections and requests to LOGFILE')
 (options, args) = parser.parse_args()
+logfile = options.logfile
 if options.fallback:
     del ophandlers[KCMOpcodes.RETRIEVE]
     del ophandlers[KCMOpcodes.GET_CRED_LIST]
@@ -330,6 +350,7 @@ while True:
         if s == server:
             client, addr = server.accept()
             select_input.append(client)
+            log(client, 'connect')
         else:
             if not service_request(s):
                 select_input.remove(s)
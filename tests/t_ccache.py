@@ -138,16 +138,51 @@ def collection_test(realm, ccname):
 
 collection_test(realm, 'DIR:' + os.path.join(realm.testdir, 'cc'))
 
+# Using the KCM daemon's request log, check that a single process
+# makes one connection to the daemon, pipelines its cache lookups, and
+# iterates with GET_CRED_LIST when the daemon supports it (or
+# pipelines GET_CRED_BY_UUID requests when it doesn't).
+def kcm_log_test(realm, kcmlog, fallback):
+    mark('KCM connection sharing and pipelining')
+    oldccname = realm.env['KRB5CCNAME']
+    realm.env['KRB5CCNAME'] = 'KCM:'
+    realm.kinit('alice', password('alice'))
+    realm.kinit('carol', password('carol'))
+    realm.kinit('doug', password('doug'))
+    with open(kcmlog) as f:
+        start = len(f.readlines())
+    output = realm.run([klist, '-A'])
+    if output.count('Default principal:') != 3:
+        fail('klist -A did not show three caches')
+    with open(kcmlog) as f:
+        ops = [l.split(None, 1)[1].strip() for l in f.readlines()[start:]]
+    if ops.count('connect') != 1:
+        fail('klist -A made %d KCM connections' % ops.count('connect'))
+    if 'GET_CACHE_BY_UUID pipelined' not in ops:
+        fail('GET_CACHE_BY_UUID requests were not pipelined')
+    if fallback:
+        if 'GET_CRED_BY_UUID pipelined' not in ops:
+            fail('GET_CRED_BY_UUID requests were not pipelined')
+        if sum(1 for op in ops if op.startswith('GET_CRED_LIST')) != 1:
+            fail('Unsupported GET_CRED_LIST was retried')
+    elif any(op.startswith('GET_CRED_BY_UUID') for op in ops):
+        fail('Creds were fetched by UUID despite GET_CRED_LIST support')
+    realm.run([kdestroy, '-A'])
+    realm.env['KRB5CCNAME'] = oldccname
+
 # Test KCM with and without RETRIEVE and GET_CRED_LIST support.
 kcmserver_path = os.path.join(srctop, 'tests', 'kcmserver.py')
-kcmd = realm.start_server([sys.executable, kcmserver_path, kcm_socket_path],
-                          'starting...')
+kcmlog = os.path.join(realm.testdir, 'kcm.log')
+kcmd = realm.start_server([sys.executable, kcmserver_path, '-l', kcmlog,
+                           kcm_socket_path], 'starting...')
 collection_test(realm, 'KCM:')
+kcm_log_test(realm, kcmlog, False)
 stop_daemon(kcmd)
 os.remove(kcm_socket_path)
-realm.start_server([sys.executable, kcmserver_path, '-f', kcm_socket_path],
-                   'starting...')
+realm.start_server([sys.executable, kcmserver_path, '-f', '-l', kcmlog,
+                    kcm_socket_path], 'starting...')
 collection_test(realm, 'KCM:')
+kcm_log_test(realm, kcmlog, True)
 
 if test_keyring:
     def cleanup_keyring(anchor, name):
@@ -47,4 +47,44 @@ realm.kinit('testprinc', 'pw4')
 realm.run([kdestroy])
 realm.run([kadminl, 'delprinc', 'testprinc'])
 
+realm.stop()
+
+# With worker threads, kpasswd requests are checked on the reader
+# threads and committed on the writer thread.  Make sure concurrent
+# changes all succeed and are logged, and that quality failures are
+# still reported with the policy details.
+mark('kpasswd with kadmind_workers')
+conf = {'realms': {'$realm': {'kadmind_workers': '3',
+                              'iprop_enable': 'true',
+                              'iprop_logfile': '$testdir/db.ulog'}}}
+realm = K5Realm(create_host=False, get_creds=False, start_kadmind=True,
+                kdc_conf=conf)
+realm.run([kadminl, 'addpol', '-minlength', '6', 'minlen'])
+realm.run([kadminl, 'addprinc', '-pw', 'oldpw1', '-policy', 'minlen', 'short'])
+procs = []
+for i in range(6):
+    realm.run([kadminl, 'addprinc', '-pw', 'oldpw%d' % i, 'kp%d' % i])
+    p = subprocess.Popen([kpasswd, 'kp%d' % i], env=realm.env,
+                         stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                         stderr=subprocess.STDOUT)
+    p.stdin.write(('oldpw%d\nnewpw%d\nnewpw%d\n' % (i, i, i)).encode())
+    p.stdin.close()
+    procs.append(p)
+for i, p in enumerate(procs):
+    out = p.stdout.read().decode()
+    p.wait()
+    if p.returncode != 0 or 'Password changed.' not in out:
+        fail('kpasswd %d failed with workers: %s' % (i, out))
+for i in range(6):
+    realm.kinit('kp%d' % i, 'newpw%d' % i)
+realm.run([kpasswd, 'short'], input='oldpw1\nabc\nabc\n', expected_code=2,
+          expected_msg='at least 6 characters long')
+realm.kinit('short', 'oldpw1')
+out = realm.run([kproplog])
+for i in range(6):
+    if out.count('Update principal : kp%d@' % i) != 2:
+        fail('Missing update log entries for kp%d with workers' % i)
+if out.count('Update principal : short@') != 1:
+    fail('Rejected kpasswd request logged an update')
+
 success('Password change tests')
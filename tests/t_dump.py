@@ -68,6 +68,49 @@ for realm in multidb_realms(start_kdc=False):
     if 'compat\n' not in out or 'fred\n' not in out or 'barney\n' not in out:
         fail('Missing policy after second load')
 
+    # Principal stores are batched and sorted during a load; make sure
+    # the last of several records for a principal still wins.
+    mark('duplicate principal records')
+    realm.run([kadminl, 'modprinc', '-maxlife', '1 hour', realm.user_princ])
+    realm.run([kdb5_util, 'dump', dumpfile])
+    realm.run([kadminl, 'modprinc', '-maxlife', '2 hours', realm.user_princ])
+    dupfile = os.path.join(realm.testdir, 'dump.dup')
+    realm.run([kdb5_util, 'dump', dupfile, realm.user_princ])
+    with open(dupfile) as f:
+        duplines = f.readlines()[1:]
+    with open(dumpfile, 'a') as f:
+        f.writelines(duplines)
+    realm.run([kadminl, 'modprinc', '-maxlife', '3 hours', realm.user_princ])
+    realm.run([kdb5_util, 'load', dumpfile])
+    realm.run([kadminl, 'getprinc', realm.user_princ],
+              expected_msg='Maximum ticket life: 0 days 02:00:00')
+
+    # Make sure a binary dump loads back to the same database contents.
+    mark('binary dump')
+    textfile = os.path.join(realm.testdir, 'dump.txt')
+    binfile = os.path.join(realm.testdir, 'dump.bin')
+    realm.run([kdb5_util, 'dump', textfile])
+    realm.run([kdb5_util, 'dump', '-binary', binfile])
+    realm.run([kdb5_util, 'dump', '-binary'], expected_code=1,
+              expected_msg='cannot be written to standard output')
+    realm.run([kdb5_util, 'destroy', '-f'])
+    realm.run([kdb5_util, 'load', binfile])
+    dump_compare(realm, [], textfile)
+
+    # A binary dump read from a pipe is loaded as it arrives.
+    realm.run([kdb5_util, 'destroy', '-f'])
+    realm.run(['sh', '-c', 'cat %s | %s load -' % (binfile, kdb5_util)])
+    dump_compare(realm, [], textfile)
+
+    # A corrupted binary dump should fail its section checksum.
+    with open(binfile, 'r+b') as f:
+        f.seek(100)
+        b = f.read(1)
+        f.seek(100)
+        f.write(bytes([b[0] ^ 1]))
+    realm.run([kdb5_util, 'load', binfile], expected_code=1,
+              expected_msg='checksum mismatch')
+
     srcdumpdir = os.path.join(srctop, 'tests', 'dumpfiles')
     srcdump = os.path.join(srcdumpdir, 'dump')
     srcdump_r18 = os.path.join(srcdumpdir, 'dump.r18')
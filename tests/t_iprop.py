@@ -83,6 +83,38 @@ def wait_for_prop(kpropd, full_expected, expected_old, expected_new):
             break
     output('*** Sync complete\n')
 
+# Read lines from a kpropd using iprop_replica_wait until it has
+# applied the update with serial number expected_new.  The update
+# must arrive while kpropd is waiting on the primary, not after a
+# sleep.
+def wait_for_push(kpropd, expected_new):
+    output('*** Waiting for pushed update from kpropd\n')
+    new_sno = -1
+    while True:
+        line = kpropd.stdout.readline()
+        if line == '':
+            fail('kpropd process exited unexpectedly')
+        output('kpropd: ' + line)
+        m = re.match(r'Got incremental updates \(sno=(\d+) ', line)
+        if m:
+            new_sno = int(m.group(1))
+        if 'Incremental updates:' in line:
+            break
+        if 'Waiting for' in line:
+            fail('kpropd slept instead of waiting on the primary')
+        if 'Calling iprop_get_updates_1' in line:
+            fail('kpropd did not ask the primary to wait')
+    if new_sno != expected_new:
+        fail('Expected new serial %d from kpropd sync' % expected_new)
+
+    # Wait until kpropd is waiting on the primary again.
+    while True:
+        line = kpropd.stdout.readline()
+        output('kpropd: ' + line)
+        if 'Calling iprop_wait_updates_1' in line:
+            break
+    output('*** Sync complete\n')
+
 # Verify the output of kproplog against the expected number of
 # entries, first and last serial number, and a list of principal names
 # for the update entrires.
@@ -136,6 +168,11 @@ conf_rep2 = {'realms': {'$realm': {'iprop_replica_poll': '600',
                                    'iprop_port': '$port8'}},
              'dbmodules': {'db': {'database_name': '$testdir/db.replica2'}}}
 
+conf_rep1w = {'realms': {'$realm': {'iprop_replica_poll': '600',
+                                    'iprop_replica_wait': '600',
+                                    'iprop_logfile': '$testdir/ulog.replica1'}},
+              'dbmodules': {'db': {'database_name': '$testdir/db.replica1'}}}
+
 conf_foo = {'libdefaults': {'default_realm': 'FOO'},
             'domain_realm': {hostname: 'FOO'}}
 conf_rep3 = {'realms': {'$realm': {'iprop_replica_poll': '600',
@@ -156,6 +193,7 @@ for realm in multidb_realms(kdc_conf=conf, create_user=False,
     replica1m = realm.special_env('replica1m', True, krb5_conf=conf_foo,
                                   kdc_conf=conf_rep1m)
     replica2 = realm.special_env('replica2', True, kdc_conf=conf_rep2)
+    replica1w = realm.special_env('replica1w', True, kdc_conf=conf_rep1w)
 
     # A default_realm and domain_realm that do not match the KDC's
     # realm.  The FOO realm iprop_logfile setting is needed to run
@@ -491,4 +529,91 @@ for realm in multidb_realms(kdc_conf=conf, create_user=False,
     realm.run([kadminl, 'getpol', 'testpol'], env=replica1,
               expected_msg='Minimum number of password character classes: 3')
 
+    # With iprop_replica_wait set, kadmind holds kpropd's request open
+    # and answers it as soon as the primary changes, so updates arrive
+    # without signalling kpropd.
+    mark('propagate M->1 incremental (waiting replica)')
+    kpropd1 = realm.start_kpropd(replica1w, ['-d'])
+    while True:
+        line = kpropd1.stdout.readline()
+        if line == '':
+            fail('kpropd process exited unexpectedly')
+        output('kpropd: ' + line)
+        if 'Calling iprop_wait_updates_1 (sno=1 ' in line:
+            break
+    realm.run([kadminl, 'modprinc', '-maxlife', '6 minutes', pr1])
+    check_ulog(2, 1, 2, [None, pr1])
+    wait_for_push(kpropd1, 2)
+    check_ulog(2, 1, 2, [None, pr1], replica1)
+    realm.run([kadminl, 'getprinc', pr1], env=replica1,
+              expected_msg='Maximum ticket life: 0 days 00:06:00')
+    realm.run([kadminl, 'modprinc', '-maxlife', '7 minutes', pr1])
+    wait_for_push(kpropd1, 3)
+    realm.run([kadminl, 'getprinc', pr1], env=replica1,
+              expected_msg='Maximum ticket life: 0 days 00:07:00')
+    realm.stop_kpropd(kpropd1)
+
+# A replica which falls behind the start of the primary's ulog can
+# catch up from the primary's checkpoint, receiving just the
+# principals changed since its last update.
+mark('catch up from checkpoint')
+conf_small = {'realms': {'$realm': {'iprop_enable': 'true',
+                                    'iprop_ulogsize': '5',
+                                    'iprop_logfile': '$testdir/db.ulog'}}}
+realm = K5Realm(kdc_conf=conf_small, create_user=False, start_kadmind=True)
+replica1 = realm.special_env('replica1', True, kdc_conf=conf_rep1)
+kiprop_princ = 'kiprop/' + hostname
+realm.addprinc(kiprop_princ)
+realm.extract_keytab(kiprop_princ, realm.keytab)
+with open(os.path.join(realm.testdir, 'kpropd-acl'), 'w') as f:
+    f.write(realm.host_princ + '\n')
+realm.addprinc('a1')
+realm.addprinc('a2')
+realm.run([kproplog, '-R'])
+out = realm.run_kpropd_once(replica1, ['-d'])
+if 'Full propagation transfer finished' not in out:
+    fail('Expected full dump from kpropd -t')
+check_ulog(1, 1, 1, [None], replica1)
+
+# Push the replica's position out of the primary's ulog, including a
+# deletion and a principal changed more than once.
+realm.addprinc('a3')
+realm.run([kadminl, 'modprinc', '-maxlife', '5 minutes', 'a1'])
+realm.run([kadminl, 'delprinc', 'a2'])
+realm.addprinc('a4')
+realm.run([kadminl, 'modprinc', '-maxlife', '6 minutes', 'a1'])
+realm.run([kadminl, 'modprinc', '-maxlife', '7 minutes', 'a3'])
+realm.run([kadminl, 'modprinc', '-maxlife', '8 minutes', 'a4'])
+check_ulog(5, 4, 8, ['a2@KRBTEST.COM', 'a4@KRBTEST.COM', 'a1@KRBTEST.COM',
+                     'a3@KRBTEST.COM', 'a4@KRBTEST.COM'])
+out = realm.run_kpropd_once(replica1, ['-d'])
+if ('Caught up from checkpoint (sno=8 ' not in out or
+    'Full propagation transfer finished' in out):
+    fail('Expected kpropd -t to catch up from checkpoint')
+check_ulog(1, 8, 8, [None], replica1)
+out = realm.run([kadminl, 'listprincs'], env=replica1)
+if 'a1@' not in out or 'a2@' in out or 'a3@' not in out or 'a4@' not in out:
+    fail('Wrong principals on replica after catching up')
+realm.run([kadminl, 'getprinc', 'a1'], env=replica1,
+          expected_msg='Maximum ticket life: 0 days 00:06:00')
+realm.run([kadminl, 'getprinc', 'a4'], env=replica1,
+          expected_msg='Maximum ticket life: 0 days 00:08:00')
+out = realm.run_kpropd_once(replica1, ['-d'])
+if 'KDC is synchronized' not in out:
+    fail('Expected synchronized from kpropd -t after catching up')
+
+# If the checkpoint is lost, a new one starts with the next entry to
+# leave the ulog, so a replica which is already behind that needs a
+# full resync.
+for i in range(5):
+    realm.run([kadminl, 'modprinc', '-maxlife', '%d minutes' % (10 + i),
+               'a1'])
+os.remove(os.path.join(realm.testdir, 'db.ulog.ckpt'))
+realm.run([kadminl, 'modprinc', '-maxlife', '15 minutes', 'a1'])
+out = realm.run_kpropd_once(replica1, ['-d'])
+if 'Full propagation transfer finished' not in out:
+    fail('Expected full dump without a usable checkpoint')
+realm.run([kadminl, 'getprinc', 'a1'], env=replica1,
+          expected_msg='Maximum ticket life: 0 days 00:15:00')
+
 success('iprop tests')
@@ -12,4 +12,38 @@ realm.run([kadminl, 'addprinc', '-randkey', 'test'],
 realm.run([kadminl, 'renprinc', 'test', 'test2'],
           expected_msg='rename: stage precommit')
 
+# In the default mode, postcommit calls complete before the operation
+# returns.
+mark('synchronous postcommit')
+out = realm.run([kadminl], input='addprinc -randkey slow\n')
+if (out.index('create: stage postcommit principal slow@') >
+    out.index('Principal "slow@KRBTEST.COM" created.')):
+    fail('synchronous postcommit call made after operation returned')
+
+# In asynchronous mode, postcommit calls are made by a dispatcher
+# thread, retried on failure, and delivered before kadmin.local exits.
+mark('asynchronous postcommit')
+async_conf = {'realms': {'$realm': {'kadm5_hook_async': 'true',
+                                    'kadm5_hook_queue_size': '1',
+                                    'kadm5_hook_retries': '1'}}}
+async_env = realm.special_env('async', True, kdc_conf=async_conf)
+out = realm.run([kadminl], env=async_env,
+                input='addprinc -randkey slow2\n')
+if (out.index('create: stage postcommit principal slow2@') <
+    out.index('Principal "slow2@KRBTEST.COM" created.')):
+    fail('asynchronous postcommit call did not run in the background')
+out = realm.run([kadminl, 'addprinc', '-randkey', 'retry'], env=async_env)
+if out.count('create: stage postcommit principal retry@') != 2:
+    fail('failed asynchronous postcommit call was not retried')
+
+# With a queue size of one, creating several principals must wait for
+# the dispatcher rather than deadlock or drop calls.
+mark('asynchronous postcommit back-pressure')
+out = realm.run([kadminl, 'bulk_principals', '-'], env=async_env,
+                input='addprinc -randkey slow3\naddprinc -randkey slow4\n'
+                'addprinc -randkey slow5\n')
+for name in ('slow3', 'slow4', 'slow5'):
+    if 'create: stage postcommit principal %s@' % name not in out:
+        fail('asynchronous postcommit call not delivered for %s' % name)
+
 success('kadm5_hook')
@@ -63,4 +63,108 @@ no_canon_conf = {'libdefaults': {'dns_canonicalize_hostname': 'false'}}
 no_canon = realm.special_env('no_canon', False, krb5_conf=no_canon_conf)
 realm.run([kadmin, '-k', 'getprinc', realm.host_princ], env=no_canon)
 
+realm.stop()
+
+# Run kadmind with a pool of worker threads, and make sure reads and
+# writes from several clients at once are all answered, and that the
+# writes are recorded in the update log.
+mark('kadmind_workers')
+conf = {'realms': {'$realm': {'kadmind_workers': '3',
+                              'iprop_enable': 'true',
+                              'iprop_logfile': '$testdir/db.ulog'}}}
+realm = K5Realm(create_host=False, start_kadmind=True, kdc_conf=conf)
+realm.prep_kadmin()
+procs = []
+for i in range(8):
+    cmds = ('addprinc -randkey w%d\ngetprinc w%d\nlistprincs w*\n'
+            'modprinc -maxlife "%d minutes" w%d\ngetprivs\n' %
+            (i, i, i + 1, i))
+    args = [kadmin, '-c', realm.kadmin_ccache]
+    p = subprocess.Popen(args, env=realm.env, stdin=subprocess.PIPE,
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    p.stdin.write(cmds.encode())
+    p.stdin.close()
+    procs.append(p)
+for i, p in enumerate(procs):
+    out = p.stdout.read().decode()
+    p.wait()
+    if p.returncode != 0 or ('Principal: w%d@' % i) not in out:
+        fail('kadmin client %d failed with workers: %s' % (i, out))
+for i in range(8):
+    realm.run_kadmin(['getprinc', 'w%d' % i],
+                     expected_msg='Maximum ticket life: 0 days 00:%02d:00' %
+                     (i + 1))
+out = realm.run([kproplog])
+for i in range(8):
+    if out.count('Update principal : w%d@' % i) != 2:
+        fail('Missing update log entries for w%d with workers' % i)
+
+# Add and modify principals in batches, and make sure per-item
+# failures are reported without affecting the rest of the batch.
+mark('bulk_principals')
+bulkfile = os.path.join(realm.testdir, 'bulk')
+with open(bulkfile, 'w') as f:
+    f.write('# bulk input\n'
+            'addprinc -randkey b0\n'
+            'ank -pw pw1 b1\n'
+            '\n'
+            'addprinc -nokey b2\n'
+            'addprinc -randkey b0\n'
+            'addprinc b3\n'
+            'modprinc -maxlife "2 hours" b0\n'
+            'modprinc +requires_preauth b1\n'
+            'modprinc -maxlife 1h nonexistent\n'
+            'addprinc -randkey b4\n')
+out = realm.run([kadmin, '-c', realm.kadmin_ccache, 'bulk_principals', '-b',
+                 '2', bulkfile], expected_code=1)
+if ('line 6: while creating "b0@' not in out or
+    'line 7: -pw, -randkey, or -nokey is required' not in out or
+    'line 10: while modifying "nonexistent@' not in out or
+    'line 2:' in out or 'line 11:' in out):
+    fail('Wrong bulk_principals failure messages')
+realm.run_kadmin(['getprinc', 'b0'],
+                 expected_msg='Maximum ticket life: 0 days 02:00:00')
+realm.run_kadmin(['getprinc', 'b1'], expected_msg='REQUIRES_PRE_AUTH')
+realm.run_kadmin(['getprinc', 'b2'], expected_msg='Number of keys: 0')
+realm.run_kadmin(['getprinc', 'b3'], expected_code=1,
+                 expected_msg='Principal does not exist')
+realm.kinit('b1', 'pw1')
+out = realm.run([kproplog])
+if out.count('Update principal : b0@') != 2:
+    fail('Wrong update log entries for bulk_principals')
+realm.run([kadminl, 'bulk_principals', '-'],
+          input='addprinc -randkey b5\nmodprinc -maxlife 1h b5\n')
+realm.run([kadminl, 'getprinc', 'b5'],
+          expected_msg='Maximum ticket life: 0 days 01:00:00')
+
+# Extract keys for several principals at once, with machine-readable
+# progress output.  The keys are changed in one request and written
+# to the keytab in one update.
+mark('bulk ktadd')
+for i in range(5):
+    realm.run([kadminl, 'addprinc', '-randkey', 'k%d' % i])
+ktfile = os.path.join(realm.testdir, 'bulk.keytab')
+out = realm.run([kadmin, '-c', realm.kadmin_ccache, 'ktadd', '-k', ktfile,
+                 '-progress', '-glob', 'k?', 'nonexistent'])
+lines = [l for l in out.splitlines() if '\t' in l]
+if len(lines) != 6:
+    fail('Wrong number of ktadd progress lines')
+for i in range(5):
+    fields = lines[i].split('\t')
+    if fields[:5] != [str(i + 1), '6', 'k%d@KRBTEST.COM' % i, 'ok', '2']:
+        fail('Wrong ktadd progress line: ' + lines[i])
+if not lines[5].startswith('6\t6\tnonexistent\terror\t'):
+    fail('Wrong ktadd progress line for nonexistent principal')
+out = realm.run([klist, '-k', ktfile])
+for i in range(5):
+    if ('   2 k%d@KRBTEST.COM' % i) not in out:
+        fail('Missing bulk ktadd keytab entry for k%d' % i)
+realm.kinit('k3', flags=['-k', '-t', ktfile])
+out = realm.run([kproplog])
+for i in range(5):
+    if out.count('Update principal : k%d@' % i) != 2:
+        fail('Wrong update log entries for bulk ktadd')
+realm.run([kadminl, 'ktadd', '-k', ktfile, '-q', 'k0', 'k1'])
+realm.run([klist, '-k', ktfile], expected_msg='   3 k1@KRBTEST.COM')
+
 success('kadmin and kpasswd tests')
@@ -1,4 +1,5 @@
 from k5test import *
+import struct
 
 conf_replica = {'dbmodules': {'db': {'database_name': '$testdir/db.replica'}}}
 
@@ -8,8 +9,9 @@ def setup_acl(realm):
     acl.write(realm.host_princ + '\n')
     acl.close()
 
-def check_output(kpropd):
+def check_output(kpropd, expected_msg=None):
     output('*** kpropd output follows\n')
+    seen = False
     while True:
         line = kpropd.stdout.readline()
         if 'Database load process for full propagation completed' in line:
@@ -17,6 +19,10 @@ def check_output(kpropd):
         output('kpropd: ' + line)
         if 'Rejected connection' in line:
             fail('kpropd rejected connection from kprop')
+        if expected_msg is not None and expected_msg in line:
+            seen = True
+    if expected_msg is not None and not seen:
+        fail('Expected kpropd output not seen: ' + expected_msg)
 
 # kprop/kpropd are the only users of krb5_auth_con_initivector, so run
 # this test over all enctypes to exercise mkpriv cipher state.
@@ -87,8 +93,42 @@ realm.run([kdb5_util, 'dump', dumpfile])
 realm.run([kprop, '-f', dumpfile, '-P', str(realm.kprop_port()), hostname])
 check_output(kpropd)
 realm.run([kadminl, 'listprincs'], replica3, expected_msg='wakawaka')
+
+# Simulate an interrupted transfer by leaving the first half of the
+# dump in kpropd's temp file, and check that kprop resumes after it.
+mark('resumed transfer')
+realm.addprinc('resumed')
+realm.run([kdb5_util, 'dump', dumpfile])
+st = os.stat(dumpfile)
+half = st.st_size // 2
+tempfile = os.path.join(realm.testdir, 'incoming-datatrans.temp')
+with open(dumpfile, 'rb') as f, open(tempfile, 'wb') as t:
+    t.write(f.read(half))
+with open(tempfile + '.resume', 'wb') as f:
+    f.write(struct.pack('>QQQ', st.st_size, int(st.st_mtime), st.st_ino))
+realm.run([kprop, '-f', dumpfile, '-P', str(realm.kprop_port()), hostname])
+check_output(kpropd, 'started at offset %d of %d' % (half, st.st_size))
+realm.run([kadminl, 'listprincs'], replica3, expected_msg='resumed')
+if os.path.exists(tempfile + '.resume'):
+    fail('kpropd resume file left behind after transfer')
+
+# A partial dump from a different dump file must not be resumed.
+with open(tempfile, 'wb') as t:
+    t.write(b'garbage')
+with open(tempfile + '.resume', 'wb') as f:
+    f.write(struct.pack('>QQQ', st.st_size, 0, 0))
+realm.run([kprop, '-f', dumpfile, '-P', str(realm.kprop_port()), hostname])
+check_output(kpropd, 'started at offset 0 of %d' % st.st_size)
+realm.run([kadminl, 'listprincs'], replica3, expected_msg='resumed')
 stop_daemon(kpropd)
 
+# kdb5_util must not make a streamed load live unless kpropd
+# confirms that the whole dump arrived.
+mark('unconfirmed streaming load')
+realm.run([kdb5_util, 'load', '-confirm', '99', '-'], replica3,
+          input=open(dumpfile).read(), expected_code=1,
+          expected_msg='was not confirmed')
+
 # This test is too resource-intensive to be included in "make check"
 # by default, but it can be enabled in the environment to test the
 # propagation of databases large enough to require a 12-byte encoding
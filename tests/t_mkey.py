@@ -115,8 +115,9 @@ def add_mkey(options):
 
 
 # Run kdb5_util update_princ_encryption (with the dry-run option if
-# specified) and verify the output against the expected mkvno, number
-# of updated principals, and number of already-current principals.
+# specified, and with -j if nthreads is given) and verify the output
+# against the expected mkvno, number of updated principals, and number
+# of already-current principals.
 mkvno_re = {False: re.compile(r'^Principals whose keys are being re-encrypted '
                               r'to master key vno (\d+) if necessary:$'),
             True: re.compile(r'^Principals whose keys WOULD BE re-encrypted '
@@ -126,10 +127,12 @@ count_re = {False: re.compile(r'^(\d+) principals processed: (\d+) updated, '
             True: re.compile(r'^(\d+) principals processed: (\d+) would be '
                              r'updated, (\d+) already current$')}
 def update_princ_encryption(dry_run, expected_mkvno, expected_updated,
-                            expected_current):
+                            expected_current, nthreads=None):
     opts = ['-f', '-v']
     if dry_run:
         opts += ['-n']
+    if nthreads is not None:
+        opts += ['-j', str(nthreads)]
     out = realm.run([kdb5_util, 'update_princ_encryption'] + opts)
     lines = out.splitlines()
     # Parse the first line to get the target mkvno.
@@ -228,6 +231,27 @@ realm.run([kdb5_util, 'use_mkey', '2', 'now-1day'])
 update_princ_encryption(False, 2, nprincs - 1, 0)
 check_mkvno(realm.user_princ, 2)
 
+# Do the same using batches re-encrypted by worker threads.  Leave one
+# principal current to check that it is skipped.
+mark('update_princ_encryption -j')
+realm.run([kdb5_util, 'use_mkey', '2', 'now+1day'])
+realm.run([kadminl, 'cpw', '-pw', 'user', realm.user_princ])
+check_mkvno(realm.user_princ, 1)
+update_princ_encryption(False, 1, nprincs - 2, 1, nthreads=3)
+check_mkvno(realm.admin_princ, 1)
+realm.run([kdb5_util, 'use_mkey', '2', 'now-1day'])
+out = realm.run([kdb5_util, 'update_princ_encryption', '-f', '-j', '2'])
+if ('%d principals re-encrypted so far' % (nprincs - 1) not in out or
+    'processed: %d updated, 0 already current' % (nprincs - 1) not in out):
+    fail('Unexpected output from update_princ_encryption -j')
+check_mkvno(realm.user_princ, 2)
+realm.run([kdb5_util, 'update_princ_encryption', '-f', '-j', '2'],
+          expected_msg='processed: 0 updated, %d already current' %
+          (nprincs - 1))
+realm.stop_kdc()
+realm.start_kdc()
+realm.kinit(realm.user_princ, 'user')
+
 # Test the safety check for purging with an outdated stash file.
 mark('purge_mkeys (outdated stash file)')
 realm.run([kdb5_util, 'purge_mkeys', '-f'], expected_code=1,
@@ -38,6 +38,31 @@ realm.run([kadminl, 'addprinc', '-pw', 'p5', '-policy', 'pol', 'p5'],
 realm.run([kadminl, 'addprinc', '-pw', 'birdsoranges', 'p6'], expected_code=1,
           expected_msg='Password may not be a pair of dictionary words')
 
+mark('compiled dictionary')
+
+# A compiled dictionary is case-insensitive by default, like a text one.
+cdict = os.path.join(realm.testdir, 'dict.compiled')
+realm.run([kdb5_util, 'compile_dict', dictfile, cdict])
+cenv = realm.special_env('cdict', True,
+                         kdc_conf={'realms': {'$realm': {'dict_file': cdict}}})
+realm.run([kadminl, 'addprinc', '-pw', 'BIRDS', '-policy', 'pol', 'p7'],
+          env=cenv, expected_code=1,
+          expected_msg='Password is in the password dictionary')
+realm.run([kadminl, 'addprinc', '-pw', 'oranges', '-policy', 'pol', 'p7'],
+          env=cenv, expected_code=1,
+          expected_msg='Password is in the password dictionary')
+realm.run([kadminl, 'addprinc', '-pw', 'pears', '-policy', 'pol', 'p7'],
+          env=cenv)
+
+# With -s, lookups in the compiled dictionary are case-sensitive.
+realm.run([kdb5_util, 'compile_dict', '-s', dictfile, cdict])
+realm.run([kadminl, 'cpw', '-pw', 'BIRDS', 'p7'], env=cenv)
+realm.run([kadminl, 'cpw', '-pw', 'birds', 'p7'], env=cenv, expected_code=1,
+          expected_msg='Password is in the password dictionary')
+
+realm.run([kdb5_util, 'compile_dict', dictfile + '.none', cdict],
+          expected_code=1, expected_msg='while compiling dictionary')
+
 # These plugin ordering tests aren't specifically related to the
 # password quality interface, but are convenient to put here.
 
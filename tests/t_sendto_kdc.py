@@ -0,0 +1,112 @@
+from k5test import *
+import socket
+import struct
+import threading
+
+# List an address with no listener ahead of the real KDC, and use TCP so that
+# the dead address fails without a timeout.
+conf = {'libdefaults': {'udp_preference_limit': '1'},
+        'realms': {'$realm': {'kdc': ['127.0.0.1:$port9',
+                                      '$hostname:$port0']}}}
+realm = K5Realm(create_host=False, krb5_conf=conf)
+deadaddr = '127.0.0.1:%d' % (realm.portbase + 9)
+liveaddr = '%s:%d' % (hostname, realm.portbase)
+realm.run([kadminl, 'modprinc', '+requires_preauth', realm.user_princ])
+
+# kinit makes two requests to the KDC.  The first should try the dead address
+# before moving on to the live KDC.  The second should try the live KDC first,
+# as the dead address failed and has been demoted.
+mark('dead KDC demotion')
+msgs = ('Initiating TCP connection to stream ' + deadaddr,
+        'Received answer',
+        'KDC order 1: %s (rtt ' % liveaddr,
+        'KDC order 2: %s (rtt unknown, 1 failures, demoted)' % deadaddr,
+        'Received answer')
+out, trace = realm.run([kinit, realm.user_princ], input=password('user') + '\n',
+                       expected_trace=msgs, return_trace=True)
+if trace.count('Initiating TCP connection to stream ' + deadaddr) != 1:
+    fail('Demoted KDC was contacted again')
+
+
+def recv_exact(sock, n):
+    buf = b''
+    while len(buf) < n:
+        data = sock.recv(n - len(buf))
+        if not data:
+            return None
+        buf += data
+    return buf
+
+
+# Relay length-prefixed requests from a client connection to the KDC, one
+# KDC connection per request, leaving the client connection open.
+def relay_client(client, kdcport):
+    while True:
+        hdr = recv_exact(client, 4)
+        if hdr is None:
+            break
+        req = recv_exact(client, struct.unpack('>I', hdr)[0])
+        kdc = socket.create_connection(('127.0.0.1', kdcport))
+        kdc.sendall(hdr + req)
+        rhdr = recv_exact(kdc, 4)
+        rep = recv_exact(kdc, struct.unpack('>I', rhdr)[0])
+        kdc.close()
+        client.sendall(rhdr + rep)
+    client.close()
+
+
+def relay(listener, kdcport, accepted):
+    while True:
+        try:
+            client, addr = listener.accept()
+        except OSError:
+            return
+        accepted.append(addr)
+        threading.Thread(target=relay_client, args=(client, kdcport),
+                         daemon=True).start()
+
+
+# Stand up a relay which keeps client connections open, the way a KDC
+# proxy or some KDCs do, and check that both of kinit's requests use a
+# single connection to it.
+mark('connection reuse')
+listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+listener.bind(('127.0.0.1', realm.portbase + 8))
+listener.listen(5)
+accepted = []
+threading.Thread(target=relay, args=(listener, realm.portbase, accepted),
+                 daemon=True).start()
+relayaddr = 'stream 127.0.0.1:%d' % (realm.portbase + 8)
+reuse_conf = {'libdefaults': {'kdc_connection_reuse': 'true'},
+              'realms': {'$realm': {'kdc': '127.0.0.1:$port8'}}}
+reuse_env = realm.special_env('reuse', False, krb5_conf=reuse_conf)
+msgs = ('Initiating TCP connection to ' + relayaddr,
+        'Received answer',
+        'Keeping connection to %s for reuse' % relayaddr,
+        'Reusing idle connection to ' + relayaddr,
+        'Received answer')
+realm.run([kinit, realm.user_princ], input=password('user') + '\n',
+          env=reuse_env, expected_trace=msgs)
+if len(accepted) != 1:
+    fail('Expected one connection to relay, got %d' % len(accepted))
+listener.close()
+
+# The KDC closes each connection after replying, so a pooled connection to
+# it must be detected as closed (or fail and be replaced) without breaking
+# the exchange.
+mark('closed pooled connection')
+reuse_conf = {'libdefaults': {'kdc_connection_reuse': 'true'},
+              'realms': {'$realm': {'kdc': '$hostname:$port0'}}}
+reuse_env = realm.special_env('reuse2', False, krb5_conf=reuse_conf)
+realm.run([kinit, realm.user_princ], input=password('user') + '\n',
+          env=reuse_env, expected_trace=('Keeping connection to',))
+
+# Drive many initial creds exchanges at once from one poll() loop using the
+# asynchronous exchange API.  Each exchange starts with the dead address.
+mark('asynchronous exchanges')
+out = realm.run(['./asyncsend', realm.user_princ, password('user'), '20'])
+if out != '20 clients finished, at most 20 exchanges in flight\n':
+    fail('Unexpected asyncsend output')
+
+success('KDC selection, connection reuse, and async exchange tests')